@@ -0,0 +1,103 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/base/arena.h"
+
+#include <string.h>
+
+#include <new>
+
+namespace x509ls {
+namespace {
+// Alignment of every allocation, enough for any type.
+const size_t kAlignment = 16;
+
+// Round |size| up to kAlignment.
+size_t Align(size_t size) {
+  return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+// The Block header, rounded so that block data stays aligned.
+const size_t kHeaderSize = 16;
+}  // namespace
+
+ArenaString::ArenaString()
+  :
+    data(""),
+    size(0) {
+}
+
+string ArenaString::ToString() const {
+  return string(data, size);
+}
+
+// static
+const size_t Arena::kDefaultBlockSize;
+
+Arena::Arena(size_t block_size)
+  :
+    block_size_(block_size),
+    blocks_(NULL),
+    block_bytes_(0),
+    free_(NULL),
+    free_size_(0) {
+}
+
+Arena::~Arena() {
+  while (blocks_ != NULL) {
+    Block* next = blocks_->next;
+    ::operator delete(blocks_);
+    blocks_ = next;
+  }
+}
+
+void* Arena::Allocate(size_t size) {
+  size = Align(size == 0 ? 1 : size);
+
+  if (size > free_size_) {
+    // Large allocations get their own block, leaving the current block's
+    // remainder for later small allocations.
+    if (size > block_size_ / 4) {
+      return AllocateBlock(size);
+    }
+
+    free_ = AllocateBlock(block_size_);
+    free_size_ = block_size_;
+  }
+
+  void* memory = free_;
+  free_ += size;
+  free_size_ -= size;
+
+  return memory;
+}
+
+ArenaString Arena::CopyString(const char* data, size_t size) {
+  char* copy = static_cast<char*>(Allocate(size + 1));
+  memcpy(copy, data, size);
+  copy[size] = '\0';
+
+  ArenaString text;
+  text.data = copy;
+  text.size = size;
+
+  return text;
+}
+
+ArenaString Arena::CopyString(const string& text) {
+  return CopyString(text.data(), text.size());
+}
+
+size_t Arena::BlockBytes() const {
+  return block_bytes_;
+}
+
+char* Arena::AllocateBlock(size_t size) {
+  Block* block = static_cast<Block*>(::operator new(kHeaderSize + size));
+  block->next = blocks_;
+  blocks_ = block;
+  block_bytes_ += kHeaderSize + size;
+
+  return reinterpret_cast<char*>(block) + kHeaderSize;
+}
+}  // namespace x509ls
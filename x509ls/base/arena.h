@@ -0,0 +1,76 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BASE_ARENA_H_
+#define X509LS_BASE_ARENA_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+// A string stored in an Arena.
+struct ArenaString {
+  ArenaString();
+
+  const char* data;
+  size_t size;
+
+  string ToString() const;
+};
+
+// Monotonic allocator: Allocations are carved from large blocks, and only
+// released, all at once, when the Arena is destroyed.
+//
+// For groups of objects with one lifetime, e.g. the Certificates and strings
+// of one fetched chain: One block replaces many small heap allocations, and
+// teardown is one free per block. Objects placed in an Arena with placement
+// new must still be destroyed explicitly if they own other resources.
+//
+// Not thread-safe.
+class Arena {
+ public:
+  // Allocate blocks of |block_size| bytes, or larger for large allocations.
+  explicit Arena(size_t block_size = kDefaultBlockSize);
+  ~Arena();
+
+  static const size_t kDefaultBlockSize = 32768;
+
+  // Return |size| bytes, aligned for any type.
+  void* Allocate(size_t size);
+
+  // Return a copy of |size| bytes at |data|, NUL-terminated.
+  ArenaString CopyString(const char* data, size_t size);
+  ArenaString CopyString(const string& text);
+
+  // Return the number of bytes of blocks allocated.
+  size_t BlockBytes() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(Arena)
+
+  struct Block {
+    Block* next;
+  };
+
+  const size_t block_size_;
+
+  // The blocks allocated, most recent first.
+  Block* blocks_;
+  size_t block_bytes_;
+
+  // The unused remainder of the current block.
+  char* free_;
+  size_t free_size_;
+
+  // Allocate a block with at least |size| usable bytes. Large blocks don't
+  // replace the current block.
+  char* AllocateBlock(size_t size);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BASE_ARENA_H_
@@ -27,11 +27,10 @@ BaseObject::BaseObject(CliApplication* application)
 BaseObject::~BaseObject() {
   application_->GetEventManager()->Unregister(this);
 
-  set<BaseObject*>::iterator it;
-  for (it = children_.begin(); it != children_.end(); ++it) {
-    DeleteChild(*it);
+  // DeleteChild() erases from |children_|, invalidating iterators.
+  while (!children_.empty()) {
+    DeleteChild(*children_.begin());
   }
-  children_.clear();
 }
 
 void BaseObject::AddChild(BaseObject* child) {
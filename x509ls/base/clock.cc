@@ -0,0 +1,21 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/base/clock.h"
+
+#include <time.h>
+
+namespace x509ls {
+// static
+int64_t Clock::NowMicroseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+// static
+int Clock::ElapsedMilliseconds(int64_t start_us, int64_t end_us) {
+  return static_cast<int>((end_us - start_us) / 1000);
+}
+}  // namespace x509ls
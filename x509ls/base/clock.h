@@ -0,0 +1,31 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BASE_CLOCK_H_
+#define X509LS_BASE_CLOCK_H_
+
+#include <stdint.h>
+
+#include "x509ls/base/types.h"
+
+namespace x509ls {
+// Monotonic clock, for measuring elapsed times.
+//
+// Unaffected by changes to the system time, so suitable for timing network
+// activity. The values returned have no meaning on their own, only the
+// difference between two values is meaningful.
+class Clock {
+ public:
+  // Return the current monotonic time in microseconds.
+  static int64_t NowMicroseconds();
+
+  // Return the number of whole milliseconds between |start_us| and |end_us|.
+  static int ElapsedMilliseconds(int64_t start_us, int64_t end_us);
+
+ private:
+  NO_COPY_AND_ASSIGN(Clock)
+  Clock();
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BASE_CLOCK_H_
@@ -7,9 +7,12 @@
 #include <sys/select.h>
 
 #include <algorithm>
+#include <typeinfo>
 #include <utility>
 
 #include "x509ls/base/base_object.h"
+#include "x509ls/base/clock.h"
+#include "x509ls/base/trace_recorder.h"
 
 using std::max;
 using std::pair;
@@ -30,7 +33,9 @@ const int EventManager::kFDAllEvents =
   EventManager::kFDWritable |
   EventManager::kFDException;
 
-EventManager::EventManager() {
+EventManager::EventManager()
+  :
+    last_wait_us_(0) {
 }
 
 EventManager::~EventManager() {
@@ -114,6 +119,11 @@ void EventManager::Unsubscribe(const BaseObject* source,
 }
 
 void EventManager::DeliverEvents() {
+  TraceSpan span("DeliverEvents");
+#ifdef X509LS_LOOP_STATISTICS
+  const int64_t start_us = Clock::NowMicroseconds();
+#endif
+
   while (queued_events_.size() > 0) {
     const struct Event event = queued_events_.front();
     queued_events_.pop_front();
@@ -130,9 +140,14 @@ void EventManager::DeliverEvents() {
     for (it = range.first; it != range.second; ++it) {
       // TODO(tfh): check destination & source still in set of valid objects
       // before dispatching here.
+      TraceSpan dispatch_span("OnEvent", TypeName(it->second));
       it->second->OnEvent(event.source, event.event_code);
     }
   }
+
+#ifdef X509LS_LOOP_STATISTICS
+  statistics_.AddEventDelivery(Clock::NowMicroseconds() - start_us);
+#endif
 }
 
 void EventManager::EnqueueEvent(const BaseObject* source,
@@ -178,11 +193,26 @@ bool EventManager::HasNetworkEvents() const {
 }
 
 void EventManager::DeliverNetworkEvents(int timeout_ms) {
+#ifdef X509LS_LOOP_STATISTICS
+  const int64_t start_us = Clock::NowMicroseconds();
+#endif
+
   DeliverFDEvents(timeout_ms);
   DeliverPoll();
+
+#ifdef X509LS_LOOP_STATISTICS
+  statistics_.AddNetworkDelivery(
+      Clock::NowMicroseconds() - start_us - last_wait_us_);
+#endif
+}
+
+int64_t EventManager::LastWaitMicroseconds() const {
+  return last_wait_us_;
 }
 
 void EventManager::DeliverFDEvents(int timeout_ms) {
+  TraceSpan span("DeliverFDEvents");
+
   // Timeout setup.
   const int kMillisecondsInAMicrosecond = 1000;
   struct timeval timeout;
@@ -217,8 +247,15 @@ void EventManager::DeliverFDEvents(int timeout_ms) {
     }
   }
 
+  const int64_t wait_start_us = Clock::NowMicroseconds();
   int ready_descriptor_count = select(highest_fd + 1,
      &fds[0], &fds[1], &fds[2], &timeout);
+  const int64_t wait_end_us = Clock::NowMicroseconds();
+  last_wait_us_ = wait_end_us - wait_start_us;
+
+  if (TraceRecorder::IsEnabled()) {
+    TraceRecorder::AddSpan("select", wait_start_us, wait_end_us, NULL);
+  }
 
   if (ready_descriptor_count <= 0) {
     return;
@@ -238,6 +275,7 @@ void EventManager::DeliverFDEvents(int timeout_ms) {
       wit->second.fd_events & kFDException;
 
     if (read_event || write_event || exception_event) {
+      TraceSpan dispatch_span("OnFDEvent", TypeName(wit->second.receiver));
       wit->second.receiver->OnFDEvent(wit->first,
           read_event, write_event, exception_event);
     }
@@ -253,13 +291,34 @@ void EventManager::DisablePoll(BaseObject* destination) {
 }
 
 void EventManager::DeliverPoll() {
+  TraceSpan span("DeliverPoll");
+
   set<BaseObject*> poll_receivers = poll_receivers_;
 
   for (set<BaseObject*>::iterator it = poll_receivers.begin();
       it != poll_receivers.end();
       ++it) {
+    TraceSpan dispatch_span("OnPoll", TypeName(*it));
     (*it)->OnPoll();
   }
 }
+
+void EventManager::TakeStatistics(LoopStatistics* statistics) {
+  *statistics = statistics_;
+  statistics_ = LoopStatistics();
+
+  statistics->queued_events = queued_events_.size();
+  statistics->watched_fds = watched_fds_.size();
+  statistics->poll_receivers = poll_receivers_.size();
+}
+
+// static
+const char* EventManager::TypeName(const BaseObject* receiver) {
+  if (!TraceRecorder::IsEnabled()) {
+    return NULL;
+  }
+
+  return typeid(*receiver).name();
+}
 }  // namespace x509ls
 
@@ -4,10 +4,13 @@
 #ifndef X509LS_BASE_EVENT_MANAGER_H_
 #define X509LS_BASE_EVENT_MANAGER_H_
 
+#include <stdint.h>
+
 #include <list>
 #include <map>
 #include <set>
 
+#include "x509ls/base/loop_statistics.h"
 #include "x509ls/base/types.h"
 
 using std::list;
@@ -120,10 +123,18 @@ class EventManager {
   // Wait upto |timeout_ms| milliseconds for network activity before timing out.
   void DeliverNetworkEvents(int timeout_ms = 100);
 
+  // Return the microseconds the last DeliverNetworkEvents() spent waiting for
+  // network activity, i.e. not delivering events.
+  int64_t LastWaitMicroseconds() const;
+
   // Enable and disable polling on |destination|.
   void EnablePoll(BaseObject* destination);
   void DisablePoll(BaseObject* destination);
 
+  // Move the delivery counts and times since the last call into
+  // |statistics|, and set its EventManager state fields. See LoopStatistics.
+  void TakeStatistics(LoopStatistics* statistics);
+
  private:
   NO_COPY_AND_ASSIGN(EventManager)
 
@@ -167,8 +178,17 @@ class EventManager {
 
   set<BaseObject*> poll_receivers_;
 
+  int64_t last_wait_us_;
+
+  // Delivery counts and times, see TakeStatistics().
+  LoopStatistics statistics_;
+
   void DeliverFDEvents(int timeout_ms);
   void DeliverPoll();
+
+  // Return |receiver|'s std::type_info name for TraceSpan, or NULL if not
+  // tracing.
+  static const char* TypeName(const BaseObject* receiver);
 };
 }  // namespace x509ls
 
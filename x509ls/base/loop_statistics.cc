@@ -0,0 +1,44 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/base/loop_statistics.h"
+
+namespace x509ls {
+// static
+#ifdef X509LS_LOOP_STATISTICS
+const bool LoopStatistics::kEnabled = true;
+#else
+const bool LoopStatistics::kEnabled = false;
+#endif
+
+LoopStatistics::LoopStatistics()
+  :
+    iterations(0),
+    paints(0),
+    network_deliveries(0),
+    network_total_us(0),
+    network_max_us(0),
+    event_deliveries(0),
+    events_total_us(0),
+    events_max_us(0),
+    queued_events(0),
+    watched_fds(0),
+    poll_receivers(0) {
+}
+
+void LoopStatistics::AddNetworkDelivery(int64_t duration_us) {
+  ++network_deliveries;
+  network_total_us += duration_us;
+  if (duration_us > network_max_us) {
+    network_max_us = duration_us;
+  }
+}
+
+void LoopStatistics::AddEventDelivery(int64_t duration_us) {
+  ++event_deliveries;
+  events_total_us += duration_us;
+  if (duration_us > events_max_us) {
+    events_max_us = duration_us;
+  }
+}
+}  // namespace x509ls
@@ -0,0 +1,48 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BASE_LOOP_STATISTICS_H_
+#define X509LS_BASE_LOOP_STATISTICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace x509ls {
+// Event loop health counters, since they were last taken (see
+// CliApplication::TakeLoopStatistics()).
+//
+// Counted only when built with X509LS_LOOP_STATISTICS defined (the default,
+// see CMakeLists.txt). Otherwise the counting code compiles to nothing, and
+// every count stays 0.
+struct LoopStatistics {
+  LoopStatistics();
+
+  // True iif counting is compiled in.
+  static const bool kEnabled;
+
+  // Run loop iterations, and top level control repaints.
+  uint64_t iterations;
+  uint64_t paints;
+
+  // EventManager::DeliverNetworkEvents() calls and their busy time, i.e.
+  // excluding the select() wait.
+  uint64_t network_deliveries;
+  int64_t network_total_us;
+  int64_t network_max_us;
+
+  // EventManager::DeliverEvents() calls and their time.
+  uint64_t event_deliveries;
+  int64_t events_total_us;
+  int64_t events_max_us;
+
+  // EventManager state when taken.
+  size_t queued_events;
+  size_t watched_fds;
+  size_t poll_receivers;
+
+  void AddNetworkDelivery(int64_t duration_us);
+  void AddEventDelivery(int64_t duration_us);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BASE_LOOP_STATISTICS_H_
@@ -0,0 +1,239 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/base/metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sstream>
+
+using std::stringstream;
+
+namespace x509ls {
+Counter::Counter()
+  :
+    value_(0) {
+}
+
+void Counter::Increment(uint64_t count) {
+  __sync_fetch_and_add(&value_, count);
+}
+
+uint64_t Counter::Value() const {
+  return __sync_fetch_and_add(&value_, 0);
+}
+
+Gauge::Gauge()
+  :
+    value_(0) {
+}
+
+void Gauge::Add(int64_t delta) {
+  __sync_fetch_and_add(&value_, delta);
+}
+
+int64_t Gauge::Value() const {
+  return __sync_fetch_and_add(&value_, 0);
+}
+
+// static
+const size_t Histogram::kBucketCount;
+
+// static
+const int64_t Histogram::kBucketBoundsMicroseconds[kBucketCount] = {
+  100, 250, 500,
+  1000, 2500, 5000,
+  10000, 25000, 50000,
+  100000, 250000, 500000,
+  1000000, 2500000, 5000000,
+  10000000
+};
+
+Histogram::Histogram()
+  :
+    sum_us_(0) {
+  memset(bucket_counts_, 0, sizeof bucket_counts_);
+}
+
+void Histogram::Observe(int64_t duration_us) {
+  if (duration_us < 0) {
+    return;
+  }
+
+  size_t index = 0;
+  while (index < kBucketCount &&
+      duration_us > kBucketBoundsMicroseconds[index]) {
+    ++index;
+  }
+
+  __sync_fetch_and_add(&bucket_counts_[index], 1);
+  __sync_fetch_and_add(&sum_us_, duration_us);
+}
+
+uint64_t Histogram::CumulativeCount(size_t index) const {
+  uint64_t count = 0;
+  for (size_t i = 0; i <= index && i <= kBucketCount; ++i) {
+    count += __sync_fetch_and_add(&bucket_counts_[i], 0);
+  }
+
+  return count;
+}
+
+uint64_t Histogram::Count() const {
+  return CumulativeCount(kBucketCount);
+}
+
+uint64_t Histogram::SumMicroseconds() const {
+  return __sync_fetch_and_add(&sum_us_, 0);
+}
+
+MetricsRegistry::MetricsRegistry() {
+}
+
+MetricsRegistry::~MetricsRegistry() {
+  for (size_t i = 0; i < metrics_.size(); ++i) {
+    delete metrics_[i].counter;
+    delete metrics_[i].gauge;
+    delete metrics_[i].histogram;
+  }
+}
+
+Counter* MetricsRegistry::AddCounter(const string& name,
+    const string& labels, const string& help) {
+  Counter* counter = new Counter();
+  Add(kTypeCounter, name, labels, help, counter, NULL, NULL);
+
+  return counter;
+}
+
+Gauge* MetricsRegistry::AddGauge(const string& name, const string& labels,
+    const string& help) {
+  Gauge* gauge = new Gauge();
+  Add(kTypeGauge, name, labels, help, NULL, gauge, NULL);
+
+  return gauge;
+}
+
+Histogram* MetricsRegistry::AddHistogram(const string& name,
+    const string& labels, const string& help) {
+  Histogram* histogram = new Histogram();
+  Add(kTypeHistogram, name, labels, help, NULL, NULL, histogram);
+
+  return histogram;
+}
+
+string MetricsRegistry::AsPrometheusText() const {
+  static const char* const kTypeNames[] = {"counter", "gauge", "histogram"};
+
+  string text;
+  for (size_t i = 0; i < metrics_.size(); ++i) {
+    const Metric& metric = metrics_[i];
+
+    // HELP and TYPE once per family.
+    if (i == 0 || metrics_[i - 1].name != metric.name) {
+      text.append("# HELP " + metric.name + " " + metric.help + "\n");
+      text.append("# TYPE " + metric.name + " " + kTypeNames[metric.type] +
+          "\n");
+    }
+
+    const string labels = metric.labels.empty() ?
+      "" : "{" + metric.labels + "}";
+
+    stringstream line;
+    switch (metric.type) {
+    case kTypeCounter:
+      line << metric.name << labels << " " << metric.counter->Value() << "\n";
+      break;
+    case kTypeGauge:
+      line << metric.name << labels << " " << metric.gauge->Value() << "\n";
+      break;
+    case kTypeHistogram:
+      AppendHistogram(metric.name, metric.labels, *metric.histogram, &text);
+      break;
+    }
+    text.append(line.str());
+  }
+
+  return text;
+}
+
+bool MetricsRegistry::WriteFile(const string& filename,
+    string* error_message) const {
+  stringstream temp_filename;
+  temp_filename << filename << ".tmp." << getpid();
+
+  const string text = AsPrometheusText();
+
+  FILE* file = fopen(temp_filename.str().c_str(), "w");
+  if (!file) {
+    *error_message = "Unable to open " + temp_filename.str() + ": ";
+    error_message->append(strerror(errno));
+    return false;
+  }
+
+  bool success = fwrite(text.data(), 1, text.size(), file) == text.size();
+  if (fclose(file) != 0) {
+    success = false;
+  }
+
+  if (success && rename(temp_filename.str().c_str(), filename.c_str()) != 0) {
+    success = false;
+  }
+
+  if (!success) {
+    *error_message = "Unable to write " + filename + ": ";
+    error_message->append(strerror(errno));
+    unlink(temp_filename.str().c_str());
+  }
+
+  return success;
+}
+
+void MetricsRegistry::Add(Type type, const string& name,
+    const string& labels, const string& help, Counter* counter, Gauge* gauge,
+    Histogram* histogram) {
+  Metric metric;
+  metric.type = type;
+  metric.name = name;
+  metric.labels = labels;
+  metric.help = help;
+  metric.counter = counter;
+  metric.gauge = gauge;
+  metric.histogram = histogram;
+
+  metrics_.push_back(metric);
+}
+
+// static
+void MetricsRegistry::AppendHistogram(const string& name,
+    const string& labels, const Histogram& histogram, string* text) {
+  const string label_prefix = labels.empty() ? "" : labels + ",";
+
+  // The count is the +Inf bucket as read, so observations racing with the
+  // export can't make the two differ. They may still appear in the sum.
+  stringstream lines;
+  lines.precision(12);
+  uint64_t count = 0;
+  for (size_t i = 0; i <= Histogram::kBucketCount; ++i) {
+    lines << name << "_bucket{" << label_prefix << "le=\"";
+    if (i < Histogram::kBucketCount) {
+      lines << Histogram::kBucketBoundsMicroseconds[i] / 1e6;
+    } else {
+      lines << "+Inf";
+    }
+    count = histogram.CumulativeCount(i);
+    lines << "\"} " << count << "\n";
+  }
+
+  const string braced_labels = labels.empty() ? "" : "{" + labels + "}";
+  lines << name << "_sum" << braced_labels << " ";
+  lines << histogram.SumMicroseconds() / 1e6 << "\n";
+  lines << name << "_count" << braced_labels << " ";
+  lines << count << "\n";
+
+  text->append(lines.str());
+}
+}  // namespace x509ls
@@ -0,0 +1,152 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BASE_METRICS_H_
+#define X509LS_BASE_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// A monotonically increasing count.
+//
+// Updates are lock-free atomic adds, so a Counter may be shared by any number
+// of threads and read at any time.
+class Counter {
+ public:
+  Counter();
+
+  void Increment(uint64_t count = 1);
+  uint64_t Value() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(Counter)
+
+  mutable uint64_t value_;
+};
+
+// A value which may go up and down, e.g. the number of fetches in progress.
+// Lock-free, as Counter.
+class Gauge {
+ public:
+  Gauge();
+
+  void Add(int64_t delta);
+  int64_t Value() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(Gauge)
+
+  mutable int64_t value_;
+};
+
+// A distribution of latencies, in fixed exponential buckets from 100us to
+// 10s. Lock-free, as Counter: Observe() is one bucket search and three atomic
+// adds.
+class Histogram {
+ public:
+  Histogram();
+
+  // Add one latency of |duration_us| microseconds. Negative durations (i.e.
+  // incomplete, see FetchTiming::Duration()) are ignored.
+  void Observe(int64_t duration_us);
+
+  // The upper bound of each bucket, in microseconds, and the number of
+  // buckets (excluding the final, unbounded bucket).
+  static const size_t kBucketCount = 16;
+  static const int64_t kBucketBoundsMicroseconds[kBucketCount];
+
+  // Return the number of observations <= kBucketBoundsMicroseconds[index],
+  // or all observations if |index| is kBucketCount.
+  uint64_t CumulativeCount(size_t index) const;
+
+  uint64_t Count() const;
+  uint64_t SumMicroseconds() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(Histogram)
+
+  // Per bucket (not cumulative) counts, the last for values above every
+  // bound.
+  mutable uint64_t bucket_counts_[kBucketCount + 1];
+  mutable uint64_t sum_us_;
+};
+
+// A set of named metrics, exported in the Prometheus text format.
+//
+// Metrics are registered up front (not thread-safe), then updated from any
+// thread while the registry is exported from another. The registry owns its
+// metrics.
+//
+// Metrics sharing a name but with different labels form one family, e.g.:
+//   registry.AddCounter("x509ls_fetches_failed_total", "reason=\"resolve\"",
+//       "Fetches failed.");
+//   registry.AddCounter("x509ls_fetches_failed_total", "reason=\"connect\"",
+//       "Fetches failed.");
+// Register the members of a family consecutively.
+class MetricsRegistry {
+ public:
+  MetricsRegistry();
+  ~MetricsRegistry();
+
+  // Register and return a new metric called |name|, with the Prometheus
+  // |labels| ("" for none, or e.g. "phase=\"connect\"") and |help| text.
+  Counter* AddCounter(const string& name, const string& labels,
+      const string& help);
+  Gauge* AddGauge(const string& name, const string& labels,
+      const string& help);
+
+  // Histograms are exported in seconds.
+  Histogram* AddHistogram(const string& name, const string& labels,
+      const string& help);
+
+  // Return every metric in the Prometheus text exposition format.
+  string AsPrometheusText() const;
+
+  // Write AsPrometheusText() to |filename| atomically: Through a temporary
+  // file renamed over |filename|, so readers (e.g. the node exporter's
+  // textfile collector) never see a partial file.
+  //
+  // Returns true iif successful, else sets |error_message|.
+  bool WriteFile(const string& filename, string* error_message) const;
+
+ private:
+  NO_COPY_AND_ASSIGN(MetricsRegistry)
+
+  enum Type {
+    kTypeCounter,
+    kTypeGauge,
+    kTypeHistogram
+  };
+
+  struct Metric {
+    Type type;
+    string name;
+    string labels;
+    string help;
+    Counter* counter;
+    Gauge* gauge;
+    Histogram* histogram;
+  };
+  vector<Metric> metrics_;
+
+  void Add(Type type, const string& name, const string& labels,
+      const string& help, Counter* counter, Gauge* gauge,
+      Histogram* histogram);
+
+  // Append |histogram|'s buckets, sum and count for |name|{|labels|} to
+  // |text|.
+  static void AppendHistogram(const string& name, const string& labels,
+      const Histogram& histogram, string* text);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BASE_METRICS_H_
@@ -0,0 +1,55 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/base/metrics_exporter.h"
+
+#include "x509ls/base/clock.h"
+#include "x509ls/base/metrics.h"
+
+namespace x509ls {
+MetricsExporter::MetricsExporter(CliApplication* application,
+    const MetricsRegistry* registry, const string& filename, int interval_ms)
+  :
+    BaseObject(application),
+    registry_(registry),
+    filename_(filename),
+    interval_us_(static_cast<int64_t>(interval_ms) * 1000),
+    last_write_us_(0) {
+}
+
+// virtual
+MetricsExporter::~MetricsExporter() {
+  DisablePoll();
+}
+
+void MetricsExporter::StartPolling() {
+  EnablePoll();
+}
+
+void MetricsExporter::WriteIfDue() {
+  const int64_t now_us = Clock::NowMicroseconds();
+  if (last_write_us_ != 0 && now_us - last_write_us_ < interval_us_) {
+    return;
+  }
+
+  string error_message;
+  if (!Write(&error_message)) {
+    error_message_ = error_message;
+  }
+}
+
+bool MetricsExporter::Write(string* error_message) {
+  last_write_us_ = Clock::NowMicroseconds();
+
+  return registry_->WriteFile(filename_, error_message);
+}
+
+string MetricsExporter::ErrorMessage() const {
+  return error_message_;
+}
+
+// virtual
+void MetricsExporter::OnPoll() {
+  WriteIfDue();
+}
+}  // namespace x509ls
@@ -0,0 +1,62 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BASE_METRICS_EXPORTER_H_
+#define X509LS_BASE_METRICS_EXPORTER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+class CliApplication;
+class MetricsRegistry;
+// Rewrites a MetricsRegistry's Prometheus text file (see
+// MetricsRegistry::WriteFile()) at an interval.
+//
+// Either call WriteIfDue() regularly, or StartPolling() to have the event loop
+// do so: Polling keeps the run loop waking for network events, so an
+// interactive application then wakes every 250ms even when idle.
+class MetricsExporter : public BaseObject {
+ public:
+  // Construct, to write |registry| to |filename| at most every
+  // |interval_ms|. |registry| must outlive the MetricsExporter.
+  MetricsExporter(CliApplication* application,
+      const MetricsRegistry* registry, const string& filename,
+      int interval_ms);
+  virtual ~MetricsExporter();
+
+  // Call WriteIfDue() from each event loop poll.
+  void StartPolling();
+
+  // Write the file if |interval_ms| has passed since the last write. Errors
+  // are kept for ErrorMessage().
+  void WriteIfDue();
+
+  // Write the file now. Returns true iif successful, else sets
+  // |error_message|.
+  bool Write(string* error_message);
+
+  // Return the error of the last unsuccessful WriteIfDue(), or "".
+  string ErrorMessage() const;
+
+  virtual void OnPoll();
+
+ private:
+  NO_COPY_AND_ASSIGN(MetricsExporter)
+
+  const MetricsRegistry* const registry_;
+  const string filename_;
+  const int64_t interval_us_;
+
+  int64_t last_write_us_;
+  string error_message_;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BASE_METRICS_EXPORTER_H_
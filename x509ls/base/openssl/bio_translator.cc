@@ -14,10 +14,28 @@ BIO* BioTranslator::Get() const {
 }
 
 string BioTranslator::ToString() const {
-  char* data;
-  long length = BIO_get_mem_data(bio_.Get(), &data);  // NOLINT(runtime/int)
+  const char* data;
+  size_t size;
+  View(&data, &size);
 
-  return string(data, length);
+  return string(data, size);
+}
+
+void BioTranslator::View(const char** data, size_t* size) const {
+  char* bio_data;
+  long length =  // NOLINT(runtime/int)
+    BIO_get_mem_data(bio_.Get(), &bio_data);
+
+  *data = bio_data;
+  *size = length > 0 ? length : 0;
+}
+
+void BioTranslator::AppendTo(string* output) const {
+  const char* data;
+  size_t size;
+  View(&data, &size);
+
+  output->append(data, size);
 }
 }  // namespace x509ls
 
@@ -5,6 +5,7 @@
 #define X509LS_BASE_OPENSSL_BIO_TRANSLATOR_H_
 
 #include <openssl/bio.h>
+#include <stddef.h>
 
 #include <string>
 
@@ -18,7 +19,8 @@ namespace x509ls {
 // Enables the output of OpenSSL functions which write to a BIO (an IO
 // abstraction) to be accessed via a std::string.
 //
-// Provides a BIO to write into, and a method to read the contents as a
+// Provides a BIO to write into, and methods to read the contents: In place
+// (View()), appended to a caller's buffer (AppendTo()), or as a new
 // std::string.
 class BioTranslator {
  public:
@@ -27,6 +29,13 @@ class BioTranslator {
   BIO* Get() const;
   string ToString() const;
 
+  // Point |data| at the contents, |size| bytes, without copying. Valid until
+  // the BIO is next written to, or the BioTranslator is destroyed.
+  void View(const char** data, size_t* size) const;
+
+  // Append the contents to |output|, e.g. a buffer reused between calls.
+  void AppendTo(string* output) const;
+
  private:
   NO_COPY_AND_ASSIGN(BioTranslator)
 
@@ -10,22 +10,58 @@
 namespace x509ls {
 int ScopedOpenSSLEnvironment::recurse_level_ = 0;
 
-ScopedOpenSSLEnvironment::ScopedOpenSSLEnvironment() {
-  recurse_level_++;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+pthread_mutex_t* ScopedOpenSSLEnvironment::locks_ = NULL;
+#endif
 
-  if (recurse_level_ == 1) {
+ScopedOpenSSLEnvironment::ScopedOpenSSLEnvironment() {
+  if (__sync_add_and_fetch(&recurse_level_, 1) == 1) {
     SSL_load_error_strings();
     SSL_library_init();
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    locks_ = new pthread_mutex_t[CRYPTO_num_locks()];
+    for (int i = 0; i < CRYPTO_num_locks(); ++i) {
+      pthread_mutex_init(&locks_[i], NULL);
+    }
+    CRYPTO_THREADID_set_callback(ThreadIdProcedure);
+    CRYPTO_set_locking_callback(LockingProcedure);
+#endif
   }
 }
 
 ScopedOpenSSLEnvironment::~ScopedOpenSSLEnvironment() {
-  recurse_level_--;
+  if (__sync_sub_and_fetch(&recurse_level_, 1) == 0) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    CRYPTO_set_locking_callback(NULL);
+    for (int i = 0; i < CRYPTO_num_locks(); ++i) {
+      pthread_mutex_destroy(&locks_[i]);
+    }
+    delete[] locks_;
+    locks_ = NULL;
+#endif
 
-  if (recurse_level_ == 0) {
     EVP_cleanup();
     ERR_free_strings();
   }
 }
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+// static
+void ScopedOpenSSLEnvironment::LockingProcedure(int mode, int type,
+    const char* file, int line) {
+  if (mode & CRYPTO_LOCK) {
+    pthread_mutex_lock(&locks_[type]);
+  } else {
+    pthread_mutex_unlock(&locks_[type]);
+  }
+}
+
+// static
+void ScopedOpenSSLEnvironment::ThreadIdProcedure(CRYPTO_THREADID* thread_id) {
+  CRYPTO_THREADID_set_numeric(thread_id,
+      static_cast<unsigned long>(pthread_self()));  // NOLINT(runtime/int)
+}
+#endif
 }  // namespace x509ls
 
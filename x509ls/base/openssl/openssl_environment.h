@@ -4,7 +4,9 @@
 #ifndef X509LS_BASE_OPENSSL_OPENSSL_ENVIRONMENT_H_
 #define X509LS_BASE_OPENSSL_OPENSSL_ENVIRONMENT_H_
 
+#include <openssl/crypto.h>
 #include <openssl/opensslv.h>
+#include <pthread.h>
 
 #include "x509ls/base/types.h"
 
@@ -19,6 +21,9 @@ namespace x509ls {
 // reference counting, OpenSSL is kept initialised while one or more
 // ScopedOpenSSLEnvironment objects are in scope. Runs the necessary OpenSSL
 // cleanup functions when the last ScopedOpenSSLEnvironment is destroyed.
+//
+// Also installs the locking callbacks OpenSSL versions before 1.1.0 need to be
+// used from multiple threads.
 class ScopedOpenSSLEnvironment {
  public:
   ScopedOpenSSLEnvironment();
@@ -28,6 +33,14 @@ class ScopedOpenSSLEnvironment {
   NO_COPY_AND_ASSIGN(ScopedOpenSSLEnvironment)
 
   static int recurse_level_;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  static pthread_mutex_t* locks_;
+
+  static void LockingProcedure(int mode, int type, const char* file,
+      int line);
+  static void ThreadIdProcedure(CRYPTO_THREADID* thread_id);
+#endif
 };
 }  // namespace x509ls
 
@@ -0,0 +1,93 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BASE_OPENSSL_SHARED_OPENSSL_H_
+#define X509LS_BASE_OPENSSL_SHARED_OPENSSL_H_
+
+#include <openssl/crypto.h>
+#include <openssl/x509.h>
+#include <stddef.h>
+
+namespace x509ls {
+// Reference counted OpenSSL object handle. Like ScopedOpenSSL, but copying a
+// handle takes another reference on the object (with |UpRef|) instead of
+// being disallowed, so handles can be stored in containers. Each handle
+// releases its reference with |Destructor|.
+//
+// OpenSSL's reference counts are atomic, so handles to one object may be
+// copied and destroyed on different threads.
+//
+// example usage:
+// X509Handle x509 = X509Handle::Share(sk_X509_value(peer_chain, 0));
+template <typename T, int (*UpRef)(T* t), void (*Destructor)(T* t)>
+class SharedOpenSSL {
+ public:
+  SharedOpenSSL()
+    :
+      ptr_(NULL) {
+  }
+
+  // Adopt the caller's reference on |ptr|, e.g. from a *_new() call.
+  explicit SharedOpenSSL(T* ptr)
+    :
+      ptr_(ptr) {
+  }
+
+  SharedOpenSSL(const SharedOpenSSL& other)
+    :
+      ptr_(other.ptr_) {
+    if (ptr_) {
+      UpRef(ptr_);
+    }
+  }
+
+  ~SharedOpenSSL() {
+    if (ptr_) {
+      Destructor(ptr_);
+    }
+  }
+
+  SharedOpenSSL& operator=(const SharedOpenSSL& other) {
+    SharedOpenSSL copy(other);
+    Swap(&copy);
+    return *this;
+  }
+
+  // Return a handle taking a new reference on |ptr|, which the caller keeps
+  // its own reference to.
+  static SharedOpenSSL Share(T* ptr) {
+    if (ptr) {
+      UpRef(ptr);
+    }
+    return SharedOpenSSL(ptr);
+  }
+
+  // Exchange objects with |other|, without touching either reference count.
+  void Swap(SharedOpenSSL* other) {
+    T* const ptr = ptr_;
+    ptr_ = other->ptr_;
+    other->ptr_ = ptr;
+  }
+
+  T* Get() const {
+    return ptr_;
+  }
+
+ private:
+  T* ptr_;
+};
+
+// Take a reference on |x509|. OpenSSL 1.1 adds X509_up_ref(), earlier
+// versions only CRYPTO_add().
+inline int X509UpRef(X509* x509) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  return X509_up_ref(x509);
+#else
+  return CRYPTO_add(&x509->references, 1, CRYPTO_LOCK_X509) > 1;
+#endif
+}
+
+typedef SharedOpenSSL<X509, X509UpRef, X509_free> X509Handle;
+}  // namespace x509ls
+
+#endif  // X509LS_BASE_OPENSSL_SHARED_OPENSSL_H_
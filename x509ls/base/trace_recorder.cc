@@ -0,0 +1,456 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/base/trace_recorder.h"
+
+#include <cxxabi.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "x509ls/base/clock.h"
+
+using std::map;
+using std::stringstream;
+using std::vector;
+
+namespace x509ls {
+namespace {
+// Events per thread buffer, before it's handed to the writer thread.
+const size_t kBufferEvents = 4096;
+
+// How often the writer thread writes handed over buffers.
+const int kWriteIntervalMilliseconds = 100;
+const int kStopCheckMilliseconds = 10;
+
+uint64_t next_operation_id = 0;
+}  // namespace
+
+class TraceRecorder::Impl {
+ public:
+  struct Event {
+    char phase;
+    const char* name;
+    const char* type_name;
+    uint64_t id;
+    int64_t timestamp_us;
+    int64_t duration_us;
+    string detail;
+  };
+
+  // One thread's events. Buffers are owned by their thread until handed to
+  // the writer thread, through a lock-free stack as ResultQueue.
+  struct Buffer {
+    uint32_t tid;
+    vector<Event> events;
+    Buffer* next;
+  };
+
+  Impl(FILE* file, const string& filename);
+  ~Impl();
+
+  bool StartWriter(string* error_message);
+
+  // Hand the calling thread's buffer over, stop the writer thread and finish
+  // the file.
+  bool Finish(string* error_message);
+
+  // Return the calling thread's buffer, with room for one more event.
+  Buffer* ThreadBuffer();
+
+  int64_t start_us() const {
+    return start_us_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Impl)
+
+  FILE* const file_;
+  const string filename_;
+  const int64_t start_us_;
+  const int pid_;
+
+  pthread_key_t buffer_key_;
+  pthread_t writer_thread_;
+  bool writer_started_;
+  volatile int stop_;
+
+  uint32_t next_tid_;
+  Buffer* head_;
+
+  // Writer thread only.
+  bool first_event_;
+  map<const char*, string> demangled_names_;
+
+  void Push(Buffer* buffer);
+  void WriteBuffers();
+  void WriteEvent(uint32_t tid, const Event& event);
+  const string& DemangledName(const char* type_name);
+
+  static void* WriterProcedure(void* impl);
+  static void ReleaseBuffer(void* buffer);
+  static string JsonString(const string& text);
+};
+
+TraceRecorder::Impl::Impl(FILE* file, const string& filename)
+  :
+    file_(file),
+    filename_(filename),
+    start_us_(Clock::NowMicroseconds()),
+    pid_(getpid()),
+    writer_started_(false),
+    stop_(0),
+    next_tid_(0),
+    head_(NULL),
+    first_event_(true) {
+  pthread_key_create(&buffer_key_, ReleaseBuffer);
+  fputs("{\"traceEvents\":[\n", file_);
+}
+
+TraceRecorder::Impl::~Impl() {
+  pthread_key_delete(buffer_key_);
+
+  while (head_ != NULL) {
+    Buffer* next = head_->next;
+    delete head_;
+    head_ = next;
+  }
+}
+
+bool TraceRecorder::Impl::StartWriter(string* error_message) {
+  const int result = pthread_create(&writer_thread_, NULL, WriterProcedure,
+      this);
+  if (result != 0) {
+    *error_message = "Unable to start trace writer thread: ";
+    error_message->append(strerror(result));
+    return false;
+  }
+
+  writer_started_ = true;
+  return true;
+}
+
+bool TraceRecorder::Impl::Finish(string* error_message) {
+  Buffer* buffer = static_cast<Buffer*>(pthread_getspecific(buffer_key_));
+  if (buffer != NULL) {
+    pthread_setspecific(buffer_key_, NULL);
+    Push(buffer);
+  }
+
+  if (writer_started_) {
+    __sync_lock_test_and_set(&stop_, 1);
+    pthread_join(writer_thread_, NULL);
+  }
+
+  fputs("\n]}\n", file_);
+
+  bool success = ferror(file_) == 0;
+  if (fclose(file_) != 0) {
+    success = false;
+  }
+
+  if (!success) {
+    *error_message = "Unable to write " + filename_ + ": ";
+    error_message->append(strerror(errno));
+  }
+
+  return success;
+}
+
+TraceRecorder::Impl::Buffer* TraceRecorder::Impl::ThreadBuffer() {
+  Buffer* buffer = static_cast<Buffer*>(pthread_getspecific(buffer_key_));
+
+  if (buffer != NULL && buffer->events.size() >= kBufferEvents) {
+    Buffer* full = buffer;
+    buffer = new Buffer();
+    buffer->tid = full->tid;
+    Push(full);
+    buffer->events.reserve(kBufferEvents);
+    pthread_setspecific(buffer_key_, buffer);
+  } else if (buffer == NULL) {
+    buffer = new Buffer();
+    buffer->tid = __sync_add_and_fetch(&next_tid_, 1);
+    buffer->events.reserve(kBufferEvents);
+    pthread_setspecific(buffer_key_, buffer);
+  }
+
+  return buffer;
+}
+
+void TraceRecorder::Impl::Push(Buffer* buffer) {
+  do {
+    buffer->next = head_;
+  } while (!__sync_bool_compare_and_swap(&head_, buffer->next, buffer));
+}
+
+void TraceRecorder::Impl::WriteBuffers() {
+  Buffer* buffer = __sync_lock_test_and_set(&head_,
+      static_cast<Buffer*>(NULL));
+  __sync_synchronize();
+
+  // The stack is newest first.
+  vector<Buffer*> buffers;
+  while (buffer != NULL) {
+    buffers.push_back(buffer);
+    buffer = buffer->next;
+  }
+  std::reverse(buffers.begin(), buffers.end());
+
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    const vector<Event>& events = buffers[i]->events;
+    for (size_t j = 0; j < events.size(); ++j) {
+      WriteEvent(buffers[i]->tid, events[j]);
+    }
+    delete buffers[i];
+  }
+
+  fflush(file_);
+}
+
+void TraceRecorder::Impl::WriteEvent(uint32_t tid, const Event& event) {
+  stringstream line;
+  if (!first_event_) {
+    line << ",\n";
+  }
+  first_event_ = false;
+
+  line << "{\"ph\":\"" << event.phase << "\",\"pid\":" << pid_;
+  line << ",\"tid\":" << tid;
+
+  switch (event.phase) {
+  case 'M':
+    line << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+    line << JsonString(event.detail) << "}";
+    break;
+  case 'X':
+    line << ",\"name\":" << JsonString(event.name);
+    line << ",\"cat\":\"event_loop\",\"ts\":" << event.timestamp_us;
+    line << ",\"dur\":" << event.duration_us;
+    if (event.type_name != NULL) {
+      line << ",\"args\":{\"type\":";
+      line << JsonString(DemangledName(event.type_name)) << "}";
+    }
+    break;
+  case 'b':
+  case 'e':
+    line << ",\"name\":" << JsonString(event.name);
+    line << ",\"cat\":\"fetch\",\"id\":\"0x" << std::hex << event.id;
+    line << std::dec << "\",\"ts\":" << event.timestamp_us;
+    if (event.phase == 'b') {
+      line << ",\"args\":{\"target\":" << JsonString(event.detail) << "}";
+    }
+    break;
+  }
+  line << "}";
+
+  const string text = line.str();
+  fwrite(text.data(), 1, text.size(), file_);
+}
+
+const string& TraceRecorder::Impl::DemangledName(const char* type_name) {
+  map<const char*, string>::iterator it = demangled_names_.find(type_name);
+  if (it != demangled_names_.end()) {
+    return it->second;
+  }
+
+  int status = 0;
+  char* demangled = abi::__cxa_demangle(type_name, NULL, NULL, &status);
+  string& name = demangled_names_[type_name];
+  name = (status == 0 && demangled != NULL) ? demangled : type_name;
+  free(demangled);
+
+  return name;
+}
+
+// static
+void* TraceRecorder::Impl::WriterProcedure(void* impl_ptr) {
+  Impl* impl = static_cast<Impl*>(impl_ptr);
+
+  struct timespec interval;
+  interval.tv_sec = 0;
+  interval.tv_nsec = kStopCheckMilliseconds * 1000000L;
+
+  int elapsed_ms = 0;
+  while (!__sync_fetch_and_add(&impl->stop_, 0)) {
+    nanosleep(&interval, NULL);
+    elapsed_ms += kStopCheckMilliseconds;
+
+    if (elapsed_ms >= kWriteIntervalMilliseconds) {
+      impl->WriteBuffers();
+      elapsed_ms = 0;
+    }
+  }
+
+  // Buffers handed over before stopping.
+  impl->WriteBuffers();
+
+  return NULL;
+}
+
+// static
+void TraceRecorder::Impl::ReleaseBuffer(void* buffer) {
+  // Called as a thread exits, before TraceRecorder::Stop().
+  if (recorder_ != NULL) {
+    recorder_->Push(static_cast<Buffer*>(buffer));
+  } else {
+    delete static_cast<Buffer*>(buffer);
+  }
+}
+
+// static
+string TraceRecorder::Impl::JsonString(const string& text) {
+  string json = "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    const char c = text[i];
+    if (c == '"' || c == '\\') {
+      json.push_back('\\');
+      json.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof escaped, "\\u%04x", c);
+      json.append(escaped);
+    } else {
+      json.push_back(c);
+    }
+  }
+  json.push_back('"');
+
+  return json;
+}
+
+// static
+TraceRecorder::Impl* TraceRecorder::recorder_ = NULL;
+
+// static
+bool TraceRecorder::Start(const string& filename, string* error_message) {
+  if (recorder_ != NULL) {
+    *error_message = "Already tracing";
+    return false;
+  }
+
+  FILE* file = fopen(filename.c_str(), "w");
+  if (!file) {
+    *error_message = "Unable to open " + filename + ": ";
+    error_message->append(strerror(errno));
+    return false;
+  }
+
+  Impl* recorder = new Impl(file, filename);
+  if (!recorder->StartWriter(error_message)) {
+    string unused;
+    recorder->Finish(&unused);
+    delete recorder;
+    return false;
+  }
+
+  recorder_ = recorder;
+  SetThreadName("main");
+
+  return true;
+}
+
+// static
+bool TraceRecorder::Stop(string* error_message) {
+  if (recorder_ == NULL) {
+    return true;
+  }
+
+  Impl* recorder = recorder_;
+  recorder_ = NULL;
+
+  const bool success = recorder->Finish(error_message);
+  delete recorder;
+
+  return success;
+}
+
+// static
+void TraceRecorder::SetThreadName(const string& name) {
+  if (recorder_ == NULL) {
+    return;
+  }
+
+  Impl::Buffer* buffer = recorder_->ThreadBuffer();
+  buffer->events.push_back(Impl::Event());
+
+  Impl::Event& event = buffer->events.back();
+  event.phase = 'M';
+  event.name = NULL;
+  event.type_name = NULL;
+  event.id = 0;
+  event.timestamp_us = 0;
+  event.duration_us = 0;
+  event.detail = name;
+}
+
+// static
+void TraceRecorder::AddSpan(const char* name, int64_t start_us,
+    int64_t end_us, const char* type_name) {
+  if (recorder_ == NULL) {
+    return;
+  }
+
+  Impl::Buffer* buffer = recorder_->ThreadBuffer();
+  buffer->events.push_back(Impl::Event());
+
+  Impl::Event& event = buffer->events.back();
+  event.phase = 'X';
+  event.name = name;
+  event.type_name = type_name;
+  event.id = 0;
+  event.timestamp_us = start_us - recorder_->start_us();
+  event.duration_us = end_us - start_us;
+}
+
+// static
+void TraceRecorder::AddAsyncSpan(const char* name, uint64_t id,
+    int64_t start_us, int64_t end_us, const string& detail) {
+  if (recorder_ == NULL) {
+    return;
+  }
+
+  Impl::Event event;
+  event.name = name;
+  event.type_name = NULL;
+  event.id = id;
+  event.duration_us = 0;
+
+  event.phase = 'b';
+  event.timestamp_us = start_us - recorder_->start_us();
+  event.detail = detail;
+  recorder_->ThreadBuffer()->events.push_back(event);
+
+  event.phase = 'e';
+  event.timestamp_us = end_us - recorder_->start_us();
+  event.detail.clear();
+  recorder_->ThreadBuffer()->events.push_back(event);
+}
+
+// static
+uint64_t TraceRecorder::NextId() {
+  return __sync_add_and_fetch(&next_operation_id, 1);
+}
+
+TraceSpan::TraceSpan(const char* name, const char* type_name)
+  :
+    name_(name),
+    type_name_(type_name),
+    start_us_(TraceRecorder::IsEnabled() ? Clock::NowMicroseconds() : 0) {
+}
+
+TraceSpan::~TraceSpan() {
+  if (TraceRecorder::IsEnabled() && start_us_ != 0) {
+    TraceRecorder::AddSpan(name_, start_us_, Clock::NowMicroseconds(),
+        type_name_);
+  }
+}
+}  // namespace x509ls
@@ -0,0 +1,93 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BASE_TRACE_RECORDER_H_
+#define X509LS_BASE_TRACE_RECORDER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+// Records spans in the Chrome trace event format (as read by chrome://tracing
+// and Perfetto), process wide.
+//
+// Each thread appends to its own buffer, without locking. Full buffers are
+// handed to a writer thread through a lock-free stack, and written out
+// asynchronously, so recording only costs a clock read and an append.
+//
+// Usage:
+//   TraceRecorder::Start("trace.json", &error_message);
+//   ...
+//   { TraceSpan span("DeliverEvents"); ... }
+//   ...
+//   TraceRecorder::Stop(&error_message);
+//
+// Call Stop() once every other recording thread has exited: Their buffers are
+// handed over as they exit.
+class TraceRecorder {
+ public:
+  // Start recording to |filename|. Returns false if the file can't be opened
+  // or the writer thread can't be started, setting |error_message|.
+  static bool Start(const string& filename, string* error_message);
+
+  // Hand over the calling thread's buffer, wait for the writer thread to
+  // write every buffer, then finish the file. Returns false if any write
+  // failed, setting |error_message|.
+  static bool Stop(string* error_message);
+
+  // Return true iif recording.
+  static bool IsEnabled() {
+    return recorder_ != NULL;
+  }
+
+  // Name the calling thread in the trace, e.g. "batch worker 1".
+  static void SetThreadName(const string& name);
+
+  // Record the span |name| from |start_us| to |end_us| (Clock times) on the
+  // calling thread. |type_name| is NULL, or a std::type_info::name() of the
+  // object the span dispatched to, demangled by the writer thread.
+  //
+  // Spans on one thread must nest.
+  static void AddSpan(const char* name, int64_t start_us, int64_t end_us,
+      const char* type_name);
+
+  // Record the asynchronous span |name| of operation |id| (see NextId()),
+  // with the |detail| text, e.g. a target. Unlike AddSpan(), the spans of
+  // different operations may overlap, and are shown on their own track.
+  static void AddAsyncSpan(const char* name, uint64_t id, int64_t start_us,
+      int64_t end_us, const string& detail);
+
+  // Return a new operation id for AddAsyncSpan().
+  static uint64_t NextId();
+
+ private:
+  NO_COPY_AND_ASSIGN(TraceRecorder)
+
+  class Impl;
+  static Impl* recorder_;
+
+  TraceRecorder();
+};
+
+// Records a TraceRecorder span from construction to destruction, if
+// recording.
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name, const char* type_name = NULL);
+  ~TraceSpan();
+
+ private:
+  NO_COPY_AND_ASSIGN(TraceSpan)
+
+  const char* const name_;
+  const char* const type_name_;
+  const int64_t start_us_;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BASE_TRACE_RECORDER_H_
@@ -0,0 +1,233 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/batch/batch_runner.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "x509ls/base/clock.h"
+#include "x509ls/base/metrics_exporter.h"
+#include "x509ls/batch/batch_scanner.h"
+#include "x509ls/batch/batch_worker.h"
+#include "x509ls/batch/result_queue.h"
+#include "x509ls/batch/work_queue.h"
+#include "x509ls/certificate/ocsp_cache.h"
+#include "x509ls/certificate/trust_store.h"
+#include "x509ls/net/connect_scheduler.h"
+#include "x509ls/net/dns_cache.h"
+#include "x509ls/net/ocsp_client.h"
+#include "x509ls/net/rate_limiter.h"
+#include "x509ls/net/stub_resolver.h"
+#include "x509ls/net/uring_backend.h"
+
+using std::stringstream;
+using std::vector;
+
+namespace x509ls {
+namespace {
+// Default total number of fetches in progress at once.
+const size_t kDefaultConcurrency = 32;
+
+// Interval between writing out the results handed back by the workers.
+const long kResultPollNanoseconds = 2 * 1000 * 1000;  // NOLINT(runtime/int)
+
+void WriteLines(const vector<string>& lines, FILE* output) {
+  for (size_t i = 0; i < lines.size(); ++i) {
+    fwrite(lines[i].data(), 1, lines[i].size(), output);
+  }
+}
+}  // namespace
+
+BatchRunner::BatchRunner(TrustStore* trust_store, ChainCache* chain_cache,
+    FILE* output)
+  :
+    trust_store_(trust_store),
+    chain_cache_(chain_cache),
+    output_(output),
+    thread_count_(1),
+    concurrency_(kDefaultConcurrency),
+    global_rate_(0),
+    subnet_rate_(0),
+    address_rate_(0),
+    address_map_(NULL),
+    bio_pair_(false),
+    io_uring_(false),
+    stub_resolver_(false),
+    ocsp_(false),
+    metrics_(NULL),
+    exporter_(NULL) {
+}
+
+BatchRunner::~BatchRunner() {
+}
+
+void BatchRunner::SetThreadCount(size_t thread_count) {
+  thread_count_ = thread_count > 0 ? thread_count : 1;
+}
+
+void BatchRunner::SetConcurrency(size_t concurrency) {
+  concurrency_ = concurrency > 0 ? concurrency : 1;
+}
+
+void BatchRunner::SetRateLimits(double global_rate, double subnet_rate,
+    double address_rate) {
+  global_rate_ = global_rate;
+  subnet_rate_ = subnet_rate;
+  address_rate_ = address_rate;
+}
+
+void BatchRunner::SetAddressMap(const AddressMap* address_map) {
+  address_map_ = address_map;
+}
+
+void BatchRunner::SetBioPair(bool bio_pair) {
+  bio_pair_ = bio_pair;
+}
+
+void BatchRunner::SetIoUring(bool io_uring) {
+  io_uring_ = io_uring;
+}
+
+void BatchRunner::SetStubResolver(bool stub_resolver,
+    const vector<string>& nameservers) {
+  stub_resolver_ = stub_resolver;
+  nameservers_ = nameservers;
+}
+
+void BatchRunner::SetOCSP(bool ocsp) {
+  ocsp_ = ocsp;
+}
+
+void BatchRunner::SetMetrics(FetchMetrics* metrics,
+    MetricsExporter* exporter) {
+  metrics_ = metrics;
+  exporter_ = exporter;
+}
+
+bool BatchRunner::Run(const string& filename, string* error_message) {
+  vector<string> targets;
+  if (!BatchScanner::LoadTargets(filename, &targets, error_message)) {
+    return false;
+  }
+
+  const int64_t start_us = Clock::NowMicroseconds();
+
+  // Every worker runs at least one fetch: Run no more workers than fetches.
+  const size_t thread_count = std::min(thread_count_, concurrency_);
+
+  RateLimiter rate_limiter(global_rate_, subnet_rate_, address_rate_);
+  WorkQueue work_queue(thread_count);
+  work_queue.AddAll(targets);
+  ResultQueue results;
+  DnsCache dns_cache;
+  OCSPCache ocsp_cache;
+
+  // Divide the concurrency between the workers, the first few taking one
+  // more each for the remainder, so the total is exactly |concurrency_|.
+  vector<BatchWorker*> workers;
+  for (size_t i = 0; i < thread_count; ++i) {
+    const size_t worker_concurrency = concurrency_ / thread_count +
+      (i < concurrency_ % thread_count ? 1 : 0);
+    BatchWorker* worker = new BatchWorker(trust_store_, chain_cache_,
+        &rate_limiter, &work_queue, i, &results, worker_concurrency);
+    worker->SetAddressMap(address_map_);
+    worker->SetBioPair(bio_pair_);
+    worker->SetIoUring(io_uring_);
+    worker->SetMetrics(metrics_);
+    if (stub_resolver_) {
+      worker->SetStubResolver(&dns_cache, nameservers_);
+    }
+    if (ocsp_) {
+      worker->SetOCSPCache(&ocsp_cache);
+    }
+    if (!worker->StartThread()) {
+      delete worker;
+      break;
+    }
+    workers.push_back(worker);
+  }
+
+  if (workers.empty()) {
+    *error_message = "Unable to start batch worker threads.";
+    return false;
+  }
+
+  // Write results as they are handed back, until every worker is done.
+  vector<string> lines;
+  size_t finished_count = 0;
+  while (finished_count < workers.size()) {
+    lines.clear();
+    results.PopAll(&lines);
+    WriteLines(lines, output_);
+
+    if (exporter_) {
+      exporter_->WriteIfDue();
+    }
+
+    finished_count = 0;
+    for (size_t i = 0; i < workers.size(); ++i) {
+      if (workers[i]->IsFinished()) {
+        ++finished_count;
+      }
+    }
+
+    if (lines.empty() && finished_count < workers.size()) {
+      const struct timespec delay = { 0, kResultPollNanoseconds };
+      nanosleep(&delay, NULL);
+    }
+  }
+
+  uint64_t success_count = 0;
+  uint64_t failure_count = 0;
+  ConnectScheduler::Statistics connect_statistics;
+  UringBackend::Statistics uring_statistics;
+  StubResolver::Statistics dns_statistics;
+  OCSPClient::Statistics ocsp_statistics;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->JoinThread();
+    success_count += workers[i]->SuccessCount();
+    failure_count += workers[i]->FailureCount();
+    connect_statistics.Merge(workers[i]->ConnectStatistics());
+    uring_statistics.Merge(workers[i]->UringStatistics());
+    dns_statistics.Merge(workers[i]->DnsStatistics());
+    ocsp_statistics.Merge(workers[i]->OCSPStatistics());
+    delete workers[i];
+  }
+
+  lines.clear();
+  results.PopAll(&lines);
+  WriteLines(lines, output_);
+  fflush(output_);
+
+  const int elapsed_ms =
+    Clock::ElapsedMilliseconds(start_us, Clock::NowMicroseconds());
+
+  stringstream summary;
+  summary << targets.size() << " targets, " << success_count << " ok, ";
+  summary << failure_count << " failed in " << elapsed_ms << "ms";
+  summary << " (" << workers.size() << " threads, ";
+  summary << work_queue.StealCount() << " steals); ";
+  summary << connect_statistics.Summary();
+  if (io_uring_) {
+    summary << "; " << uring_statistics.Summary();
+  }
+  if (stub_resolver_) {
+    summary << "; " << dns_statistics.Summary();
+  }
+  if (ocsp_) {
+    summary << "; " << ocsp_statistics.Summary();
+  }
+  summary << "; " << trust_store_->Signatures()->GetStatistics().Summary();
+  summary_ = summary.str();
+
+  return true;
+}
+
+string BatchRunner::Summary() const {
+  return summary_;
+}
+}  // namespace x509ls
@@ -0,0 +1,113 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BATCH_BATCH_RUNNER_H_
+#define X509LS_BATCH_BATCH_RUNNER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+using std::vector;
+
+namespace x509ls {
+class AddressMap;
+class ChainCache;
+class FetchMetrics;
+class MetricsExporter;
+class TrustStore;
+// Runs a batch of targets on one or more BatchWorker threads.
+//
+// The targets are divided between the workers through a WorkQueue, and the
+// results are handed back through a ResultQueue to the calling thread, which
+// writes them to the output. Connection rate limits are shared by all workers.
+//
+// Usage:
+//   BatchRunner runner(&trust_store, chain_cache, stdout);
+//   runner.SetThreadCount(4);
+//   if (!runner.Run(filename, &error_message)) { ... }
+class BatchRunner {
+ public:
+  // Construct, verifying against |trust_store| and writing results to
+  // |output|. |chain_cache| may be NULL.
+  BatchRunner(TrustStore* trust_store, ChainCache* chain_cache, FILE* output);
+  ~BatchRunner();
+
+  // Run |thread_count| worker threads, default 1, but no more than the
+  // concurrency.
+  void SetThreadCount(size_t thread_count);
+
+  // Run at most |concurrency| fetches at once in total, default 32.
+  void SetConcurrency(size_t concurrency);
+
+  // Limit TLS connections to |global_rate|, |subnet_rate| and |address_rate|
+  // per second (see RateLimiter), 0 for unlimited.
+  void SetRateLimits(double global_rate, double subnet_rate,
+      double address_rate);
+
+  // Connect to the targets in |address_map| without DNS lookups. May be NULL
+  // (the default), and must outlive the BatchRunner.
+  void SetAddressMap(const AddressMap* address_map);
+
+  // Run TLS connections over BIO pairs, default false.
+  void SetBioPair(bool bio_pair);
+
+  // Perform socket I/O through an io_uring per worker, default false. Check
+  // UringBackend::IsAvailable() first: Workers otherwise silently fall back.
+  void SetIoUring(bool io_uring);
+
+  // Resolve names with a StubResolver per worker, default false. The workers
+  // share one DnsCache. Queries |nameservers| (see
+  // StubResolver::SetNameservers()), or if empty those of /etc/resolv.conf.
+  void SetStubResolver(bool stub_resolver, const vector<string>& nameservers);
+
+  // Query the OCSP responders of end-entity certificates without a current
+  // stapled response, default false. The workers share one OCSPCache.
+  void SetOCSP(bool ocsp);
+
+  // Record the fetches in |metrics|, rewriting the metrics file through
+  // |exporter| while running. Either may be NULL (the default), and both must
+  // outlive the BatchRunner.
+  void SetMetrics(FetchMetrics* metrics, MetricsExporter* exporter);
+
+  // Fetch the targets listed in |filename| (see BatchScanner::LoadTargets()),
+  // returning once all are done.
+  //
+  // Returns false if the targets couldn't be read or no thread could be
+  // started, setting |error_message|.
+  bool Run(const string& filename, string* error_message);
+
+  // Return a one line summary of the last Run().
+  string Summary() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(BatchRunner)
+
+  TrustStore* const trust_store_;
+  ChainCache* const chain_cache_;
+  FILE* const output_;
+
+  size_t thread_count_;
+  size_t concurrency_;
+  double global_rate_;
+  double subnet_rate_;
+  double address_rate_;
+  const AddressMap* address_map_;
+  bool bio_pair_;
+  bool io_uring_;
+  bool stub_resolver_;
+  vector<string> nameservers_;
+  bool ocsp_;
+  FetchMetrics* metrics_;
+  MetricsExporter* exporter_;
+
+  string summary_;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BATCH_BATCH_RUNNER_H_
@@ -0,0 +1,314 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/batch/batch_scanner.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sstream>
+
+#include "x509ls/batch/result_writer.h"
+#include "x509ls/batch/work_queue.h"
+#include "x509ls/cli/base/cli_application.h"
+#include "x509ls/cli/certificate_list_layout.h"
+#include "x509ls/net/chain_fetcher.h"
+#include "x509ls/net/fetch_metrics.h"
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// Default number of fetches in progress at once.
+const size_t kDefaultConcurrency = 32;
+}  // namespace
+
+BatchScanner::BatchScanner(CliApplication* application,
+    TrustStore* trust_store, ResultWriter* writer, WorkQueue* work_queue,
+    size_t worker_index)
+  :
+    BaseObject(application),
+    trust_store_(trust_store),
+    writer_(writer),
+    work_queue_(work_queue),
+    worker_index_(worker_index),
+    chain_cache_(NULL),
+    address_map_(NULL),
+    connect_scheduler_(NULL),
+    concurrency_(kDefaultConcurrency),
+    bio_pair_(false),
+    io_uring_(false),
+    uring_backend_(NULL),
+    dns_cache_(NULL),
+    stub_resolver_(NULL),
+    ocsp_cache_(NULL),
+    ocsp_client_(NULL),
+    metrics_(NULL),
+    success_count_(0),
+    failure_count_(0) {
+}
+
+// virtual
+BatchScanner::~BatchScanner() {
+  // Delete the fetchers before the ConnectScheduler they may be queued in,
+  // the UringBackend they may have operations outstanding on, and the
+  // StubResolver and OCSPClient they may be waiting for. The OCSPClient's
+  // own lookups may be waiting for the StubResolver.
+  for (map<ChainFetcher*, string>::iterator it = fetchers_.begin();
+      it != fetchers_.end();
+      ++it) {
+    DeleteChild(it->first);
+  }
+  if (ocsp_client_) {
+    DeleteChild(ocsp_client_);
+  }
+}
+
+// static
+bool BatchScanner::LoadTargets(const string& filename,
+    vector<string>* targets, string* error_message) {
+  *error_message = "";
+
+  FILE* file = filename == "-" ? stdin : fopen(filename.c_str(), "r");
+  if (!file) {
+    *error_message = "Unable to open " + filename + ": ";
+    error_message->append(strerror(errno));
+    return false;
+  }
+
+  char buffer[1024];
+  while (fgets(buffer, sizeof buffer, file)) {
+    string line(buffer);
+
+    const size_t end = line.find_last_not_of(" \t\r\n");
+    const size_t start = line.find_first_not_of(" \t");
+    if (end == string::npos || line[start] == '#') {
+      continue;
+    }
+
+    targets->push_back(line.substr(start, end - start + 1));
+  }
+
+  if (file != stdin) {
+    fclose(file);
+  }
+
+  return true;
+}
+
+void BatchScanner::SetConcurrency(size_t concurrency) {
+  concurrency_ = concurrency > 0 ? concurrency : 1;
+}
+
+void BatchScanner::SetRateLimiter(RateLimiter* rate_limiter) {
+  if (connect_scheduler_) {
+    DeleteChild(connect_scheduler_);
+  }
+
+  connect_scheduler_ = new ConnectScheduler(this, rate_limiter);
+}
+
+void BatchScanner::SetChainCache(ChainCache* chain_cache) {
+  chain_cache_ = chain_cache;
+}
+
+void BatchScanner::SetAddressMap(const AddressMap* address_map) {
+  address_map_ = address_map;
+}
+
+void BatchScanner::SetBioPair(bool bio_pair) {
+  bio_pair_ = bio_pair;
+}
+
+void BatchScanner::SetIoUring(bool io_uring) {
+  io_uring_ = io_uring;
+}
+
+void BatchScanner::SetStubResolver(DnsCache* dns_cache,
+    const vector<string>& nameservers) {
+  dns_cache_ = dns_cache;
+  nameservers_ = nameservers;
+}
+
+void BatchScanner::SetOCSPCache(OCSPCache* ocsp_cache) {
+  ocsp_cache_ = ocsp_cache;
+}
+
+void BatchScanner::SetMetrics(FetchMetrics* metrics) {
+  metrics_ = metrics;
+}
+
+void BatchScanner::Start() {
+  if (io_uring_) {
+    // Fall back to watching sockets if the ring can't be set up.
+    uring_backend_ = new UringBackend(this);
+    string error_message;
+    if (!uring_backend_->Init(&error_message)) {
+      DeleteChild(uring_backend_);
+      uring_backend_ = NULL;
+    }
+  }
+
+  if (dns_cache_) {
+    // Without a readable resolv.conf the resolver queries 127.0.0.1.
+    stub_resolver_ = new StubResolver(this, dns_cache_);
+    string error_message;
+    if (nameservers_.empty()) {
+      stub_resolver_->Configure("/etc/resolv.conf", &error_message);
+    } else {
+      stub_resolver_->SetNameservers(nameservers_, &error_message);
+    }
+  }
+
+  if (ocsp_cache_) {
+    ocsp_client_ = new OCSPClient(this, ocsp_cache_, trust_store_);
+    if (stub_resolver_) {
+      ocsp_client_->SetStubResolver(stub_resolver_);
+    }
+  }
+
+  StartFetches();
+}
+
+uint64_t BatchScanner::SuccessCount() const {
+  return success_count_;
+}
+
+uint64_t BatchScanner::FailureCount() const {
+  return failure_count_;
+}
+
+ConnectScheduler::Statistics BatchScanner::ConnectStatistics() const {
+  if (connect_scheduler_ == NULL) {
+    return ConnectScheduler::Statistics();
+  }
+
+  return connect_scheduler_->GetStatistics();
+}
+
+UringBackend::Statistics BatchScanner::UringStatistics() const {
+  if (uring_backend_ == NULL) {
+    return UringBackend::Statistics();
+  }
+
+  return uring_backend_->GetStatistics();
+}
+
+StubResolver::Statistics BatchScanner::DnsStatistics() const {
+  if (stub_resolver_ == NULL) {
+    return StubResolver::Statistics();
+  }
+
+  return stub_resolver_->GetStatistics();
+}
+
+OCSPClient::Statistics BatchScanner::OCSPStatistics() const {
+  if (ocsp_client_ == NULL) {
+    return OCSPClient::Statistics();
+  }
+
+  return ocsp_client_->GetStatistics();
+}
+
+// virtual
+void BatchScanner::OnEvent(const BaseObject* source, int event_code) {
+  map<ChainFetcher*, string>::iterator it =
+    fetchers_.find(const_cast<ChainFetcher*>(
+          static_cast<const ChainFetcher*>(source)));
+  if (it == fetchers_.end()) {
+    return;
+  }
+
+  FinishFetch(it->first, event_code);
+  StartFetches();
+}
+
+void BatchScanner::StartFetches() {
+  string target;
+  while (fetchers_.size() < concurrency_ &&
+      work_queue_->Take(worker_index_, &target)) {
+    string node;
+    string port;
+    if (!CertificateListLayout::ReadUserInputNode(target, &node, &port)) {
+      writer_->WriteFailure(target, "", "Unable to understand target");
+      ++failure_count_;
+      if (metrics_) {
+        metrics_->FetchRejected();
+      }
+      continue;
+    }
+
+    ChainFetcher* fetcher = new ChainFetcher(this, trust_store_, node, port,
+        DnsLookup::kLookupTypeIPv4then6, 0, 0);
+    fetcher->SetChainCache(chain_cache_);
+    fetcher->SetAddressMap(address_map_);
+    fetcher->SetConnectScheduler(connect_scheduler_);
+    fetcher->SetBioPair(bio_pair_);
+    fetcher->SetUringBackend(uring_backend_);
+    if (stub_resolver_) {
+      fetcher->SetStubResolver(stub_resolver_);
+    }
+    fetcher->SetOCSPClient(ocsp_client_);
+    Subscribe(fetcher, ChainFetcher::kStateResolveFail);
+    Subscribe(fetcher, ChainFetcher::kStateConnectSuccess);
+    Subscribe(fetcher, ChainFetcher::kStateConnectFail);
+    Subscribe(fetcher, ChainFetcher::kStateRevalidated);
+
+    fetchers_[fetcher] = target;
+    if (metrics_) {
+      metrics_->FetchStarted();
+    }
+    fetcher->Start();
+  }
+
+  // Nothing in progress, so Take() failed: The WorkQueue is exhausted.
+  if (fetchers_.empty()) {
+    GetApplication()->Exit(true);
+  }
+}
+
+void BatchScanner::FinishFetch(ChainFetcher* fetcher, int event_code) {
+  const string target = fetchers_[fetcher];
+
+  if (metrics_) {
+    metrics_->FetchFinished(*fetcher, event_code);
+    if (chain_cache_) {
+      metrics_->ChainCacheLookup(fetcher->WasCacheHit());
+    }
+    if (stub_resolver_) {
+      metrics_->PublishDnsStatistics(stub_resolver_->GetStatistics(),
+          &published_dns_statistics_);
+    }
+  }
+
+  switch (event_code) {
+  case ChainFetcher::kStateConnectSuccess:
+  case ChainFetcher::kStateRevalidated: {
+    stringstream details;
+    details << "queued=" << fetcher->QueueDelayMilliseconds() << "ms";
+    details << " received=" << fetcher->BytesReceived();
+    details << " sent=" << fetcher->BytesSent();
+    details << " " << fetcher->Timing().Summary();
+    writer_->WriteSuccess(target, fetcher->IPAddressAndPort(),
+        *fetcher->Verification(), details.str());
+    ++success_count_;
+    break;
+  }
+  case ChainFetcher::kStateResolveFail:
+    writer_->WriteFailure(target, "", fetcher->ErrorMessage());
+    ++failure_count_;
+    break;
+  case ChainFetcher::kStateConnectFail:
+  default:
+    writer_->WriteFailure(target, fetcher->IPAddressAndPort(),
+        "Connection failed");
+    ++failure_count_;
+    break;
+  }
+
+  fetchers_.erase(fetcher);
+  Unsubscribe(fetcher);
+  DeleteChild(fetcher);
+}
+}  // namespace x509ls
@@ -0,0 +1,164 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BATCH_BATCH_SCANNER_H_
+#define X509LS_BATCH_BATCH_SCANNER_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/types.h"
+#include "x509ls/net/connect_scheduler.h"
+#include "x509ls/net/ocsp_client.h"
+#include "x509ls/net/stub_resolver.h"
+#include "x509ls/net/uring_backend.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+class AddressMap;
+class ChainCache;
+class ChainFetcher;
+class CliApplication;
+class FetchMetrics;
+class RateLimiter;
+class ResultWriter;
+class TrustStore;
+class WorkQueue;
+// Fetches and verifies the chains of batch targets, non-interactively.
+//
+// Takes targets from a WorkQueue, running up to SetConcurrency() ChainFetchers
+// at once, and writes one result per target to a ResultWriter. TLS connections
+// are scheduled by a ConnectScheduler, so the configured rate limits are never
+// exceeded for any destination. Calls Exit() on the application once the
+// WorkQueue is exhausted and every fetch is done.
+//
+// Each BatchScanner runs in its own application's event loop: Several may run
+// on separate threads, sharing the WorkQueue and RateLimiter.
+class BatchScanner : public BaseObject {
+ public:
+  // Construct, taking targets for worker |worker_index| from |work_queue|,
+  // verifying against |trust_store| and writing to |writer|.
+  BatchScanner(CliApplication* application, TrustStore* trust_store,
+      ResultWriter* writer, WorkQueue* work_queue, size_t worker_index);
+  virtual ~BatchScanner();
+
+  // Read the targets from |filename| ("-" for standard input) into
+  // |targets|: One "host[:port]" per line. Blank lines and lines starting
+  // with # are ignored.
+  //
+  // Returns true iif the file was read. On error, |error_message| is set.
+  static bool LoadTargets(const string& filename, vector<string>* targets,
+      string* error_message);
+
+  // Run at most |concurrency| fetches at once. Call before Start().
+  void SetConcurrency(size_t concurrency);
+
+  // Schedule TLS connections within the limits of |rate_limiter|, which must
+  // outlive the BatchScanner. Call before Start().
+  void SetRateLimiter(RateLimiter* rate_limiter);
+
+  // Use |chain_cache| for the fetches, may be NULL. Call before Start().
+  void SetChainCache(ChainCache* chain_cache);
+
+  // Skip DNS for the targets in |address_map|, may be NULL. Call before
+  // Start().
+  void SetAddressMap(const AddressMap* address_map);
+
+  // Run TLS connections over BIO pairs. Call before Start().
+  void SetBioPair(bool bio_pair);
+
+  // Perform socket I/O through an io_uring, if available. Call before
+  // Start().
+  void SetIoUring(bool io_uring);
+
+  // Resolve names with a StubResolver, caching answers in |dns_cache|, which
+  // must outlive the BatchScanner. Queries |nameservers| (see
+  // StubResolver::SetNameservers()), or if empty those of /etc/resolv.conf.
+  // Call before Start().
+  void SetStubResolver(DnsCache* dns_cache, const vector<string>& nameservers);
+
+  // Query the OCSP responders of end-entity certificates without a current
+  // stapled response, caching results in |ocsp_cache|, which must outlive the
+  // BatchScanner. May be NULL (the default) not to. Call before Start().
+  void SetOCSPCache(OCSPCache* ocsp_cache);
+
+  // Record every fetch in the shared |metrics|, may be NULL. Call before
+  // Start().
+  void SetMetrics(FetchMetrics* metrics);
+
+  // Start fetching.
+  void Start();
+
+  // Return the number of targets fetched successfully / unsuccessfully.
+  uint64_t SuccessCount() const;
+  uint64_t FailureCount() const;
+
+  // Return the ConnectScheduler's queueing statistics.
+  ConnectScheduler::Statistics ConnectStatistics() const;
+
+  // Return the io_uring statistics, all zero if io_uring isn't used.
+  UringBackend::Statistics UringStatistics() const;
+
+  // Return the StubResolver's statistics, all zero if it isn't used.
+  StubResolver::Statistics DnsStatistics() const;
+
+  // Return the OCSPClient's statistics, all zero if it isn't used.
+  OCSPClient::Statistics OCSPStatistics() const;
+
+  // Receives events from the ChainFetchers.
+  virtual void OnEvent(const BaseObject* source, int event_code);
+
+ private:
+  NO_COPY_AND_ASSIGN(BatchScanner)
+
+  TrustStore* const trust_store_;
+  ResultWriter* const writer_;
+  WorkQueue* const work_queue_;
+  const size_t worker_index_;
+  ChainCache* chain_cache_;
+  const AddressMap* address_map_;
+  ConnectScheduler* connect_scheduler_;
+  size_t concurrency_;
+  bool bio_pair_;
+  bool io_uring_;
+
+  // The io_uring shared by all fetches, or NULL.
+  UringBackend* uring_backend_;
+
+  // The StubResolver shared by all fetches, or NULL for getaddrinfo_a().
+  DnsCache* dns_cache_;
+  vector<string> nameservers_;
+  StubResolver* stub_resolver_;
+
+  // The OCSPClient shared by all fetches, or NULL.
+  OCSPCache* ocsp_cache_;
+  OCSPClient* ocsp_client_;
+
+  // The shared metrics, or NULL, and the DNS statistics already recorded in
+  // them.
+  FetchMetrics* metrics_;
+  StubResolver::Statistics published_dns_statistics_;
+
+  // Fetches in progress, and their target.
+  map<ChainFetcher*, string> fetchers_;
+
+  uint64_t success_count_;
+  uint64_t failure_count_;
+
+  // Start fetches until |concurrency_| are in progress, or Exit() once all
+  // targets are done.
+  void StartFetches();
+
+  // Write the result of |fetcher|, and delete it.
+  void FinishFetch(ChainFetcher* fetcher, int event_code);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BATCH_BATCH_SCANNER_H_
@@ -0,0 +1,144 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/batch/batch_worker.h"
+
+#include <sstream>
+
+#include "x509ls/base/trace_recorder.h"
+#include "x509ls/batch/batch_scanner.h"
+#include "x509ls/net/fetch_metrics.h"
+
+namespace x509ls {
+BatchWorker::BatchWorker(TrustStore* trust_store, ChainCache* chain_cache,
+    RateLimiter* rate_limiter, WorkQueue* work_queue, size_t worker_index,
+    ResultQueue* results, size_t concurrency)
+  :
+    CliApplication(),
+    trust_store_(trust_store),
+    chain_cache_(chain_cache),
+    rate_limiter_(rate_limiter),
+    work_queue_(work_queue),
+    worker_index_(worker_index),
+    concurrency_(concurrency),
+    address_map_(NULL),
+    bio_pair_(false),
+    io_uring_(false),
+    dns_cache_(NULL),
+    ocsp_cache_(NULL),
+    metrics_(NULL),
+    writer_(results),
+    scanner_(NULL),
+    thread_started_(false),
+    finished_(0) {
+  SetHeadless(true);
+}
+
+// virtual
+BatchWorker::~BatchWorker() {
+  JoinThread();
+
+  delete scanner_;
+}
+
+void BatchWorker::SetAddressMap(const AddressMap* address_map) {
+  address_map_ = address_map;
+}
+
+void BatchWorker::SetBioPair(bool bio_pair) {
+  bio_pair_ = bio_pair;
+}
+
+void BatchWorker::SetIoUring(bool io_uring) {
+  io_uring_ = io_uring;
+}
+
+void BatchWorker::SetStubResolver(DnsCache* dns_cache,
+    const vector<string>& nameservers) {
+  dns_cache_ = dns_cache;
+  nameservers_ = nameservers;
+}
+
+void BatchWorker::SetOCSPCache(OCSPCache* ocsp_cache) {
+  ocsp_cache_ = ocsp_cache;
+}
+
+void BatchWorker::SetMetrics(FetchMetrics* metrics) {
+  metrics_ = metrics;
+  SetLoopHistogram(metrics_ ? metrics_->EventLoopHistogram() : NULL);
+}
+
+bool BatchWorker::StartThread() {
+  thread_started_ = pthread_create(&thread_, NULL, ThreadProcedure, this) == 0;
+
+  return thread_started_;
+}
+
+bool BatchWorker::IsFinished() {
+  return __sync_add_and_fetch(&finished_, 0) != 0;
+}
+
+void BatchWorker::JoinThread() {
+  if (thread_started_) {
+    pthread_join(thread_, NULL);
+    thread_started_ = false;
+  }
+}
+
+uint64_t BatchWorker::SuccessCount() const {
+  return scanner_ ? scanner_->SuccessCount() : 0;
+}
+
+uint64_t BatchWorker::FailureCount() const {
+  return scanner_ ? scanner_->FailureCount() : 0;
+}
+
+ConnectScheduler::Statistics BatchWorker::ConnectStatistics() const {
+  return scanner_ ? scanner_->ConnectStatistics() :
+    ConnectScheduler::Statistics();
+}
+
+UringBackend::Statistics BatchWorker::UringStatistics() const {
+  return scanner_ ? scanner_->UringStatistics() : UringBackend::Statistics();
+}
+
+StubResolver::Statistics BatchWorker::DnsStatistics() const {
+  return scanner_ ? scanner_->DnsStatistics() : StubResolver::Statistics();
+}
+
+OCSPClient::Statistics BatchWorker::OCSPStatistics() const {
+  return scanner_ ? scanner_->OCSPStatistics() : OCSPClient::Statistics();
+}
+
+// virtual
+void BatchWorker::RunEvent() {
+  scanner_ = new BatchScanner(this, trust_store_, &writer_, work_queue_,
+      worker_index_);
+  scanner_->SetConcurrency(concurrency_);
+  scanner_->SetRateLimiter(rate_limiter_);
+  scanner_->SetChainCache(chain_cache_);
+  scanner_->SetAddressMap(address_map_);
+  scanner_->SetBioPair(bio_pair_);
+  scanner_->SetIoUring(io_uring_);
+  if (dns_cache_) {
+    scanner_->SetStubResolver(dns_cache_, nameservers_);
+  }
+  scanner_->SetOCSPCache(ocsp_cache_);
+  scanner_->SetMetrics(metrics_);
+  scanner_->Start();
+}
+
+// static
+void* BatchWorker::ThreadProcedure(void* arg) {
+  BatchWorker* worker = static_cast<BatchWorker*>(arg);
+
+  std::stringstream thread_name;
+  thread_name << "batch worker " << worker->worker_index_;
+  TraceRecorder::SetThreadName(thread_name.str());
+
+  worker->Run();
+  __sync_lock_test_and_set(&worker->finished_, 1);
+
+  return NULL;
+}
+}  // namespace x509ls
@@ -0,0 +1,123 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BATCH_BATCH_WORKER_H_
+#define X509LS_BATCH_BATCH_WORKER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+#include "x509ls/batch/result_writer.h"
+#include "x509ls/cli/base/cli_application.h"
+#include "x509ls/net/connect_scheduler.h"
+#include "x509ls/net/ocsp_client.h"
+#include "x509ls/net/stub_resolver.h"
+#include "x509ls/net/uring_backend.h"
+
+using std::string;
+using std::vector;
+
+namespace x509ls {
+class BatchScanner;
+class AddressMap;
+class ChainCache;
+class FetchMetrics;
+class RateLimiter;
+class ResultQueue;
+class TrustStore;
+class WorkQueue;
+// A batch mode worker thread.
+//
+// Each worker is a headless CliApplication with its own event loop, and so its
+// own file descriptors, timers and ChainFetchers (each with its own SSL_CTX).
+// It runs a BatchScanner, which takes targets from the shared WorkQueue and
+// pushes results onto the shared ResultQueue.
+//
+// The TrustStore, ChainCache and RateLimiter are shared with the other
+// workers.
+class BatchWorker : public CliApplication {
+ public:
+  // Construct worker |worker_index|, taking targets from |work_queue| and
+  // pushing results onto |results|. At most |concurrency| fetches run at once.
+  BatchWorker(TrustStore* trust_store, ChainCache* chain_cache,
+      RateLimiter* rate_limiter, WorkQueue* work_queue, size_t worker_index,
+      ResultQueue* results, size_t concurrency);
+  virtual ~BatchWorker();
+
+  // Skip DNS for the targets in the shared |address_map|, may be NULL. Call
+  // before StartThread().
+  void SetAddressMap(const AddressMap* address_map);
+
+  // Run TLS connections over BIO pairs. Call before StartThread().
+  void SetBioPair(bool bio_pair);
+
+  // Perform socket I/O through an io_uring. Call before StartThread().
+  void SetIoUring(bool io_uring);
+
+  // Resolve names with a StubResolver, caching answers in the shared
+  // |dns_cache|. See BatchScanner::SetStubResolver(). Call before
+  // StartThread().
+  void SetStubResolver(DnsCache* dns_cache, const vector<string>& nameservers);
+
+  // Query OCSP responders, caching results in the shared |ocsp_cache|. See
+  // BatchScanner::SetOCSPCache(). Call before StartThread().
+  void SetOCSPCache(OCSPCache* ocsp_cache);
+
+  // Record fetches and event loop iterations in the shared |metrics|, may be
+  // NULL. Call before StartThread().
+  void SetMetrics(FetchMetrics* metrics);
+
+  // Start a thread running the worker. Returns false if no thread could be
+  // created.
+  bool StartThread();
+
+  // Return true once the worker's thread has finished.
+  bool IsFinished();
+
+  // Wait for the worker's thread to finish.
+  void JoinThread();
+
+  // The following are valid after JoinThread():
+  uint64_t SuccessCount() const;
+  uint64_t FailureCount() const;
+  ConnectScheduler::Statistics ConnectStatistics() const;
+  UringBackend::Statistics UringStatistics() const;
+  StubResolver::Statistics DnsStatistics() const;
+  OCSPClient::Statistics OCSPStatistics() const;
+
+ protected:
+  virtual void RunEvent();
+
+ private:
+  NO_COPY_AND_ASSIGN(BatchWorker)
+
+  TrustStore* const trust_store_;
+  ChainCache* const chain_cache_;
+  RateLimiter* const rate_limiter_;
+  WorkQueue* const work_queue_;
+  const size_t worker_index_;
+  const size_t concurrency_;
+  const AddressMap* address_map_;
+  bool bio_pair_;
+  bool io_uring_;
+  DnsCache* dns_cache_;
+  vector<string> nameservers_;
+  OCSPCache* ocsp_cache_;
+  FetchMetrics* metrics_;
+
+  ResultWriter writer_;
+  BatchScanner* scanner_;
+
+  pthread_t thread_;
+  bool thread_started_;
+  int finished_;
+
+  static void* ThreadProcedure(void* arg);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BATCH_BATCH_WORKER_H_
@@ -0,0 +1,45 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/batch/result_queue.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+
+namespace x509ls {
+ResultQueue::ResultQueue()
+  :
+    head_(NULL) {
+}
+
+ResultQueue::~ResultQueue() {
+  vector<string> unused;
+  PopAll(&unused);
+}
+
+void ResultQueue::Push(const string& line) {
+  Node* node = new Node();
+  node->line = line;
+
+  do {
+    node->next = head_;
+  } while (!__sync_bool_compare_and_swap(&head_, node->next, node));
+}
+
+void ResultQueue::PopAll(vector<string>* lines) {
+  Node* node = __sync_lock_test_and_set(&head_, static_cast<Node*>(NULL));
+  __sync_synchronize();
+
+  // The stack is newest first.
+  const size_t first = lines->size();
+  while (node != NULL) {
+    lines->push_back(node->line);
+    Node* next = node->next;
+    delete node;
+    node = next;
+  }
+
+  std::reverse(lines->begin() + first, lines->end());
+}
+}  // namespace x509ls
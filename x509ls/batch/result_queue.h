@@ -0,0 +1,47 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BATCH_RESULT_QUEUE_H_
+#define X509LS_BATCH_RESULT_QUEUE_H_
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// Lock-free hand-off of result lines from many producer threads to one
+// consumer (the output writer).
+//
+// Producers push onto a singly linked stack with compare-and-swap. The consumer
+// detaches the whole stack with a single atomic exchange, so neither side ever
+// blocks the other, and there is no ABA problem: Nodes are only freed after
+// being detached.
+class ResultQueue {
+ public:
+  ResultQueue();
+  ~ResultQueue();
+
+  // Add |line|. May be called from any thread.
+  void Push(const string& line);
+
+  // Append every line pushed so far to |lines|, oldest first. Call from the
+  // consumer thread only.
+  void PopAll(vector<string>* lines);
+
+ private:
+  NO_COPY_AND_ASSIGN(ResultQueue)
+
+  struct Node {
+    string line;
+    Node* next;
+  };
+
+  Node* head_;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BATCH_RESULT_QUEUE_H_
@@ -0,0 +1,112 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/batch/result_writer.h"
+
+#include <time.h>
+
+#include <sstream>
+
+#include "x509ls/batch/result_queue.h"
+#include "x509ls/certificate/ocsp_cache.h"
+#include "x509ls/certificate/ocsp_staple.h"
+#include "x509ls/certificate/verified_chain.h"
+
+using std::stringstream;
+
+namespace x509ls {
+ResultWriter::ResultWriter(FILE* output)
+  :
+    output_(output),
+    queue_(NULL),
+    result_count_(0) {
+}
+
+ResultWriter::ResultWriter(ResultQueue* queue)
+  :
+    output_(NULL),
+    queue_(queue),
+    result_count_(0) {
+}
+
+ResultWriter::~ResultWriter() {
+  if (output_) {
+    fflush(output_);
+  }
+}
+
+void ResultWriter::WriteSuccess(const string& target, const string& address,
+    const VerifiedChain& chain, const string& details) {
+  stringstream line;
+  line << Field(target) << "\t" << Field(address) << "\tok\t";
+  line << Field(chain.VerifyStatus()) << "\t";
+  line << chain.Chain().Size() << "\t" << chain.Path().Size() << "\t";
+  if (chain.Chain().Size() > 0) {
+    line << Field(chain.Chain().CommonNames(0));
+  }
+  if (!details.empty()) {
+    line << "\t" << Field(details);
+  }
+  const char* separator = details.empty() ? "\t" : " ";
+  const time_t now = time(NULL);
+
+  const OCSPStaple& staple = chain.Staple();
+  if (staple.GetStatus() != OCSPStaple::kStatusNotChecked) {
+    line << separator;
+    separator = " ";
+    line << "staple=" << OCSPStaple::StatusName(staple.GetStatus());
+
+    if (staple.IsCurrent() && staple.NextUpdate() > now) {
+      line << " staple_ttl=" << staple.NextUpdate() - now << "s";
+    }
+  }
+
+  const OCSPResult& responder = chain.ResponderResult();
+  if (responder.status != OCSPResult::kStatusNotChecked) {
+    line << separator;
+    line << "responder=" << OCSPResult::StatusName(responder.status);
+
+    if (responder.next_update > now) {
+      line << " responder_ttl=" << responder.next_update - now << "s";
+    }
+  }
+  line << "\n";
+
+  WriteLine(line.str());
+}
+
+void ResultWriter::WriteFailure(const string& target, const string& address,
+    const string& reason) {
+  stringstream line;
+  line << Field(target) << "\t" << Field(address) << "\tfail\t";
+  line << Field(reason) << "\n";
+
+  WriteLine(line.str());
+}
+
+uint64_t ResultWriter::ResultCount() const {
+  return result_count_;
+}
+
+void ResultWriter::WriteLine(const string& line) {
+  if (queue_) {
+    queue_->Push(line);
+  } else {
+    fwrite(line.data(), 1, line.size(), output_);
+  }
+
+  ++result_count_;
+}
+
+// static
+string ResultWriter::Field(const string& text) {
+  string field = text;
+  for (size_t i = 0; i < field.size(); ++i) {
+    if (field[i] == '\t' || field[i] == '\n' || field[i] == '\r') {
+      field[i] = ' ';
+    }
+  }
+
+  return field;
+}
+}  // namespace x509ls
@@ -0,0 +1,65 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BATCH_RESULT_WRITER_H_
+#define X509LS_BATCH_RESULT_WRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+class ResultQueue;
+class VerifiedChain;
+// Writes non-interactive results, one line per target.
+//
+// Lines are tab separated, for easy processing with cut/awk:
+//   <target> <address> ok <verify status> <chain length> <path length>
+//       <leaf common names> [<details>] [staple=<status> [staple_ttl=<N>s]]
+//       [responder=<status> [responder_ttl=<N>s]]
+//   <target> <address> fail <reason>
+//
+// Tabs and newlines within fields are replaced with spaces.
+//
+// A ResultWriter is used from one thread only. Worker threads each write to a
+// ResultQueue instead, drained by the thread writing the output.
+class ResultWriter {
+ public:
+  // Construct, writing to |output|. |output| is not closed.
+  explicit ResultWriter(FILE* output);
+
+  // Construct, pushing each line to |queue|.
+  explicit ResultWriter(ResultQueue* queue);
+  ~ResultWriter();
+
+  // Write a result line for the verified |chain| of |target|, fetched from
+  // |address|. |details| is optional free text.
+  void WriteSuccess(const string& target, const string& address,
+      const VerifiedChain& chain, const string& details);
+
+  // Write a failure line for |target|, with the failure |reason|.
+  void WriteFailure(const string& target, const string& address,
+      const string& reason);
+
+  // Return the number of result lines written.
+  uint64_t ResultCount() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(ResultWriter)
+
+  FILE* const output_;
+  ResultQueue* const queue_;
+  uint64_t result_count_;
+
+  void WriteLine(const string& line);
+
+  static string Field(const string& text);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BATCH_RESULT_WRITER_H_
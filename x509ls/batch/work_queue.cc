@@ -0,0 +1,106 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/batch/work_queue.h"
+
+namespace x509ls {
+WorkQueue::WorkQueue(size_t worker_count)
+  :
+    steal_count_(0) {
+  for (size_t i = 0; i < worker_count; ++i) {
+    WorkerDeque* worker_deque = new WorkerDeque();
+    pthread_mutex_init(&worker_deque->mutex, NULL);
+    deques_.push_back(worker_deque);
+  }
+}
+
+WorkQueue::~WorkQueue() {
+  for (size_t i = 0; i < deques_.size(); ++i) {
+    pthread_mutex_destroy(&deques_[i]->mutex);
+    delete deques_[i];
+  }
+}
+
+void WorkQueue::AddAll(const vector<string>& targets) {
+  const size_t worker_count = deques_.size();
+
+  for (size_t i = 0; i < targets.size(); ++i) {
+    WorkerDeque* worker_deque = deques_[i * worker_count / targets.size()];
+
+    pthread_mutex_lock(&worker_deque->mutex);
+    worker_deque->targets.push_back(targets[i]);
+    pthread_mutex_unlock(&worker_deque->mutex);
+  }
+}
+
+bool WorkQueue::Take(size_t worker_index, string* target) {
+  WorkerDeque* worker_deque = deques_[worker_index];
+
+  do {
+    pthread_mutex_lock(&worker_deque->mutex);
+    if (!worker_deque->targets.empty()) {
+      *target = worker_deque->targets.front();
+      worker_deque->targets.pop_front();
+      pthread_mutex_unlock(&worker_deque->mutex);
+      return true;
+    }
+    pthread_mutex_unlock(&worker_deque->mutex);
+  } while (Steal(worker_index));
+
+  return false;
+}
+
+uint64_t WorkQueue::StealCount() const {
+  return steal_count_;
+}
+
+bool WorkQueue::Steal(size_t worker_index) {
+  // Find the fullest deque. The sizes may change before the steal: Any
+  // non-empty victim will do.
+  size_t victim_index = worker_index;
+  size_t victim_size = 0;
+  for (size_t i = 0; i < deques_.size(); ++i) {
+    if (i == worker_index) {
+      continue;
+    }
+
+    pthread_mutex_lock(&deques_[i]->mutex);
+    const size_t size = deques_[i]->targets.size();
+    pthread_mutex_unlock(&deques_[i]->mutex);
+
+    if (size > victim_size) {
+      victim_index = i;
+      victim_size = size;
+    }
+  }
+
+  if (victim_size == 0) {
+    return false;
+  }
+
+  // Take the back half (rounded up) of the victim's deque, without holding
+  // two locks at once.
+  vector<string> stolen;
+  WorkerDeque* victim = deques_[victim_index];
+  pthread_mutex_lock(&victim->mutex);
+  const size_t steal_size = (victim->targets.size() + 1) / 2;
+  stolen.assign(victim->targets.end() - steal_size, victim->targets.end());
+  victim->targets.erase(victim->targets.end() - steal_size,
+      victim->targets.end());
+  pthread_mutex_unlock(&victim->mutex);
+
+  WorkerDeque* worker_deque = deques_[worker_index];
+  pthread_mutex_lock(&worker_deque->mutex);
+  worker_deque->targets.insert(worker_deque->targets.end(), stolen.begin(),
+      stolen.end());
+  pthread_mutex_unlock(&worker_deque->mutex);
+
+  if (!stolen.empty()) {
+    __sync_add_and_fetch(&steal_count_, 1);
+  }
+
+  // Even if another thief emptied the victim first, try again: There may be
+  // other victims.
+  return true;
+}
+}  // namespace x509ls
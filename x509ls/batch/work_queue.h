@@ -0,0 +1,65 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BATCH_WORK_QUEUE_H_
+#define X509LS_BATCH_WORK_QUEUE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::deque;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// Work-stealing queue of batch targets, shared by a fixed number of worker
+// threads.
+//
+// Each worker has its own deque, and takes targets from the front of it. A
+// worker whose deque is empty steals half of the targets from the back of the
+// fullest deque, so the workers finish at about the same time even when some
+// targets are much slower than others.
+//
+// Each deque has its own lock: Workers only contend when stealing.
+class WorkQueue {
+ public:
+  // Construct with |worker_count| deques.
+  explicit WorkQueue(size_t worker_count);
+  ~WorkQueue();
+
+  // Divide |targets| between the workers, in contiguous blocks. Call before
+  // the workers start.
+  void AddAll(const vector<string>& targets);
+
+  // Take the next target for worker |worker_index|.
+  //
+  // Returns false once every deque is empty: No more targets will be added.
+  bool Take(size_t worker_index, string* target);
+
+  // Return the number of successful steals. Call once the workers are done.
+  uint64_t StealCount() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(WorkQueue)
+
+  struct WorkerDeque {
+    pthread_mutex_t mutex;
+    deque<string> targets;
+  };
+
+  vector<WorkerDeque*> deques_;
+  uint64_t steal_count_;
+
+  // Move about half of the fullest other deque to |worker_index|'s deque.
+  // Returns false if there was nothing to steal.
+  bool Steal(size_t worker_index);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BATCH_WORK_QUEUE_H_
@@ -0,0 +1,142 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/bench/allocation_counter.h"
+
+#include <openssl/crypto.h>
+#include <stdlib.h>
+
+#include <new>
+
+// The replaceable operator new's exception specification differs between
+// C++98 and C++11.
+#if __cplusplus >= 201103L
+#define X509LS_THROW_BAD_ALLOC
+#define X509LS_NO_THROW noexcept
+#else
+#define X509LS_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define X509LS_NO_THROW throw()
+#endif
+
+namespace x509ls {
+namespace {
+uint64_t allocation_count = 0;
+uint64_t allocation_bytes = 0;
+uint64_t new_count = 0;
+
+void* CountedNew(size_t size) {
+  AllocationCounter::Add(size, true);
+
+  void* memory = malloc(size == 0 ? 1 : size);
+  if (memory == NULL) {
+    throw std::bad_alloc();
+  }
+
+  return memory;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+void* CountedMalloc(size_t size, const char* file, int line) {
+  AllocationCounter::Add(size, false);
+  return malloc(size);
+}
+
+void* CountedRealloc(void* memory, size_t size, const char* file, int line) {
+  AllocationCounter::Add(size, false);
+  return realloc(memory, size);
+}
+
+void CountedFree(void* memory, const char* file, int line) {
+  free(memory);
+}
+#else
+void* CountedMalloc(size_t size) {
+  AllocationCounter::Add(size, false);
+  return malloc(size);
+}
+
+void* CountedRealloc(void* memory, size_t size) {
+  AllocationCounter::Add(size, false);
+  return realloc(memory, size);
+}
+
+void CountedFree(void* memory) {
+  free(memory);
+}
+#endif
+}  // namespace
+
+// static
+bool AllocationCounter::Install() {
+  return CRYPTO_set_mem_functions(CountedMalloc, CountedRealloc,
+      CountedFree) != 0;
+}
+
+// static
+uint64_t AllocationCounter::Count() {
+  return __sync_fetch_and_add(&allocation_count, 0);
+}
+
+// static
+uint64_t AllocationCounter::Bytes() {
+  return __sync_fetch_and_add(&allocation_bytes, 0);
+}
+
+// static
+uint64_t AllocationCounter::NewCount() {
+  return __sync_fetch_and_add(&new_count, 0);
+}
+
+// static
+void AllocationCounter::Add(size_t size, bool is_new) {
+  __sync_fetch_and_add(&allocation_count, 1);
+  __sync_fetch_and_add(&allocation_bytes, size);
+  if (is_new) {
+    __sync_fetch_and_add(&new_count, 1);
+  }
+}
+}  // namespace x509ls
+
+void* operator new(size_t size) X509LS_THROW_BAD_ALLOC {
+  return x509ls::CountedNew(size);
+}
+
+void* operator new[](size_t size) X509LS_THROW_BAD_ALLOC {
+  return x509ls::CountedNew(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) X509LS_NO_THROW {
+  x509ls::AllocationCounter::Add(size, true);
+  return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) X509LS_NO_THROW {
+  x509ls::AllocationCounter::Add(size, true);
+  return malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* memory) X509LS_NO_THROW {
+  free(memory);
+}
+
+void operator delete[](void* memory) X509LS_NO_THROW {
+  free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) X509LS_NO_THROW {
+  free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) X509LS_NO_THROW {
+  free(memory);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void* memory, size_t size) X509LS_NO_THROW {
+  free(memory);
+}
+
+void operator delete[](void* memory, size_t size) X509LS_NO_THROW {
+  free(memory);
+}
+#endif
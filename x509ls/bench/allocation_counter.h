@@ -0,0 +1,42 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BENCH_ALLOCATION_COUNTER_H_
+#define X509LS_BENCH_ALLOCATION_COUNTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "x509ls/base/types.h"
+
+namespace x509ls {
+// Counts heap allocations in the benchmark binary: Every C++ operator new, and
+// (once Install()ed) every OpenSSL allocation. Counts are process wide and
+// lock-free, so include allocations by any thread.
+//
+// Benchmark reports the allocations made while timing, per iteration.
+class AllocationCounter {
+ public:
+  // Route OpenSSL's allocations through the counter. Call first thing in
+  // main(), before OpenSSL allocates anything. Returns false if OpenSSL
+  // refused, in which case only operator new is counted.
+  static bool Install();
+
+  // Return the number of allocations, and their total bytes, so far.
+  static uint64_t Count();
+  static uint64_t Bytes();
+
+  // Return the number of those allocations made by operator new, i.e. by
+  // x509ls code and the standard library rather than OpenSSL.
+  static uint64_t NewCount();
+
+  // Count an allocation of |size| bytes, by operator new iif |is_new|.
+  static void Add(size_t size, bool is_new);
+
+ private:
+  NO_COPY_AND_ASSIGN(AllocationCounter)
+  AllocationCounter();
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BENCH_ALLOCATION_COUNTER_H_
@@ -0,0 +1,107 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/openssl/openssl_environment.h"
+#include "x509ls/bench/allocation_counter.h"
+#include "x509ls/bench/benchmark.h"
+
+using std::string;
+using std::vector;
+using x509ls::AllocationCounter;
+using x509ls::Benchmark;
+using x509ls::ScopedOpenSSLEnvironment;
+
+namespace {
+// Default minimum time per benchmark.
+const int kDefaultMinTimeMs = 200;
+
+void PrintUsage() {
+  fprintf(stderr,
+      "Usage: x509ls_bench [--filter=text] [--min-time=ms] [--text] [--list]\n"
+      "\n"
+      "Runs the benchmarks whose names contain |text| (default all), each\n"
+      "for at least |ms| milliseconds (default %d). Results are written to\n"
+      "stdout as JSON lines, or as a table with --text.\n",
+      kDefaultMinTimeMs);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  // Before anything allocates through OpenSSL.
+  AllocationCounter::Install();
+
+  static const struct option options[] = {
+    {"filter", required_argument, NULL, 'f'},
+    {"min-time", required_argument, NULL, 'm'},
+    {"text", no_argument, NULL, 't'},
+    {"list", no_argument, NULL, 'l'},
+    {"help", no_argument, NULL, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  string filter;
+  int min_time_ms = kDefaultMinTimeMs;
+  bool text = false;
+  bool list = false;
+  int getopt_flag;
+  while ((getopt_flag = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (getopt_flag) {
+    case 'f':
+      filter = optarg;
+      break;
+    case 'm':
+      min_time_ms = atoi(optarg);
+      if (min_time_ms <= 0) {
+        fprintf(stderr, "Invalid --min-time, expecting milliseconds > 0.\n");
+        return EXIT_FAILURE;
+      }
+      break;
+    case 't':
+      text = true;
+      break;
+    case 'l':
+      list = true;
+      break;
+    case 'h':
+      PrintUsage();
+      return EXIT_SUCCESS;
+    default:
+      PrintUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Loopback servers and clients write to sockets closed by their peers.
+  signal(SIGPIPE, SIG_IGN);
+
+  ScopedOpenSSLEnvironment openssl;
+
+  bool success = true;
+  const vector<Benchmark*> benchmarks = Benchmark::All();
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    if (benchmarks[i]->Name().find(filter) == string::npos) {
+      continue;
+    } else if (list) {
+      printf("%s\n", benchmarks[i]->Name().c_str());
+      continue;
+    }
+
+    const Benchmark::Result result = benchmarks[i]->Run(min_time_ms);
+    printf("%s\n", text ? result.AsText().c_str() : result.AsJSON().c_str());
+    fflush(stdout);
+
+    if (!result.error_message.empty()) {
+      success = false;
+    }
+  }
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,253 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/bench/benchmark.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "x509ls/base/clock.h"
+#include "x509ls/bench/allocation_counter.h"
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// Never run more than this many iterations, however fast.
+const size_t kMaxIterations = 1000 * 1000 * 1000;
+
+bool CompareNames(const Benchmark* a, const Benchmark* b) {
+  return a->Name() < b->Name();
+}
+
+// Return |text| quoted as a JSON string.
+string JSONString(const string& text) {
+  string quoted = "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    const unsigned char c = text[i];
+    if (c == '"' || c == '\\') {
+      quoted.push_back('\\');
+      quoted.push_back(c);
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof escaped, "\\u%04x", c);
+      quoted.append(escaped);
+    } else {
+      quoted.push_back(c);
+    }
+  }
+  quoted.push_back('"');
+
+  return quoted;
+}
+}  // namespace
+
+// static
+vector<Benchmark*>* Benchmark::registry_ = NULL;
+
+Benchmark::Benchmark(const string& name, Function function, int arg0,
+    int arg1)
+  :
+    name_(name),
+    function_(function),
+    start_us_(0),
+    elapsed_us_(0),
+    timing_(false),
+    start_allocations_(0),
+    start_allocation_bytes_(0),
+    start_new_allocations_(0),
+    allocations_(0),
+    allocation_bytes_(0),
+    new_allocations_(0),
+    items_per_iteration_(1),
+    sink_(0) {
+  args_[0] = arg0;
+  args_[1] = arg1;
+
+  // Constructed on first use: Static initialization order is undefined.
+  if (registry_ == NULL) {
+    registry_ = new vector<Benchmark*>;
+  }
+  registry_->push_back(this);
+}
+
+// static
+vector<Benchmark*> Benchmark::All() {
+  vector<Benchmark*> all;
+  if (registry_) {
+    all = *registry_;
+  }
+  std::stable_sort(all.begin(), all.end(), CompareNames);
+
+  return all;
+}
+
+const string& Benchmark::Name() const {
+  return name_;
+}
+
+int Benchmark::Arg(int index) const {
+  return args_[index];
+}
+
+void Benchmark::StartTiming() {
+  elapsed_us_ = 0;
+  allocations_ = 0;
+  allocation_bytes_ = 0;
+  new_allocations_ = 0;
+  start_allocations_ = AllocationCounter::Count();
+  start_allocation_bytes_ = AllocationCounter::Bytes();
+  start_new_allocations_ = AllocationCounter::NewCount();
+  start_us_ = Clock::NowMicroseconds();
+  timing_ = true;
+}
+
+void Benchmark::StopTiming() {
+  if (timing_) {
+    elapsed_us_ += Clock::NowMicroseconds() - start_us_;
+    allocations_ += AllocationCounter::Count() - start_allocations_;
+    allocation_bytes_ += AllocationCounter::Bytes() - start_allocation_bytes_;
+    new_allocations_ += AllocationCounter::NewCount() - start_new_allocations_;
+    timing_ = false;
+  }
+}
+
+void Benchmark::SetItemsPerIteration(double items) {
+  items_per_iteration_ = items;
+}
+
+void Benchmark::SetCounter(const string& name, double value) {
+  counters_[name] = value;
+}
+
+void Benchmark::SetError(const string& error_message) {
+  error_message_ = error_message;
+}
+
+Benchmark::Result::Result()
+  :
+    iterations(0),
+    ns_per_iteration(0),
+    items_per_second(0) {
+}
+
+string Benchmark::Result::AsJSON() const {
+  stringstream json;
+  json << "{\"name\": " << JSONString(name);
+  if (!error_message.empty()) {
+    json << ", \"error\": " << JSONString(error_message) << "}";
+    return json.str();
+  }
+
+  json << ", \"iterations\": " << iterations;
+  json.precision(1);
+  json << std::fixed;
+  json << ", \"ns_per_iteration\": " << ns_per_iteration;
+  json << ", \"items_per_second\": " << items_per_second;
+  for (map<string, double>::const_iterator it = counters.begin();
+      it != counters.end();
+      ++it) {
+    json << ", " << JSONString(it->first) << ": " << it->second;
+  }
+  json << "}";
+
+  return json.str();
+}
+
+string Benchmark::Result::AsText() const {
+  char line[256];
+  if (!error_message.empty()) {
+    snprintf(line, sizeof line, "%-48s error: %s", name.c_str(),
+        error_message.c_str());
+    return line;
+  }
+
+  snprintf(line, sizeof line, "%-48s %12lu %14.1f ns %14.1f items/s",
+      name.c_str(),
+      static_cast<unsigned long>(iterations),  // NOLINT(runtime/int)
+      ns_per_iteration, items_per_second);
+
+  string text = line;
+  for (map<string, double>::const_iterator it = counters.begin();
+      it != counters.end();
+      ++it) {
+    snprintf(line, sizeof line, " %s=%.1f", it->first.c_str(), it->second);
+    text.append(line);
+  }
+
+  return text;
+}
+
+Benchmark::Result Benchmark::Run(int min_time_ms) {
+  const int64_t min_time_us = min_time_ms * 1000;
+
+  Result result;
+  result.name = name_;
+
+  size_t iterations = 1;
+  int64_t elapsed_us;
+  for (;;) {
+    elapsed_us = RunIterations(iterations);
+    if (!error_message_.empty()) {
+      result.error_message = error_message_;
+      return result;
+    }
+
+    if (elapsed_us >= min_time_us || iterations >= kMaxIterations) {
+      break;
+    }
+
+    // Aim for 40% more than the minimum time, growing at most 10x a run.
+    size_t next = iterations * 10;
+    if (elapsed_us > 0) {
+      next = std::min(next, static_cast<size_t>(
+            iterations * 1.4 * min_time_us / elapsed_us));
+    }
+    iterations = std::min(std::max(next, iterations + 1), kMaxIterations);
+  }
+
+  result.iterations = iterations;
+  result.counters = counters_;
+  result.counters["allocs_per_iteration"] =
+    static_cast<double>(allocations_) / iterations;
+  result.counters["alloc_bytes_per_iteration"] =
+    static_cast<double>(allocation_bytes_) / iterations;
+  result.counters["new_allocs_per_iteration"] =
+    static_cast<double>(new_allocations_) / iterations;
+  result.ns_per_iteration = elapsed_us * 1000.0 / iterations;
+  if (elapsed_us > 0) {
+    result.items_per_second =
+      iterations * items_per_iteration_ * 1000000.0 / elapsed_us;
+  }
+
+  return result;
+}
+
+int64_t Benchmark::RunIterations(size_t iterations) {
+  items_per_iteration_ = 1;
+  counters_.clear();
+  StartTiming();
+
+  function_(this, iterations);
+
+  StopTiming();
+
+  return elapsed_us_;
+}
+
+BenchmarkApplication::BenchmarkApplication()
+  :
+    CliApplication() {
+  SetHeadless(true);
+}
+
+// virtual
+BenchmarkApplication::~BenchmarkApplication() {
+}
+
+// virtual
+void BenchmarkApplication::RunEvent() {
+}
+}  // namespace x509ls
@@ -0,0 +1,156 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BENCH_BENCHMARK_H_
+#define X509LS_BENCH_BENCHMARK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+#include "x509ls/cli/base/cli_application.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// A microbenchmark.
+//
+// A benchmark is a function run for a number of iterations, repeatedly, with
+// the iteration count increased until a run takes at least the minimum time.
+// The time per iteration of the final run is reported.
+//
+// Benchmarks register themselves when constructed, so are defined as statics:
+//
+//   void BenchFoo(Benchmark* benchmark, size_t iterations) {
+//     Foo foo(benchmark->Arg(0));  // Setup, not timed.
+//     benchmark->StartTiming();
+//     for (size_t i = 0; i < iterations; ++i) {
+//       benchmark->Consume(foo.Bar());
+//     }
+//   }
+//   Benchmark bench_foo_16("Foo/16", BenchFoo, 16);
+//
+// Results are written as JSON lines, one object per benchmark, so they can be
+// compared between builds:
+//   {"name": "Foo/16", "iterations": 2000000, "ns_per_iteration": 104.2,
+//    "items_per_second": 9596928.9}
+// with any counters following as further members, in name order. Counters are
+// set by the benchmark, plus the heap allocations made while timing (see
+// AllocationCounter): "allocs_per_iteration", "alloc_bytes_per_iteration" and
+// "new_allocs_per_iteration" (those by operator new).
+class Benchmark {
+ public:
+  typedef void (*Function)(Benchmark* benchmark, size_t iterations);
+
+  // Register the benchmark |name|, running |function| with up to two
+  // arguments.
+  Benchmark(const string& name, Function function, int arg0 = 0,
+      int arg1 = 0);
+
+  // Return all the registered benchmarks, in name order.
+  static vector<Benchmark*> All();
+
+  const string& Name() const;
+
+  // Return argument |index| (0 or 1).
+  int Arg(int index) const;
+
+  // The following are called by benchmark functions:
+
+  // Start (or restart) timing: Excludes setup done so far in the run.
+  void StartTiming();
+
+  // Stop timing: Excludes teardown done after this point.
+  void StopTiming();
+
+  // Report a throughput of |items| items processed per iteration, e.g.
+  // certificates per chain. Default 1.
+  void SetItemsPerIteration(double items);
+
+  // Report |value| as the counter |name| of the run, e.g. a latency
+  // percentile. Counters are reported from the final run only.
+  void SetCounter(const string& name, double value);
+
+  // Keep |value| alive, so the work producing it isn't optimized away.
+  template <typename T>
+  void Consume(const T& value) {
+    sink_ += *reinterpret_cast<const volatile unsigned char*>(&value);
+  }
+
+  // Mark the benchmark as failed with |error_message|, e.g. when setup
+  // fails. The benchmark function should return.
+  void SetError(const string& error_message);
+
+  // A completed run.
+  struct Result {
+    Result();
+
+    string name;
+    size_t iterations;
+    double ns_per_iteration;
+    double items_per_second;
+    map<string, double> counters;
+    string error_message;
+
+    // Return the result as a single line JSON object, without a newline.
+    string AsJSON() const;
+
+    // Return the result as a human readable, fixed width line.
+    string AsText() const;
+  };
+
+  // Run the benchmark until a run takes at least |min_time_ms|.
+  Result Run(int min_time_ms);
+
+ private:
+  NO_COPY_AND_ASSIGN(Benchmark)
+
+  const string name_;
+  const Function function_;
+  int args_[2];
+
+  // Timing of the current run.
+  int64_t start_us_;
+  int64_t elapsed_us_;
+  bool timing_;
+  uint64_t start_allocations_;
+  uint64_t start_allocation_bytes_;
+  uint64_t start_new_allocations_;
+  uint64_t allocations_;
+  uint64_t allocation_bytes_;
+  uint64_t new_allocations_;
+  double items_per_iteration_;
+  map<string, double> counters_;
+  string error_message_;
+
+  volatile uintptr_t sink_;
+
+  // Run the function for |iterations|, returning the microseconds timed.
+  int64_t RunIterations(size_t iterations);
+
+  static vector<Benchmark*>* registry_;
+};
+
+// A headless application, for benchmarking objects that need one (every
+// BaseObject). The event loop isn't run: Benchmarks drive the EventManager
+// directly.
+class BenchmarkApplication : public CliApplication {
+ public:
+  BenchmarkApplication();
+  virtual ~BenchmarkApplication();
+
+ protected:
+  virtual void RunEvent();
+
+ private:
+  NO_COPY_AND_ASSIGN(BenchmarkApplication)
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BENCH_BENCHMARK_H_
@@ -0,0 +1,378 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+// Benchmarks of certificate handling: Certificate construction, certificate
+// list scans, chain verification and path finding, trust store and CRL index
+// lookups.
+
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "x509ls/bench/benchmark.h"
+#include "x509ls/bench/synthetic_chain.h"
+#include "x509ls/certificate/certificate.h"
+#include "x509ls/certificate/certificate_list.h"
+#include "x509ls/certificate/crl_index.h"
+#include "x509ls/certificate/trust_store.h"
+#include "x509ls/certificate/verified_chain.h"
+
+using std::string;
+
+namespace x509ls {
+namespace {
+// Construct a Certificate: Shares the X509, and formats its subject, common
+// names and text description.
+void BenchCertificateConstruct(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(
+      static_cast<SyntheticChain::KeyType>(benchmark->Arg(0)), 2, 0,
+      &error_message);
+  if (chain == NULL) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  const X509* x509 = sk_X509_value(chain->ServedChain(), 0);
+
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    Certificate certificate(*x509);
+    benchmark->Consume(certificate);
+  }
+}
+Benchmark bench_certificate_construct_rsa("Certificate/Construct/rsa",
+    BenchCertificateConstruct, SyntheticChain::kKeyTypeRSA);
+Benchmark bench_certificate_construct_ecdsa("Certificate/Construct/ecdsa",
+    BenchCertificateConstruct, SyntheticChain::kKeyTypeECDSA);
+
+// Count the self-signed certificates in a list of Arg(0) certificates, as a
+// filter over a large list would. Throughput is in certificates.
+void BenchCertificateListScan(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeECDSA, 1, benchmark->Arg(0) - 1,
+      &error_message);
+  if (chain == NULL) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  CertificateList list;
+  STACK_OF(X509)* served = chain->ServedChain();
+  list.Reserve(sk_X509_num(served));
+  for (int i = 0; i < sk_X509_num(served); ++i) {
+    list.Add(*sk_X509_value(served, i));
+  }
+
+  const size_t size = list.Size();
+  benchmark->SetItemsPerIteration(size);
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    size_t self_signed = 0;
+    for (size_t j = 0; j < size; ++j) {
+      if (list.Flags(j) & CertificateList::kFlagSelfSigned) {
+        ++self_signed;
+      }
+    }
+    benchmark->Consume(self_signed);
+  }
+  benchmark->StopTiming();
+}
+Benchmark bench_certificate_list_scan_1000("CertificateList/Scan/1000",
+    BenchCertificateListScan, 1000);
+
+// Verify a served chain of depth Arg(0), padded with Arg(1) unrelated
+// certificates, against a trust store containing its root. Throughput is in
+// served certificates. Unless |kMemoized|, the trust store's signature memo is
+// cleared first, as for a chain through issuers not seen before.
+template <SyntheticChain::KeyType kKeyType, bool kMemoized>
+void BenchPopulateChainAndPath(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(kKeyType,
+      benchmark->Arg(0), benchmark->Arg(1), &error_message);
+  if (chain == NULL) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  TrustStore trust_store;
+  X509_STORE_add_cert(trust_store.Store(), chain->Root());
+
+  benchmark->SetItemsPerIteration(sk_X509_num(chain->ServedChain()));
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    if (!kMemoized) {
+      trust_store.Signatures()->Clear();
+    }
+    VerifiedChain verified_chain(&trust_store);
+    verified_chain.PopulateChainAndPath(chain->ServedChain());
+    benchmark->Consume(verified_chain.VerifyLevel());
+  }
+}
+Benchmark bench_populate_rsa_2_0("VerifiedChain/PopulateChainAndPath/rsa/2/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeRSA, false>, 2, 0);
+Benchmark bench_populate_rsa_4_0("VerifiedChain/PopulateChainAndPath/rsa/4/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeRSA, false>, 4, 0);
+Benchmark bench_populate_rsa_8_0("VerifiedChain/PopulateChainAndPath/rsa/8/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeRSA, false>, 8, 0);
+Benchmark bench_populate_rsa_4_100(
+    "VerifiedChain/PopulateChainAndPath/rsa/4/100",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeRSA, false>, 4, 100);
+Benchmark bench_populate_ecdsa_2_0(
+    "VerifiedChain/PopulateChainAndPath/ecdsa/2/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeECDSA, false>, 2, 0);
+Benchmark bench_populate_ecdsa_4_0(
+    "VerifiedChain/PopulateChainAndPath/ecdsa/4/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeECDSA, false>, 4, 0);
+Benchmark bench_populate_ecdsa_8_0(
+    "VerifiedChain/PopulateChainAndPath/ecdsa/8/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeECDSA, false>, 8, 0);
+Benchmark bench_populate_ecdsa_4_100(
+    "VerifiedChain/PopulateChainAndPath/ecdsa/4/100",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeECDSA, false>, 4, 100);
+Benchmark bench_populate_memoized_rsa_4_0(
+    "VerifiedChain/PopulateChainAndPath/memoized/rsa/4/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeRSA, true>, 4, 0);
+Benchmark bench_populate_memoized_ecdsa_4_0(
+    "VerifiedChain/PopulateChainAndPath/memoized/ecdsa/4/0",
+    BenchPopulateChainAndPath<SyntheticChain::kKeyTypeECDSA, true>, 4, 0);
+
+// As the memoized PopulateChainAndPath benchmark, then find every path to the
+// trust store, as the interactive interface does for each fetch.
+void BenchFindPaths(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeECDSA, benchmark->Arg(0), benchmark->Arg(1),
+      &error_message);
+  if (chain == NULL) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  TrustStore trust_store;
+  X509_STORE_add_cert(trust_store.Store(), chain->Root());
+
+  benchmark->SetItemsPerIteration(sk_X509_num(chain->ServedChain()));
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    VerifiedChain verified_chain(&trust_store);
+    verified_chain.PopulateChainAndPath(chain->ServedChain());
+    verified_chain.FindPaths();
+    benchmark->Consume(verified_chain.FoundPathCount());
+  }
+}
+Benchmark bench_find_paths_ecdsa_4_0("VerifiedChain/FindPaths/ecdsa/4/0",
+    BenchFindPaths, 4, 0);
+Benchmark bench_find_paths_ecdsa_4_100("VerifiedChain/FindPaths/ecdsa/4/100",
+    BenchFindPaths, 4, 100);
+
+// Look up a certificate in a trust store of Arg(0) roots. The certificate is
+// one of the roots if |kHit|.
+template <bool kHit>
+void BenchTrustStoreContains(Benchmark* benchmark, size_t iterations) {
+  // A self-signed certificate, padded with the other roots.
+  string error_message;
+  const SyntheticChain* roots = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeECDSA, 1, benchmark->Arg(0) - 1,
+      &error_message);
+  const SyntheticChain* other = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeECDSA, 2, 0, &error_message);
+  if (roots == NULL || other == NULL) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  TrustStore trust_store;
+  STACK_OF(X509)* served = roots->ServedChain();
+  for (int i = 0; i < sk_X509_num(served); ++i) {
+    X509_STORE_add_cert(trust_store.Store(), sk_X509_value(served, i));
+  }
+
+  const X509* x509 = kHit ? sk_X509_value(served, sk_X509_num(served) / 2) :
+    other->Root();
+
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    benchmark->Consume(trust_store.Contains(x509));
+  }
+}
+Benchmark bench_trust_store_hit_1("TrustStore/Contains/hit/1",
+    BenchTrustStoreContains<true>, 1);
+Benchmark bench_trust_store_hit_150("TrustStore/Contains/hit/150",
+    BenchTrustStoreContains<true>, 150);
+Benchmark bench_trust_store_hit_1000("TrustStore/Contains/hit/1000",
+    BenchTrustStoreContains<true>, 1000);
+Benchmark bench_trust_store_miss_1("TrustStore/Contains/miss/1",
+    BenchTrustStoreContains<false>, 1);
+Benchmark bench_trust_store_miss_150("TrustStore/Contains/miss/150",
+    BenchTrustStoreContains<false>, 150);
+Benchmark bench_trust_store_miss_1000("TrustStore/Contains/miss/1000",
+    BenchTrustStoreContains<false>, 1000);
+
+// A temporary directory holding a CRL from a chain's root, revoking serial
+// numbers none of the chain's certificates have. Removed, with any CRL index
+// cache file, when destroyed.
+class TemporaryCRLDirectory {
+ public:
+  TemporaryCRLDirectory() {}
+
+  ~TemporaryCRLDirectory() {
+    if (!directory_.empty()) {
+      unlink(CRLFilename().c_str());
+      unlink(CacheFilename().c_str());
+      rmdir(directory_.c_str());
+    }
+  }
+
+  // Create the directory, with a CRL of |count| serial numbers issued by
+  // |chain|'s root. Returns false on error, setting |error_message|.
+  bool Create(const SyntheticChain& chain, size_t count,
+      string* error_message) {
+    char directory[] = "/tmp/x509ls-bench-crl.XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+      *error_message = "Unable to create a temporary directory.";
+      return false;
+    }
+    directory_ = directory;
+
+    X509_CRL* crl = X509_CRL_new();
+    ASN1_TIME* now = X509_gmtime_adj(NULL, 0);
+    ASN1_TIME* next_update = X509_gmtime_adj(NULL, 86400);
+    X509_CRL_set_version(crl, 1);
+    X509_CRL_set_issuer_name(crl, X509_get_subject_name(chain.Root()));
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    X509_CRL_set1_lastUpdate(crl, now);
+    X509_CRL_set1_nextUpdate(crl, next_update);
+#else
+    X509_CRL_set_lastUpdate(crl, now);
+    X509_CRL_set_nextUpdate(crl, next_update);
+#endif
+
+    // Chain serial numbers are small: Start well clear of them.
+    const long kFirstSerial = 1000000;  // NOLINT(runtime/int)
+    for (size_t i = 0; i < count; ++i) {
+      X509_REVOKED* revoked = X509_REVOKED_new();
+      ASN1_INTEGER* serial = ASN1_INTEGER_new();
+      ASN1_INTEGER_set(serial, kFirstSerial + 7 * i);
+      X509_REVOKED_set_serialNumber(revoked, serial);
+      X509_REVOKED_set_revocationDate(revoked, now);
+      ASN1_INTEGER_free(serial);
+      X509_CRL_add0_revoked(crl, revoked);
+    }
+    X509_CRL_sort(crl);
+
+    bool success = X509_CRL_sign(crl, chain.Key(), EVP_sha256()) > 0;
+    BIO* bio = BIO_new_file(CRLFilename().c_str(), "w");
+    success = success && bio != NULL && PEM_write_bio_X509_CRL(bio, crl);
+    if (bio != NULL) {
+      BIO_free(bio);
+    }
+
+    ASN1_TIME_free(now);
+    ASN1_TIME_free(next_update);
+    X509_CRL_free(crl);
+
+    if (!success) {
+      *error_message = "Unable to write a CRL.";
+    }
+
+    return success;
+  }
+
+  const string& Directory() const {
+    return directory_;
+  }
+
+  string CacheFilename() const {
+    return directory_ + "/" + CRLIndex::kCacheFilename;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(TemporaryCRLDirectory)
+
+  string directory_;
+
+  string CRLFilename() const {
+    return directory_ + "/root.crl";
+  }
+};
+
+// Look up an unrevoked certificate in an index of one CRL of Arg(0) revoked
+// serial numbers.
+void BenchCRLIndexLookup(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeECDSA, 2, 0, &error_message);
+  TemporaryCRLDirectory directory;
+  CRLIndex index;
+  if (chain == NULL ||
+      !directory.Create(*chain, benchmark->Arg(0), &error_message) ||
+      !index.Open(directory.Directory(), &error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  const X509* x509 = sk_X509_value(chain->ServedChain(), 0);
+  X509* issuer = chain->Root();
+  const time_t now = time(NULL);
+  if (index.Lookup(x509, issuer, now) != CRLIndex::kStatusGood) {
+    benchmark->SetError("Certificate not found good.");
+    return;
+  }
+
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    benchmark->Consume(index.Lookup(x509, issuer, now));
+  }
+}
+Benchmark bench_crl_index_lookup_1000("CRLIndex/Lookup/1000",
+    BenchCRLIndexLookup, 1000);
+Benchmark bench_crl_index_lookup_100000("CRLIndex/Lookup/100000",
+    BenchCRLIndexLookup, 100000);
+
+// Open an index of one CRL of Arg(0) revoked serial numbers: From its cache
+// file if |kMapped|, else parsing the CRL and rewriting the cache file.
+template <bool kMapped>
+void BenchCRLIndexOpen(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeECDSA, 2, 0, &error_message);
+  TemporaryCRLDirectory directory;
+  if (chain == NULL ||
+      !directory.Create(*chain, benchmark->Arg(0), &error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  if (kMapped) {
+    // Write the cache file.
+    CRLIndex index;
+    index.Open(directory.Directory(), &error_message);
+  }
+
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    if (!kMapped) {
+      unlink(directory.CacheFilename().c_str());
+    }
+
+    CRLIndex index;
+    if (!index.Open(directory.Directory(), &error_message)) {
+      benchmark->SetError(error_message);
+      return;
+    }
+    benchmark->Consume(index.SerialCount());
+  }
+}
+Benchmark bench_crl_index_open_mapped("CRLIndex/Open/mapped/100000",
+    BenchCRLIndexOpen<true>, 100000);
+Benchmark bench_crl_index_open_built("CRLIndex/Open/built/100000",
+    BenchCRLIndexOpen<false>, 100000);
+}  // namespace
+}  // namespace x509ls
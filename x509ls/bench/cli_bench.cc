@@ -0,0 +1,178 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+// Benchmarks of CLI painting, on an offscreen terminal: TextControl layout and
+// CertificateListControl line painting.
+
+#include <ncurses.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "x509ls/bench/benchmark.h"
+#include "x509ls/bench/synthetic_chain.h"
+#include "x509ls/certificate/certificate.h"
+#include "x509ls/certificate/certificate_list.h"
+#include "x509ls/cli/base/cli_control.h"
+#include "x509ls/cli/base/text_control.h"
+#include "x509ls/cli/certificate_list_control.h"
+
+using std::string;
+
+namespace x509ls {
+namespace {
+const int kRows = 50;
+const int kCols = 120;
+
+// Return true iif the offscreen terminal is (or could now be) set up. Output
+// goes to /dev/null, and the terminal is never ended: It is shared by every
+// benchmark in the process.
+bool StartOffscreenTerminal(string* error_message) {
+  static bool started = false;
+  if (started) {
+    return true;
+  }
+
+  FILE* output = fopen("/dev/null", "w");
+  FILE* input = fopen("/dev/null", "r");
+  if (output == NULL || input == NULL) {
+    *error_message = "Unable to open /dev/null.";
+    return false;
+  }
+
+  const char* terminals[] = { "xterm-256color", "xterm", "vt100" };
+  for (size_t i = 0; i < sizeof terminals / sizeof terminals[0]; ++i) {
+    if (newterm(const_cast<char*>(terminals[i]), output, input) != NULL) {
+      resizeterm(kRows, kCols);
+      start_color();
+      started = true;
+      return true;
+    }
+  }
+
+  *error_message = "No terminfo entry for xterm or vt100.";
+  return false;
+}
+
+// Exposes TextControl's painting.
+class BenchTextControl : public TextControl {
+ public:
+  BenchTextControl(CliControl* parent, const string& text)
+    :
+      TextControl(parent, text) {
+  }
+
+  void Paint() {
+    PaintEvent();
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(BenchTextControl)
+};
+
+// Exposes CertificateListControl's line painting.
+class BenchCertificateListControl : public CertificateListControl {
+ public:
+  BenchCertificateListControl(CliControl* parent, ListType list_type,
+      const CertificateList* model)
+    :
+      CertificateListControl(parent, list_type, model) {
+  }
+
+  void Paint(unsigned int index, unsigned int row, bool selected) {
+    PaintLine(index, row, selected);
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(BenchCertificateListControl)
+};
+
+// Lay out and paint Arg(0) KiB of certificate text descriptions. The control
+// alternates between two windows of different widths, so every paint rewraps
+// the whole text, as on a terminal resize. Throughput is in bytes laid out.
+void BenchTextControlLayout(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeRSA, 4, 0, &error_message);
+  if (chain == NULL || !StartOffscreenTerminal(&error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  const Certificate certificate(*sk_X509_value(chain->ServedChain(), 0));
+  const size_t size = benchmark->Arg(0) * 1024;
+  string text;
+  while (text.size() < size) {
+    text.append(certificate.TextDescription());
+  }
+  text.resize(size);
+
+  BenchmarkApplication application;
+  CliControl root(&application);
+  BenchTextControl* control = new BenchTextControl(&root, text);
+
+  WINDOW* windows[2] = { newwin(kRows, kCols, 0, 0),
+    newwin(kRows, kCols - 1, 0, 0) };
+
+  benchmark->SetItemsPerIteration(size);
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    control->SetWindow(windows[i % 2]);
+    control->Paint();
+  }
+  benchmark->StopTiming();
+
+  control->SetWindow(NULL);
+  delwin(windows[0]);
+  delwin(windows[1]);
+}
+Benchmark bench_text_control_layout_4("TextControl/Layout/4",
+    BenchTextControlLayout, 4);
+Benchmark bench_text_control_layout_32("TextControl/Layout/32",
+    BenchTextControlLayout, 32);
+
+// Paint one certificate list row, in the |kListType| style.
+template <CertificateListControl::ListType kListType>
+void BenchCertificateListPaintLine(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(
+      SyntheticChain::kKeyTypeRSA, 4, 0, &error_message);
+  if (chain == NULL || !StartOffscreenTerminal(&error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  CertificateList model;
+  STACK_OF(X509)* served = chain->ServedChain();
+  for (int i = 0; i < sk_X509_num(served); ++i) {
+    model.Add(*sk_X509_value(served, i), false, true, true);
+  }
+
+  BenchmarkApplication application;
+  CliControl root(&application);
+  BenchCertificateListControl* control =
+    new BenchCertificateListControl(&root, kListType, &model);
+
+  WINDOW* window = newwin(kRows, kCols, 0, 0);
+  control->SetWindow(window);
+
+  const unsigned int size = model.Size();
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations; ++i) {
+    const unsigned int index = i % size;
+    control->Paint(index, index, index == 0);
+  }
+  benchmark->StopTiming();
+
+  control->SetWindow(NULL);
+  delwin(window);
+}
+Benchmark bench_certificate_list_paint_line_chain(
+    "CertificateListControl/PaintLine/chain",
+    BenchCertificateListPaintLine<CertificateListControl::kTypePeerChain>);
+Benchmark bench_certificate_list_paint_line_path(
+    "CertificateListControl/PaintLine/path",
+    BenchCertificateListPaintLine<
+        CertificateListControl::kTypeValidationPath>);
+}  // namespace
+}  // namespace x509ls
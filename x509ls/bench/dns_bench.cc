@@ -0,0 +1,174 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+// End-to-end benchmarks of the StubResolver against a LoopbackDnsServer,
+// configured as with --nameserver=127.0.0.1:port. Runs fail if any answer is
+// wrong, or if the queries came from too few source ports.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/bench/benchmark.h"
+#include "x509ls/bench/loopback_dns_server.h"
+#include "x509ls/net/dns_cache.h"
+#include "x509ls/net/stub_resolver.h"
+
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace x509ls {
+namespace {
+// Resolves a number of distinct names, so none are cached, |concurrency| at
+// a time, caching answers in |cache|.
+class ResolveLoad : public BaseObject {
+ public:
+  ResolveLoad(CliApplication* application, DnsCache* cache,
+      const string& nameserver, size_t concurrency, size_t lookup_count)
+    :
+      BaseObject(application),
+      resolver_(new StubResolver(this, cache)),
+      remaining_(lookup_count),
+      in_flight_(0),
+      failure_count_(0) {
+    string error_message;
+    resolver_->SetNameservers(vector<string>(1, nameserver), &error_message);
+
+    for (size_t i = 0; i < concurrency; ++i) {
+      lookups_.push_back(Lookup(this));
+    }
+  }
+
+  void Start() {
+    for (size_t i = 0; i < lookups_.size(); ++i) {
+      Next(&lookups_[i]);
+    }
+    if (in_flight_ == 0) {
+      GetApplication()->Exit(true);
+    }
+  }
+
+  size_t FailureCount() const {
+    return failure_count_;
+  }
+
+  const StubResolver::Statistics& GetStatistics() const {
+    return resolver_->GetStatistics();
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(ResolveLoad)
+
+  class Lookup : public StubResolver::Listener {
+   public:
+    explicit Lookup(ResolveLoad* load)
+      :
+        load_(load) {
+    }
+
+    virtual void OnDnsAnswer(const DnsAnswer& answer) {
+      --load_->in_flight_;
+      load_->Check(answer);
+      load_->Next(this);
+      if (load_->in_flight_ == 0) {
+        load_->GetApplication()->Exit(true);
+      }
+    }
+
+   private:
+    ResolveLoad* load_;
+  };
+
+  StubResolver* const resolver_;
+  vector<Lookup> lookups_;
+  size_t remaining_;
+  size_t in_flight_;
+  size_t failure_count_;
+
+  // Start the next lookup on |lookup|, if any remain.
+  void Next(Lookup* lookup) {
+    while (remaining_ > 0) {
+      stringstream name;
+      name << "host" << remaining_-- << ".bench.test";
+
+      DnsAnswer answer;
+      if (!resolver_->Resolve(lookup, name.str(), StubResolver::kTypeA,
+            &answer)) {
+        ++in_flight_;
+        return;
+      }
+      Check(answer);
+    }
+  }
+
+  void Check(const DnsAnswer& answer) {
+    static const char kLoopback[] = {127, 0, 0, 1};
+    if (answer.result != DnsAnswer::kResultAddresses ||
+        answer.addresses.size() != 1 ||
+        answer.addresses[0] != string(kLoopback, sizeof kLoopback)) {
+      ++failure_count_;
+    }
+  }
+};
+
+// Resolve distinct names from a LoopbackDnsServer, Arg(0) at a time, with
+// every UDP answer truncated if Arg(1), so each is retried over TCP. Each
+// iteration is one uncached lookup.
+void BenchStubResolverResolve(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  LoopbackDnsServer server;
+  if (!server.Listen(&error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  }
+  server.SetTruncate(benchmark->Arg(1) != 0);
+  if (!server.StartThread()) {
+    benchmark->SetError("Unable to start server thread.");
+    return;
+  }
+
+  DnsCache cache;
+  BenchmarkApplication application;
+  ResolveLoad load(&application, &cache, server.Nameserver(),
+      benchmark->Arg(0), iterations);
+
+  benchmark->StartTiming();
+  load.Start();
+  application.Run();
+  benchmark->StopTiming();
+
+  server.Stop();
+
+  // Every query opens a new UDP socket until the pool is full.
+  const size_t pool_size = StubResolver::kUdpSocketsPerFamily;
+  const size_t expected_ports = std::min(iterations, pool_size);
+  if (load.FailureCount() > 0) {
+    stringstream error;
+    error << load.FailureCount() << " of " << iterations << " lookups failed";
+    benchmark->SetError(error.str());
+    return;
+  } else if (server.SourcePortCount() < expected_ports) {
+    stringstream error;
+    error << "queries came from " << server.SourcePortCount()
+      << " source ports, expected at least " << expected_ports;
+    benchmark->SetError(error.str());
+    return;
+  }
+
+  benchmark->SetCounter("source_ports", server.SourcePortCount());
+  benchmark->SetCounter("tcp_per_iteration",
+      static_cast<double>(load.GetStatistics().tcp_count) / iterations);
+}
+Benchmark bench_resolve_udp_1("StubResolver/Resolve/udp/1",
+    BenchStubResolverResolve, 1, 0);
+Benchmark bench_resolve_udp_64("StubResolver/Resolve/udp/64",
+    BenchStubResolverResolve, 64, 0);
+Benchmark bench_resolve_tcp_8("StubResolver/Resolve/tcp/8",
+    BenchStubResolverResolve, 8, 1);
+}  // namespace
+}  // namespace x509ls
@@ -0,0 +1,162 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+// Benchmarks of the EventManager: Event delivery to many subscribers, and FD
+// event delivery with many watched FDs.
+
+#include <unistd.h>
+
+#include <vector>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/event_manager.h"
+#include "x509ls/bench/benchmark.h"
+
+using std::vector;
+
+namespace x509ls {
+namespace {
+const int kEventCode = 1;
+
+// Emits events on request.
+class Source : public BaseObject {
+ public:
+  explicit Source(BaseObject* parent) : BaseObject(parent) {
+  }
+
+  void EmitEvent() {
+    Emit(kEventCode);
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Source)
+};
+
+// Counts the events from a Source.
+class Subscriber : public BaseObject {
+ public:
+  Subscriber(BaseObject* parent, Source* source)
+    :
+      BaseObject(parent),
+      events_(0) {
+    Subscribe(source, kEventCode);
+  }
+
+  virtual void OnEvent(const BaseObject* source, int event_code) {
+    ++events_;
+  }
+
+  size_t Events() const {
+    return events_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Subscriber)
+
+  size_t events_;
+};
+
+// Watches the read end of a pipe, draining it on each readable event.
+class PipeReader : public BaseObject {
+ public:
+  PipeReader(BaseObject* parent, int fd)
+    :
+      BaseObject(parent),
+      fd_(fd),
+      events_(0) {
+    WatchFD(fd_, EventManager::kFDReadable);
+  }
+
+  virtual void OnFDEvent(int fd, bool read_event, bool write_event,
+      bool error_event) {
+    char byte;
+    if (read(fd_, &byte, 1) == 1) {
+      ++events_;
+    }
+  }
+
+  size_t Events() const {
+    return events_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(PipeReader)
+
+  const int fd_;
+  size_t events_;
+};
+
+// Each iteration emits one event to Arg(0) subscribers, and makes one of
+// Arg(1) watched pipes readable, delivering both. Throughput is in events
+// delivered.
+void BenchEventManagerDispatch(Benchmark* benchmark, size_t iterations) {
+  const int subscriber_count = benchmark->Arg(0);
+  const int fd_count = benchmark->Arg(1);
+
+  BenchmarkApplication application;
+  EventManager* event_manager = application.GetEventManager();
+  BaseObject root(&application);
+
+  Source* source = new Source(&root);
+  vector<Subscriber*> subscribers;
+  for (int i = 0; i < subscriber_count; ++i) {
+    subscribers.push_back(new Subscriber(&root, source));
+  }
+
+  vector<int> write_fds;
+  vector<int> read_fds;
+  for (int i = 0; i < fd_count; ++i) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      benchmark->SetError("Unable to create pipe.");
+      break;
+    }
+    read_fds.push_back(fds[0]);
+    write_fds.push_back(fds[1]);
+    new PipeReader(&root, fds[0]);
+  }
+
+  if (write_fds.size() == static_cast<size_t>(fd_count)) {
+    benchmark->SetItemsPerIteration(subscriber_count + (fd_count > 0));
+    benchmark->StartTiming();
+    for (size_t i = 0; i < iterations; ++i) {
+      source->EmitEvent();
+      event_manager->DeliverEvents();
+
+      if (fd_count > 0) {
+        const char byte = 0;
+        if (write(write_fds[i % fd_count], &byte, 1) != 1) {
+          benchmark->SetError("Unable to write to pipe.");
+          break;
+        }
+        event_manager->DeliverNetworkEvents(0);
+      }
+    }
+    benchmark->StopTiming();
+
+    if (subscriber_count > 0) {
+      benchmark->Consume(subscribers[0]->Events());
+    }
+  }
+
+  for (size_t i = 0; i < read_fds.size(); ++i) {
+    close(read_fds[i]);
+    close(write_fds[i]);
+  }
+}
+Benchmark bench_event_manager_1_0("EventManager/Dispatch/1/0",
+    BenchEventManagerDispatch, 1, 0);
+Benchmark bench_event_manager_16_0("EventManager/Dispatch/16/0",
+    BenchEventManagerDispatch, 16, 0);
+Benchmark bench_event_manager_256_0("EventManager/Dispatch/256/0",
+    BenchEventManagerDispatch, 256, 0);
+Benchmark bench_event_manager_1_1("EventManager/Dispatch/1/1",
+    BenchEventManagerDispatch, 1, 1);
+Benchmark bench_event_manager_1_16("EventManager/Dispatch/1/16",
+    BenchEventManagerDispatch, 1, 16);
+Benchmark bench_event_manager_1_256("EventManager/Dispatch/1/256",
+    BenchEventManagerDispatch, 1, 256);
+Benchmark bench_event_manager_256_256("EventManager/Dispatch/256/256",
+    BenchEventManagerDispatch, 256, 256);
+}  // namespace
+}  // namespace x509ls
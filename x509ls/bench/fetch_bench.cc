@@ -0,0 +1,200 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+// End-to-end benchmarks of the fetch pipeline: ChainFetchers against a
+// LoopbackTlsServer, at increasing concurrency.
+
+#include <openssl/x509_vfy.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/clock.h"
+#include "x509ls/bench/benchmark.h"
+#include "x509ls/bench/loopback_tls_server.h"
+#include "x509ls/bench/synthetic_chain.h"
+#include "x509ls/certificate/trust_store.h"
+#include "x509ls/net/chain_fetcher.h"
+
+using std::map;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace x509ls {
+namespace {
+// Runs a number of fetches from 127.0.0.1:|port|, |concurrency| at a time,
+// timing each from Start() to its final event.
+class FetchLoad : public BaseObject {
+ public:
+  FetchLoad(CliApplication* application, TrustStore* trust_store, int port,
+      size_t concurrency, size_t fetch_count)
+    :
+      BaseObject(application),
+      trust_store_(trust_store),
+      concurrency_(concurrency),
+      remaining_(fetch_count),
+      failure_count_(0) {
+    stringstream service;
+    service << port;
+    service_ = service.str();
+  }
+
+  void Start() {
+    StartFetches();
+  }
+
+  virtual void OnEvent(const BaseObject* source, int event_code) {
+    ChainFetcher* fetcher =
+      const_cast<ChainFetcher*>(static_cast<const ChainFetcher*>(source));
+    map<ChainFetcher*, int64_t>::iterator it = fetchers_.find(fetcher);
+    if (it == fetchers_.end()) {
+      return;
+    }
+
+    if (event_code == ChainFetcher::kStateConnectSuccess) {
+      latencies_us_.push_back(Clock::NowMicroseconds() - it->second);
+    } else {
+      ++failure_count_;
+    }
+
+    fetchers_.erase(it);
+    Unsubscribe(fetcher);
+    DeleteChild(fetcher);
+
+    StartFetches();
+  }
+
+  // Return the latencies of the successful fetches, in microseconds.
+  const vector<int64_t>& LatenciesMicroseconds() const {
+    return latencies_us_;
+  }
+
+  size_t FailureCount() const {
+    return failure_count_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(FetchLoad)
+
+  TrustStore* const trust_store_;
+  string service_;
+  const size_t concurrency_;
+  size_t remaining_;
+
+  // Fetches in progress, and their start times.
+  map<ChainFetcher*, int64_t> fetchers_;
+
+  vector<int64_t> latencies_us_;
+  size_t failure_count_;
+
+  void StartFetches() {
+    while (fetchers_.size() < concurrency_ && remaining_ > 0) {
+      --remaining_;
+
+      ChainFetcher* fetcher = new ChainFetcher(this, trust_store_,
+          "127.0.0.1", service_, DnsLookup::kLookupTypeIPv4, 0, 0);
+      Subscribe(fetcher, ChainFetcher::kStateResolveFail);
+      Subscribe(fetcher, ChainFetcher::kStateConnectSuccess);
+      Subscribe(fetcher, ChainFetcher::kStateConnectFail);
+
+      fetchers_[fetcher] = Clock::NowMicroseconds();
+      fetcher->Start();
+    }
+
+    if (fetchers_.empty()) {
+      GetApplication()->Exit(true);
+    }
+  }
+};
+
+// Return the |percentile| (0-100) of the sorted |values|.
+int64_t Percentile(const vector<int64_t>& values, int percentile) {
+  if (values.empty()) {
+    return 0;
+  }
+
+  size_t index = values.size() * percentile / 100;
+  return values[std::min(index, values.size() - 1)];
+}
+
+// Fetch the chain of depth |kDepth|, padded with Arg(0) certificates, from a
+// LoopbackTlsServer, Arg(1) fetches at a time. Each iteration is a complete
+// fetch: Connect, handshake and chain verification. Throughput is in
+// handshakes per second, with latency percentiles as counters.
+template <SyntheticChain::KeyType kKeyType, int kDepth>
+void BenchChainFetcherHandshake(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  const SyntheticChain* chain = SyntheticChain::Shared(kKeyType, kDepth,
+      benchmark->Arg(0), &error_message);
+  if (chain == NULL) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  LoopbackTlsServer server(chain);
+  if (!server.Listen(&error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  } else if (!server.StartThread()) {
+    benchmark->SetError("Unable to start server thread.");
+    return;
+  }
+
+  TrustStore trust_store;
+  X509_STORE_add_cert(trust_store.Store(), chain->Root());
+
+  BenchmarkApplication application;
+  FetchLoad load(&application, &trust_store, server.Port(),
+      benchmark->Arg(1), iterations);
+
+  benchmark->StartTiming();
+  load.Start();
+  application.Run();
+  benchmark->StopTiming();
+
+  server.Stop();
+
+  if (load.FailureCount() > 0) {
+    stringstream error;
+    error << load.FailureCount() << " of " << iterations << " fetches failed";
+    benchmark->SetError(error.str());
+    return;
+  }
+
+  vector<int64_t> latencies_us = load.LatenciesMicroseconds();
+  std::sort(latencies_us.begin(), latencies_us.end());
+  benchmark->SetCounter("latency_p50_us", Percentile(latencies_us, 50));
+  benchmark->SetCounter("latency_p90_us", Percentile(latencies_us, 90));
+  benchmark->SetCounter("latency_p99_us", Percentile(latencies_us, 99));
+  benchmark->SetCounter("latency_max_us", Percentile(latencies_us, 100));
+}
+Benchmark bench_fetch_rsa_3_0_1("ChainFetcher/Handshake/rsa/3/0/1",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeRSA, 3>, 0, 1);
+Benchmark bench_fetch_rsa_3_0_8("ChainFetcher/Handshake/rsa/3/0/8",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeRSA, 3>, 0, 8);
+Benchmark bench_fetch_rsa_3_0_64("ChainFetcher/Handshake/rsa/3/0/64",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeRSA, 3>, 0, 64);
+Benchmark bench_fetch_rsa_3_100_1("ChainFetcher/Handshake/rsa/3/100/1",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeRSA, 3>, 100, 1);
+Benchmark bench_fetch_rsa_3_100_8("ChainFetcher/Handshake/rsa/3/100/8",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeRSA, 3>, 100, 8);
+Benchmark bench_fetch_rsa_3_100_64("ChainFetcher/Handshake/rsa/3/100/64",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeRSA, 3>, 100, 64);
+Benchmark bench_fetch_ecdsa_3_0_1("ChainFetcher/Handshake/ecdsa/3/0/1",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeECDSA, 3>, 0, 1);
+Benchmark bench_fetch_ecdsa_3_0_8("ChainFetcher/Handshake/ecdsa/3/0/8",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeECDSA, 3>, 0, 8);
+Benchmark bench_fetch_ecdsa_3_0_64("ChainFetcher/Handshake/ecdsa/3/0/64",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeECDSA, 3>, 0, 64);
+Benchmark bench_fetch_ecdsa_6_0_8("ChainFetcher/Handshake/ecdsa/6/0/8",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeECDSA, 6>, 0, 8);
+Benchmark bench_fetch_ecdsa_3_100_8("ChainFetcher/Handshake/ecdsa/3/100/8",
+    BenchChainFetcherHandshake<SyntheticChain::kKeyTypeECDSA, 3>, 100, 8);
+}  // namespace
+}  // namespace x509ls
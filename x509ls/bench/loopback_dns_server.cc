@@ -0,0 +1,458 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/bench/loopback_dns_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <set>
+#include <sstream>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/event_manager.h"
+
+using std::set;
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+const size_t kHeaderLength = 12;
+const uint16_t kFlagResponse = 0x8000;
+const uint16_t kFlagTruncated = 0x0200;
+const uint16_t kFlagRecursionDesired = 0x0100;
+const uint16_t kFlagRecursionAvailable = 0x0080;
+const uint16_t kTypeA = 1;
+const uint16_t kClassIN = 1;
+const uint32_t kTtl = 300;
+
+// Attempts at finding a port free for both UDP and TCP.
+const int kMaxBindAttempts = 16;
+
+uint16_t ReadUint16(const string& data, size_t offset) {
+  return (static_cast<unsigned char>(data[offset]) << 8) |
+    static_cast<unsigned char>(data[offset + 1]);
+}
+
+void AppendUint16(string* data, uint16_t value) {
+  data->push_back(static_cast<char>(value >> 8));
+  data->push_back(static_cast<char>(value & 0xff));
+}
+
+void AppendUint32(string* data, uint32_t value) {
+  AppendUint16(data, value >> 16);
+  AppendUint16(data, value & 0xffff);
+}
+}  // namespace
+
+// A single TCP connection: Reads one length-prefixed query, writes the
+// answer, then emits kEventFinished (and is deleted by the Server).
+class LoopbackDnsServer::Connection : public BaseObject {
+ public:
+  static const int kEventFinished = 1;
+
+  Connection(BaseObject* parent, int fd)
+    :
+      BaseObject(parent),
+      fd_(fd),
+      output_offset_(0),
+      success_(false) {
+    WatchFD(fd_, EventManager::kFDReadable);
+  }
+
+  virtual ~Connection() {
+    UnwatchFD(fd_);
+    close(fd_);
+  }
+
+  virtual void OnFDEvent(int fd, bool read_event, bool write_event,
+      bool error_event) {
+    if (output_.empty()) {
+      Read();
+    } else {
+      Write();
+    }
+  }
+
+  bool Success() const {
+    return success_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Connection)
+
+  const int fd_;
+  string input_;
+  string output_;
+  size_t output_offset_;
+  bool success_;
+
+  void Read() {
+    char buffer[4096];
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd_, buffer, sizeof buffer)) > 0) {
+      input_.append(buffer, bytes_read);
+    }
+    const bool closed = bytes_read == 0 ||
+      (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+
+    if (input_.size() < 2 || input_.size() < 2u + ReadUint16(input_, 0)) {
+      if (closed) {
+        Finish(false);
+      }
+      return;
+    }
+
+    string answer;
+    if (!Answer(input_.substr(2, ReadUint16(input_, 0)), false, &answer)) {
+      Finish(false);
+      return;
+    }
+    AppendUint16(&output_, answer.size());
+    output_.append(answer);
+
+    WatchFD(fd_, EventManager::kFDWritable);
+    Write();
+  }
+
+  void Write() {
+    while (output_offset_ < output_.size()) {
+      const ssize_t bytes_written = write(fd_,
+          output_.data() + output_offset_, output_.size() - output_offset_);
+      if (bytes_written > 0) {
+        output_offset_ += bytes_written;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return;
+      } else {
+        Finish(false);
+        return;
+      }
+    }
+
+    Finish(true);
+  }
+
+  void Finish(bool success) {
+    UnwatchFD(fd_);
+    success_ = success;
+    Emit(kEventFinished);
+  }
+};
+
+// Answers UDP queries and accepts TCP connections, until woken by the stop
+// pipe.
+class LoopbackDnsServer::Server : public BaseObject {
+ public:
+  Server(CliApplication* application, bool truncate, int udp_fd,
+      int listen_fd, int stop_fd)
+    :
+      BaseObject(application),
+      truncate_(truncate),
+      udp_fd_(udp_fd),
+      listen_fd_(listen_fd),
+      stop_fd_(stop_fd),
+      udp_query_count_(0),
+      tcp_query_count_(0) {
+    WatchFD(udp_fd_, EventManager::kFDReadable);
+    WatchFD(listen_fd_, EventManager::kFDReadable);
+    WatchFD(stop_fd_, EventManager::kFDReadable);
+  }
+
+  virtual ~Server() {
+    UnwatchFD(udp_fd_);
+    UnwatchFD(listen_fd_);
+    UnwatchFD(stop_fd_);
+  }
+
+  virtual void OnFDEvent(int fd, bool read_event, bool write_event,
+      bool error_event) {
+    if (fd == stop_fd_) {
+      GetApplication()->Exit(true);
+    } else if (fd == udp_fd_) {
+      ReceiveUdp();
+    } else {
+      int connection_fd;
+      while ((connection_fd = accept(listen_fd_, NULL, NULL)) != -1) {
+        fcntl(connection_fd, F_SETFL,
+            fcntl(connection_fd, F_GETFL) | O_NONBLOCK);
+
+        Connection* connection = new Connection(this, connection_fd);
+        Subscribe(connection, Connection::kEventFinished);
+      }
+    }
+  }
+
+  virtual void OnEvent(const BaseObject* source, int event_code) {
+    Connection* connection =
+      const_cast<Connection*>(static_cast<const Connection*>(source));
+
+    if (connection->Success()) {
+      ++tcp_query_count_;
+    }
+
+    Unsubscribe(connection);
+    DeleteChild(connection);
+  }
+
+  uint64_t UdpQueryCount() const {
+    return udp_query_count_;
+  }
+
+  uint64_t TcpQueryCount() const {
+    return tcp_query_count_;
+  }
+
+  size_t SourcePortCount() const {
+    return source_ports_.size();
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Server)
+
+  const bool truncate_;
+  const int udp_fd_;
+  const int listen_fd_;
+  const int stop_fd_;
+
+  uint64_t udp_query_count_;
+  uint64_t tcp_query_count_;
+  set<uint16_t> source_ports_;
+
+  void ReceiveUdp() {
+    char message[65536];
+    for (;;) {
+      sockaddr_in source;
+      socklen_t source_length = sizeof source;
+      const ssize_t length = recvfrom(udp_fd_, message, sizeof message, 0,
+          reinterpret_cast<sockaddr*>(&source), &source_length);
+      if (length == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+
+      string answer;
+      if (!Answer(string(message, length), truncate_, &answer)) {
+        continue;
+      }
+
+      ++udp_query_count_;
+      source_ports_.insert(ntohs(source.sin_port));
+      sendto(udp_fd_, answer.data(), answer.size(), 0,
+          reinterpret_cast<sockaddr*>(&source), source_length);
+    }
+  }
+};
+
+LoopbackDnsServer::LoopbackDnsServer()
+  :
+    CliApplication(),
+    truncate_(false),
+    udp_fd_(-1),
+    listen_fd_(-1),
+    port_(0),
+    server_(NULL),
+    thread_started_(false) {
+  stop_fds_[0] = -1;
+  stop_fds_[1] = -1;
+  SetHeadless(true);
+}
+
+// virtual
+LoopbackDnsServer::~LoopbackDnsServer() {
+  Stop();
+
+  delete server_;
+
+  if (udp_fd_ != -1) {
+    close(udp_fd_);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+  }
+  if (stop_fds_[0] != -1) {
+    close(stop_fds_[0]);
+    close(stop_fds_[1]);
+  }
+}
+
+bool LoopbackDnsServer::Listen(string* error_message) {
+  if (pipe(stop_fds_) != 0) {
+    stop_fds_[0] = -1;
+    *error_message = "Unable to create pipe.";
+    return false;
+  }
+
+  for (int attempt = 0; attempt < kMaxBindAttempts; ++attempt) {
+    if (Bind(error_message)) {
+      fcntl(udp_fd_, F_SETFL, fcntl(udp_fd_, F_GETFL) | O_NONBLOCK);
+      fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+      return true;
+    } else if (!error_message->empty()) {
+      return false;
+    }
+  }
+
+  *error_message = "Unable to find a port free for both UDP and TCP.";
+  return false;
+}
+
+int LoopbackDnsServer::Port() const {
+  return port_;
+}
+
+string LoopbackDnsServer::Nameserver() const {
+  stringstream nameserver;
+  nameserver << "127.0.0.1:" << port_;
+  return nameserver.str();
+}
+
+void LoopbackDnsServer::SetTruncate(bool truncate) {
+  truncate_ = truncate;
+}
+
+bool LoopbackDnsServer::StartThread() {
+  thread_started_ = pthread_create(&thread_, NULL, ThreadProcedure, this) == 0;
+
+  return thread_started_;
+}
+
+void LoopbackDnsServer::Stop() {
+  if (!thread_started_) {
+    return;
+  }
+
+  const char byte = 0;
+  while (write(stop_fds_[1], &byte, 1) == -1 && errno == EINTR) {
+  }
+
+  pthread_join(thread_, NULL);
+  thread_started_ = false;
+}
+
+uint64_t LoopbackDnsServer::UdpQueryCount() const {
+  return server_ ? server_->UdpQueryCount() : 0;
+}
+
+uint64_t LoopbackDnsServer::TcpQueryCount() const {
+  return server_ ? server_->TcpQueryCount() : 0;
+}
+
+size_t LoopbackDnsServer::SourcePortCount() const {
+  return server_ ? server_->SourcePortCount() : 0;
+}
+
+// virtual
+void LoopbackDnsServer::RunEvent() {
+  server_ = new Server(this, truncate_, udp_fd_, listen_fd_, stop_fds_[0]);
+}
+
+bool LoopbackDnsServer::Bind(string* error_message) {
+  error_message->clear();
+  if (udp_fd_ != -1) {
+    close(udp_fd_);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+  }
+
+  udp_fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (udp_fd_ == -1 || listen_fd_ == -1) {
+    *error_message = strerror(errno);
+    return false;
+  }
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof address);
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+
+  socklen_t address_length = sizeof address;
+  if (bind(udp_fd_, reinterpret_cast<sockaddr*>(&address),
+        sizeof address) != 0 ||
+      getsockname(udp_fd_, reinterpret_cast<sockaddr*>(&address),
+        &address_length) != 0) {
+    *error_message = strerror(errno);
+    return false;
+  }
+
+  // The UDP port may be taken for TCP: Try another.
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+        sizeof address) != 0) {
+    if (errno != EADDRINUSE) {
+      *error_message = strerror(errno);
+    }
+    return false;
+  }
+
+  if (listen(listen_fd_, SOMAXCONN) != 0) {
+    *error_message = strerror(errno);
+    return false;
+  }
+
+  port_ = ntohs(address.sin_port);
+
+  return true;
+}
+
+// static
+bool LoopbackDnsServer::Answer(const string& message, bool truncate,
+    string* answer) {
+  if (message.size() < kHeaderLength ||
+      (ReadUint16(message, 2) & kFlagResponse) != 0 ||
+      ReadUint16(message, 4) != 1) {
+    return false;
+  }
+
+  // The question's name is uncompressed: Labels up to the root.
+  size_t offset = kHeaderLength;
+  while (offset < message.size() && message[offset] != '\0') {
+    offset += 1 + static_cast<unsigned char>(message[offset]);
+  }
+  offset += 1;
+  if (offset + 4 > message.size()) {
+    return false;
+  }
+  const uint16_t type = ReadUint16(message, offset);
+  const bool has_address = type == kTypeA && !truncate;
+
+  AppendUint16(answer, ReadUint16(message, 0));
+  AppendUint16(answer, kFlagResponse | kFlagRecursionAvailable |
+      (ReadUint16(message, 2) & kFlagRecursionDesired) |
+      (truncate ? kFlagTruncated : 0));
+  AppendUint16(answer, 1);
+  AppendUint16(answer, has_address ? 1 : 0);
+  AppendUint16(answer, 0);
+  AppendUint16(answer, 0);
+  answer->append(message, kHeaderLength, offset + 4 - kHeaderLength);
+
+  if (has_address) {
+    // Owner: A pointer to the question's name.
+    AppendUint16(answer, 0xc000 | kHeaderLength);
+    AppendUint16(answer, kTypeA);
+    AppendUint16(answer, kClassIN);
+    AppendUint32(answer, kTtl);
+    AppendUint16(answer, 4);
+    AppendUint32(answer, INADDR_LOOPBACK);
+  }
+
+  return true;
+}
+
+// static
+void* LoopbackDnsServer::ThreadProcedure(void* arg) {
+  LoopbackDnsServer* server = static_cast<LoopbackDnsServer*>(arg);
+
+  server->Run();
+
+  return NULL;
+}
+}  // namespace x509ls
@@ -0,0 +1,104 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BENCH_LOOPBACK_DNS_SERVER_H_
+#define X509LS_BENCH_LOOPBACK_DNS_SERVER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+#include "x509ls/cli/base/cli_application.h"
+
+using std::string;
+
+namespace x509ls {
+// A DNS server on loopback, for benchmarks and checks of the StubResolver
+// without the internet, used as its nameserver "127.0.0.1:port" (as
+// --nameserver=127.0.0.1:port).
+//
+// Every name has the A record 127.0.0.1, and no AAAA records. Queries are
+// answered over UDP and TCP on the same port; SetTruncate() makes every UDP
+// answer truncated, so resolvers retry over TCP. The UDP source ports queries
+// come from are recorded.
+//
+// Like the LoopbackTlsServer, the server is a headless CliApplication running
+// its own event loop in its own thread.
+//
+// Usage:
+//   LoopbackDnsServer server;
+//   if (!server.Listen(&error_message) || !server.StartThread()) { ... }
+//   ... query 127.0.0.1:server.Port() ...
+//   server.Stop();
+class LoopbackDnsServer : public CliApplication {
+ public:
+  LoopbackDnsServer();
+
+  // Calls Stop().
+  virtual ~LoopbackDnsServer();
+
+  // Listen on an ephemeral 127.0.0.1 port, for UDP and TCP. Returns false on
+  // error, setting |error_message|.
+  bool Listen(string* error_message);
+
+  // Return the port listened on, and the nameserver "127.0.0.1:port", valid
+  // after Listen().
+  int Port() const;
+  string Nameserver() const;
+
+  // Truncate every UDP answer iif |truncate|. Call before StartThread().
+  void SetTruncate(bool truncate);
+
+  // Start a thread running the server. Returns false if no thread could be
+  // created.
+  bool StartThread();
+
+  // Stop the server and wait for its thread to finish. TCP connections still
+  // in progress are closed.
+  void Stop();
+
+  // The following are valid after Stop():
+  // Return the number of queries answered over UDP and TCP, and the number of
+  // distinct UDP source ports seen.
+  uint64_t UdpQueryCount() const;
+  uint64_t TcpQueryCount() const;
+  size_t SourcePortCount() const;
+
+ protected:
+  virtual void RunEvent();
+
+ private:
+  NO_COPY_AND_ASSIGN(LoopbackDnsServer)
+
+  class Server;
+  class Connection;
+
+  bool truncate_;
+
+  int udp_fd_;
+  int listen_fd_;
+  int port_;
+
+  // Written to by Stop(), to wake and stop the server thread.
+  int stop_fds_[2];
+
+  Server* server_;
+
+  pthread_t thread_;
+  bool thread_started_;
+
+  // Bind |udp_fd_| and |listen_fd_| to the same ephemeral port. Returns false
+  // if the TCP port is taken.
+  bool Bind(string* error_message);
+
+  // Answer the query |message|, storing the answer in |answer|, truncated
+  // iif |truncate|. Returns false if |message| is malformed.
+  static bool Answer(const string& message, bool truncate, string* answer);
+
+  static void* ThreadProcedure(void* arg);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BENCH_LOOPBACK_DNS_SERVER_H_
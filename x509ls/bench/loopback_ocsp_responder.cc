@@ -0,0 +1,438 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/bench/loopback_ocsp_responder.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ocsp.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/event_manager.h"
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// Most bytes read from a connection: Far more than any real request.
+const size_t kMaxRequestSize = 64 * 1024;
+
+// How long responses are current for, in seconds.
+const long kValiditySeconds = 24 * 60 * 60;  // NOLINT(runtime/int)
+
+// Parse the HTTP POST |input|. Returns true once it is complete, storing the
+// body in |body|. Sets |error| if it never will be.
+bool ParseHttpRequest(const string& input, string* body, bool* error) {
+  const size_t header_end = input.find("\r\n\r\n");
+  if (header_end == string::npos) {
+    *error = input.size() > kMaxRequestSize;
+    return false;
+  }
+
+  string headers = input.substr(0, header_end);
+  std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+
+  const string kContentLength = "\r\ncontent-length:";
+  const size_t length_start = headers.find(kContentLength);
+  if (headers.compare(0, 5, "post ") != 0 || length_start == string::npos) {
+    *error = true;
+    return false;
+  }
+
+  const size_t content_length = strtoul(
+      headers.c_str() + length_start + kContentLength.size(), NULL, 10);
+  const size_t body_start = header_end + 4;
+  if (input.size() - body_start < content_length) {
+    *error = body_start + content_length > kMaxRequestSize;
+    return false;
+  }
+
+  body->assign(input, body_start, content_length);
+  return true;
+}
+}  // namespace
+
+// A single connection: Reads one request, writes the response, then emits
+// kEventFinished (and is deleted by the Acceptor).
+class LoopbackOCSPResponder::Connection : public BaseObject {
+ public:
+  static const int kEventFinished = 1;
+
+  Connection(BaseObject* parent, const LoopbackOCSPResponder* responder,
+      int fd)
+    :
+      BaseObject(parent),
+      responder_(responder),
+      fd_(fd),
+      output_offset_(0),
+      certificate_count_(0),
+      success_(false) {
+    WatchFD(fd_, EventManager::kFDReadable);
+  }
+
+  virtual ~Connection() {
+    UnwatchFD(fd_);
+    close(fd_);
+  }
+
+  virtual void OnFDEvent(int fd, bool read_event, bool write_event,
+      bool error_event) {
+    if (output_.empty()) {
+      Read();
+    } else {
+      Write();
+    }
+  }
+
+  bool Success() const {
+    return success_;
+  }
+
+  size_t CertificateCount() const {
+    return certificate_count_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Connection)
+
+  const LoopbackOCSPResponder* const responder_;
+  const int fd_;
+  string input_;
+  string output_;
+  size_t output_offset_;
+  size_t certificate_count_;
+  bool success_;
+
+  void Read() {
+    char buffer[4096];
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd_, buffer, sizeof buffer)) > 0) {
+      input_.append(buffer, bytes_read);
+    }
+    const bool closed = bytes_read == 0 ||
+      (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+
+    string body;
+    bool error = false;
+    if (!ParseHttpRequest(input_, &body, &error)) {
+      if (error || closed) {
+        Finish(false);
+      }
+      return;
+    }
+
+    string response;
+    if (!responder_->Answer(body, &response, &certificate_count_)) {
+      Finish(false);
+      return;
+    }
+
+    stringstream header;
+    header << "HTTP/1.0 200 OK\r\n"
+      << "Content-Type: application/ocsp-response\r\n"
+      << "Content-Length: " << response.size() << "\r\n"
+      << "\r\n";
+    output_ = header.str() + response;
+
+    WatchFD(fd_, EventManager::kFDWritable);
+    Write();
+  }
+
+  void Write() {
+    while (output_offset_ < output_.size()) {
+      const ssize_t bytes_written = write(fd_,
+          output_.data() + output_offset_, output_.size() - output_offset_);
+      if (bytes_written > 0) {
+        output_offset_ += bytes_written;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return;
+      } else {
+        Finish(false);
+        return;
+      }
+    }
+
+    Finish(true);
+  }
+
+  void Finish(bool success) {
+    UnwatchFD(fd_);
+    success_ = success;
+    Emit(kEventFinished);
+  }
+};
+
+// Accepts connections, until woken by the stop pipe.
+class LoopbackOCSPResponder::Acceptor : public BaseObject {
+ public:
+  Acceptor(LoopbackOCSPResponder* responder, int listen_fd, int stop_fd)
+    :
+      BaseObject(responder),
+      responder_(responder),
+      listen_fd_(listen_fd),
+      stop_fd_(stop_fd),
+      request_count_(0),
+      certificate_count_(0),
+      failure_count_(0) {
+    WatchFD(listen_fd_, EventManager::kFDReadable);
+    WatchFD(stop_fd_, EventManager::kFDReadable);
+  }
+
+  virtual ~Acceptor() {
+    UnwatchFD(listen_fd_);
+    UnwatchFD(stop_fd_);
+  }
+
+  virtual void OnFDEvent(int fd, bool read_event, bool write_event,
+      bool error_event) {
+    if (fd == stop_fd_) {
+      GetApplication()->Exit(true);
+      return;
+    }
+
+    int connection_fd;
+    while ((connection_fd = accept(listen_fd_, NULL, NULL)) != -1) {
+      fcntl(connection_fd, F_SETFL,
+          fcntl(connection_fd, F_GETFL) | O_NONBLOCK);
+
+      Connection* connection = new Connection(this, responder_,
+          connection_fd);
+      Subscribe(connection, Connection::kEventFinished);
+    }
+  }
+
+  virtual void OnEvent(const BaseObject* source, int event_code) {
+    Connection* connection =
+      const_cast<Connection*>(static_cast<const Connection*>(source));
+
+    if (connection->Success()) {
+      ++request_count_;
+      certificate_count_ += connection->CertificateCount();
+    } else {
+      ++failure_count_;
+    }
+
+    Unsubscribe(connection);
+    DeleteChild(connection);
+  }
+
+  uint64_t RequestCount() const {
+    return request_count_;
+  }
+
+  uint64_t CertificateCount() const {
+    return certificate_count_;
+  }
+
+  uint64_t FailureCount() const {
+    return failure_count_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Acceptor)
+
+  const LoopbackOCSPResponder* const responder_;
+  const int listen_fd_;
+  const int stop_fd_;
+
+  uint64_t request_count_;
+  uint64_t certificate_count_;
+  uint64_t failure_count_;
+};
+
+LoopbackOCSPResponder::LoopbackOCSPResponder()
+  :
+    CliApplication(),
+    signer_(NULL),
+    key_(NULL),
+    listen_fd_(-1),
+    port_(0),
+    acceptor_(NULL),
+    thread_started_(false) {
+  stop_fds_[0] = -1;
+  stop_fds_[1] = -1;
+  SetHeadless(true);
+}
+
+// virtual
+LoopbackOCSPResponder::~LoopbackOCSPResponder() {
+  Stop();
+
+  delete acceptor_;
+
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+  }
+  if (stop_fds_[0] != -1) {
+    close(stop_fds_[0]);
+    close(stop_fds_[1]);
+  }
+}
+
+bool LoopbackOCSPResponder::Listen(string* error_message) {
+  if (pipe(stop_fds_) != 0) {
+    stop_fds_[0] = -1;
+    *error_message = "Unable to create pipe.";
+    return false;
+  }
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ == -1) {
+    *error_message = strerror(errno);
+    return false;
+  }
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof address);
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+
+  socklen_t address_length = sizeof address;
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+        sizeof address) != 0 ||
+      listen(listen_fd_, SOMAXCONN) != 0 ||
+      getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+        &address_length) != 0) {
+    *error_message = strerror(errno);
+    return false;
+  }
+
+  fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+  port_ = ntohs(address.sin_port);
+
+  return true;
+}
+
+int LoopbackOCSPResponder::Port() const {
+  return port_;
+}
+
+string LoopbackOCSPResponder::Url() const {
+  stringstream url;
+  url << "http://127.0.0.1:" << port_ << "/";
+  return url.str();
+}
+
+void LoopbackOCSPResponder::SetSigner(X509* signer, EVP_PKEY* key) {
+  signer_ = signer;
+  key_ = key;
+}
+
+void LoopbackOCSPResponder::Revoke(long serial) {  // NOLINT(runtime/int)
+  revoked_.insert(serial);
+}
+
+bool LoopbackOCSPResponder::StartThread() {
+  thread_started_ = pthread_create(&thread_, NULL, ThreadProcedure, this) == 0;
+
+  return thread_started_;
+}
+
+void LoopbackOCSPResponder::Stop() {
+  if (!thread_started_) {
+    return;
+  }
+
+  const char byte = 0;
+  while (write(stop_fds_[1], &byte, 1) == -1 && errno == EINTR) {
+  }
+
+  pthread_join(thread_, NULL);
+  thread_started_ = false;
+}
+
+uint64_t LoopbackOCSPResponder::RequestCount() const {
+  return acceptor_ ? acceptor_->RequestCount() : 0;
+}
+
+uint64_t LoopbackOCSPResponder::CertificateCount() const {
+  return acceptor_ ? acceptor_->CertificateCount() : 0;
+}
+
+uint64_t LoopbackOCSPResponder::FailureCount() const {
+  return acceptor_ ? acceptor_->FailureCount() : 0;
+}
+
+// virtual
+void LoopbackOCSPResponder::RunEvent() {
+  acceptor_ = new Acceptor(this, listen_fd_, stop_fds_[0]);
+}
+
+bool LoopbackOCSPResponder::Answer(const string& request_der,
+    string* response_der, size_t* certificate_count) const {
+  const unsigned char* data =
+    reinterpret_cast<const unsigned char*>(request_der.data());
+  OCSP_REQUEST* request = d2i_OCSP_REQUEST(NULL, &data, request_der.size());
+  if (request == NULL || signer_ == NULL) {
+    OCSP_REQUEST_free(request);
+    ERR_clear_error();
+    return false;
+  }
+
+  OCSP_BASICRESP* basic = OCSP_BASICRESP_new();
+  ASN1_TIME* now = X509_gmtime_adj(NULL, 0);
+  ASN1_TIME* next_update = X509_gmtime_adj(NULL, kValiditySeconds);
+
+  bool success = true;
+  const int count = OCSP_request_onereq_count(request);
+  for (int i = 0; success && i < count; ++i) {
+    OCSP_CERTID* id = OCSP_onereq_get0_id(OCSP_request_onereq_get0(request,
+          i));
+
+    ASN1_INTEGER* serial = NULL;
+    OCSP_id_get0_info(NULL, NULL, NULL, &serial, id);
+    const bool revoked = serial != NULL &&
+      revoked_.count(ASN1_INTEGER_get(serial)) > 0;
+
+    success = OCSP_basic_add1_status(basic, id,
+        revoked ? V_OCSP_CERTSTATUS_REVOKED : V_OCSP_CERTSTATUS_GOOD,
+        OCSP_REVOKED_STATUS_NOSTATUS, revoked ? now : NULL, now,
+        next_update) != NULL;
+  }
+
+  // Identified by name, without its certificate.
+  success = success && OCSP_basic_sign(basic, signer_, key_, EVP_sha256(),
+      NULL, OCSP_NOCERTS) == 1;
+
+  OCSP_RESPONSE* response = success ?
+    OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic) : NULL;
+  const int length = response ? i2d_OCSP_RESPONSE(response, NULL) : 0;
+  if (length > 0) {
+    response_der->resize(length);
+    unsigned char* out = reinterpret_cast<unsigned char*>(&(*response_der)[0]);
+    i2d_OCSP_RESPONSE(response, &out);
+    *certificate_count = count;
+  }
+
+  OCSP_RESPONSE_free(response);
+  ASN1_TIME_free(next_update);
+  ASN1_TIME_free(now);
+  OCSP_BASICRESP_free(basic);
+  OCSP_REQUEST_free(request);
+  ERR_clear_error();
+
+  return length > 0;
+}
+
+// static
+void* LoopbackOCSPResponder::ThreadProcedure(void* arg) {
+  LoopbackOCSPResponder* responder = static_cast<LoopbackOCSPResponder*>(arg);
+
+  responder->Run();
+
+  return NULL;
+}
+}  // namespace x509ls
@@ -0,0 +1,118 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BENCH_LOOPBACK_OCSP_RESPONDER_H_
+#define X509LS_BENCH_LOOPBACK_OCSP_RESPONDER_H_
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <set>
+#include <string>
+
+#include "x509ls/base/types.h"
+#include "x509ls/cli/base/cli_application.h"
+
+using std::set;
+using std::string;
+
+namespace x509ls {
+// An http OCSP responder on loopback, for benchmarks and checks of the
+// OCSPClient without the internet.
+//
+// Every certificate asked about is good, unless its serial number was
+// Revoke()d. Responses are current for a day, and are signed by the signer
+// given to SetSigner(), identified by name only: The signer's certificate
+// isn't included, so the client has to find it, and any intermediates up to
+// its trust store, in the certificates it was given.
+//
+// Like the LoopbackTlsServer, the responder is a headless CliApplication
+// running its own event loop in its own thread. Each connection carries one
+// POST, answered with HTTP/1.0 and closed.
+//
+// Usage:
+//   LoopbackOCSPResponder responder;
+//   if (!responder.Listen(&error_message)) { ... }
+//   chain.SetOCSPResponderUrl(responder.Url());
+//   ... generate the chain ...
+//   responder.SetSigner(issuer, key);
+//   if (!responder.StartThread()) { ... }
+//   ... query ...
+//   responder.Stop();
+class LoopbackOCSPResponder : public CliApplication {
+ public:
+  LoopbackOCSPResponder();
+
+  // Calls Stop().
+  virtual ~LoopbackOCSPResponder();
+
+  // Listen on an ephemeral 127.0.0.1 port. Returns false on error, setting
+  // |error_message|.
+  bool Listen(string* error_message);
+
+  // Return the port listened on, and the responder's URL,
+  // "http://127.0.0.1:port/", valid after Listen().
+  int Port() const;
+  string Url() const;
+
+  // Sign responses as |signer|, with its private key |key|. Both must outlive
+  // the responder. Call before StartThread().
+  void SetSigner(X509* signer, EVP_PKEY* key);
+
+  // Answer revoked for certificates with serial number |serial|. Call before
+  // StartThread().
+  void Revoke(long serial);  // NOLINT(runtime/int)
+
+  // Start a thread running the responder. Returns false if no thread could
+  // be created.
+  bool StartThread();
+
+  // Stop the responder and wait for its thread to finish. Requests still in
+  // progress are dropped.
+  void Stop();
+
+  // The following are valid after Stop():
+  // Return the number of requests answered, the certificates asked about in
+  // them, and the requests that failed (malformed, or closed early).
+  uint64_t RequestCount() const;
+  uint64_t CertificateCount() const;
+  uint64_t FailureCount() const;
+
+ protected:
+  virtual void RunEvent();
+
+ private:
+  NO_COPY_AND_ASSIGN(LoopbackOCSPResponder)
+
+  class Acceptor;
+  class Connection;
+
+  X509* signer_;
+  EVP_PKEY* key_;
+  set<long> revoked_;  // NOLINT(runtime/int)
+
+  int listen_fd_;
+  int port_;
+
+  // Written to by Stop(), to wake and stop the responder thread.
+  int stop_fds_[2];
+
+  Acceptor* acceptor_;
+
+  pthread_t thread_;
+  bool thread_started_;
+
+  // Answer the DER encoded OCSP request |request_der|, storing the DER
+  // encoded response in |response_der| and the number of certificates asked
+  // about in |certificate_count|. Returns false if |request_der| is
+  // malformed.
+  bool Answer(const string& request_der, string* response_der,
+      size_t* certificate_count) const;
+
+  static void* ThreadProcedure(void* arg);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BENCH_LOOPBACK_OCSP_RESPONDER_H_
@@ -0,0 +1,321 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/bench/loopback_tls_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/ec.h>
+#include <openssl/err.h>
+#include <openssl/obj_mac.h>
+#include <openssl/x509.h>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/event_manager.h"
+#include "x509ls/bench/synthetic_chain.h"
+
+namespace x509ls {
+// A single connection: Runs the server side of the TLS handshake, then emits
+// kEventFinished (and is deleted by the Acceptor).
+class LoopbackTlsServer::Connection : public BaseObject {
+ public:
+  static const int kEventFinished = 1;
+
+  Connection(BaseObject* parent, SSL_CTX* ssl_ctx, int fd)
+    :
+      BaseObject(parent),
+      fd_(fd),
+      ssl_(SSL_new(ssl_ctx)),
+      success_(false) {
+    SSL_set_fd(ssl_, fd_);
+    SSL_set_accept_state(ssl_);
+  }
+
+  virtual ~Connection() {
+    UnwatchFD(fd_);
+    SSL_free(ssl_);
+    close(fd_);
+  }
+
+  // Start (or continue) the handshake.
+  void Handshake() {
+    const int result = SSL_do_handshake(ssl_);
+    if (result == 1) {
+      // Best effort close_notify: The client has its certificates already.
+      SSL_shutdown(ssl_);
+      Finish(true);
+      return;
+    }
+
+    switch (SSL_get_error(ssl_, result)) {
+    case SSL_ERROR_WANT_READ:
+      WatchFD(fd_, EventManager::kFDReadable);
+      break;
+    case SSL_ERROR_WANT_WRITE:
+      WatchFD(fd_, EventManager::kFDWritable);
+      break;
+    default:
+      Finish(false);
+      break;
+    }
+  }
+
+  virtual void OnFDEvent(int fd, bool read_event, bool write_event,
+      bool error_event) {
+    Handshake();
+  }
+
+  bool Success() const {
+    return success_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Connection)
+
+  const int fd_;
+  SSL* const ssl_;
+  bool success_;
+
+  void Finish(bool success) {
+    ERR_clear_error();
+    UnwatchFD(fd_);
+    success_ = success;
+    Emit(kEventFinished);
+  }
+};
+
+// Accepts connections, until woken by the stop pipe.
+class LoopbackTlsServer::Acceptor : public BaseObject {
+ public:
+  Acceptor(CliApplication* application, SSL_CTX* ssl_ctx, int listen_fd,
+      int stop_fd)
+    :
+      BaseObject(application),
+      ssl_ctx_(ssl_ctx),
+      listen_fd_(listen_fd),
+      stop_fd_(stop_fd),
+      handshake_count_(0),
+      failure_count_(0) {
+    WatchFD(listen_fd_, EventManager::kFDReadable);
+    WatchFD(stop_fd_, EventManager::kFDReadable);
+  }
+
+  virtual ~Acceptor() {
+    UnwatchFD(listen_fd_);
+    UnwatchFD(stop_fd_);
+  }
+
+  virtual void OnFDEvent(int fd, bool read_event, bool write_event,
+      bool error_event) {
+    if (fd == stop_fd_) {
+      GetApplication()->Exit(true);
+      return;
+    }
+
+    int connection_fd;
+    while ((connection_fd = accept(listen_fd_, NULL, NULL)) != -1) {
+      fcntl(connection_fd, F_SETFL,
+          fcntl(connection_fd, F_GETFL) | O_NONBLOCK);
+
+      Connection* connection = new Connection(this, ssl_ctx_, connection_fd);
+      Subscribe(connection, Connection::kEventFinished);
+      connection->Handshake();
+    }
+  }
+
+  virtual void OnEvent(const BaseObject* source, int event_code) {
+    Connection* connection =
+      const_cast<Connection*>(static_cast<const Connection*>(source));
+
+    if (connection->Success()) {
+      ++handshake_count_;
+    } else {
+      ++failure_count_;
+    }
+
+    Unsubscribe(connection);
+    DeleteChild(connection);
+  }
+
+  uint64_t HandshakeCount() const {
+    return handshake_count_;
+  }
+
+  uint64_t FailureCount() const {
+    return failure_count_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(Acceptor)
+
+  SSL_CTX* const ssl_ctx_;
+  const int listen_fd_;
+  const int stop_fd_;
+
+  uint64_t handshake_count_;
+  uint64_t failure_count_;
+};
+
+LoopbackTlsServer::LoopbackTlsServer(const SyntheticChain* chain)
+  :
+    CliApplication(),
+    chain_(chain),
+    ssl_ctx_(NULL),
+    listen_fd_(-1),
+    port_(0),
+    acceptor_(NULL),
+    thread_started_(false) {
+  stop_fds_[0] = -1;
+  stop_fds_[1] = -1;
+  SetHeadless(true);
+}
+
+// virtual
+LoopbackTlsServer::~LoopbackTlsServer() {
+  Stop();
+
+  delete acceptor_;
+
+  if (ssl_ctx_) {
+    SSL_CTX_free(ssl_ctx_);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+  }
+  if (stop_fds_[0] != -1) {
+    close(stop_fds_[0]);
+    close(stop_fds_[1]);
+  }
+}
+
+bool LoopbackTlsServer::Listen(string* error_message) {
+  if (!CreateSslCtx(error_message)) {
+    return false;
+  }
+
+  if (pipe(stop_fds_) != 0) {
+    stop_fds_[0] = -1;
+    *error_message = "Unable to create pipe.";
+    return false;
+  }
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ == -1) {
+    *error_message = strerror(errno);
+    return false;
+  }
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof address);
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+
+  socklen_t address_length = sizeof address;
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+        sizeof address) != 0 ||
+      listen(listen_fd_, SOMAXCONN) != 0 ||
+      getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+        &address_length) != 0) {
+    *error_message = strerror(errno);
+    return false;
+  }
+
+  fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+  port_ = ntohs(address.sin_port);
+
+  return true;
+}
+
+int LoopbackTlsServer::Port() const {
+  return port_;
+}
+
+bool LoopbackTlsServer::StartThread() {
+  thread_started_ = pthread_create(&thread_, NULL, ThreadProcedure, this) == 0;
+
+  return thread_started_;
+}
+
+void LoopbackTlsServer::Stop() {
+  if (!thread_started_) {
+    return;
+  }
+
+  const char byte = 0;
+  while (write(stop_fds_[1], &byte, 1) == -1 && errno == EINTR) {
+  }
+
+  pthread_join(thread_, NULL);
+  thread_started_ = false;
+}
+
+uint64_t LoopbackTlsServer::HandshakeCount() const {
+  return acceptor_ ? acceptor_->HandshakeCount() : 0;
+}
+
+uint64_t LoopbackTlsServer::FailureCount() const {
+  return acceptor_ ? acceptor_->FailureCount() : 0;
+}
+
+// virtual
+void LoopbackTlsServer::RunEvent() {
+  acceptor_ = new Acceptor(this, ssl_ctx_, listen_fd_, stop_fds_[0]);
+}
+
+bool LoopbackTlsServer::CreateSslCtx(string* error_message) {
+  ssl_ctx_ = SSL_CTX_new(SSLv23_server_method());
+  if (ssl_ctx_ == NULL) {
+    *error_message = "Unable to create SSL_CTX.";
+    return false;
+  }
+
+  // Full handshakes only: Resumption would skip the chain being measured.
+  SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_OFF);
+  SSL_CTX_set_options(ssl_ctx_, SSL_OP_NO_TICKET);
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  // Pre-v1.1.0 OpenSSL needs an ECDH curve for ECDHE (and so for ECDSA
+  // certificates with most clients).
+  EC_KEY* ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  SSL_CTX_set_tmp_ecdh(ssl_ctx_, ecdh);
+  EC_KEY_free(ecdh);
+#endif
+
+  STACK_OF(X509)* served = chain_->ServedChain();
+  bool success = SSL_CTX_use_certificate(ssl_ctx_,
+      sk_X509_value(served, 0)) == 1 &&
+    SSL_CTX_use_PrivateKey(ssl_ctx_, chain_->Key()) == 1;
+
+  // The SSL_CTX takes ownership of extra chain certificates.
+  for (int i = 1; success && i < sk_X509_num(served); ++i) {
+    X509* x509 = X509_dup(sk_X509_value(served, i));
+    success = SSL_CTX_add_extra_chain_cert(ssl_ctx_, x509) == 1;
+    if (!success) {
+      X509_free(x509);
+    }
+  }
+
+  if (!success) {
+    ERR_clear_error();
+    *error_message = "Unable to load the chain into the SSL_CTX.";
+  }
+
+  return success;
+}
+
+// static
+void* LoopbackTlsServer::ThreadProcedure(void* arg) {
+  LoopbackTlsServer* server = static_cast<LoopbackTlsServer*>(arg);
+
+  server->Run();
+
+  return NULL;
+}
+}  // namespace x509ls
@@ -0,0 +1,90 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BENCH_LOOPBACK_TLS_SERVER_H_
+#define X509LS_BENCH_LOOPBACK_TLS_SERVER_H_
+
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+#include "x509ls/cli/base/cli_application.h"
+
+using std::string;
+
+namespace x509ls {
+class SyntheticChain;
+// A TLS server on loopback, serving a SyntheticChain, for end-to-end
+// benchmarks of the fetch pipeline without the internet.
+//
+// The server is a headless CliApplication running its own event loop in its
+// own thread, as a BatchWorker does, so it can be driven from another event
+// loop in the same process. Each connection is accepted, completes the TLS
+// handshake (or fails), and is closed: Nothing is served after the handshake.
+//
+// Usage:
+//   LoopbackTlsServer server(&chain);
+//   if (!server.Listen(&error_message) || !server.StartThread()) { ... }
+//   ... connect to 127.0.0.1:server.Port() ...
+//   server.Stop();
+class LoopbackTlsServer : public CliApplication {
+ public:
+  // Construct a server of |chain|, which must outlive it.
+  explicit LoopbackTlsServer(const SyntheticChain* chain);
+
+  // Calls Stop().
+  virtual ~LoopbackTlsServer();
+
+  // Listen on an ephemeral 127.0.0.1 port. Returns false on error, setting
+  // |error_message|.
+  bool Listen(string* error_message);
+
+  // Return the port listened on, valid after Listen().
+  int Port() const;
+
+  // Start a thread running the server. Returns false if no thread could be
+  // created.
+  bool StartThread();
+
+  // Stop the server and wait for its thread to finish. Connections still in
+  // progress are closed.
+  void Stop();
+
+  // The following are valid after Stop():
+  // Return the number of handshakes completed/failed.
+  uint64_t HandshakeCount() const;
+  uint64_t FailureCount() const;
+
+ protected:
+  virtual void RunEvent();
+
+ private:
+  NO_COPY_AND_ASSIGN(LoopbackTlsServer)
+
+  class Acceptor;
+  class Connection;
+
+  const SyntheticChain* const chain_;
+
+  SSL_CTX* ssl_ctx_;
+  int listen_fd_;
+  int port_;
+
+  // Written to by Stop(), to wake and stop the server thread.
+  int stop_fds_[2];
+
+  Acceptor* acceptor_;
+
+  pthread_t thread_;
+  bool thread_started_;
+
+  bool CreateSslCtx(string* error_message);
+
+  static void* ThreadProcedure(void* arg);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BENCH_LOOPBACK_TLS_SERVER_H_
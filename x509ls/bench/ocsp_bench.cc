@@ -0,0 +1,148 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+// End-to-end benchmarks of the OCSPClient against a LoopbackOCSPResponder,
+// which also check its answers: A run fails unless every query gets the
+// expected status.
+
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+#include <stdint.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/openssl/shared_openssl.h"
+#include "x509ls/bench/benchmark.h"
+#include "x509ls/bench/loopback_ocsp_responder.h"
+#include "x509ls/bench/synthetic_chain.h"
+#include "x509ls/certificate/ocsp_cache.h"
+#include "x509ls/certificate/trust_store.h"
+#include "x509ls/net/ocsp_client.h"
+
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace x509ls {
+namespace {
+// Receives one query's result, stopping the event loop. Parent of the
+// client queried.
+class ResultListener : public BaseObject, public OCSPClient::Listener {
+ public:
+  explicit ResultListener(CliApplication* application)
+    :
+      BaseObject(application) {
+  }
+
+  virtual void OnOCSPResult(const OCSPResult& result) {
+    result_ = result;
+    GetApplication()->Exit(true);
+  }
+
+  const OCSPResult& Result() const {
+    return result_;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(ResultListener)
+
+  OCSPResult result_;
+};
+
+// Query the status of the end-entity of a chain of depth |kDepth| from a
+// LoopbackOCSPResponder, revoked if Arg(0). Each iteration is an uncached
+// query through a fresh OCSPCache and client: Gathering, connect, request,
+// and response verification.
+//
+// The responder signs as the end-entity's issuer, without including its
+// certificate, so past depth 3 verification needs the served chain's
+// intermediates as well as the issuer.
+template <int kDepth>
+void BenchOCSPClientQuery(Benchmark* benchmark, size_t iterations) {
+  string error_message;
+  LoopbackOCSPResponder responder;
+  if (!responder.Listen(&error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  // Not shared: The chain names this responder's port.
+  SyntheticChain chain;
+  chain.SetOCSPResponderUrl(responder.Url());
+  if (!chain.Generate(SyntheticChain::kKeyTypeECDSA, kDepth, "localhost",
+        &error_message)) {
+    benchmark->SetError(error_message);
+    return;
+  }
+
+  STACK_OF(X509)* served = chain.ServedChain();
+  X509* leaf = sk_X509_value(served, 0);
+  X509* issuer = kDepth > 1 ? sk_X509_value(served, 1) : leaf;
+  vector<X509Handle> untrusted;
+  for (int i = 0; i < sk_X509_num(served); ++i) {
+    untrusted.push_back(X509Handle::Share(sk_X509_value(served, i)));
+  }
+
+  const bool revoked = benchmark->Arg(0) != 0;
+  if (revoked) {
+    responder.Revoke(ASN1_INTEGER_get(X509_get_serialNumber(leaf)));
+  }
+  responder.SetSigner(issuer, chain.Key());
+  if (!responder.StartThread()) {
+    benchmark->SetError("Unable to start responder thread.");
+    return;
+  }
+
+  TrustStore trust_store;
+  X509_STORE_add_cert(trust_store.Store(), chain.Root());
+
+  const OCSPResult::Status expected =
+    revoked ? OCSPResult::kStatusRevoked : OCSPResult::kStatusGood;
+  OCSPResult::Status status = expected;
+  string query_error_message;
+
+  BenchmarkApplication application;
+  benchmark->StartTiming();
+  for (size_t i = 0; i < iterations && status == expected; ++i) {
+    OCSPCache cache;
+    ResultListener listener(&application);
+    OCSPClient* client = new OCSPClient(&listener, &cache, &trust_store);
+
+    OCSPResult result;
+    if (!client->Query(&listener, leaf, issuer, untrusted, &result)) {
+      application.Run();
+      result = listener.Result();
+    }
+    status = result.status;
+    query_error_message = result.error_message;
+  }
+  benchmark->StopTiming();
+
+  responder.Stop();
+
+  if (status != expected) {
+    stringstream error;
+    error << "expected " << OCSPResult::StatusName(expected) << ", got "
+      << OCSPResult::StatusName(status);
+    if (!query_error_message.empty()) {
+      error << " (" << query_error_message << ")";
+    }
+    benchmark->SetError(error.str());
+    return;
+  }
+
+  benchmark->SetCounter("responder_failures", responder.FailureCount());
+}
+Benchmark bench_ocsp_query_3_good("OCSPClient/Query/3/good",
+    BenchOCSPClientQuery<3>, 0);
+Benchmark bench_ocsp_query_3_revoked("OCSPClient/Query/3/revoked",
+    BenchOCSPClientQuery<3>, 1);
+Benchmark bench_ocsp_query_5_good("OCSPClient/Query/5/good",
+    BenchOCSPClientQuery<5>, 0);
+Benchmark bench_ocsp_query_5_revoked("OCSPClient/Query/5/revoked",
+    BenchOCSPClientQuery<5>, 1);
+}  // namespace
+}  // namespace x509ls
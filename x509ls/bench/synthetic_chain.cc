@@ -0,0 +1,282 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/bench/synthetic_chain.h"
+
+#include <openssl/ec.h>
+#include <openssl/err.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rsa.h>
+#include <openssl/x509v3.h>
+
+#include <map>
+#include <sstream>
+#include <utility>
+
+using std::make_pair;
+using std::map;
+using std::pair;
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+const int kRSAKeyBits = 2048;
+
+// Validity: From a day ago, for a year.
+const long kNotBeforeSeconds = -24 * 60 * 60;  // NOLINT(runtime/int)
+const long kNotAfterSeconds = 365 * 24 * 60 * 60;  // NOLINT(runtime/int)
+
+// Add the extension |nid| with the OpenSSL config style |value| to |x509|.
+bool AddExtension(X509* x509, X509V3_CTX* context, int nid,
+    const string& value) {
+  X509_EXTENSION* extension = X509V3_EXT_conf_nid(NULL, context, nid,
+      const_cast<char*>(value.c_str()));
+  if (extension == NULL) {
+    return false;
+  }
+
+  const bool success = X509_add_ext(x509, extension, -1) == 1;
+  X509_EXTENSION_free(extension);
+
+  return success;
+}
+
+// The chains returned by SyntheticChain::Shared(), by key type, depth and
+// padding.
+class SharedChains {
+ public:
+  SharedChains() {
+  }
+
+  ~SharedChains() {
+    for (ChainMap::iterator it = chains_.begin(); it != chains_.end(); ++it) {
+      delete it->second;
+    }
+  }
+
+  const SyntheticChain* Get(SyntheticChain::KeyType key_type, size_t depth,
+      size_t padding, string* error_message) {
+    const Key key = make_pair(key_type, make_pair(depth, padding));
+    ChainMap::const_iterator it = chains_.find(key);
+    if (it != chains_.end()) {
+      return it->second;
+    }
+
+    SyntheticChain* chain = new SyntheticChain;
+    if (!chain->Generate(key_type, depth, "bench.example.org",
+          error_message) ||
+        !chain->AddPadding(padding, error_message)) {
+      delete chain;
+      return NULL;
+    }
+    chains_[key] = chain;
+
+    return chain;
+  }
+
+ private:
+  NO_COPY_AND_ASSIGN(SharedChains)
+
+  typedef pair<int, pair<size_t, size_t> > Key;
+  typedef map<Key, SyntheticChain*> ChainMap;
+  ChainMap chains_;
+};
+}  // namespace
+
+// static
+const SyntheticChain* SyntheticChain::Shared(KeyType key_type, size_t depth,
+    size_t padding, string* error_message) {
+  static SharedChains shared_chains;
+  return shared_chains.Get(key_type, depth, padding, error_message);
+}
+
+SyntheticChain::SyntheticChain()
+  :
+    key_type_(kKeyTypeRSA),
+    key_(NULL),
+    root_(NULL),
+    served_(sk_X509_new_null()),
+    serial_(0) {
+}
+
+SyntheticChain::~SyntheticChain() {
+  sk_X509_pop_free(served_, X509_free);
+  if (root_) {
+    X509_free(root_);
+  }
+  if (key_) {
+    EVP_PKEY_free(key_);
+  }
+}
+
+void SyntheticChain::SetOCSPResponderUrl(const string& url) {
+  ocsp_responder_url_ = url;
+}
+
+bool SyntheticChain::Generate(KeyType key_type, size_t depth,
+    const string& common_name, string* error_message) {
+  key_type_ = key_type;
+  if (depth < 1) {
+    *error_message = "Chain depth must be at least 1.";
+    return false;
+  } else if (!GenerateKey(error_message)) {
+    return false;
+  }
+
+  // Issue from the root down, then serve from the end-entity up.
+  X509* issuer = NULL;
+  for (size_t level = 0; level < depth; ++level) {
+    const bool is_end_entity = level == depth - 1;
+
+    stringstream name;
+    if (is_end_entity) {
+      name << common_name;
+    } else if (level == 0) {
+      name << "x509ls Synthetic Root CA";
+    } else {
+      name << "x509ls Synthetic Intermediate CA " << level;
+    }
+
+    X509* x509 = NewCertificate(name.str(), issuer, !is_end_entity);
+    if (x509 == NULL) {
+      *error_message = "Unable to create certificate.";
+      return false;
+    }
+
+    if (level == 0) {
+      root_ = x509;
+    }
+    if (level > 0 || depth == 1) {
+      sk_X509_unshift(served_, level == 0 ? X509_dup(x509) : x509);
+    }
+
+    issuer = x509;
+  }
+
+  return true;
+}
+
+bool SyntheticChain::AddPadding(size_t count, string* error_message) {
+  for (size_t i = 0; i < count; ++i) {
+    stringstream name;
+    name << "x509ls Synthetic Padding " << i + 1;
+
+    X509* x509 = NewCertificate(name.str(), NULL, true);
+    if (x509 == NULL) {
+      *error_message = "Unable to create certificate.";
+      return false;
+    }
+
+    sk_X509_push(served_, x509);
+  }
+
+  return true;
+}
+
+STACK_OF(X509)* SyntheticChain::ServedChain() const {
+  return served_;
+}
+
+X509* SyntheticChain::Root() const {
+  return root_;
+}
+
+EVP_PKEY* SyntheticChain::Key() const {
+  return key_;
+}
+
+size_t SyntheticChain::ServedChainSize() const {
+  size_t size = 0;
+  for (int i = 0; i < sk_X509_num(served_); ++i) {
+    size += i2d_X509(sk_X509_value(served_, i), NULL);
+  }
+
+  return size;
+}
+
+bool SyntheticChain::GenerateKey(string* error_message) {
+  bool success = false;
+  if (key_type_ == kKeyTypeRSA) {
+    EVP_PKEY_CTX* context = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    success = context != NULL &&
+      EVP_PKEY_keygen_init(context) == 1 &&
+      EVP_PKEY_CTX_set_rsa_keygen_bits(context, kRSAKeyBits) == 1 &&
+      EVP_PKEY_keygen(context, &key_) == 1;
+    EVP_PKEY_CTX_free(context);
+  } else {
+    key_ = EVP_PKEY_new();
+    EC_KEY* ec_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    if (ec_key != NULL) {
+      // Named curve parameters: Explicit ones are rejected by TLS peers.
+      EC_KEY_set_asn1_flag(ec_key, OPENSSL_EC_NAMED_CURVE);
+      success = EC_KEY_generate_key(ec_key) == 1 &&
+        EVP_PKEY_assign_EC_KEY(key_, ec_key) == 1;
+      if (!success) {
+        EC_KEY_free(ec_key);
+      }
+    }
+  }
+
+  if (!success) {
+    *error_message = "Unable to generate key.";
+  }
+
+  return success;
+}
+
+X509* SyntheticChain::NewCertificate(const string& common_name,
+    X509* issuer, bool is_ca) {
+  X509* x509 = X509_new();
+  X509_set_version(x509, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), ++serial_);
+  X509_gmtime_adj(X509_get_notBefore(x509), kNotBeforeSeconds);
+  X509_gmtime_adj(X509_get_notAfter(x509), kNotAfterSeconds);
+  X509_set_pubkey(x509, key_);
+
+  X509_NAME* name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC,
+      reinterpret_cast<const unsigned char*>("x509ls"), -1, -1, 0);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+      reinterpret_cast<const unsigned char*>(common_name.c_str()), -1, -1, 0);
+  X509_set_issuer_name(x509, issuer ? X509_get_subject_name(issuer) : name);
+
+  X509V3_CTX context;
+  X509V3_set_ctx(&context, issuer ? issuer : x509, x509, NULL, NULL, 0);
+
+  bool success = true;
+  if (is_ca) {
+    success = AddExtension(x509, &context, NID_basic_constraints,
+        "critical,CA:TRUE") &&
+      AddExtension(x509, &context, NID_key_usage,
+          "critical,keyCertSign,cRLSign");
+  } else {
+    success = AddExtension(x509, &context, NID_basic_constraints,
+        "critical,CA:FALSE") &&
+      AddExtension(x509, &context, NID_key_usage,
+          key_type_ == kKeyTypeRSA ?
+          "critical,digitalSignature,keyEncipherment" :
+          "critical,digitalSignature") &&
+      AddExtension(x509, &context, NID_ext_key_usage, "serverAuth") &&
+      AddExtension(x509, &context, NID_subject_alt_name,
+          "DNS:" + common_name) &&
+      (ocsp_responder_url_.empty() ||
+       AddExtension(x509, &context, NID_info_access,
+           "OCSP;URI:" + ocsp_responder_url_));
+  }
+
+  success = success &&
+    AddExtension(x509, &context, NID_subject_key_identifier, "hash") &&
+    (issuer == NULL || AddExtension(x509, &context,
+                                    NID_authority_key_identifier,
+                                    "keyid:always")) &&
+    X509_sign(x509, key_, EVP_sha256()) > 0;
+
+  if (!success) {
+    ERR_clear_error();
+    X509_free(x509);
+    return NULL;
+  }
+
+  return x509;
+}
+}  // namespace x509ls
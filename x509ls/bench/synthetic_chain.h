@@ -0,0 +1,94 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_BENCH_SYNTHETIC_CHAIN_H_
+#define X509LS_BENCH_SYNTHETIC_CHAIN_H_
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+// Generates certificate chains, for benchmarks and local test servers.
+//
+// A chain of depth N is a self-signed root, N - 2 intermediate CAs and an
+// end-entity certificate (depth 1 is a lone self-signed end-entity). Padding
+// certificates, unrelated to the chain, can be appended to the served chain to
+// imitate badly configured servers sending 100+ certificates.
+//
+// Every certificate shares one key, so even long chains generate quickly:
+// Only the names, serial numbers and signatures differ. This makes no
+// difference to chain building or signature verification costs.
+class SyntheticChain {
+ public:
+  enum KeyType {
+    kKeyTypeRSA,    // 2048 bit RSA.
+    kKeyTypeECDSA   // ECDSA P-256.
+  };
+
+  SyntheticChain();
+  ~SyntheticChain();
+
+  // Return a shared chain of |depth| certificates with |padding| padding
+  // certificates, generated on first use and kept until exit. Generation is
+  // far slower than anything benchmarked, so benchmarks share chains. Not
+  // thread safe.
+  //
+  // Returns NULL on error, setting |error_message|.
+  static const SyntheticChain* Shared(KeyType key_type, size_t depth,
+      size_t padding, string* error_message);
+
+  // Name |url| as the end-entity's OCSP responder, in an Authority
+  // Information Access extension. Call before Generate().
+  void SetOCSPResponderUrl(const string& url);
+
+  // Generate a chain of |depth| (>= 1) certificates with |key_type| keys.
+  // The end-entity's common name and DNS subjectAltName are |common_name|.
+  // Call once.
+  //
+  // Returns false on error, setting |error_message|.
+  bool Generate(KeyType key_type, size_t depth, const string& common_name,
+      string* error_message);
+
+  // Append |count| unrelated self-signed certificates to the served chain.
+  // Call after Generate().
+  bool AddPadding(size_t count, string* error_message);
+
+  // Return the chain as a server sends it: End-entity first, then the
+  // intermediates and any padding, without the root. Owned by the
+  // SyntheticChain.
+  STACK_OF(X509)* ServedChain() const;
+
+  // Return the root certificate, for trusting.
+  X509* Root() const;
+
+  // Return the end-entity certificate's private key.
+  EVP_PKEY* Key() const;
+
+  // Return the total DER size of the served chain, in bytes.
+  size_t ServedChainSize() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(SyntheticChain)
+
+  KeyType key_type_;
+  EVP_PKEY* key_;
+  X509* root_;
+  STACK_OF(X509)* served_;
+  long serial_;  // NOLINT(runtime/int)
+  string ocsp_responder_url_;
+
+  bool GenerateKey(string* error_message);
+
+  // Create and sign a certificate for |common_name|, issued by |issuer| (or
+  // self-signed if NULL). Non-CA certificates get a DNS subjectAltName.
+  X509* NewCertificate(const string& common_name, X509* issuer, bool is_ca);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_BENCH_SYNTHETIC_CHAIN_H_
@@ -7,7 +7,10 @@
 #include <openssl/bio.h>
 #include <openssl/pem.h>
 #include <openssl/x509v3.h>
+#include <stdio.h>
+#include <string.h>
 
+#include <algorithm>
 #include <sstream>
 
 #include "x509ls/base/openssl/bio_translator.h"
@@ -15,27 +18,47 @@
 using std::stringstream;
 
 namespace x509ls {
+namespace {
+// Block size of the Arena of a Certificate constructed without one: Enough
+// for the strings of a typical certificate.
+const size_t kOwnedArenaBlockSize = 8192;
+}  // namespace
+
 Certificate::Certificate(const X509& x509,
     bool is_in_trust_store,
     bool is_in_peer_chain,
-    bool is_in_validation_path)
+    bool is_in_validation_path,
+    bool is_revoked,
+    bool is_stapled,
+    Arena* arena)
   :
-    x509_(X509_dup(const_cast<X509*>(&x509))),
+    x509_(X509Handle::Share(const_cast<X509*>(&x509))),
+    owned_arena_(arena ? NULL : new Arena(kOwnedArenaBlockSize)),
     is_in_trust_store_(is_in_trust_store),
     is_in_peer_chain_(is_in_peer_chain),
-    is_in_validation_path_(is_in_validation_path) {
+    is_in_validation_path_(is_in_validation_path),
+    is_revoked_(is_revoked),
+    is_stapled_(is_stapled),
+    is_responder_good_(false) {
+  if (arena == NULL) {
+    arena = owned_arena_;
+  }
+
   const size_t kMaxSubjectLength = 1024;
   char subject[kMaxSubjectLength];
   X509_NAME_oneline(X509_get_subject_name(x509_.Get()),
       subject, sizeof subject);
-  subject_ = subject;
+  subject_ = arena->CopyString(subject, strlen(subject));
 
   X509_NAME* name = X509_get_subject_name(x509_.Get());
 
   // OID for Common Name.
   ASN1_OBJECT* obj = OBJ_txt2obj("2.5.4.3", 0);
 
-  // Build a one line description of all Common Names.
+  // Build a one line description of all Common Names, truncated as the
+  // subject.
+  char common_names[kMaxSubjectLength];
+  size_t common_names_length = 0;
   int pos = -1;
   while ((pos = X509_NAME_get_index_by_OBJ(name, obj, pos)) != -1) {
     X509_NAME_ENTRY* name_entry = X509_NAME_get_entry(name, pos);
@@ -43,36 +66,51 @@ Certificate::Certificate(const X509& x509,
 
     unsigned char* final_utf8_string;
     int length = ASN1_STRING_to_UTF8(&final_utf8_string, asn1_string);
-
-    if (!common_names_.empty()) {
-      common_names_.append("/");
+    if (length < 0) {
+      continue;
     }
 
-    common_names_.append("CN=");
-
-    common_names_.append(string(
-          reinterpret_cast<char*>(final_utf8_string), length));
+    const int written = snprintf(common_names + common_names_length,
+        sizeof common_names - common_names_length, "%sCN=%.*s",
+        common_names_length > 0 ? "/" : "", length,
+        reinterpret_cast<char*>(final_utf8_string));
+    common_names_length = std::min(common_names_length + written,
+        sizeof common_names - 1);
 
     OPENSSL_free(final_utf8_string);
   }
   ASN1_OBJECT_free(obj);
+  common_names_ = arena->CopyString(common_names, common_names_length);
 
-  // Text description.
+  // Text description, followed by the PEM, rendered into one BIO and copied
+  // once. The PEM is then served from the tail of the copy.
   BioTranslator x509_text_bio;
   X509_print_ex(x509_text_bio.Get(), x509_.Get(), 0, 0);
-  text_description_ = x509_text_bio.ToString();
-  text_description_.append(AsPEM());
+
+  const char* text;
+  size_t pem_offset;
+  x509_text_bio.View(&text, &pem_offset);
+
+  PEM_write_bio_X509(x509_text_bio.Get(), x509_.Get());
+
+  size_t text_length;
+  x509_text_bio.View(&text, &text_length);
+  text_description_ = arena->CopyString(text, text_length);
+
+  pem_.data = text_description_.data + pem_offset;
+  pem_.size = text_description_.size - pem_offset;
 }
 
 Certificate::~Certificate() {
+  delete owned_arena_;
 }
 
 string Certificate::Subject() const {
-  return subject_;
+  return subject_.ToString();
 }
 
 string Certificate::CommonNames() const {
-  return common_names_;
+  return common_names_.ToString();
 }
 
 bool Certificate::IsSelfSigned() const {
@@ -91,6 +129,26 @@ bool Certificate::IsInValidationPath() const {
   return is_in_validation_path_;
 }
 
+bool Certificate::IsRevoked() const {
+  return is_revoked_;
+}
+
+bool Certificate::IsStapled() const {
+  return is_stapled_;
+}
+
+bool Certificate::IsResponderGood() const {
+  return is_responder_good_;
+}
+
+void Certificate::SetRevoked() {
+  is_revoked_ = true;
+}
+
+void Certificate::SetResponderGood() {
+  is_responder_good_ = true;
+}
+
 string Certificate::NotAfterDate() const {
   const ASN1_TIME* not_after = X509_get_notAfter(x509_.Get());
   stringstream date;
@@ -141,14 +199,32 @@ bool Certificate::IsNumberString(const unsigned char* start, int length) {
 }
 
 string Certificate::TextDescription() const {
-  return text_description_;
+  return text_description_.ToString();
 }
 
 string Certificate::AsPEM() const {
-  BioTranslator pem_bio;
-  PEM_write_bio_X509(pem_bio.Get(), x509_.Get());
+  return pem_.ToString();
+}
+
+const ArenaString& Certificate::TextDescriptionView() const {
+  return text_description_;
+}
+
+const ArenaString& Certificate::PEMView() const {
+  return pem_;
+}
+
+string Certificate::AsDER() const {
+  const int length = i2d_X509(x509_.Get(), NULL);
+  if (length <= 0) {
+    return "";
+  }
+
+  string der(length, '\0');
+  unsigned char* data = reinterpret_cast<unsigned char*>(&der[0]);
+  i2d_X509(x509_.Get(), &data);
 
-  return pem_bio.ToString();
+  return der;
 }
 
 }  // namespace x509ls
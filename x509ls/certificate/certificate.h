@@ -10,25 +10,35 @@
 
 using std::string;
 
-#include "x509ls/base/openssl/scoped_openssl.h"
+#include "x509ls/base/arena.h"
+#include "x509ls/base/openssl/shared_openssl.h"
 #include "x509ls/base/types.h"
 
 namespace x509ls {
 // OpenSSL X509 certificate wrapper.
 //
 // X509 certificate with some simple accessors. Flags for marking certificates
-// as self-signed, in the trust store, peer chain or validation path.
+// as self-signed, in the trust store, peer chain or validation path, revoked,
+// stapled with a current OCSP response, or good according to its OCSP
+// responder.
 class Certificate {
  public:
-  // Construct a Certificate. Clones |x509|.
+  // Construct a Certificate. Shares |x509| by taking a reference on it rather
+  // than copying it, so |x509| must not be modified afterwards.
   //
   // Flags stating if the certificate |is_in_trust_store|, |is_in_peer_chain|,
-  // and |is_in_validation_path| are specific to the current trust store and
-  // SSL server, and so are determined externally.
+  // |is_in_validation_path|, |is_revoked| and |is_stapled| are specific to the
+  // current trust store and SSL server, and so are determined externally.
+  //
+  // The certificate's strings are stored in |arena|, which must outlive the
+  // Certificate, or in an Arena of its own if NULL.
   Certificate(const X509& x509,
       bool is_in_trust_store = false,
       bool is_in_peer_chain = false,
-      bool is_in_validation_path = false);
+      bool is_in_validation_path = false,
+      bool is_revoked = false,
+      bool is_stapled = false,
+      Arena* arena = NULL);
   ~Certificate();
 
   // Return the certificate subject in OpenSSL OneLine format.
@@ -50,6 +60,14 @@ class Certificate {
   // Return the certificate in PEM format.
   string AsPEM() const;
 
+  // Return TextDescription() and AsPEM() in place, without copying. Valid for
+  // the Certificate's lifetime.
+  const ArenaString& TextDescriptionView() const;
+  const ArenaString& PEMView() const;
+
+  // Return the certificate in DER format.
+  string AsDER() const;
+
   // Certificate flags.
   // Determined internally.
   bool IsSelfSigned() const;
@@ -58,19 +76,41 @@ class Certificate {
   bool IsInTrustStore() const;
   bool IsInPeerChain() const;
   bool IsInValidationPath() const;
+  bool IsRevoked() const;
+  bool IsStapled() const;
+
+  // Set after construction.
+  bool IsResponderGood() const;
+
+  // Mark the certificate as revoked, when that is only learnt after
+  // construction (e.g. from an OCSP responder).
+  void SetRevoked();
+
+  // Mark the certificate as good according to a current, trusted response
+  // from its OCSP responder.
+  void SetResponderGood();
 
  private:
   NO_COPY_AND_ASSIGN(Certificate)
 
-  ScopedOpenSSL<X509, void, X509_free> x509_;
+  X509Handle x509_;
+
+  // The Arena allocated when constructed without one, else NULL.
+  Arena* const owned_arena_;
+
+  ArenaString subject_;
+  ArenaString common_names_;
+  ArenaString text_description_;
 
-  string subject_;
-  string common_names_;
-  string text_description_;
+  // The tail of |text_description_|.
+  ArenaString pem_;
 
   bool is_in_trust_store_;
   bool is_in_peer_chain_;
   bool is_in_validation_path_;
+  bool is_revoked_;
+  bool is_stapled_;
+  bool is_responder_good_;
 
   static bool IsNumberString(const unsigned char* start, int length);
 };
@@ -0,0 +1,238 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/certificate/certificate_graph.h"
+
+#include <openssl/evp.h>
+#include <openssl/x509v3.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "x509ls/certificate/trust_store.h"
+
+using std::pair;
+
+namespace x509ls {
+namespace {
+typedef multimap<unsigned long, size_t> NameIndex;  // NOLINT(runtime/int)
+typedef multimap<string, size_t> KeyIdIndex;
+
+bool IsShorter(const vector<size_t>& a, const vector<size_t>& b) {
+  return a.size() < b.size();
+}
+}  // namespace
+
+CertificateGraph::CertificateGraph(TrustStore* trust_store)
+  :
+    trust_store_(trust_store) {
+}
+
+CertificateGraph::~CertificateGraph() {
+  for (vector<Node*>::iterator it = nodes_.begin(); it != nodes_.end();
+      ++it) {
+    delete *it;
+  }
+}
+
+void CertificateGraph::Add(X509* x509) {
+  AddNode(x509, false);
+}
+
+void CertificateGraph::FindPaths(X509* leaf,
+    vector<vector<X509Handle> >* paths) {
+  const size_t leaf_index = AddNode(leaf, false);
+
+  vector<size_t> path;
+  vector<vector<size_t> > found;
+  size_t steps = 0;
+  Search(leaf_index, &path, &found, &steps);
+
+  std::stable_sort(found.begin(), found.end(), IsShorter);
+
+  for (size_t i = 0; i < found.size(); ++i) {
+    paths->push_back(vector<X509Handle>());
+    vector<X509Handle>& x509_path = paths->back();
+    for (size_t j = 0; j < found[i].size(); ++j) {
+      x509_path.push_back(nodes_[found[i][j]]->x509);
+    }
+  }
+}
+
+size_t CertificateGraph::Size() const {
+  return nodes_.size();
+}
+
+size_t CertificateGraph::AddNode(X509* x509, bool is_anchor) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_size = 0;
+  string fingerprint;
+  if (X509_digest(x509, EVP_sha1(), digest, &digest_size)) {
+    fingerprint.assign(reinterpret_cast<const char*>(digest), digest_size);
+
+    map<string, size_t>::const_iterator it = by_fingerprint_.find(fingerprint);
+    if (it != by_fingerprint_.end()) {
+      if (is_anchor) {
+        nodes_[it->second]->is_anchor = true;
+      }
+      return it->second;
+    }
+  }
+
+  Node* node = new Node;
+  node->x509 = X509Handle::Share(x509);
+  node->subject_key_id = SubjectKeyId(x509);
+  node->authority_key_id = AuthorityKeyId(x509);
+  node->is_anchor = is_anchor;
+  node->are_anchors_loaded = false;
+
+  const size_t index = nodes_.size();
+  nodes_.push_back(node);
+
+  const unsigned long subject_hash =  // NOLINT(runtime/int)
+    X509_subject_name_hash(x509);
+  const unsigned long issuer_hash =  // NOLINT(runtime/int)
+    X509_issuer_name_hash(x509);
+
+  // Its issuers: By SKI if it names one, and by name those without an SKI to
+  // match.
+  if (!node->authority_key_id.empty()) {
+    pair<KeyIdIndex::iterator, KeyIdIndex::iterator> range =
+      by_subject_key_id_.equal_range(node->authority_key_id);
+    for (KeyIdIndex::iterator it = range.first; it != range.second; ++it) {
+      Link(index, it->second);
+    }
+  }
+  pair<NameIndex::iterator, NameIndex::iterator> issuers =
+    by_subject_.equal_range(issuer_hash);
+  for (NameIndex::iterator it = issuers.first; it != issuers.second; ++it) {
+    if (node->authority_key_id.empty() ||
+        nodes_[it->second]->subject_key_id.empty()) {
+      Link(index, it->second);
+    }
+  }
+
+  // The certificates it issued, likewise.
+  if (!node->subject_key_id.empty()) {
+    pair<KeyIdIndex::iterator, KeyIdIndex::iterator> range =
+      by_authority_key_id_.equal_range(node->subject_key_id);
+    for (KeyIdIndex::iterator it = range.first; it != range.second; ++it) {
+      Link(it->second, index);
+    }
+  }
+  pair<NameIndex::iterator, NameIndex::iterator> subjects =
+    by_issuer_.equal_range(subject_hash);
+  for (NameIndex::iterator it = subjects.first; it != subjects.second; ++it) {
+    if (node->subject_key_id.empty() ||
+        nodes_[it->second]->authority_key_id.empty()) {
+      Link(it->second, index);
+    }
+  }
+
+  if (!fingerprint.empty()) {
+    by_fingerprint_[fingerprint] = index;
+  }
+  by_subject_.insert(std::make_pair(subject_hash, index));
+  by_issuer_.insert(std::make_pair(issuer_hash, index));
+  if (!node->subject_key_id.empty()) {
+    by_subject_key_id_.insert(std::make_pair(node->subject_key_id, index));
+  }
+  if (!node->authority_key_id.empty()) {
+    by_authority_key_id_.insert(std::make_pair(node->authority_key_id, index));
+  }
+
+  return index;
+}
+
+void CertificateGraph::Link(size_t subject, size_t issuer) {
+  if (subject == issuer) {
+    return;
+  }
+
+  vector<size_t>& issuers = nodes_[subject]->issuers;
+  if (std::find(issuers.begin(), issuers.end(), issuer) != issuers.end()) {
+    return;
+  }
+
+  if (X509_check_issued(nodes_[issuer]->x509.Get(),
+        nodes_[subject]->x509.Get()) == X509_V_OK) {
+    issuers.push_back(issuer);
+  }
+}
+
+void CertificateGraph::LoadAnchors(size_t index) {
+  if (nodes_[index]->are_anchors_loaded) {
+    return;
+  }
+  nodes_[index]->are_anchors_loaded = true;
+
+  vector<X509Handle> anchors;
+  trust_store_->FindBySubject(
+      X509_get_issuer_name(nodes_[index]->x509.Get()), &anchors);
+
+  for (vector<X509Handle>::const_iterator it = anchors.begin();
+      it != anchors.end(); ++it) {
+    AddNode(it->Get(), true);
+  }
+}
+
+void CertificateGraph::Search(size_t index, vector<size_t>* path,
+    vector<vector<size_t> >* found, size_t* steps) {
+  if (found->size() >= kMaxPaths || *steps >= kMaxSteps) {
+    return;
+  }
+  ++*steps;
+
+  path->push_back(index);
+
+  if (nodes_[index]->is_anchor && path->size() > 1) {
+    found->push_back(*path);
+  } else if (path->size() < kMaxPathLength) {
+    // The anchors loaded are linked as issuers, so copy the list first.
+    LoadAnchors(index);
+    const vector<size_t> issuers = nodes_[index]->issuers;
+
+    for (vector<size_t>::const_iterator it = issuers.begin();
+        it != issuers.end(); ++it) {
+      if (std::find(path->begin(), path->end(), *it) == path->end()) {
+        Search(*it, path, found, steps);
+      }
+    }
+  }
+
+  path->pop_back();
+}
+
+// static
+string CertificateGraph::SubjectKeyId(X509* x509) {
+  ASN1_OCTET_STRING* key_id = static_cast<ASN1_OCTET_STRING*>(
+      X509_get_ext_d2i(x509, NID_subject_key_identifier, NULL, NULL));
+  if (key_id == NULL) {
+    return "";
+  }
+
+  const string result(reinterpret_cast<const char*>(key_id->data),
+      key_id->length);
+  ASN1_OCTET_STRING_free(key_id);
+
+  return result;
+}
+
+// static
+string CertificateGraph::AuthorityKeyId(X509* x509) {
+  AUTHORITY_KEYID* authority_key_id = static_cast<AUTHORITY_KEYID*>(
+      X509_get_ext_d2i(x509, NID_authority_key_identifier, NULL, NULL));
+  if (authority_key_id == NULL) {
+    return "";
+  }
+
+  string result;
+  if (authority_key_id->keyid != NULL) {
+    result.assign(reinterpret_cast<const char*>(authority_key_id->keyid->data),
+        authority_key_id->keyid->length);
+  }
+  AUTHORITY_KEYID_free(authority_key_id);
+
+  return result;
+}
+}  // namespace x509ls
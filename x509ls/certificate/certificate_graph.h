@@ -0,0 +1,122 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CERTIFICATE_CERTIFICATE_GRAPH_H_
+#define X509LS_CERTIFICATE_CERTIFICATE_GRAPH_H_
+
+#include <openssl/x509.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/openssl/shared_openssl.h"
+#include "x509ls/base/types.h"
+
+using std::map;
+using std::multimap;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+class TrustStore;
+// A graph of certificates and their possible issuers, to find every path from
+// an end-entity certificate to a trust anchor, where OpenSSL only builds one.
+//
+// Certificates are indexed by subject name and Subject Key Identifier, and by
+// issuer name and Authority Key Identifier, so each one added is linked to
+// its issuers and the certificates it issued already present. Certificates
+// with an AKI key identifier are matched to issuers by SKI, others by name;
+// either way the issuer must pass X509_check_issued(). Signatures and
+// validity periods aren't checked: Verify each path found.
+//
+// The graph is built incrementally: From the certificates added, e.g. a
+// server's chain, and from the trust store, queried by name for the issuers
+// of each certificate searched the first time it is searched. Trust store
+// certificates are the anchors that end paths.
+//
+// Searches are bounded by kMaxPathLength, kMaxPaths and kMaxSteps.
+class CertificateGraph {
+ public:
+  // Construct an empty graph, finding anchors in |trust_store|, which must
+  // outlive the graph.
+  explicit CertificateGraph(TrustStore* trust_store);
+  ~CertificateGraph();
+
+  // Add |x509|, unless already present. |x509| is shared, not copied.
+  void Add(X509* x509);
+
+  // Append every path found from |leaf|, which must have been added, to a
+  // trust anchor to |paths|: End-entity certificate first, shortest paths
+  // first.
+  void FindPaths(X509* leaf, vector<vector<X509Handle> >* paths);
+
+  // Return the number of certificates in the graph.
+  size_t Size() const;
+
+  // Longest path searched, in certificates.
+  static const size_t kMaxPathLength = 10;
+
+  // Most paths found by one FindPaths().
+  static const size_t kMaxPaths = 16;
+
+  // Most certificates visited by one FindPaths().
+  static const size_t kMaxSteps = 1024;
+
+ private:
+  NO_COPY_AND_ASSIGN(CertificateGraph)
+
+  struct Node {
+    X509Handle x509;
+
+    // Key identifiers, or "" if absent.
+    string subject_key_id;
+    string authority_key_id;
+
+    // In the trust store.
+    bool is_anchor;
+
+    // The trust store has been queried for issuers.
+    bool are_anchors_loaded;
+
+    // Indexes of the certificates issuing this one.
+    vector<size_t> issuers;
+  };
+
+  TrustStore* const trust_store_;
+
+  vector<Node*> nodes_;
+
+  // Node indexes, by SHA-1 fingerprint.
+  map<string, size_t> by_fingerprint_;
+
+  // Node indexes, by subject and issuer name hash, and by key identifier.
+  multimap<unsigned long, size_t> by_subject_;  // NOLINT(runtime/int)
+  multimap<unsigned long, size_t> by_issuer_;  // NOLINT(runtime/int)
+  multimap<string, size_t> by_subject_key_id_;
+  multimap<string, size_t> by_authority_key_id_;
+
+  // Add |x509|, or find it, returning its index. Marks it as an anchor if
+  // |is_anchor|.
+  size_t AddNode(X509* x509, bool is_anchor);
+
+  // Link |issuer| as an issuer of |subject| if it issued it.
+  void Link(size_t subject, size_t issuer);
+
+  // Add the trust store's certificates named as the issuer of |index|.
+  void LoadAnchors(size_t index);
+
+  // Extend |path| with |index| and on towards the anchors, depth first,
+  // appending each complete path to |found|. Counts the certificates visited
+  // in |steps|.
+  void Search(size_t index, vector<size_t>* path,
+      vector<vector<size_t> >* found, size_t* steps);
+
+  // Return the key identifier of |x509|'s Subject or Authority Key Identifier
+  // extension, or "".
+  static string SubjectKeyId(X509* x509);
+  static string AuthorityKeyId(X509* x509);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CERTIFICATE_CERTIFICATE_GRAPH_H_
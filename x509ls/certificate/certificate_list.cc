@@ -3,40 +3,150 @@
 
 #include "x509ls/certificate/certificate_list.h"
 
+#include <string.h>
+
+#include <new>
+
+#include "x509ls/base/arena.h"
+
 namespace x509ls {
-CertificateList::CertificateList() {
+namespace {
+// Expected bytes of subject and common names per certificate, to reserve.
+const size_t kNamesSizeHint = 128;
+}  // namespace
+
+// static
+const size_t CertificateList::kDateLength;
+
+CertificateList::CertificateList(Arena* arena)
+  :
+    arena_(arena) {
 }
 
 // virtual
 CertificateList::~CertificateList() {
-  for (vector<Certificate*>::iterator it = list_.begin();
-      it != list_.end(); ++it) {
-    delete *it;
+  for (vector<Certificate*>::iterator it = certificates_.begin();
+      it != certificates_.end(); ++it) {
+    if (arena_) {
+      // The memory is released with the arena.
+      (*it)->~Certificate();
+    } else {
+      delete *it;
+    }
   }
 }
 
+void CertificateList::Reserve(size_t count) {
+  entries_.reserve(count);
+  names_.reserve(count * kNamesSizeHint);
+  certificates_.reserve(count);
+}
+
 void CertificateList::Add(const X509& x509,
     bool is_in_trust_store,
     bool is_in_peer_chain,
-    bool is_in_validation_path) {
-  list_.push_back(new Certificate(x509,
+    bool is_in_validation_path,
+    bool is_revoked,
+    bool is_stapled) {
+  Certificate* certificate;
+  if (arena_) {
+    void* memory = arena_->Allocate(sizeof(Certificate));
+    certificate = new(memory) Certificate(x509,
+        is_in_trust_store,
+        is_in_peer_chain,
+        is_in_validation_path,
+        is_revoked,
+        is_stapled,
+        arena_);
+  } else {
+    certificate = new Certificate(x509,
         is_in_trust_store,
         is_in_peer_chain,
-        is_in_validation_path));
+        is_in_validation_path,
+        is_revoked,
+        is_stapled);
+  }
+  certificates_.push_back(certificate);
+
+  const string subject = certificate->Subject();
+  const string common_names = certificate->CommonNames();
+
+  Entry entry;
+  entry.subject_offset = AppendName(subject);
+  entry.subject_size = subject.size();
+  entry.common_names_offset = AppendName(common_names);
+  entry.common_names_size = common_names.size();
+
+  string date = certificate->NotAfterDate();
+  date.resize(kDateLength, '?');
+  memcpy(entry.not_after_date, date.data(), kDateLength);
+
+  entry.flags = 0;
+  if (certificate->IsSelfSigned()) {
+    entry.flags |= kFlagSelfSigned;
+  }
+  if (is_in_trust_store) {
+    entry.flags |= kFlagInTrustStore;
+  }
+  if (is_in_peer_chain) {
+    entry.flags |= kFlagInPeerChain;
+  }
+  if (is_in_validation_path) {
+    entry.flags |= kFlagInValidationPath;
+  }
+  if (is_revoked) {
+    entry.flags |= kFlagRevoked;
+  }
+  if (is_stapled) {
+    entry.flags |= kFlagStapled;
+  }
+
+  entries_.push_back(entry);
 }
 
 // virtual
 string CertificateList::Name(size_t index) const {
-  return list_[index]->Subject();
+  const Entry& entry = entries_[index];
+  return names_.substr(entry.subject_offset, entry.subject_size);
 }
 
 // virtual
 size_t CertificateList::Size() const {
-  return list_.size();
+  return entries_.size();
+}
+
+string CertificateList::CommonNames(size_t index) const {
+  const Entry& entry = entries_[index];
+  return names_.substr(entry.common_names_offset, entry.common_names_size);
+}
+
+string CertificateList::NotAfterDate(size_t index) const {
+  return string(entries_[index].not_after_date, kDateLength);
+}
+
+unsigned int CertificateList::Flags(size_t index) const {
+  return entries_[index].flags;
+}
+
+void CertificateList::SetRevoked(size_t index) {
+  entries_[index].flags |= kFlagRevoked;
+  certificates_[index]->SetRevoked();
+}
+
+void CertificateList::SetResponderGood(size_t index) {
+  entries_[index].flags |= kFlagResponderGood;
+  certificates_[index]->SetResponderGood();
 }
 
 const Certificate& CertificateList::operator[](size_t index) const {
-  return *(list_[index]);
+  return *(certificates_[index]);
+}
+
+uint32_t CertificateList::AppendName(const string& name) {
+  const uint32_t offset = names_.size();
+  names_.append(name);
+
+  return offset;
 }
 }  // namespace x509ls
 
@@ -5,6 +5,7 @@
 #define X509LS_CERTIFICATE_CERTIFICATE_LIST_H_
 
 #include <openssl/x509.h>
+#include <stdint.h>
 
 #include <string>
 #include <vector>
@@ -17,19 +18,46 @@ using std::string;
 using std::vector;
 
 namespace x509ls {
+class Arena;
 // A list of Certificates.
+//
+// The fields read when painting or scanning the list (subject, common names,
+// expiry date and flags) are stored contiguously: One packed Entry per
+// certificate, with the strings in one shared buffer. The Certificates
+// themselves, holding the X509 and its text description, are only touched to
+// render or export a single certificate. Indices are stable, as certificates
+// are only ever appended.
 class CertificateList : public ListModel {
  public:
-  CertificateList();
+  // Certificate flags, see Flags().
+  enum Flag {
+    kFlagSelfSigned = 1 << 0,
+    kFlagInTrustStore = 1 << 1,
+    kFlagInPeerChain = 1 << 2,
+    kFlagInValidationPath = 1 << 3,
+    kFlagRevoked = 1 << 4,
+    kFlagStapled = 1 << 5,
+    kFlagResponderGood = 1 << 6
+  };
+
+  // Construct an empty list. The Certificates are placed in |arena|, which
+  // must outlive the list, or allocated individually if NULL.
+  explicit CertificateList(Arena* arena = NULL);
   virtual ~CertificateList();
 
+  // Make room for |count| certificates, to add without reallocating.
+  void Reserve(size_t count);
+
   // Add certificate |x509| with flags |is_in_trust_store|, |is_in_peer_chain|,
-  // |is_in_validation_path|. |x509| is cloned. The certificate is added to the
-  // end of the list.
+  // |is_in_validation_path|, |is_revoked| and |is_stapled|. |x509| is shared,
+  // not copied.
+  // The certificate is added to the end of the list.
   void Add(const X509& x509,
       bool is_in_trust_store = false,
       bool is_in_peer_chain = false,
-      bool is_in_validation_path = false);
+      bool is_in_validation_path = false,
+      bool is_revoked = false,
+      bool is_stapled = false);
 
   // Return the Subject() of the certificate at |index|.
   virtual string Name(size_t index) const;
@@ -37,13 +65,52 @@ class CertificateList : public ListModel {
   // Return the number of certificates.
   virtual size_t Size() const;
 
+  // Return the CommonNames() of the certificate at |index|.
+  string CommonNames(size_t index) const;
+
+  // Return the NotAfterDate() of the certificate at |index|.
+  string NotAfterDate(size_t index) const;
+
+  // Return the flags of the certificate at |index|, a bitwise OR of Flag
+  // values.
+  unsigned int Flags(size_t index) const;
+
+  // Mark the certificate at |index| as revoked, see Certificate::SetRevoked().
+  void SetRevoked(size_t index);
+
+  // Mark the certificate at |index| as good according to its OCSP responder,
+  // see Certificate::SetResponderGood().
+  void SetResponderGood(size_t index);
+
   // Return the certificate at |index|.
   const Certificate& operator[](size_t index) const;
 
  private:
   NO_COPY_AND_ASSIGN(CertificateList)
 
-  vector<Certificate*> list_;
+  // Length of a NotAfterDate(), YYYY-MM-DD.
+  static const size_t kDateLength = 10;
+
+  struct Entry {
+    // Offsets and sizes in |names_|.
+    uint32_t subject_offset;
+    uint32_t subject_size;
+    uint32_t common_names_offset;
+    uint32_t common_names_size;
+
+    // Unterminated.
+    char not_after_date[kDateLength];
+    uint8_t flags;
+  };
+
+  Arena* const arena_;
+
+  vector<Entry> entries_;
+  string names_;
+
+  vector<Certificate*> certificates_;
+
+  uint32_t AppendName(const string& name);
 };
 }  // namespace x509ls
 
@@ -0,0 +1,203 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/certificate/chain_cache.h"
+
+#include <errno.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <sstream>
+
+using std::stringstream;
+
+namespace x509ls {
+// static
+const char* ChainCache::kFileMagic = "x509ls-chain-cache 1";
+
+ChainCache::ChainCache(const string& directory, int ttl_seconds)
+  :
+    directory_(directory),
+    ttl_seconds_(ttl_seconds) {
+}
+
+ChainCache::~ChainCache() {
+}
+
+bool ChainCache::Init(string* error_message) {
+  *error_message = "";
+
+  if (mkdir(directory_.c_str(), 0700) != 0 && errno != EEXIST) {
+    *error_message = "Unable to create cache directory " + directory_ + ": ";
+    error_message->append(strerror(errno));
+    return false;
+  }
+
+  struct stat directory_stat;
+  if (stat(directory_.c_str(), &directory_stat) != 0 ||
+      !S_ISDIR(directory_stat.st_mode)) {
+    *error_message = "Not a directory: " + directory_;
+    return false;
+  }
+
+  return true;
+}
+
+// static
+string ChainCache::Key(const string& host, const string& port,
+    const string& sni_name, const string& tls_method_name,
+    const string& tls_auth_type_name) {
+  // Tab separated: None of the fields can contain a tab.
+  stringstream key;
+  key << host << "\t" << port << "\t" << sni_name << "\t";
+  key << tls_method_name << "\t" << tls_auth_type_name;
+
+  return key.str();
+}
+
+bool ChainCache::Lookup(const string& key, vector<string>* der_chain,
+    time_t* fetch_time) const {
+  der_chain->clear();
+
+  FILE* file = fopen(EntryFilename(key).c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+
+  string contents;
+  char buffer[8192];
+  size_t bytes_read;
+  while ((bytes_read = fread(buffer, 1, sizeof buffer, file)) > 0) {
+    contents.append(buffer, bytes_read);
+  }
+  fclose(file);
+
+  // Header: magic, key, fetch time and certificate count, one per line.
+  string lines[4];
+  size_t offset = 0;
+  for (int i = 0; i < 4; ++i) {
+    const size_t newline = contents.find('\n', offset);
+    if (newline == string::npos) {
+      return false;
+    }
+    lines[i] = contents.substr(offset, newline - offset);
+    offset = newline + 1;
+  }
+
+  if (lines[0] != kFileMagic || lines[1] != key) {
+    return false;
+  }
+
+  const time_t stored_time = strtol(lines[2].c_str(), NULL, 10);
+  const long count =  // NOLINT(runtime/int)
+    strtol(lines[3].c_str(), NULL, 10);
+  const time_t now = time(NULL);
+  if (count <= 0 || stored_time > now || now - stored_time > ttl_seconds_) {
+    return false;
+  }
+
+  // Body: Each certificate is a length line followed by the DER bytes.
+  for (long i = 0; i < count; ++i) {  // NOLINT(runtime/int)
+    const size_t newline = contents.find('\n', offset);
+    if (newline == string::npos) {
+      der_chain->clear();
+      return false;
+    }
+
+    const size_t length = strtoul(
+        contents.substr(offset, newline - offset).c_str(), NULL, 10);
+    offset = newline + 1;
+
+    if (length == 0 || length > contents.size() - offset) {
+      der_chain->clear();
+      return false;
+    }
+
+    der_chain->push_back(contents.substr(offset, length));
+    offset += length;
+  }
+
+  *fetch_time = stored_time;
+
+  return true;
+}
+
+bool ChainCache::Store(const string& key, const vector<string>& der_chain,
+    time_t fetch_time) {
+  if (der_chain.empty()) {
+    return false;
+  }
+
+  const string filename = EntryFilename(key);
+
+  // Unique per process and per call: Batch worker threads may store the same
+  // entry concurrently.
+  static int temp_file_count = 0;
+  stringstream temp_filename;
+  temp_filename << filename << ".tmp." << getpid() << ".";
+  temp_filename << __sync_fetch_and_add(&temp_file_count, 1);
+
+  FILE* file = fopen(temp_filename.str().c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  stringstream header;
+  header << kFileMagic << "\n";
+  header << key << "\n";
+  header << static_cast<long>(fetch_time) << "\n";  // NOLINT(runtime/int)
+  header << der_chain.size() << "\n";
+
+  const string header_text = header.str();
+  bool success = fwrite(header_text.data(), 1, header_text.size(), file) ==
+    header_text.size();
+
+  for (vector<string>::const_iterator it = der_chain.begin();
+      success && it != der_chain.end();
+      ++it) {
+    stringstream length;
+    length << it->size() << "\n";
+    const string length_text = length.str();
+
+    success = fwrite(length_text.data(), 1, length_text.size(), file) ==
+      length_text.size() &&
+      fwrite(it->data(), 1, it->size(), file) == it->size();
+  }
+
+  if (fclose(file) != 0) {
+    success = false;
+  }
+
+  if (!success || rename(temp_filename.str().c_str(), filename.c_str()) != 0) {
+    unlink(temp_filename.str().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+int ChainCache::TTL() const {
+  return ttl_seconds_;
+}
+
+string ChainCache::EntryFilename(const string& key) const {
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1(reinterpret_cast<const unsigned char*>(key.data()), key.size(), digest);
+
+  static const char kHexDigits[] = "0123456789abcdef";
+  string filename = directory_;
+  filename.append("/");
+  for (size_t i = 0; i < sizeof digest; ++i) {
+    filename.push_back(kHexDigits[digest[i] >> 4]);
+    filename.push_back(kHexDigits[digest[i] & 0xf]);
+  }
+  filename.append(".chain");
+
+  return filename;
+}
+}  // namespace x509ls
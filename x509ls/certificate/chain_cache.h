@@ -0,0 +1,81 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CERTIFICATE_CHAIN_CACHE_H_
+#define X509LS_CERTIFICATE_CHAIN_CACHE_H_
+
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// Persistent on-disk cache of server certificate chains.
+//
+// Each entry holds one server's certificate chain (as DER encoded
+// certificates, end-entity certificate first) and the time it was fetched.
+// Entries are keyed by the connection parameters which can affect the chain
+// served: host, port, SNI name, TLS method and authentication type. See Key().
+//
+// Each entry is stored in its own file in the cache directory, named after a
+// hash of the key. Entries are written to a temporary file and renamed into
+// place, so concurrent x509ls processes never see a partially written entry.
+//
+// Entries older than the TTL are treated as missing, but are not deleted: The
+// next successful fetch overwrites them.
+class ChainCache {
+ public:
+  // Construct a ChainCache stored in |directory|, with entries valid for
+  // |ttl_seconds| after being fetched.
+  ChainCache(const string& directory, int ttl_seconds);
+  ~ChainCache();
+
+  // Create the cache directory if necessary.
+  //
+  // Returns true iif the directory exists or was created. On error,
+  // |error_message| is set to a short string describing the problem.
+  bool Init(string* error_message);
+
+  // Return the cache key for the given connection parameters.
+  static string Key(const string& host, const string& port,
+      const string& sni_name, const string& tls_method_name,
+      const string& tls_auth_type_name);
+
+  // Look up the entry for |key|.
+  //
+  // Returns true iif an entry exists and was fetched within the TTL. On
+  // success |der_chain| is set to the cached chain and |fetch_time| to the
+  // time it was fetched.
+  bool Lookup(const string& key, vector<string>* der_chain,
+      time_t* fetch_time) const;
+
+  // Store |der_chain|, fetched at |fetch_time|, as the entry for |key|,
+  // replacing any existing entry.
+  //
+  // Returns true iif the entry was written successfully.
+  bool Store(const string& key, const vector<string>& der_chain,
+      time_t fetch_time);
+
+  // Return the cache TTL in seconds.
+  int TTL() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(ChainCache)
+
+  const string directory_;
+  const int ttl_seconds_;
+
+  // Return the filename of the entry for |key|.
+  string EntryFilename(const string& key) const;
+
+  // First line of every cache entry file.
+  static const char* kFileMagic;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CERTIFICATE_CHAIN_CACHE_H_
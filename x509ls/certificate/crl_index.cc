@@ -0,0 +1,581 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/certificate/crl_index.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
+#include <openssl/x509v3.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+using std::map;
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+const char kFileMagic[16] = "x509ls-crl-idx3";
+
+// Return true iif |issuer| may sign CRLs: A keyUsage extension must allow it.
+bool MaySignCRLs(X509* issuer) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  return (X509_get_extension_flags(issuer) & EXFLAG_KUSAGE) == 0 ||
+    (X509_get_key_usage(issuer) & KU_CRL_SIGN) != 0;
+#else
+  X509_check_purpose(issuer, -1, 0);
+  return (issuer->ex_flags & EXFLAG_KUSAGE) == 0 ||
+    (issuer->ex_kusage & KU_CRL_SIGN) != 0;
+#endif
+}
+}  // namespace
+
+// static
+const char CRLIndex::kCacheFilename[] = ".x509ls-crl-index";
+
+// static
+const size_t CRLIndex::kNameHashSize;
+
+CRLIndex::CRLIndex()
+  :
+    mapping_(NULL),
+    mapping_size_(0),
+    header_(NULL),
+    crls_(NULL),
+    serials_(NULL),
+    der_(NULL) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+CRLIndex::~CRLIndex() {
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+  }
+
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool CRLIndex::Open(const string& directory, string* error_message) {
+  *error_message = "";
+
+  vector<string> filenames;
+  unsigned char fingerprint[SHA_DIGEST_LENGTH];
+  if (!ListDirectory(directory, &filenames, fingerprint, error_message)) {
+    return false;
+  }
+
+  const string cache_filename = directory + "/" + kCacheFilename;
+  if (Map(cache_filename, fingerprint)) {
+    return true;
+  }
+
+  Build(filenames, fingerprint, &built_index_);
+
+  // Unwritable directories still get an index, just not a cached one.
+  Write(cache_filename, built_index_);
+
+  return Attach(built_index_.data(), built_index_.size(), fingerprint);
+}
+
+CRLIndex::Status CRLIndex::Lookup(const X509* x509, X509* issuer,
+    time_t now) const {
+  if (header_ == NULL || issuer == NULL) {
+    return kStatusUnknown;
+  }
+
+  X509* mutable_x509 = const_cast<X509*>(x509);
+
+  unsigned char name_hash[kNameHashSize];
+  if (!NameHash(X509_get_issuer_name(mutable_x509), name_hash)) {
+    return kStatusUnknown;
+  }
+
+  const IndexedCRL* crls_end = crls_ + header_->crl_count;
+  const IndexedCRL* first = std::lower_bound(crls_, crls_end, name_hash,
+      NameHashLess);
+  const IndexedCRL* last = std::upper_bound(first, crls_end, name_hash,
+      NameHashGreater);
+  if (first == last) {
+    return kStatusUnknown;
+  }
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_size = 0;
+  if (!X509_pubkey_digest(issuer, EVP_sha256(), digest, &digest_size)) {
+    return kStatusUnknown;
+  }
+  const string key_hash(reinterpret_cast<const char*>(digest), digest_size);
+
+  Serial serial;
+  const bool has_serial =
+    SerialFromASN1(X509_get_serialNumber(mutable_x509), &serial);
+
+  // Revoked if on any of the issuer's CRLs, good if any current one doesn't
+  // list it.
+  Status status = kStatusUnknown;
+  for (const IndexedCRL* crl = first; crl != last; ++crl) {
+    if ((crl->this_update != 0 && now < crl->this_update) ||
+        !IsSignedBy(crl, issuer, key_hash)) {
+      continue;
+    }
+
+    const Serial* serials = serials_ + crl->first_serial;
+    if (has_serial && std::binary_search(serials,
+          serials + crl->serial_count, serial, SerialLess)) {
+      return kStatusRevoked;
+    }
+
+    if (crl->next_update == 0 || now < crl->next_update) {
+      status = kStatusGood;
+    }
+  }
+
+  return status;
+}
+
+size_t CRLIndex::CRLCount() const {
+  return header_ ? header_->crl_count : 0;
+}
+
+size_t CRLIndex::SerialCount() const {
+  return header_ ? header_->serial_count : 0;
+}
+
+bool CRLIndex::IsMapped() const {
+  return mapping_ != NULL;
+}
+
+bool CRLIndex::Attach(const char* data, size_t size,
+    const unsigned char* fingerprint) {
+  if (size < sizeof(Header)) {
+    return false;
+  }
+
+  const Header* header = reinterpret_cast<const Header*>(data);
+  if (memcmp(header->magic, kFileMagic, sizeof header->magic) != 0 ||
+      memcmp(header->fingerprint, fingerprint,
+        sizeof header->fingerprint) != 0) {
+    return false;
+  }
+
+  const uint64_t serials_offset = sizeof(Header) +
+    static_cast<uint64_t>(header->crl_count) * sizeof(IndexedCRL);
+  const uint64_t der_offset = serials_offset +
+    static_cast<uint64_t>(header->serial_count) * sizeof(Serial);
+  if (der_offset > size || header->der_size != size - der_offset) {
+    return false;
+  }
+
+  const IndexedCRL* crls = reinterpret_cast<const IndexedCRL*>(
+      data + sizeof(Header));
+  for (uint32_t i = 0; i < header->crl_count; ++i) {
+    if (crls[i].first_serial > header->serial_count ||
+        crls[i].serial_count > header->serial_count - crls[i].first_serial ||
+        crls[i].der_offset > header->der_size ||
+        crls[i].der_length > header->der_size - crls[i].der_offset) {
+      return false;
+    }
+  }
+
+  header_ = header;
+  crls_ = crls;
+  serials_ = reinterpret_cast<const Serial*>(data + serials_offset);
+  der_ = reinterpret_cast<const unsigned char*>(data + der_offset);
+
+  return true;
+}
+
+bool CRLIndex::Map(const string& filename, const unsigned char* fingerprint) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+
+  const size_t size = file_stat.st_size;
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  if (!Attach(static_cast<const char*>(mapping), size, fingerprint)) {
+    munmap(mapping, size);
+    return false;
+  }
+
+  mapping_ = mapping;
+  mapping_size_ = size;
+
+  return true;
+}
+
+bool CRLIndex::IsSignedBy(const IndexedCRL* crl, X509* issuer,
+    const string& key_hash) const {
+  const uint32_t crl_index = crl - crls_;
+  const string key =
+    string(reinterpret_cast<const char*>(&crl_index), sizeof crl_index) +
+    key_hash;
+
+  pthread_mutex_lock(&mutex_);
+  map<string, bool>::const_iterator it = signatures_.find(key);
+  const bool is_known = it != signatures_.end();
+  const bool is_signed = is_known && it->second;
+  pthread_mutex_unlock(&mutex_);
+
+  if (is_known) {
+    return is_signed;
+  }
+
+  // Racing threads may both verify: Either result is the same.
+  bool is_valid = false;
+  const unsigned char* der = der_ + crl->der_offset;
+  X509_CRL* x509_crl = d2i_X509_CRL(NULL, &der, crl->der_length);
+  EVP_PKEY* pkey = X509_get_pubkey(issuer);
+  if (x509_crl != NULL && pkey != NULL && MaySignCRLs(issuer)) {
+    is_valid = X509_CRL_verify(x509_crl, pkey) > 0;
+  }
+
+  // Only the DER is signed: The serial numbers and times looked up must be
+  // the ones it holds.
+  PendingCRL parsed;
+  if (is_valid) {
+    is_valid = ParseCRL(x509_crl, &parsed) && Matches(crl, parsed);
+  }
+  EVP_PKEY_free(pkey);
+  X509_CRL_free(x509_crl);
+  ERR_clear_error();
+
+  pthread_mutex_lock(&mutex_);
+  signatures_[key] = is_valid;
+  pthread_mutex_unlock(&mutex_);
+
+  return is_valid;
+}
+
+bool CRLIndex::Matches(const IndexedCRL* crl, const PendingCRL& parsed) const {
+  if (parsed.name_hash.size() != kNameHashSize ||
+      memcmp(crl->name_hash, parsed.name_hash.data(), kNameHashSize) != 0 ||
+      crl->this_update != parsed.this_update ||
+      crl->next_update != parsed.next_update ||
+      crl->serial_count != parsed.serials.size()) {
+    return false;
+  }
+
+  return parsed.serials.empty() ||
+    memcmp(serials_ + crl->first_serial, &parsed.serials[0],
+        parsed.serials.size() * sizeof(Serial)) == 0;
+}
+
+// static
+bool CRLIndex::ParseCRL(X509_CRL* crl, PendingCRL* parsed) {
+  ASN1_INTEGER* delta = static_cast<ASN1_INTEGER*>(
+      X509_CRL_get_ext_d2i(crl, NID_delta_crl, NULL, NULL));
+  if (delta != NULL) {
+    ASN1_INTEGER_free(delta);
+    return false;
+  }
+
+  unsigned char name_hash[kNameHashSize];
+  if (!NameHash(X509_CRL_get_issuer(crl), name_hash)) {
+    return false;
+  }
+  parsed->name_hash.assign(reinterpret_cast<char*>(name_hash),
+      kNameHashSize);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  const ASN1_TIME* this_update_time = X509_CRL_get0_lastUpdate(crl);
+  const ASN1_TIME* next_update_time = X509_CRL_get0_nextUpdate(crl);
+#else
+  ASN1_TIME* this_update_time = X509_CRL_get_lastUpdate(crl);
+  ASN1_TIME* next_update_time = X509_CRL_get_nextUpdate(crl);
+#endif
+  if (!TimeFromASN1(this_update_time, &parsed->this_update)) {
+    parsed->this_update = 0;
+  }
+  if (!TimeFromASN1(next_update_time, &parsed->next_update)) {
+    parsed->next_update = 0;
+  }
+
+  vector<Serial>& serials = parsed->serials;
+  serials.clear();
+  STACK_OF(X509_REVOKED)* revoked = X509_CRL_get_REVOKED(crl);
+  for (int i = 0; i < sk_X509_REVOKED_num(revoked); ++i) {
+    X509_REVOKED* entry = sk_X509_REVOKED_value(revoked, i);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    const ASN1_INTEGER* serial_number = X509_REVOKED_get0_serialNumber(entry);
+#else
+    const ASN1_INTEGER* serial_number = entry->serialNumber;
+#endif
+    Serial serial;
+    if (SerialFromASN1(serial_number, &serial)) {
+      serials.push_back(serial);
+    }
+  }
+
+  std::sort(serials.begin(), serials.end(), SerialLess);
+  size_t unique_count = 0;
+  for (size_t i = 0; i < serials.size(); ++i) {
+    if (i == 0 || SerialLess(serials[unique_count - 1], serials[i])) {
+      serials[unique_count++] = serials[i];
+    }
+  }
+  serials.resize(unique_count);
+
+  return true;
+}
+
+// static
+void CRLIndex::Build(const vector<string>& filenames,
+    const unsigned char* fingerprint, string* index) {
+  vector<PendingCRL> pending_crls;
+
+  for (vector<string>::const_iterator it = filenames.begin();
+      it != filenames.end();
+      ++it) {
+    BIO* bio = BIO_new_file(it->c_str(), "rb");
+    if (bio == NULL) {
+      continue;
+    }
+
+    // PEM files may hold several CRLs, and certificates, which are skipped.
+    // Otherwise try one DER CRL.
+    vector<X509_CRL*> crls;
+    X509_CRL* crl;
+    while ((crl = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL)) != NULL) {
+      crls.push_back(crl);
+    }
+    if (crls.empty() && BIO_seek(bio, 0) == 0 &&
+        (crl = d2i_X509_CRL_bio(bio, NULL)) != NULL) {
+      crls.push_back(crl);
+    }
+    BIO_free(bio);
+    ERR_clear_error();
+
+    for (size_t i = 0; i < crls.size(); ++i) {
+      crl = crls[i];
+
+      PendingCRL pending;
+      const int der_length = i2d_X509_CRL(crl, NULL);
+      if (der_length > 0 && ParseCRL(crl, &pending)) {
+        // Kept to verify the signature once the issuer is known.
+        pending.der.resize(der_length);
+        unsigned char* der =
+          reinterpret_cast<unsigned char*>(&pending.der[0]);
+        i2d_X509_CRL(crl, &der);
+
+        pending_crls.push_back(pending);
+      }
+
+      X509_CRL_free(crl);
+    }
+  }
+
+  // Lay out the index, sorted by name hash as memcmp() orders them.
+  std::stable_sort(pending_crls.begin(), pending_crls.end(), PendingCRLLess);
+
+  vector<IndexedCRL> indexed_crls;
+  vector<Serial> serials;
+  string der;
+  for (vector<PendingCRL>::iterator it = pending_crls.begin();
+      it != pending_crls.end();
+      ++it) {
+    const vector<Serial>& crl_serials = it->serials;
+
+    IndexedCRL indexed_crl;
+    memset(&indexed_crl, 0, sizeof indexed_crl);
+    memcpy(indexed_crl.name_hash, it->name_hash.data(), kNameHashSize);
+    indexed_crl.first_serial = serials.size();
+    indexed_crl.der_offset = der.size();
+    indexed_crl.der_length = it->der.size();
+    indexed_crl.this_update = it->this_update;
+    indexed_crl.next_update = it->next_update;
+
+    serials.insert(serials.end(), crl_serials.begin(), crl_serials.end());
+    indexed_crl.serial_count = crl_serials.size();
+
+    der.append(it->der);
+    indexed_crls.push_back(indexed_crl);
+  }
+
+  Header header;
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, kFileMagic, sizeof header.magic);
+  memcpy(header.fingerprint, fingerprint, sizeof header.fingerprint);
+  header.crl_count = indexed_crls.size();
+  header.serial_count = serials.size();
+  header.der_size = der.size();
+
+  index->clear();
+  index->reserve(sizeof header + indexed_crls.size() * sizeof(IndexedCRL) +
+      serials.size() * sizeof(Serial) + der.size());
+  index->append(reinterpret_cast<const char*>(&header), sizeof header);
+  if (!indexed_crls.empty()) {
+    index->append(reinterpret_cast<const char*>(&indexed_crls[0]),
+        indexed_crls.size() * sizeof(IndexedCRL));
+  }
+  if (!serials.empty()) {
+    index->append(reinterpret_cast<const char*>(&serials[0]),
+        serials.size() * sizeof(Serial));
+  }
+  index->append(der);
+}
+
+// static
+bool CRLIndex::Write(const string& filename, const string& index) {
+  stringstream temp_filename;
+  temp_filename << filename << ".tmp." << getpid();
+
+  FILE* file = fopen(temp_filename.str().c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool success = fwrite(index.data(), 1, index.size(), file) == index.size();
+  if (fclose(file) != 0) {
+    success = false;
+  }
+
+  if (!success || rename(temp_filename.str().c_str(), filename.c_str()) != 0) {
+    unlink(temp_filename.str().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+// static
+bool CRLIndex::ListDirectory(const string& directory,
+    vector<string>* filenames, unsigned char* fingerprint,
+    string* error_message) {
+  DIR* dir = opendir(directory.c_str());
+  if (dir == NULL) {
+    *error_message = "Unable to read CRL directory " + directory + ": ";
+    error_message->append(strerror(errno));
+    return false;
+  }
+
+  vector<string> names;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    // Skips the cache file, and any temporary ones.
+    if (entry->d_name[0] != '.') {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+
+  std::sort(names.begin(), names.end());
+
+  stringstream listing;
+  listing << kFileMagic << "\n";
+  for (vector<string>::const_iterator it = names.begin();
+      it != names.end();
+      ++it) {
+    const string filename = directory + "/" + *it;
+
+    struct stat file_stat;
+    if (stat(filename.c_str(), &file_stat) != 0 ||
+        !S_ISREG(file_stat.st_mode)) {
+      continue;
+    }
+
+    filenames->push_back(filename);
+    listing << *it << "\t" << file_stat.st_size << "\t";
+    listing << static_cast<long>(file_stat.st_mtime) << "\n";  // NOLINT
+  }
+
+  const string listing_text = listing.str();
+  SHA1(reinterpret_cast<const unsigned char*>(listing_text.data()),
+      listing_text.size(), fingerprint);
+
+  return true;
+}
+
+// static
+bool CRLIndex::NameHash(X509_NAME* name, unsigned char* name_hash) {
+  unsigned int length;
+  return name != NULL &&
+    X509_NAME_digest(name, EVP_sha1(), name_hash, &length) == 1 &&
+    length == kNameHashSize;
+}
+
+// static
+bool CRLIndex::SerialFromASN1(const ASN1_INTEGER* integer, Serial* serial) {
+  // Negative serial numbers are invalid, and never indexed.
+  if (integer == NULL || integer->type != V_ASN1_INTEGER ||
+      integer->length < 0 ||
+      static_cast<size_t>(integer->length) > sizeof serial->bytes) {
+    return false;
+  }
+
+  const size_t padding = sizeof serial->bytes - integer->length;
+  memset(serial->bytes, 0, padding);
+  memcpy(serial->bytes + padding, integer->data, integer->length);
+
+  return true;
+}
+
+// static
+bool CRLIndex::SerialLess(const Serial& a, const Serial& b) {
+  return memcmp(a.bytes, b.bytes, sizeof a.bytes) < 0;
+}
+
+// static
+bool CRLIndex::PendingCRLLess(const PendingCRL& a, const PendingCRL& b) {
+  return a.name_hash < b.name_hash;
+}
+
+// static
+bool CRLIndex::NameHashLess(const IndexedCRL& crl,
+    const unsigned char* name_hash) {
+  return memcmp(crl.name_hash, name_hash, kNameHashSize) < 0;
+}
+
+// static
+bool CRLIndex::NameHashGreater(const unsigned char* name_hash,
+    const IndexedCRL& crl) {
+  return memcmp(name_hash, crl.name_hash, kNameHashSize) < 0;
+}
+
+// static
+bool CRLIndex::TimeFromASN1(const ASN1_TIME* time, int64_t* seconds) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  if (time == NULL) {
+    return false;
+  }
+
+  ASN1_TIME* epoch = ASN1_TIME_set(NULL, 0);
+  int days;
+  int day_seconds;
+  const bool is_converted = epoch != NULL &&
+    ASN1_TIME_diff(&days, &day_seconds, epoch, time);
+  ASN1_TIME_free(epoch);
+
+  if (is_converted) {
+    *seconds = static_cast<int64_t>(days) * 86400 + day_seconds;
+    return true;
+  }
+#endif
+
+  return false;
+}
+}  // namespace x509ls
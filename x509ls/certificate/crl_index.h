@@ -0,0 +1,193 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CERTIFICATE_CRL_INDEX_H_
+#define X509LS_CERTIFICATE_CRL_INDEX_H_
+
+#include <openssl/x509.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// Index of the certificate revocation lists in a directory, for O(log n)
+// revocation lookups.
+//
+// The CRLs (PEM or DER, with any file names; certificates sharing the
+// directory are skipped) are parsed once into an array of CRLs sorted by
+// issuer name, each with a sorted array of revoked serial numbers and its DER
+// encoding. The index is written to a cache file in the directory
+// (kCacheFilename) and memory-mapped by later runs, unless the directory's
+// files have changed since: Startup doesn't parse CRLs of hundreds of
+// thousands of entries again. If the cache file can't be written, the index
+// is kept in memory.
+//
+// Issuers are matched by their DER encoded name, and a CRL is only used once
+// its signature is verified with the public key of the certificate's issuer,
+// on first lookup: The issuer isn't known when indexing. The verified CRL's
+// serial numbers, issuer and update times must then match its index entry,
+// which a stale or altered cache file may not. Signature checks are
+// remembered per CRL and issuer key. CRLs not yet current (thisUpdate) are
+// skipped, as are delta CRLs.
+//
+// Thread safe: One CRLIndex may be shared by threads.
+class CRLIndex {
+ public:
+  // Revocation status of a certificate.
+  enum Status {
+    kStatusUnknown,  // No valid CRL from its issuer, or only expired ones.
+    kStatusGood,     // Not on its issuer's current CRL.
+    kStatusRevoked   // On a CRL signed by its issuer.
+  };
+
+  CRLIndex();
+  ~CRLIndex();
+
+  // Index the CRLs in |directory|, from or into its cache file. Call once.
+  //
+  // Returns false if the directory can't be read, setting |error_message|.
+  bool Open(const string& directory, string* error_message);
+
+  // Return the revocation status of |x509|, issued by |issuer|, at time
+  // |now|. Only CRLs signed by |issuer|'s key are used: Unknown if |issuer| is
+  // NULL.
+  Status Lookup(const X509* x509, X509* issuer, time_t now) const;
+
+  // Return the number of CRLs, and revoked serial numbers, indexed.
+  size_t CRLCount() const;
+  size_t SerialCount() const;
+
+  // Return true iif the index was read from the cache file, rather than
+  // built from the CRLs.
+  bool IsMapped() const;
+
+  // Name of the cache file in the CRL directory.
+  static const char kCacheFilename[];
+
+ private:
+  NO_COPY_AND_ASSIGN(CRLIndex)
+
+  // SHA-1 hash of an issuer's DER encoded name.
+  static const size_t kNameHashSize = 20;
+
+  // A serial number, big-endian and left padded with zeros. RFC 5280 limits
+  // serial numbers to 20 bytes.
+  struct Serial {
+    unsigned char bytes[20];
+  };
+
+  // The cache file is a Header, then the IndexedCRLs sorted by issuer name
+  // hash, then the sorted serial numbers of each CRL in turn, then the DER
+  // encoded CRLs. Integers are in host byte order: The cache is only for the
+  // machine which wrote it.
+  struct Header {
+    char magic[16];
+    // Of the directory's file names, sizes and modification times.
+    unsigned char fingerprint[20];
+    uint32_t crl_count;
+    uint32_t serial_count;
+    uint32_t reserved;
+    uint64_t der_size;
+  };
+
+  struct IndexedCRL {
+    unsigned char name_hash[kNameHashSize];
+    uint32_t first_serial;
+    uint32_t serial_count;
+    uint32_t der_length;
+    uint64_t der_offset;
+    // thisUpdate and nextUpdate, 0 if absent or unknown.
+    int64_t this_update;
+    int64_t next_update;
+  };
+
+  // A CRL being indexed by Build(), or checked against its index entry.
+  struct PendingCRL {
+    string name_hash;
+    vector<Serial> serials;
+    string der;
+    int64_t this_update;
+    int64_t next_update;
+  };
+
+  // The mapped cache file, or NULL.
+  void* mapping_;
+  size_t mapping_size_;
+
+  // The index if built, rather than mapped.
+  string built_index_;
+
+  const Header* header_;
+  const IndexedCRL* crls_;
+  const Serial* serials_;
+  const unsigned char* der_;
+
+  // Whether each CRL checked is signed by an issuer key: Keyed by the CRL's
+  // index and the SHA-256 hash of the key.
+  mutable pthread_mutex_t mutex_;
+  mutable map<string, bool> signatures_;
+
+  // Point |header_|, |crls_|, |serials_| and |der_| into the |size| byte
+  // index at |data|. Returns false if it is malformed, or not of
+  // |fingerprint|.
+  bool Attach(const char* data, size_t size,
+      const unsigned char* fingerprint);
+
+  // Map |filename|, and Attach() it. Returns false if it can't be mapped or
+  // attached.
+  bool Map(const string& filename, const unsigned char* fingerprint);
+
+  // Return true iif |crl| is signed by |issuer|, whose SHA-256 public key
+  // hash is |key_hash|, verifying the signature on first use. False if the
+  // signed CRL doesn't match |crl|.
+  bool IsSignedBy(const IndexedCRL* crl, X509* issuer,
+      const string& key_hash) const;
+
+  // Return true iif |crl|'s entry, and its serial numbers, are those of
+  // |parsed|.
+  bool Matches(const IndexedCRL* crl, const PendingCRL& parsed) const;
+
+  // Parse |crl| into |parsed|, bar its DER encoding. Serial numbers are sorted
+  // without duplicates. Returns false for delta CRLs, or unusable ones.
+  static bool ParseCRL(X509_CRL* crl, PendingCRL* parsed);
+
+  // Parse the CRLs in |filenames| into an index, written to |index|.
+  static void Build(const vector<string>& filenames,
+      const unsigned char* fingerprint, string* index);
+
+  // Write |index| to |filename|, via a temporary file.
+  static bool Write(const string& filename, const string& index);
+
+  // List the regular files in |directory| (bar dot files) in |filenames|,
+  // and hash their names, sizes and modification times into |fingerprint|.
+  static bool ListDirectory(const string& directory,
+      vector<string>* filenames, unsigned char* fingerprint,
+      string* error_message);
+
+  static bool NameHash(X509_NAME* name, unsigned char* name_hash);
+  static bool SerialFromASN1(const ASN1_INTEGER* integer, Serial* serial);
+  static bool SerialLess(const Serial& a, const Serial& b);
+  static bool PendingCRLLess(const PendingCRL& a, const PendingCRL& b);
+  static bool NameHashLess(const IndexedCRL& crl,
+      const unsigned char* name_hash);
+  static bool NameHashGreater(const unsigned char* name_hash,
+      const IndexedCRL& crl);
+
+  // Return |time| as seconds since the epoch in |seconds|, or false if it
+  // can't be converted. Exact, so times parsed again match those indexed.
+  static bool TimeFromASN1(const ASN1_TIME* time, int64_t* seconds);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CERTIFICATE_CRL_INDEX_H_
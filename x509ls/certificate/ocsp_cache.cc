@@ -0,0 +1,105 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/certificate/ocsp_cache.h"
+
+#include <time.h>
+
+namespace x509ls {
+namespace {
+// Minimum number of entries before purging.
+const size_t kMinimumPurgeSize = 1024;
+}  // namespace
+
+OCSPResult::OCSPResult()
+  :
+    status(kStatusNotChecked),
+    next_update(0) {
+}
+
+// static
+const char* OCSPResult::StatusName(Status status) {
+  switch (status) {
+  case kStatusNotChecked:
+    return "unchecked";
+  case kStatusGood:
+    return "good";
+  case kStatusRevoked:
+    return "revoked";
+  case kStatusUnknown:
+    return "unknown";
+  case kStatusNoResponder:
+    return "none";
+  case kStatusError:
+    return "error";
+  }
+
+  return "";
+}
+
+OCSPCache::OCSPCache()
+  :
+    purge_size_(kMinimumPurgeSize) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+OCSPCache::~OCSPCache() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool OCSPCache::Lookup(const string& cert_id, OCSPResult* result) {
+  const int64_t now = time(NULL);
+  bool found = false;
+
+  pthread_mutex_lock(&mutex_);
+  map<string, OCSPResult>::iterator it = entries_.find(cert_id);
+  if (it != entries_.end()) {
+    if (it->second.next_update > now) {
+      *result = it->second;
+      found = true;
+    } else {
+      entries_.erase(it);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  return found;
+}
+
+void OCSPCache::Store(const string& cert_id, const OCSPResult& result) {
+  const int64_t now = time(NULL);
+  if (result.next_update <= now || (result.status != OCSPResult::kStatusGood &&
+        result.status != OCSPResult::kStatusRevoked &&
+        result.status != OCSPResult::kStatusUnknown)) {
+    return;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  entries_[cert_id] = result;
+
+  if (entries_.size() >= purge_size_) {
+    map<string, OCSPResult>::iterator it = entries_.begin();
+    while (it != entries_.end()) {
+      if (it->second.next_update <= now) {
+        entries_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+
+    purge_size_ = entries_.size() * 2;
+    if (purge_size_ < kMinimumPurgeSize) {
+      purge_size_ = kMinimumPurgeSize;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+size_t OCSPCache::Size() {
+  pthread_mutex_lock(&mutex_);
+  const size_t size = entries_.size();
+  pthread_mutex_unlock(&mutex_);
+
+  return size;
+}
+}  // namespace x509ls
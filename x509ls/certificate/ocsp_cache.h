@@ -0,0 +1,81 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CERTIFICATE_OCSP_CACHE_H_
+#define X509LS_CERTIFICATE_OCSP_CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::map;
+using std::string;
+
+namespace x509ls {
+// A certificate's revocation status, as queried from its OCSP responder.
+struct OCSPResult {
+  OCSPResult();
+
+  enum Status {
+    kStatusNotChecked,   // Not queried.
+    kStatusGood,
+    kStatusRevoked,
+    kStatusUnknown,      // The responder doesn't know the certificate.
+    kStatusNoResponder,  // The certificate names no http OCSP responder.
+    kStatusError         // No valid answer: Timeouts, bad signatures...
+  };
+  Status status;
+
+  // The response's nextUpdate time, in seconds since the epoch, or 0 if none
+  // (or unknown, for OpenSSL before v1.0.2).
+  int64_t next_update;
+
+  // For kStatusNoResponder and kStatusError, a short description, e.g.
+  // "timed out".
+  string error_message;
+
+  // Return a one word name of |status|, e.g. "good".
+  static const char* StatusName(Status status);
+};
+
+// Caches OCSPResults until the nextUpdate of their response.
+//
+// Results are keyed by the DER encoded OCSP CertID of the certificate: The
+// hashes of its issuer's name and key, and its serial number. Only answers
+// from the responder are cached, and only if they have a nextUpdate: RFC 6960
+// says newer information is always available otherwise.
+//
+// Thread safe: One OCSPCache may be shared by the OCSPClients of several
+// threads.
+class OCSPCache {
+ public:
+  OCSPCache();
+  ~OCSPCache();
+
+  // Look up the result for |cert_id|. Returns true iif an unexpired result
+  // was found and stored in |result|.
+  bool Lookup(const string& cert_id, OCSPResult* result);
+
+  // Store |result| for |cert_id|, until its nextUpdate.
+  void Store(const string& cert_id, const OCSPResult& result);
+
+  // Return the number of results cached, including any expired but not yet
+  // purged.
+  size_t Size();
+
+ private:
+  NO_COPY_AND_ASSIGN(OCSPCache)
+
+  pthread_mutex_t mutex_;
+  map<string, OCSPResult> entries_;
+
+  // Purge expired entries once the cache has doubled since the last purge.
+  size_t purge_size_;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CERTIFICATE_OCSP_CACHE_H_
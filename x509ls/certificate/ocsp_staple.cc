@@ -0,0 +1,205 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/certificate/ocsp_staple.h"
+
+#include <openssl/asn1.h>
+#include <openssl/err.h>
+#include <openssl/ocsp.h>
+#include <stdio.h>
+
+namespace x509ls {
+namespace {
+// Clock skew allowed between us and the OCSP responder.
+const long kMaxClockSkewSeconds = 5 * 60;  // NOLINT(runtime/int)
+}  // namespace
+
+OCSPStaple::OCSPStaple()
+  :
+    status_(kStatusNotChecked),
+    error_(NULL),
+    this_update_(0),
+    next_update_(0) {
+}
+
+void OCSPStaple::SetResponse(const unsigned char* der, size_t size) {
+  der_.assign(reinterpret_cast<const char*>(der), size);
+  status_ = kStatusMissing;
+}
+
+void OCSPStaple::Validate(X509* leaf, X509* issuer,
+    STACK_OF(X509)* untrusted, X509_STORE* store) {
+  if (status_ != kStatusMissing || der_.empty()) {
+    return;
+  }
+
+  status_ = kStatusInvalid;
+
+  const unsigned char* data =
+    reinterpret_cast<const unsigned char*>(der_.data());
+  OCSP_RESPONSE* response = d2i_OCSP_RESPONSE(NULL, &data, der_.size());
+  string().swap(der_);
+  if (response == NULL) {
+    error_ = "malformed";
+    return;
+  }
+
+  OCSP_BASICRESP* basic = NULL;
+  OCSP_CERTID* id = NULL;
+  int status;
+  int reason;
+  ASN1_GENERALIZEDTIME* revocation_time;
+  ASN1_GENERALIZEDTIME* this_update;
+  ASN1_GENERALIZEDTIME* next_update;
+
+  if (OCSP_response_status(response) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+    error_ = "responder error";
+  } else if ((basic = OCSP_response_get1_basic(response)) == NULL) {
+    error_ = "malformed";
+  } else if (issuer == NULL) {
+    error_ = "issuer unknown";
+  } else if (OCSP_basic_verify(basic, untrusted, store, 0) <= 0) {
+    error_ = "signature not trusted";
+  } else if ((id = OCSP_cert_to_id(NULL, leaf, issuer)) == NULL ||
+      !OCSP_resp_find_status(basic, id, &status, &reason, &revocation_time,
+        &this_update, &next_update)) {
+    error_ = "not for this certificate";
+  } else {
+    error_ = NULL;
+    this_update_ = TimeFromASN1(this_update);
+    next_update_ = TimeFromASN1(next_update);
+
+    if (!OCSP_check_validity(this_update, next_update, kMaxClockSkewSeconds,
+          -1)) {
+      status_ = kStatusStale;
+    } else if (status == V_OCSP_CERTSTATUS_GOOD) {
+      status_ = kStatusGood;
+    } else if (status == V_OCSP_CERTSTATUS_REVOKED) {
+      status_ = kStatusRevoked;
+    } else {
+      status_ = kStatusUnknown;
+    }
+  }
+
+  // OCSP_basic_verify() leaves errors queued on failure.
+  ERR_clear_error();
+
+  OCSP_CERTID_free(id);
+  OCSP_BASICRESP_free(basic);
+  OCSP_RESPONSE_free(response);
+}
+
+OCSPStaple::Status OCSPStaple::GetStatus() const {
+  return status_;
+}
+
+bool OCSPStaple::IsCurrent() const {
+  return status_ == kStatusGood || status_ == kStatusRevoked ||
+    status_ == kStatusUnknown;
+}
+
+time_t OCSPStaple::ThisUpdate() const {
+  return this_update_;
+}
+
+time_t OCSPStaple::NextUpdate() const {
+  return next_update_;
+}
+
+string OCSPStaple::Description(time_t now) const {
+  string description;
+
+  switch (status_) {
+  case kStatusNotChecked:
+    return "not checked";
+  case kStatusMissing:
+    return "none";
+  case kStatusInvalid:
+    description = "invalid (";
+    description.append(error_ ? error_ : "unknown error");
+    description.append(")");
+    return description;
+  default:
+    break;
+  }
+
+  description = StatusName(status_);
+
+  if (status_ == kStatusStale) {
+    if (next_update_ != 0 && next_update_ < now) {
+      description.append(", expired ");
+      AppendDuration(now - next_update_, &description);
+      description.append(" ago");
+    }
+    return description;
+  }
+
+  if (this_update_ != 0 && this_update_ <= now) {
+    description.append(", updated ");
+    AppendDuration(now - this_update_, &description);
+    description.append(" ago");
+  }
+  if (next_update_ != 0 && next_update_ > now) {
+    description.append(", next update in ");
+    AppendDuration(next_update_ - now, &description);
+  }
+
+  return description;
+}
+
+// static
+const char* OCSPStaple::StatusName(Status status) {
+  switch (status) {
+  case kStatusNotChecked:
+    return "unchecked";
+  case kStatusMissing:
+    return "missing";
+  case kStatusInvalid:
+    return "invalid";
+  case kStatusStale:
+    return "stale";
+  case kStatusGood:
+    return "good";
+  case kStatusRevoked:
+    return "revoked";
+  case kStatusUnknown:
+    return "unknown";
+  }
+
+  return "";
+}
+
+// static
+int64_t OCSPStaple::TimeFromASN1(const ASN1_GENERALIZEDTIME* asn1_time) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  int days;
+  int seconds;
+  if (asn1_time != NULL &&
+      ASN1_TIME_diff(&days, &seconds, NULL, asn1_time)) {
+    return time(NULL) + static_cast<int64_t>(days) * 86400 + seconds;
+  }
+#endif
+
+  return 0;
+}
+
+// static
+void OCSPStaple::AppendDuration(int64_t seconds, string* output) {
+  const int64_t days = seconds / 86400;
+  const int64_t hours = seconds % 86400 / 3600;
+  const int64_t minutes = seconds % 3600 / 60;
+
+  char duration[64];
+  if (days > 0) {
+    snprintf(duration, sizeof duration, "%dd %dh", static_cast<int>(days),
+        static_cast<int>(hours));
+  } else if (hours > 0) {
+    snprintf(duration, sizeof duration, "%dh %dm", static_cast<int>(hours),
+        static_cast<int>(minutes));
+  } else {
+    snprintf(duration, sizeof duration, "%dm", static_cast<int>(minutes));
+  }
+
+  output->append(duration);
+}
+}  // namespace x509ls
@@ -0,0 +1,90 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CERTIFICATE_OCSP_STAPLE_H_
+#define X509LS_CERTIFICATE_OCSP_STAPLE_H_
+
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+// An OCSP response stapled by a server during the TLS handshake (the
+// status_request extension), validated for the end-entity certificate.
+//
+// The response must be signed by the certificate's issuer, or by a responder
+// the issuer delegated to, chaining to the trust store. Its status is only
+// used while current: Between its thisUpdate and nextUpdate times, allowing
+// for some clock skew.
+class OCSPStaple {
+ public:
+  enum Status {
+    kStatusNotChecked,  // Not requested, or the handshake ended before it.
+    kStatusMissing,     // Requested, but the server stapled nothing.
+    kStatusInvalid,     // Malformed, untrusted, or not for the certificate.
+    kStatusStale,       // Validly signed, but no longer (or not yet) current.
+    kStatusGood,
+    kStatusRevoked,
+    kStatusUnknown      // The responder doesn't know the certificate.
+  };
+
+  OCSPStaple();
+
+  // Set the stapled response to the |size| bytes of DER at |der|, or to none
+  // if |size| is 0. Marks the staple as requested.
+  void SetResponse(const unsigned char* der, size_t size);
+
+  // Validate the response for |leaf|, issued by |issuer|, at the current
+  // time. |untrusted| holds the server's certificates, to find a delegated
+  // responder's chain, and |store| the trust anchors. Call once, after
+  // SetResponse(). The DER encoding is released.
+  void Validate(X509* leaf, X509* issuer, STACK_OF(X509)* untrusted,
+      X509_STORE* store);
+
+  Status GetStatus() const;
+
+  // Return true iif the response validated and is current, i.e. the status
+  // is good, revoked or unknown.
+  bool IsCurrent() const;
+
+  // Return the response's thisUpdate and nextUpdate times, or 0 if unknown
+  // (e.g. for OpenSSL before v1.0.2, or a response without a nextUpdate).
+  time_t ThisUpdate() const;
+  time_t NextUpdate() const;
+
+  // Return a short description of the status and freshness at time |now|,
+  // e.g. "good, updated 2h ago, next update in 3d 4h" or "none".
+  string Description(time_t now) const;
+
+  // Return a one word name of |status|, e.g. "missing".
+  static const char* StatusName(Status status);
+
+  // Return |asn1_time| as seconds since the epoch, or 0 if NULL or unsupported.
+  static int64_t TimeFromASN1(const ASN1_GENERALIZEDTIME* asn1_time);
+
+ private:
+  NO_COPY_AND_ASSIGN(OCSPStaple)
+
+  Status status_;
+  string der_;
+
+  // Why the response is invalid, a string constant, or NULL.
+  const char* error_;
+
+  int64_t this_update_;
+  int64_t next_update_;
+
+  // Append |seconds| to |output| as e.g. "3d 4h", "4h 10m" or "10m".
+  static void AppendDuration(int64_t seconds, string* output);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CERTIFICATE_OCSP_STAPLE_H_
@@ -0,0 +1,527 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/certificate/signature_memo.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+#include <openssl/x509v3.h>
+#include <time.h>
+
+#include <sstream>
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+typedef int (*VerifyCallback)(int ok, X509_STORE_CTX* ctx);
+typedef int (*VerifyFunction)(X509_STORE_CTX* ctx);
+
+pthread_once_t initialize_once = PTHREAD_ONCE_INIT;
+int ex_data_index = -1;
+int ctx_ex_data_index = -1;
+
+// OpenSSL's internal_verify(), which stores without a verify function use.
+VerifyFunction default_verify = NULL;
+
+// Accessors for the X509_STORE_CTX, which is opaque from OpenSSL v1.1.0.
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+X509_STORE* StoreOf(X509_STORE_CTX* ctx) {
+  return X509_STORE_CTX_get0_store(ctx);
+}
+
+void* StoreExData(X509_STORE* store, int index) {
+  return X509_STORE_get_ex_data(store, index);
+}
+
+void SetStoreExData(X509_STORE* store, int index, void* data) {
+  X509_STORE_set_ex_data(store, index, data);
+}
+
+STACK_OF(X509)* ChainOf(X509_STORE_CTX* ctx) {
+  return X509_STORE_CTX_get0_chain(ctx);
+}
+
+VerifyCallback VerifyCallbackOf(X509_STORE_CTX* ctx) {
+  return X509_STORE_CTX_get_verify_cb(ctx);
+}
+
+VerifyFunction VerifyFunctionOf(X509_STORE_CTX* ctx) {
+  return X509_STORE_CTX_get_verify(ctx);
+}
+
+time_t CheckTimeOf(X509_STORE_CTX* ctx) {
+  return X509_VERIFY_PARAM_get_time(X509_STORE_CTX_get0_param(ctx));
+}
+
+unsigned long FlagsOf(X509_STORE_CTX* ctx) {  // NOLINT(runtime/int)
+  return X509_VERIFY_PARAM_get_flags(X509_STORE_CTX_get0_param(ctx));
+}
+#else
+X509_STORE* StoreOf(X509_STORE_CTX* ctx) {
+  return ctx->ctx;
+}
+
+void* StoreExData(X509_STORE* store, int index) {
+  return CRYPTO_get_ex_data(&store->ex_data, index);
+}
+
+void SetStoreExData(X509_STORE* store, int index, void* data) {
+  CRYPTO_set_ex_data(&store->ex_data, index, data);
+}
+
+STACK_OF(X509)* ChainOf(X509_STORE_CTX* ctx) {
+  return ctx->chain;
+}
+
+VerifyCallback VerifyCallbackOf(X509_STORE_CTX* ctx) {
+  return ctx->verify_cb;
+}
+
+VerifyFunction VerifyFunctionOf(X509_STORE_CTX* ctx) {
+  return ctx->verify;
+}
+
+time_t CheckTimeOf(X509_STORE_CTX* ctx) {
+  return ctx->param->check_time;
+}
+
+unsigned long FlagsOf(X509_STORE_CTX* ctx) {  // NOLINT(runtime/int)
+  return ctx->param->flags;
+}
+#endif
+
+void Initialize() {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  ex_data_index = X509_STORE_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+#else
+  ex_data_index = CRYPTO_get_ex_new_index(CRYPTO_EX_INDEX_X509_STORE, 0, NULL,
+      NULL, NULL, NULL);
+#endif
+  ctx_ex_data_index = X509_STORE_CTX_get_ex_new_index(0, NULL, NULL, NULL,
+      NULL);
+
+  // A context of a store without a verify function is given OpenSSL's own.
+  X509_STORE* store = X509_STORE_new();
+  X509_STORE_CTX* ctx = X509_STORE_CTX_new();
+  if (store != NULL && ctx != NULL &&
+      X509_STORE_CTX_init(ctx, store, NULL, NULL) == 1) {
+    default_verify = VerifyFunctionOf(ctx);
+  }
+  X509_STORE_CTX_free(ctx);
+  X509_STORE_free(store);
+}
+
+// Trust anchors need not be self-signed, from OpenSSL v1.0.2.
+#ifdef X509_V_FLAG_PARTIAL_CHAIN
+const unsigned long kFlagPartialChain =  // NOLINT(runtime/int)
+  X509_V_FLAG_PARTIAL_CHAIN;
+#else
+const unsigned long kFlagPartialChain = 0;  // NOLINT(runtime/int)
+#endif
+
+// The verify callback's view of a chain checked by OpenSSL's own function.
+struct Observation {
+  VerifyCallback callback;
+  bool has_signature_error;
+};
+}  // namespace
+
+SignatureMemo::Statistics::Statistics()
+  :
+    check_count(0),
+    memo_hit_count(0),
+    rsa_count(0),
+    ecdsa_count(0),
+    other_count(0),
+    failure_count(0) {
+}
+
+void SignatureMemo::Statistics::Merge(const Statistics& other) {
+  check_count += other.check_count;
+  memo_hit_count += other.memo_hit_count;
+  rsa_count += other.rsa_count;
+  ecdsa_count += other.ecdsa_count;
+  other_count += other.other_count;
+  failure_count += other.failure_count;
+}
+
+string SignatureMemo::Statistics::Summary() const {
+  stringstream summary;
+  summary << "signatures: " << check_count << " checks, ";
+  summary << memo_hit_count << " memoized, ";
+  summary << rsa_count + ecdsa_count + other_count << " verified (";
+  summary << rsa_count << " RSA, ";
+  summary << ecdsa_count << " ECDSA, ";
+  summary << other_count << " other), ";
+  summary << failure_count << " failed";
+
+  return summary.str();
+}
+
+SignatureMemo::ChainSignatures::ChainSignatures()
+  :
+    has_unkeyed_signature(false) {
+}
+
+SignatureMemo::SignatureMemo() {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+SignatureMemo::~SignatureMemo() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+void SignatureMemo::Install(X509_STORE* store) {
+  const int index = ExDataIndex();
+  if (index < 0 || ctx_ex_data_index < 0 || default_verify == NULL) {
+    return;
+  }
+
+  SetStoreExData(store, index, this);
+  X509_STORE_set_verify_func(store, VerifyChain);
+}
+
+void SignatureMemo::Clear() {
+  pthread_mutex_lock(&mutex_);
+  entries_.clear();
+  pthread_mutex_unlock(&mutex_);
+}
+
+SignatureMemo::Statistics SignatureMemo::GetStatistics() {
+  pthread_mutex_lock(&mutex_);
+  const Statistics statistics = statistics_;
+  pthread_mutex_unlock(&mutex_);
+
+  return statistics;
+}
+
+// static
+//
+// As OpenSSL's internal_verify(): The top of the chain is either self-signed
+// (its signature is only checked with X509_V_FLAG_CHECK_SS_SIGNATURE), a
+// partial chain's trust anchor, or an issuer-less end-entity certificate.
+void SignatureMemo::GetChainSignatures(X509_STORE_CTX* ctx,
+    ChainSignatures* signatures) {
+  STACK_OF(X509)* chain = ChainOf(ctx);
+  if (chain == NULL || sk_X509_num(chain) < 1) {
+    signatures->has_unkeyed_signature = true;
+    return;
+  }
+
+  const unsigned long flags = FlagsOf(ctx);  // NOLINT(runtime/int)
+
+  int depth = sk_X509_num(chain) - 1;
+  X509* issuer = sk_X509_value(chain, depth);
+  X509* x509 = issuer;
+
+  if (X509_check_issued(issuer, issuer) == X509_V_OK) {
+    // A self-signed signature is never remembered.
+    if (flags & X509_V_FLAG_CHECK_SS_SIGNATURE) {
+      signatures->has_unkeyed_signature = true;
+    }
+  } else if (!(flags & kFlagPartialChain) && depth > 0) {
+    x509 = sk_X509_value(chain, --depth);
+  }
+
+  while (depth >= 0) {
+    if (x509 != issuer) {
+      string key;
+      if (Key(x509, issuer, &key)) {
+        EVP_PKEY* pkey = X509_get_pubkey(issuer);
+        signatures->keys.push_back(key);
+        signatures->key_types.push_back(
+            pkey != NULL ? EVP_PKEY_base_id(pkey) : NID_undef);
+        EVP_PKEY_free(pkey);
+      } else {
+        signatures->has_unkeyed_signature = true;
+      }
+    }
+
+    if (--depth >= 0) {
+      issuer = x509;
+      x509 = sk_X509_value(chain, depth);
+    }
+  }
+}
+
+bool SignatureMemo::IsMemoized(const ChainSignatures& signatures) {
+  if (signatures.has_unkeyed_signature) {
+    return false;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  bool is_memoized = true;
+  for (size_t i = 0; i < signatures.keys.size() && is_memoized; ++i) {
+    is_memoized = entries_.count(signatures.keys[i]) > 0;
+  }
+  if (is_memoized) {
+    statistics_.check_count += signatures.keys.size();
+    statistics_.memo_hit_count += signatures.keys.size();
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  return is_memoized;
+}
+
+void SignatureMemo::Remember(const ChainSignatures& signatures,
+    bool is_checked, bool has_bad_signature) {
+  pthread_mutex_lock(&mutex_);
+  statistics_.check_count += signatures.keys.size();
+  for (size_t i = 0; i < signatures.key_types.size(); ++i) {
+    if (signatures.key_types[i] == EVP_PKEY_RSA) {
+      ++statistics_.rsa_count;
+    } else if (signatures.key_types[i] == EVP_PKEY_EC) {
+      ++statistics_.ecdsa_count;
+    } else {
+      ++statistics_.other_count;
+    }
+  }
+
+  if (has_bad_signature) {
+    ++statistics_.failure_count;
+  } else if (is_checked) {
+    if (entries_.size() + signatures.keys.size() > kMaxEntries) {
+      entries_.clear();
+    }
+    entries_.insert(signatures.keys.begin(), signatures.keys.end());
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+// static
+bool SignatureMemo::Key(X509* x509, X509* issuer, string* key) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+
+  if (!X509_digest(x509, EVP_sha256(), digest, &size)) {
+    return false;
+  }
+  key->assign(reinterpret_cast<const char*>(digest), size);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  X509_PUBKEY* public_key = X509_get_X509_PUBKEY(issuer);
+#else
+  X509_PUBKEY* public_key = issuer->cert_info->key;
+#endif
+  unsigned char* der = NULL;
+  const int der_length = i2d_X509_PUBKEY(public_key, &der);
+  if (der_length <= 0) {
+    return false;
+  }
+  const bool is_digested =
+    EVP_Digest(der, der_length, digest, &size, EVP_sha256(), NULL) == 1;
+  OPENSSL_free(der);
+  if (!is_digested) {
+    return false;
+  }
+  key->append(reinterpret_cast<const char*>(digest), size);
+
+  return true;
+}
+
+// static
+int SignatureMemo::VerifyChain(X509_STORE_CTX* ctx) {
+  SignatureMemo* memo =
+    static_cast<SignatureMemo*>(StoreExData(StoreOf(ctx), ExDataIndex()));
+  if (memo == NULL) {
+    return default_verify(ctx);
+  }
+
+  ChainSignatures signatures;
+  GetChainSignatures(ctx, &signatures);
+  if (memo->IsMemoized(signatures)) {
+    return VerifyMemoizedChain(ctx);
+  }
+
+  // Let OpenSSL check the chain, watching for bad signatures.
+  Observation observation;
+  observation.callback = VerifyCallbackOf(ctx);
+  observation.has_signature_error = false;
+  X509_STORE_CTX_set_ex_data(ctx, ctx_ex_data_index, &observation);
+  X509_STORE_CTX_set_verify_cb(ctx, ObserveCallback);
+
+  const int result = default_verify(ctx);
+
+  X509_STORE_CTX_set_verify_cb(ctx, observation.callback);
+  X509_STORE_CTX_set_ex_data(ctx, ctx_ex_data_index, NULL);
+
+  memo->Remember(signatures, result > 0, observation.has_signature_error);
+
+  return result;
+}
+
+// static
+int SignatureMemo::VerifyMemoizedChain(X509_STORE_CTX* ctx) {
+  STACK_OF(X509)* chain = ChainOf(ctx);
+  const unsigned long flags = FlagsOf(ctx);  // NOLINT(runtime/int)
+
+  int depth = sk_X509_num(chain) - 1;
+  X509* issuer = sk_X509_value(chain, depth);
+  X509* x509 = issuer;
+
+  if (X509_check_issued(issuer, issuer) != X509_V_OK &&
+      !(flags & kFlagPartialChain)) {
+    if (depth == 0) {
+      if (!Fail(ctx, issuer, 0, X509_V_ERR_UNABLE_TO_VERIFY_LEAF_SIGNATURE)) {
+        return 0;
+      }
+    } else {
+      x509 = sk_X509_value(chain, --depth);
+    }
+  }
+
+  while (depth >= 0) {
+    // The signature itself is remembered as good.
+    if (x509 != issuer && !CheckIssuer(ctx, x509, issuer, depth + 1)) {
+      return 0;
+    }
+
+    if (!CheckTime(ctx, x509, depth)) {
+      return 0;
+    }
+
+    SetCurrent(ctx, x509, depth);
+    SetCurrentIssuer(ctx, issuer);
+    if (!VerifyCallbackOf(ctx)(1, ctx)) {
+      return 0;
+    }
+
+    if (--depth >= 0) {
+      issuer = x509;
+      x509 = sk_X509_value(chain, depth);
+    }
+  }
+
+  return 1;
+}
+
+// static
+int SignatureMemo::CheckIssuer(X509_STORE_CTX* ctx, X509* x509, X509* issuer,
+    int issuer_depth) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  // As check_key_level(): Minimum key strengths, in bits of security, for
+  // each security level.
+  static const int kMinimumSecurityBits[] = {80, 112, 128, 192, 256};
+  const int kLevelCount =
+    sizeof kMinimumSecurityBits / sizeof kMinimumSecurityBits[0];
+
+  int level = X509_VERIFY_PARAM_get_auth_level(X509_STORE_CTX_get0_param(ctx));
+  if (level > 0) {
+    if (level > kLevelCount) {
+      level = kLevelCount;
+    }
+    EVP_PKEY* pkey = X509_get0_pubkey(issuer);
+    if ((pkey == NULL ||
+          EVP_PKEY_security_bits(pkey) < kMinimumSecurityBits[level - 1]) &&
+        !Fail(ctx, issuer, issuer_depth, X509_V_ERR_CA_KEY_TOO_SMALL)) {
+      return 0;
+    }
+  }
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // From OpenSSL v3.0.0, the issuer's key usage must allow signing: Proxy
+  // certificates with digitalSignature, others with keyCertSign.
+  if (X509_get_extension_flags(issuer) & EXFLAG_KUSAGE) {
+    const bool is_proxy = (X509_get_extension_flags(x509) & EXFLAG_PROXY) != 0;
+    const uint32_t usage = is_proxy ? KU_DIGITAL_SIGNATURE : KU_KEY_CERT_SIGN;
+    if (!(X509_get_key_usage(issuer) & usage) &&
+        !Fail(ctx, issuer, issuer_depth,
+          is_proxy ? X509_V_ERR_KEYUSAGE_NO_DIGITAL_SIGNATURE :
+          X509_V_ERR_KEYUSAGE_NO_CERTSIGN)) {
+      return 0;
+    }
+  }
+#endif
+
+  return 1;
+}
+
+// static
+int SignatureMemo::CheckTime(X509_STORE_CTX* ctx, X509* x509, int depth) {
+  const unsigned long flags = FlagsOf(ctx);  // NOLINT(runtime/int)
+#ifdef X509_V_FLAG_NO_CHECK_TIME
+  if (flags & X509_V_FLAG_NO_CHECK_TIME) {
+    return 1;
+  }
+#endif
+
+  time_t check_time = 0;
+  time_t* at = NULL;
+  if (flags & X509_V_FLAG_USE_CHECK_TIME) {
+    check_time = CheckTimeOf(ctx);
+    at = &check_time;
+  }
+
+  int comparison = X509_cmp_time(X509_get_notBefore(x509), at);
+  if (comparison == 0 &&
+      !Fail(ctx, x509, depth, X509_V_ERR_ERROR_IN_CERT_NOT_BEFORE_FIELD)) {
+    return 0;
+  }
+  if (comparison > 0 &&
+      !Fail(ctx, x509, depth, X509_V_ERR_CERT_NOT_YET_VALID)) {
+    return 0;
+  }
+
+  comparison = X509_cmp_time(X509_get_notAfter(x509), at);
+  if (comparison == 0 &&
+      !Fail(ctx, x509, depth, X509_V_ERR_ERROR_IN_CERT_NOT_AFTER_FIELD)) {
+    return 0;
+  }
+  if (comparison < 0 &&
+      !Fail(ctx, x509, depth, X509_V_ERR_CERT_HAS_EXPIRED)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+// static
+int SignatureMemo::Fail(X509_STORE_CTX* ctx, X509* x509, int depth,
+    int error) {
+  X509_STORE_CTX_set_error(ctx, error);
+  SetCurrent(ctx, x509, depth);
+
+  return VerifyCallbackOf(ctx)(0, ctx);
+}
+
+// static
+void SignatureMemo::SetCurrent(X509_STORE_CTX* ctx, X509* x509, int depth) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  X509_STORE_CTX_set_current_cert(ctx, x509);
+  X509_STORE_CTX_set_error_depth(ctx, depth);
+#else
+  ctx->current_cert = x509;
+  ctx->error_depth = depth;
+#endif
+}
+
+// static
+void SignatureMemo::SetCurrentIssuer(X509_STORE_CTX* ctx, X509* issuer) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  ctx->current_issuer = issuer;
+#endif
+}
+
+// static
+int SignatureMemo::ObserveCallback(int ok, X509_STORE_CTX* ctx) {
+  Observation* observation = static_cast<Observation*>(
+      X509_STORE_CTX_get_ex_data(ctx, ctx_ex_data_index));
+
+  const int error = X509_STORE_CTX_get_error(ctx);
+  if (!ok && (error == X509_V_ERR_CERT_SIGNATURE_FAILURE ||
+        error == X509_V_ERR_UNABLE_TO_DECODE_ISSUER_PUBLIC_KEY)) {
+    observation->has_signature_error = true;
+  }
+
+  return observation->callback(ok, ctx);
+}
+
+// static
+int SignatureMemo::ExDataIndex() {
+  pthread_once(&initialize_once, Initialize);
+  return ex_data_index;
+}
+}  // namespace x509ls
@@ -0,0 +1,153 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CERTIFICATE_SIGNATURE_MEMO_H_
+#define X509LS_CERTIFICATE_SIGNATURE_MEMO_H_
+
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::set;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// Remembers certificate signatures already verified, so chains seen before
+// aren't verified again.
+//
+// Entries are keyed by the SHA-256 hash of the certificate's DER encoding and
+// of the issuer's SubjectPublicKeyInfo, which between them fix the outcome of
+// the check. Only good signatures are remembered.
+//
+// Once installed in an X509_STORE, X509_verify_cert()'s final step (checking
+// signatures and validity periods) goes through the memo: Chains with any
+// signature not yet remembered are checked by OpenSSL's own function, and
+// their signatures remembered if all are good. Chains with every signature
+// remembered are checked as OpenSSL does, bar the signatures themselves.
+// From OpenSSL v1.1.0, the verify callback doesn't see the current issuer
+// for these, as OpenSSL offers no way to set it.
+//
+// Thread safe: The stores of several threads' verifications may share a memo.
+class SignatureMemo {
+ public:
+  SignatureMemo();
+  ~SignatureMemo();
+
+  // Verify signatures for |store| through the memo. The memo must outlive
+  // |store|.
+  void Install(X509_STORE* store);
+
+  // Forget every signature.
+  void Clear();
+
+  // Signature check statistics.
+  struct Statistics {
+    Statistics();
+
+    // Add the counts from |other|.
+    void Merge(const Statistics& other);
+
+    // Return a one line summary, e.g.:
+    //   "signatures: 1200 checks, 1150 memoized, 50 verified (40 RSA, 10
+    //   ECDSA, 0 other), 0 failed"
+    // Failures are chains with a bad signature, or an issuer key that
+    // couldn't be decoded.
+    string Summary() const;
+
+    uint64_t check_count;
+    uint64_t memo_hit_count;
+    uint64_t rsa_count;
+    uint64_t ecdsa_count;
+    uint64_t other_count;
+    uint64_t failure_count;
+  };
+  Statistics GetStatistics();
+
+  // Most signatures remembered: The memo is cleared when full.
+  static const size_t kMaxEntries = 65536;
+
+ private:
+  NO_COPY_AND_ASSIGN(SignatureMemo)
+
+  pthread_mutex_t mutex_;
+  set<string> entries_;
+  Statistics statistics_;
+
+  // The signatures checked in verifying a chain: The memo keys of each
+  // certificate and its issuer, bar a self-signed trust anchor.
+  struct ChainSignatures {
+    ChainSignatures();
+
+    vector<string> keys;
+    vector<int> key_types;
+
+    // A key couldn't be computed: The chain can't be memoized.
+    bool has_unkeyed_signature;
+  };
+
+  // The signatures of the chain built in |ctx|, as OpenSSL's internal_verify()
+  // would check them.
+  static void GetChainSignatures(X509_STORE_CTX* ctx,
+      ChainSignatures* signatures);
+
+  // Return true iif every signature of |signatures| is remembered, counting
+  // them in the statistics.
+  bool IsMemoized(const ChainSignatures& signatures);
+
+  // Count the signatures of |signatures| as verified by OpenSSL, with a
+  // failure if |has_bad_signature|. Remember them if |is_checked|: OpenSSL
+  // didn't stop before checking every one.
+  void Remember(const ChainSignatures& signatures, bool is_checked,
+      bool has_bad_signature);
+
+  // Return the memo key of |x509| issued by |issuer| in |key|. Returns false
+  // if either can't be hashed.
+  static bool Key(X509* x509, X509* issuer, string* key);
+
+  // The store's verify function: Check the signatures and validity periods
+  // of the built chain, by OpenSSL's own function unless every signature is
+  // remembered.
+  static int VerifyChain(X509_STORE_CTX* ctx);
+
+  // Check the chain of |ctx| as OpenSSL's internal_verify() does, taking its
+  // signatures as good, top down, reporting errors to the verify callback.
+  static int VerifyMemoizedChain(X509_STORE_CTX* ctx);
+
+  // Check that |issuer| at |issuer_depth| may sign |x509|, and that its key
+  // is strong enough for the security level. Returns 0 to stop verification.
+  static int CheckIssuer(X509_STORE_CTX* ctx, X509* x509, X509* issuer,
+      int issuer_depth);
+
+  // Check the validity period of |x509| at |depth|. Returns 0 to stop
+  // verification.
+  static int CheckTime(X509_STORE_CTX* ctx, X509* x509, int depth);
+
+  // Report |error| for |x509| at |depth| to the verify callback. Returns 0 to
+  // stop verification.
+  static int Fail(X509_STORE_CTX* ctx, X509* x509, int depth, int error);
+
+  // Set |x509| at |depth| as the certificate being checked.
+  static void SetCurrent(X509_STORE_CTX* ctx, X509* x509, int depth);
+
+  // Set |issuer| as the issuer of the certificate being checked, where
+  // OpenSSL allows it (before v1.1.0).
+  static void SetCurrentIssuer(X509_STORE_CTX* ctx, X509* issuer);
+
+  // The verify callback while OpenSSL's own function checks a chain: Notes
+  // signature failures, then calls the original callback.
+  static int ObserveCallback(int ok, X509_STORE_CTX* ctx);
+
+  // Index of the memo in X509_STORE ex_data.
+  static int ExDataIndex();
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CERTIFICATE_SIGNATURE_MEMO_H_
@@ -5,6 +5,7 @@
 
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <time.h>
 
 #include "x509ls/base/openssl/bio_translator.h"
 
@@ -12,9 +13,14 @@ namespace x509ls {
 TrustStore::TrustStore()
   :
     store_(X509_STORE_new()) {
+  signatures_.Install(store_.Get());
 }
 
 TrustStore::~TrustStore() {
+  for (vector<CRLIndex*>::iterator it = crl_indexes_.begin();
+      it != crl_indexes_.end(); ++it) {
+    delete *it;
+  }
 }
 
 bool TrustStore::AddCAFile(const string& filename, string* error_message) {
@@ -56,10 +62,100 @@ bool TrustStore::AddSystemCAPath() {
   return X509_STORE_set_default_paths(store_.Get()) == 1;
 }
 
+bool TrustStore::AddCRLDir(const string& directory, string* error_message) {
+  CRLIndex* crl_index = new CRLIndex();
+  if (!crl_index->Open(directory, error_message)) {
+    delete crl_index;
+    return false;
+  }
+
+  crl_indexes_.push_back(crl_index);
+
+  return true;
+}
+
+CRLIndex::Status TrustStore::RevocationStatus(const X509* x509,
+    X509* issuer) const {
+  const time_t now = time(NULL);
+
+  CRLIndex::Status status = CRLIndex::kStatusUnknown;
+  for (vector<CRLIndex*>::const_iterator it = crl_indexes_.begin();
+      it != crl_indexes_.end(); ++it) {
+    const CRLIndex::Status index_status = (*it)->Lookup(x509, issuer, now);
+    if (index_status == CRLIndex::kStatusRevoked) {
+      return index_status;
+    } else if (index_status == CRLIndex::kStatusGood) {
+      status = index_status;
+    }
+  }
+
+  return status;
+}
+
+#ifdef X509LS_OLD_OPENSSL_NO_TRUST_STORE_LOOKUP
+bool TrustStore::Contains(const X509* x509) const {
+  return false;
+}
+
+void TrustStore::FindBySubject(X509_NAME* name,
+    vector<X509Handle>* certificates) const {
+}
+#else
+bool TrustStore::Contains(const X509* x509) const {
+  X509_STORE_CTX* ctx = X509_STORE_CTX_new();
+  if (ctx == NULL) {
+    return false;
+  }
+  X509_STORE_CTX_init(ctx, store_.Get(), NULL, NULL);
+
+  STACK_OF(X509)* candidates = X509_STORE_get1_certs(ctx,
+      X509_get_subject_name(const_cast<X509*>(x509)));
+
+  bool is_in_trust_store = false;
+
+  if (candidates != NULL) {
+    for (int i = 0; i < sk_X509_num(candidates); ++i) {
+      if (X509_cmp(x509, sk_X509_value(candidates, i)) == 0) {
+        is_in_trust_store = true;
+        break;
+      }
+    }
+    sk_X509_pop_free(candidates, X509_free);
+  }
+
+  X509_STORE_CTX_free(ctx);
+
+  return is_in_trust_store;
+}
+
+void TrustStore::FindBySubject(X509_NAME* name,
+    vector<X509Handle>* certificates) const {
+  X509_STORE_CTX* ctx = X509_STORE_CTX_new();
+  if (ctx == NULL) {
+    return;
+  }
+  X509_STORE_CTX_init(ctx, store_.Get(), NULL, NULL);
+
+  STACK_OF(X509)* found = X509_STORE_get1_certs(ctx, name);
+  if (found != NULL) {
+    for (int i = 0; i < sk_X509_num(found); ++i) {
+      certificates->push_back(X509Handle::Share(sk_X509_value(found, i)));
+    }
+    sk_X509_pop_free(found, X509_free);
+  }
+
+  X509_STORE_CTX_free(ctx);
+}
+#endif
+
 X509_STORE* TrustStore::Store() {
   return store_.Get();
 }
 
+SignatureMemo* TrustStore::Signatures() {
+  return &signatures_;
+}
+
 // static
 void TrustStore::EmitOpenSSLErrors(const string& message, string* output) {
   BioTranslator errors_bio;
@@ -67,7 +163,7 @@ void TrustStore::EmitOpenSSLErrors(const string& message, string* output) {
 
   *output = message;
   output->append("\n");
-  output->append(errors_bio.ToString());
+  errors_bio.AppendTo(output);
 }
 }  // namespace x509ls
 
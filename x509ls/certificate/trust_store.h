@@ -7,12 +7,17 @@
 #include <openssl/x509_vfy.h>
 
 #include <string>
+#include <vector>
 
 #include "x509ls/base/openssl/openssl_environment.h"
 #include "x509ls/base/openssl/scoped_openssl.h"
+#include "x509ls/base/openssl/shared_openssl.h"
 #include "x509ls/base/types.h"
+#include "x509ls/certificate/crl_index.h"
+#include "x509ls/certificate/signature_memo.h"
 
 using std::string;
+using std::vector;
 
 namespace x509ls {
 // Wrapper around the OpenSSL Trust Store.
@@ -22,7 +27,10 @@ namespace x509ls {
 //
 // Provides methods to add files containing trusted certificates, add OpenSSL
 // style directories containing trusted certificates, and add the default system
-// trust store.
+// trust store. Certificates can also be checked against directories of CRLs.
+//
+// Signatures verified against the store are remembered in a SignatureMemo, so
+// issuers shared by many chains are only checked once.
 class TrustStore {
  public:
   TrustStore();
@@ -40,14 +48,38 @@ class TrustStore {
   bool AddCAPath(const string& directory, string* error_message);
   bool AddSystemCAPath();
 
+  // Check revocation against the CRLs in |directory|, see CRLIndex. Returns
+  // false if the directory can't be read.
+  bool AddCRLDir(const string& directory, string* error_message);
+
+  // Return true iif |x509| is one of the trusted certificates. Always returns
+  // false for pre-v1.0.0 versions of OpenSSL, which lack the necessary lookup.
+  bool Contains(const X509* x509) const;
+
+  // Append the trusted certificates with subject |name| to |certificates|.
+  // Appends nothing for pre-v1.0.0 versions of OpenSSL.
+  void FindBySubject(X509_NAME* name, vector<X509Handle>* certificates) const;
+
+  // Return the revocation status of |x509|, issued by |issuer|, from the CRL
+  // directories: Revoked if any CRL signed by |issuer| lists it, good if any
+  // current one doesn't, else unknown. Unknown if |issuer| is NULL.
+  CRLIndex::Status RevocationStatus(const X509* x509, X509* issuer) const;
+
   // Return the underlying trust store.
   X509_STORE* Store();
 
+  // Return the memo of verified signatures.
+  SignatureMemo* Signatures();
+
  private:
   NO_COPY_AND_ASSIGN(TrustStore)
 
   ScopedOpenSSLEnvironment openssl_;
+
+  // Outlives |store_|, which refers to it.
+  SignatureMemo signatures_;
   ScopedOpenSSL<X509_STORE, void, X509_STORE_free> store_;
+  vector<CRLIndex*> crl_indexes_;
 
   static void EmitOpenSSLErrors(const string& message, string* output);
 };
@@ -0,0 +1,411 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/certificate/verified_chain.h"
+
+#include <openssl/x509_vfy.h>
+#include <openssl/x509v3.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "x509ls/certificate/certificate_graph.h"
+#include "x509ls/certificate/trust_store.h"
+
+namespace x509ls {
+VerifiedChain::VerifiedChain(TrustStore* trust_store)
+  :
+    trust_store_(trust_store),
+    chain_(&arena_),
+    path_(&arena_),
+    verify_level_(0),
+    verify_error_(X509_V_OK),
+    are_paths_found_(false),
+    built_path_index_(kNoPath) {
+}
+
+VerifiedChain::~VerifiedChain() {
+  for (vector<FoundPathEntry>::iterator it = found_paths_.begin();
+      it != found_paths_.end(); ++it) {
+    delete it->path;
+  }
+}
+
+void VerifiedChain::PopulateChainAndPath(STACK_OF(X509)* peer_chain) {
+  if (peer_chain == NULL || sk_X509_num(peer_chain) < 1) {
+    return;
+  }
+
+  // Reverify the peer chain to gain access to the verification chain.
+  X509* cert = sk_X509_value(peer_chain, 0);
+
+  X509_STORE_CTX* ctx = X509_STORE_CTX_new();
+  if (ctx == NULL) {
+    return;
+  }
+  X509_STORE_CTX_init(ctx, trust_store_->Store(), cert, peer_chain);
+
+  int result = X509_verify_cert(ctx);
+  STACK_OF(X509)* verification_path = X509_STORE_CTX_get_chain(ctx);
+  if (result < 0) {
+    verification_path = NULL;
+  }
+
+  // Validate the staple against the path: It is signed by the end-entity
+  // certificate's issuer, or one of its delegated responders.
+  leaf_ = X509Handle::Share(cert);
+  if (verification_path != NULL && sk_X509_num(verification_path) > 1) {
+    issuer_ = X509Handle::Share(sk_X509_value(verification_path, 1));
+  }
+  staple_.Validate(cert, issuer_.Get(), peer_chain, trust_store_->Store());
+  const bool is_staple_revoked =
+    staple_.GetStatus() == OCSPStaple::kStatusRevoked;
+
+  // Depth in the validation path of the revoked certificate nearest the
+  // end-entity, as OpenSSL reports errors, or -1.
+  int revoked_depth = -1;
+
+  if (verification_path != NULL) {
+    revoked_depth = AddPath(verification_path, peer_chain, &path_);
+
+    for (int i = 0; i < sk_X509_num(verification_path); ++i) {
+      built_path_.push_back(
+          X509Handle::Share(sk_X509_value(verification_path, i)));
+    }
+  }
+
+  // Populate peer chain.
+  chain_.Reserve(sk_X509_num(peer_chain));
+  for (int i = 0; i < sk_X509_num(peer_chain); ++i) {
+    X509* x509 = sk_X509_value(peer_chain, i);
+    peer_chain_.push_back(X509Handle::Share(x509));
+
+    chain_.Add(*x509,
+        trust_store_->Contains(x509),
+        true,
+        verification_path != NULL &&
+          IsX509InChain(x509, verification_path),
+        (i == 0 && is_staple_revoked) ||
+          trust_store_->RevocationStatus(x509,
+            IssuerOf(x509, verification_path, peer_chain)) ==
+          CRLIndex::kStatusRevoked,
+        i == 0 && staple_.IsCurrent());
+  }
+
+  int verify_error = X509_STORE_CTX_get_error(ctx);
+  int error_depth = X509_STORE_CTX_get_error_depth(ctx);
+
+  // OpenSSL isn't given the CRLs or the staple, so report revocation for
+  // otherwise valid paths.
+  if (verify_error == X509_V_OK && revoked_depth != -1) {
+    verify_error = X509_V_ERR_CERT_REVOKED;
+    error_depth = revoked_depth;
+  }
+
+  SetVerifyStatus(verify_error, error_depth);
+
+  X509_STORE_CTX_free(ctx);
+}
+
+const CertificateList& VerifiedChain::Chain() const {
+  return chain_;
+}
+
+const CertificateList& VerifiedChain::Path() const {
+  return path_;
+}
+
+string VerifiedChain::VerifyStatus() const {
+  return verify_status_.ToString();
+}
+
+int VerifiedChain::VerifyLevel() const {
+  return verify_level_;
+}
+
+void VerifiedChain::SetStapledResponse(const unsigned char* der,
+    size_t size) {
+  staple_.SetResponse(der, size);
+}
+
+const OCSPStaple& VerifiedChain::Staple() const {
+  return staple_;
+}
+
+X509* VerifiedChain::Leaf() const {
+  return leaf_.Get();
+}
+
+X509* VerifiedChain::Issuer() const {
+  return issuer_.Get();
+}
+
+const vector<X509Handle>& VerifiedChain::PeerChain() const {
+  return peer_chain_;
+}
+
+void VerifiedChain::SetResponderResult(const OCSPResult& result) {
+  responder_result_ = result;
+  if (chain_.Size() == 0) {
+    return;
+  }
+
+  if (result.status == OCSPResult::kStatusGood) {
+    chain_.SetResponderGood(0);
+    if (path_.Size() > 0) {
+      path_.SetResponderGood(path_.Size() - 1);
+    }
+    for (vector<FoundPathEntry>::iterator it = found_paths_.begin();
+        it != found_paths_.end(); ++it) {
+      if (it->path != NULL && it->path->Size() > 0) {
+        it->path->SetResponderGood(it->path->Size() - 1);
+      }
+    }
+    return;
+  } else if (result.status != OCSPResult::kStatusRevoked) {
+    return;
+  }
+
+  chain_.SetRevoked(0);
+  if (path_.Size() > 0) {
+    path_.SetRevoked(path_.Size() - 1);
+  }
+
+  if (verify_error_ == X509_V_OK) {
+    SetVerifyStatus(X509_V_ERR_CERT_REVOKED, 0);
+  }
+
+  for (vector<FoundPathEntry>::iterator it = found_paths_.begin();
+      it != found_paths_.end(); ++it) {
+    if (it->path == NULL) {
+      continue;
+    }
+
+    if (it->path->Size() > 0) {
+      it->path->SetRevoked(it->path->Size() - 1);
+    }
+    if (it->verify_error == X509_V_OK) {
+      it->verify_error = X509_V_ERR_CERT_REVOKED;
+      it->verify_status = FormatVerifyStatus(X509_V_ERR_CERT_REVOKED,
+          it->path->Size());
+    }
+  }
+}
+
+const OCSPResult& VerifiedChain::ResponderResult() const {
+  return responder_result_;
+}
+
+void VerifiedChain::FindPaths() {
+  if (peer_chain_.empty() || are_paths_found_) {
+    return;
+  }
+  are_paths_found_ = true;
+
+  CertificateGraph graph(trust_store_);
+  STACK_OF(X509)* peer_chain = sk_X509_new_null();
+  for (vector<X509Handle>::const_iterator it = peer_chain_.begin();
+      it != peer_chain_.end(); ++it) {
+    graph.Add(it->Get());
+    sk_X509_push(peer_chain, it->Get());
+  }
+
+  vector<vector<X509Handle> > paths;
+  graph.FindPaths(peer_chain_[0].Get(), &paths);
+
+  found_paths_.reserve(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    FoundPathEntry entry;
+    entry.path = NULL;
+    entry.verify_error = verify_error_;
+
+    // Path() was verified already.
+    if (built_path_index_ == kNoPath && IsSamePath(paths[i], built_path_)) {
+      built_path_index_ = i;
+    } else {
+      VerifyFoundPath(paths[i], peer_chain, &entry);
+    }
+
+    found_paths_.push_back(entry);
+  }
+
+  sk_X509_free(peer_chain);
+
+  if (responder_result_.status == OCSPResult::kStatusRevoked) {
+    SetResponderResult(responder_result_);
+  }
+}
+
+size_t VerifiedChain::FoundPathCount() const {
+  return found_paths_.size();
+}
+
+const CertificateList& VerifiedChain::FoundPath(size_t index) const {
+  if (found_paths_[index].path == NULL) {
+    return path_;
+  }
+
+  return *found_paths_[index].path;
+}
+
+string VerifiedChain::FoundPathStatus(size_t index) const {
+  if (found_paths_[index].path == NULL) {
+    return VerifyStatus();
+  }
+
+  return found_paths_[index].verify_status.ToString();
+}
+
+size_t VerifiedChain::BuiltPathIndex() const {
+  if (built_path_index_ == kNoPath) {
+    return found_paths_.size();
+  }
+
+  return built_path_index_;
+}
+
+void VerifiedChain::VerifyFoundPath(const vector<X509Handle>& path,
+    STACK_OF(X509)* peer_chain, FoundPathEntry* entry) {
+  // Have OpenSSL verify exactly this path: Its anchor is the only trusted
+  // certificate, and its intermediates the only untrusted ones.
+  STACK_OF(X509)* untrusted = sk_X509_new_null();
+  for (size_t i = 1; i + 1 < path.size(); ++i) {
+    sk_X509_push(untrusted, path[i].Get());
+  }
+  STACK_OF(X509)* trusted = sk_X509_new_null();
+  sk_X509_push(trusted, path.back().Get());
+
+  entry->path = new CertificateList(&arena_);
+  entry->verify_error = X509_V_ERR_APPLICATION_VERIFICATION;
+  int error_depth = 0;
+
+  X509_STORE_CTX* ctx = X509_STORE_CTX_new();
+  if (ctx != NULL) {
+    X509_STORE_CTX_init(ctx, trust_store_->Store(), path[0].Get(), untrusted);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    X509_STORE_CTX_set0_trusted_stack(ctx, trusted);
+#else
+    X509_STORE_CTX_trusted_stack(ctx, trusted);
+#endif
+
+    const int result = X509_verify_cert(ctx);
+    STACK_OF(X509)* verification_path = X509_STORE_CTX_get_chain(ctx);
+
+    int revoked_depth = -1;
+    if (result >= 0 && verification_path != NULL) {
+      revoked_depth = AddPath(verification_path, peer_chain, entry->path);
+    }
+
+    entry->verify_error = X509_STORE_CTX_get_error(ctx);
+    error_depth = X509_STORE_CTX_get_error_depth(ctx);
+    if (entry->verify_error == X509_V_OK && revoked_depth != -1) {
+      entry->verify_error = X509_V_ERR_CERT_REVOKED;
+      error_depth = revoked_depth;
+    }
+
+    X509_STORE_CTX_free(ctx);
+  }
+
+  entry->verify_status = FormatVerifyStatus(entry->verify_error,
+      entry->path->Size() - error_depth);
+
+  sk_X509_free(trusted);
+  sk_X509_free(untrusted);
+}
+
+int VerifiedChain::AddPath(STACK_OF(X509)* verification_path,
+    STACK_OF(X509)* peer_chain, CertificateList* path) {
+  const bool is_staple_revoked =
+    staple_.GetStatus() == OCSPStaple::kStatusRevoked;
+  int revoked_depth = -1;
+
+  path->Reserve(sk_X509_num(verification_path));
+  for (int i = sk_X509_num(verification_path) - 1; i >= 0; --i) {
+    X509* x509 = sk_X509_value(verification_path, i);
+
+    const bool is_revoked = (i == 0 && is_staple_revoked) ||
+      trust_store_->RevocationStatus(x509,
+          IssuerOf(x509, verification_path, NULL)) ==
+      CRLIndex::kStatusRevoked;
+    if (is_revoked) {
+      revoked_depth = i;
+    }
+
+    path->Add(*x509,
+        trust_store_->Contains(x509),
+        IsX509InChain(x509, peer_chain),
+        true,
+        is_revoked,
+        i == 0 && staple_.IsCurrent());
+  }
+
+  return revoked_depth;
+}
+
+void VerifiedChain::SetVerifyStatus(int verify_error, int error_depth) {
+  verify_error_ = verify_error;
+  verify_level_ = path_.Size() - error_depth;
+  verify_status_ = FormatVerifyStatus(verify_error, verify_level_);
+}
+
+ArenaString VerifiedChain::FormatVerifyStatus(int verify_error,
+    int verify_level) {
+  const size_t kMaxVerifyStatusLength = 256;
+  char verify_status[kMaxVerifyStatusLength];
+  if (verify_error != X509_V_OK) {
+    snprintf(verify_status, sizeof verify_status, "Certificate %d: %s",
+        verify_level, X509_verify_cert_error_string(verify_error));
+  } else {
+    snprintf(verify_status, sizeof verify_status, "%s",
+        X509_verify_cert_error_string(verify_error));
+  }
+
+  return arena_.CopyString(verify_status, strlen(verify_status));
+}
+
+// static
+bool VerifiedChain::IsSamePath(const vector<X509Handle>& a,
+    const vector<X509Handle>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (X509_cmp(a[i].Get(), b[i].Get()) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// static
+bool VerifiedChain::IsX509InChain(const X509* x509, STACK_OF(X509)* chain) {
+  for (int i = 0; i < sk_X509_num(chain); ++i) {
+    if (X509_cmp(x509, sk_X509_value(chain, i)) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// static
+X509* VerifiedChain::IssuerOf(X509* x509, STACK_OF(X509)* path,
+    STACK_OF(X509)* peer_chain) {
+  for (int i = 0; i + 1 < sk_X509_num(path); ++i) {
+    if (sk_X509_value(path, i) == x509) {
+      return sk_X509_value(path, i + 1);
+    }
+  }
+
+  for (int i = 0; i + 1 < sk_X509_num(peer_chain); ++i) {
+    X509* issuer = sk_X509_value(peer_chain, i + 1);
+    if (sk_X509_value(peer_chain, i) == x509 &&
+        X509_check_issued(issuer, x509) == X509_V_OK) {
+      return issuer;
+    }
+  }
+
+  return X509_check_issued(x509, x509) == X509_V_OK ? x509 : NULL;
+}
+}  // namespace x509ls
@@ -0,0 +1,178 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CERTIFICATE_VERIFIED_CHAIN_H_
+#define X509LS_CERTIFICATE_VERIFIED_CHAIN_H_
+
+#include <openssl/x509.h>
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/arena.h"
+#include "x509ls/base/openssl/shared_openssl.h"
+#include "x509ls/base/types.h"
+#include "x509ls/certificate/certificate_list.h"
+#include "x509ls/certificate/ocsp_cache.h"
+#include "x509ls/certificate/ocsp_staple.h"
+
+using std::string;
+using std::vector;
+
+namespace x509ls {
+class TrustStore;
+// A server's certificate chain, and the validation path OpenSSL forms from it.
+//
+// The peer chain may come from a live TLS handshake, or from elsewhere (e.g. a
+// ChainCache entry). Either way it is verified against the same TrustStore, so
+// the resulting lists and flags are identical.
+//
+// The certificates and their strings are allocated in one Arena, released in
+// one go with the VerifiedChain.
+class VerifiedChain {
+ public:
+  // Construct an empty VerifiedChain, to be validated against |trust_store|.
+  explicit VerifiedChain(TrustStore* trust_store);
+  ~VerifiedChain();
+
+  // Verify |peer_chain| (end-entity certificate first) and populate Chain(),
+  // Path(), VerifyStatus() and VerifyLevel().
+  //
+  // Call only once. |peer_chain| is not modified. Its certificates aren't
+  // copied: Chain(), Path() and PeerChain() take references on them, through
+  // X509Handles.
+  void PopulateChainAndPath(STACK_OF(X509)* peer_chain);
+
+  // Have PopulateChainAndPath() validate the OCSP response stapled by the
+  // server: The |size| bytes of DER at |der|, or none if |size| is 0. A
+  // revoked status flags the end-entity certificate as revoked.
+  //
+  // Call before PopulateChainAndPath(). Otherwise the staple is reported as
+  // not checked, e.g. for chains from a ChainCache.
+  void SetStapledResponse(const unsigned char* der, size_t size);
+
+  // Return the server's certificate chain.
+  const CertificateList& Chain() const;
+
+  // Return the validation path formed by OpenSSL.
+  const CertificateList& Path() const;
+
+  // Return the validation status string from OpenSSL.
+  string VerifyStatus() const;
+
+  // Return the certificate index in the Path() to which the VerifyStatus()
+  // applies.
+  int VerifyLevel() const;
+
+  // Return the end-entity certificate's stapled OCSP response status.
+  const OCSPStaple& Staple() const;
+
+  // Return the end-entity certificate, and its issuer in the validation path,
+  // or NULL if unknown. Valid after PopulateChainAndPath().
+  X509* Leaf() const;
+  X509* Issuer() const;
+
+  // Return the peer chain, end-entity certificate first. Valid after
+  // PopulateChainAndPath().
+  const vector<X509Handle>& PeerChain() const;
+
+  // Apply |result|, the end-entity certificate's status queried from its OCSP
+  // responder. As for a staple, a revoked status flags the certificate as
+  // revoked. A good status flags it as checked with the responder. Call after
+  // PopulateChainAndPath().
+  void SetResponderResult(const OCSPResult& result);
+
+  // Return the end-entity certificate's OCSP responder status, not checked
+  // unless SetResponderResult() was called.
+  const OCSPResult& ResponderResult() const;
+
+  // Find every path from the end-entity certificate to a trust anchor, through
+  // the peer chain and trusted certificates (see CertificateGraph), where
+  // OpenSSL forms only Path(). Each path is verified by OpenSSL in turn, and
+  // flagged as Path() is.
+  //
+  // Call after PopulateChainAndPath(). Later calls do nothing.
+  void FindPaths();
+
+  // Return the number of paths found by FindPaths(), shortest first, or 0
+  // until it is called.
+  size_t FoundPathCount() const;
+
+  // Return found path |index|, as ordered for Path(), and its validation
+  // status, as for VerifyStatus().
+  const CertificateList& FoundPath(size_t index) const;
+  string FoundPathStatus(size_t index) const;
+
+  // Return the index of the found path identical to Path(), or
+  // FoundPathCount() if none is.
+  size_t BuiltPathIndex() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(VerifiedChain)
+
+  TrustStore* const trust_store_;
+
+  // Holds chain_, path_ and verify_status_, so is declared first.
+  Arena arena_;
+
+  CertificateList chain_;
+  CertificateList path_;
+  ArenaString verify_status_;
+  int verify_level_;
+  int verify_error_;
+  OCSPStaple staple_;
+
+  X509Handle leaf_;
+  X509Handle issuer_;
+  OCSPResult responder_result_;
+
+  // The peer chain and Path(), end-entity certificate first.
+  vector<X509Handle> peer_chain_;
+  vector<X509Handle> built_path_;
+
+  // A path found by FindPaths(). |path| is NULL for Path() itself.
+  struct FoundPathEntry {
+    CertificateList* path;
+    int verify_error;
+    ArenaString verify_status;
+  };
+  vector<FoundPathEntry> found_paths_;
+  bool are_paths_found_;
+
+  static const size_t kNoPath = static_cast<size_t>(-1);
+  size_t built_path_index_;
+
+  // Verify |path| (end-entity certificate first) alone, storing it and its
+  // status in |entry|.
+  void VerifyFoundPath(const vector<X509Handle>& path,
+      STACK_OF(X509)* peer_chain, FoundPathEntry* entry);
+
+  // Add the certificates of |verification_path| (end-entity certificate
+  // first) to |path|, root first, flagged against |peer_chain|, the trust
+  // store and the staple. Returns the depth in |verification_path| of the
+  // revoked certificate nearest the end-entity, or -1.
+  int AddPath(STACK_OF(X509)* verification_path, STACK_OF(X509)* peer_chain,
+      CertificateList* path);
+
+  // Set VerifyStatus() and VerifyLevel() from an OpenSSL |verify_error| at
+  // |error_depth| in the validation path.
+  void SetVerifyStatus(int verify_error, int error_depth);
+
+  // Return the status string for |verify_error| at |verify_level|, in the
+  // arena.
+  ArenaString FormatVerifyStatus(int verify_error, int verify_level);
+
+  static bool IsSamePath(const vector<X509Handle>& a,
+      const vector<X509Handle>& b);
+
+  static bool IsX509InChain(const X509* x509, STACK_OF(X509)* chain);
+
+  // Return the issuer of |x509|: The next certificate in |path| if on it,
+  // else the next in |peer_chain| if it issued |x509|, else |x509| itself if
+  // self-issued, else NULL. |path| may be NULL.
+  static X509* IssuerOf(X509* x509, STACK_OF(X509)* path,
+      STACK_OF(X509)* peer_chain);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CERTIFICATE_VERIFIED_CHAIN_H_
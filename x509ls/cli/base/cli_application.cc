@@ -6,11 +6,21 @@
 #include <locale.h>
 #include <stdio.h>
 
+#include "x509ls/base/clock.h"
+#include "x509ls/base/metrics.h"
+
 namespace x509ls {
+// static
+const int CliApplication::kLoopPollIntervalMs = 1000;
+
 CliApplication::CliApplication()
   :
     exit_requested_(false),
-    exit_success_(false) {
+    exit_success_(false),
+    headless_(false),
+    loop_histogram_(NULL),
+    loop_iterations_(0),
+    repaints_(0) {
 }
 
 CliApplication::~CliApplication() {
@@ -20,6 +30,10 @@ bool CliApplication::Run() {
   exit_requested_ = false;
   exit_success_ = false;
 
+  if (headless_) {
+    return RunHeadless();
+  }
+
   StartNCurses();
 
   RunEvent();
@@ -30,6 +44,9 @@ bool CliApplication::Run() {
   doupdate();
 
   while (!exit_requested_ && layouts_.size() > 0) {
+    const int64_t iteration_start_us = Clock::NowMicroseconds();
+    int64_t wait_us = 0;
+
     // The event loop watches two types of events:
     // - file descriptors (e.g. network socket)
     // - ncurses's getch() events (can be set blocking/non-blocking).
@@ -48,12 +65,20 @@ bool CliApplication::Run() {
 
     if (using_network_events) {
       event_manager_.DeliverNetworkEvents(250);
+      wait_us += event_manager_.LastWaitMicroseconds();
     }
 
-    // getch() setup: is_watching_fds ? 1ms timeout : blocking
-    timeout(using_network_events ? 1 : -1);
+    // getch() setup: is_watching_fds ? 1ms timeout : blocking, or waking for
+    // loop polls.
+    if (using_network_events) {
+      timeout(1);
+    } else {
+      timeout(loop_poll_receivers_.empty() ? -1 : kLoopPollIntervalMs);
+    }
 
+    const int64_t getch_start_us = Clock::NowMicroseconds();
     int ch = getch();
+    wait_us += Clock::NowMicroseconds() - getch_start_us;
     if (ch == ERR) {
       // Ignore non-blocking no-character-available condition.
     } else if (ch == KEY_RESIZE) {
@@ -66,8 +91,11 @@ bool CliApplication::Run() {
 
     ProcessDeferredCloseRequests();
     event_manager_.DeliverEvents();
+    DeliverLoopPoll();
 
     doupdate();
+
+    RecordLoopIteration(iteration_start_us, wait_us);
   }
 
   while (layouts_.size() > 0) {
@@ -81,6 +109,80 @@ bool CliApplication::Run() {
   return exit_success_;
 }
 
+bool CliApplication::RunHeadless() {
+  // Without keyboard input to wait for, wait on network events only. Wake
+  // often: Objects such as DnsLookup rely on being polled.
+  const int kHeadlessTimeoutMs = 5;
+
+  RunEvent();
+  event_manager_.DeliverEvents();
+
+  while (!exit_requested_ && event_manager_.HasNetworkEvents()) {
+    const int64_t iteration_start_us = Clock::NowMicroseconds();
+
+    event_manager_.DeliverNetworkEvents(kHeadlessTimeoutMs);
+    event_manager_.DeliverEvents();
+
+    RecordLoopIteration(iteration_start_us,
+        event_manager_.LastWaitMicroseconds());
+  }
+
+  ExitEvent();
+
+  return exit_success_;
+}
+
+void CliApplication::SetHeadless(bool headless) {
+  headless_ = headless;
+}
+
+bool CliApplication::IsHeadless() const {
+  return headless_;
+}
+
+void CliApplication::EnableLoopPoll(CliControl* control) {
+  loop_poll_receivers_.insert(control);
+}
+
+void CliApplication::DisableLoopPoll(CliControl* control) {
+  loop_poll_receivers_.erase(control);
+}
+
+void CliApplication::DeliverLoopPoll() {
+  // Uses a copy since receivers may disable polling.
+  const set<CliControl*> receivers = loop_poll_receivers_;
+  for (set<CliControl*>::const_iterator it = receivers.begin();
+      it != receivers.end();
+      ++it) {
+    if (loop_poll_receivers_.count(*it) > 0) {
+      (*it)->OnLoopPoll();
+    }
+  }
+}
+
+void CliApplication::SetLoopHistogram(Histogram* histogram) {
+  loop_histogram_ = histogram;
+}
+
+void CliApplication::RecordLoopIteration(int64_t start_us, int64_t wait_us) {
+#ifdef X509LS_LOOP_STATISTICS
+  ++loop_iterations_;
+#endif
+
+  if (loop_histogram_) {
+    loop_histogram_->Observe(Clock::NowMicroseconds() - start_us - wait_us);
+  }
+}
+
+void CliApplication::TakeLoopStatistics(LoopStatistics* statistics) {
+  event_manager_.TakeStatistics(statistics);
+
+  statistics->iterations = loop_iterations_;
+  statistics->paints = repaints_;
+  loop_iterations_ = 0;
+  repaints_ = 0;
+}
+
 void CliApplication::Exit(bool success) {
   exit_requested_ = true;
   exit_success_ = success;
@@ -6,18 +6,24 @@
 
 #include <ncurses.h>
 #include <panel.h>
+#include <stdint.h>
 
 #include <list>
+#include <set>
 #include <string>
 
 #include "x509ls/base/event_manager.h"
+#include "x509ls/base/loop_statistics.h"
 #include "x509ls/base/types.h"
 #include "x509ls/cli/base/cli_control.h"
 
 using std::list;
+using std::set;
 using std::string;
 
 namespace x509ls {
+class Histogram;
+
 // Abstract base class for an ncurses application.
 //
 // CliApplication provides the base for an ncurses application. It consists of:
@@ -34,6 +40,10 @@ namespace x509ls {
 // Use of a basic CliApplication is simply:
 //   MyApplication my_app;
 //   bool success = my_app.Run();
+//
+// A CliApplication may instead run headless (see SetHeadless()), for
+// non-interactive use: No ncurses interface is started, and the run loop only
+// delivers network and pub-sub events.
 class CliApplication {
  public:
   CliApplication();
@@ -52,8 +62,19 @@ class CliApplication {
   //
   // Returns true iif the application run was deemed to be successful. Set by
   // the |success| flag to Exit().
+  //
+  // When headless, the ncurses steps are skipped, and the run loop also exits
+  // once there are no network or pub-sub events left to deliver.
   bool Run();
 
+  // Run without an ncurses interface if |headless| is true. Call before Run().
+  //
+  // Screen layouts can't be shown when headless.
+  void SetHeadless(bool headless);
+
+  // Return true iif running headless.
+  bool IsHeadless() const;
+
   // Request exit of the CLI during the run loop.
   //
   // The run loop will exit as soon as possible. |success| indicates whether the
@@ -85,6 +106,33 @@ class CliApplication {
   // If no more screen layouts exist then the run loop exits, returning false.
   void Close(CliControl* control);
 
+  // Record the time each run loop iteration spends delivering events, i.e.
+  // excluding waits for network activity or keyboard input, in |histogram|.
+  // May be NULL (the default), and must outlive the run loop.
+  void SetLoopHistogram(Histogram* histogram);
+
+  // Move the run loop's statistics since the last call into |statistics|,
+  // for a view of event loop health. See LoopStatistics.
+  void TakeLoopStatistics(LoopStatistics* statistics);
+
+  // Count a top level control repaint. Called by CliControl::Repaint().
+  void CountRepaint() {
+#ifdef X509LS_LOOP_STATISTICS
+    ++repaints_;
+#endif
+  }
+
+  // Call |control|'s OnLoopPoll() after each run loop iteration, until
+  // DisableLoopPoll(). While waiting for keyboard input only, the run loop
+  // then wakes every kLoopPollIntervalMs.
+  //
+  // Unlike EventManager polling, the run loop stays in keyboard only mode:
+  // Key presses are handled without delay.
+  void EnableLoopPoll(CliControl* control);
+  void DisableLoopPoll(CliControl* control);
+
+  static const int kLoopPollIntervalMs;
+
   // Return the application's EventManager.
   EventManager* GetEventManager();
 
@@ -108,6 +156,22 @@ class CliApplication {
   // Flag to indicate if the application run has been successful or not.
   bool exit_success_;
 
+  // Flag to indicate if the application runs without ncurses.
+  bool headless_;
+
+  // Receives the busy time of each run loop iteration, or NULL.
+  Histogram* loop_histogram_;
+
+  // Record an iteration which started at |start_us| and waited for |wait_us|.
+  void RecordLoopIteration(int64_t start_us, int64_t wait_us);
+
+  // Run loop iterations and repaints, see TakeLoopStatistics().
+  uint64_t loop_iterations_;
+  uint64_t repaints_;
+
+  // The run loop used when |headless_|.
+  bool RunHeadless();
+
   // Startup the ncurses environment.
   void StartNCurses();
 
@@ -134,6 +198,12 @@ class CliApplication {
   // List of screen layouts.
   list<struct Layout> layouts_;
 
+  // CliControls receiving OnLoopPoll().
+  set<CliControl*> loop_poll_receivers_;
+
+  // Call OnLoopPoll() on |loop_poll_receivers_|.
+  void DeliverLoopPoll();
+
   // List of CliControls requested to be closed.
   list<CliControl*> deferred_close_requests_;
 
@@ -54,6 +54,10 @@ CliControl::~CliControl() {
   children_.clear();
 }
 
+// virtual
+void CliControl::OnLoopPoll() {
+}
+
 bool CliControl::OnKeyPress(int keypress) {
   bool handled = false;
 
@@ -86,6 +90,7 @@ void CliControl::Repaint(bool recursive_repaint) {
   if (!recursive_repaint) {
     // Top level Repaint() call only restores focus.
     GetApplication()->FocusedControl()->OnFocus();
+    GetApplication()->CountRepaint();
   }
 }
 
@@ -158,7 +163,15 @@ void CliControl::SetWindow(WINDOW* window) {
     for (list<ChildControl>::iterator it = children_.begin();
        it != children_.end();
        ++it) {
-      if (Rows() - current_row == 0 ||
+      if (it->required_rows == 0) {
+        // Hidden.
+        it->control->SetWindow(NULL);
+
+        if (it->window) {
+          delwin(it->window);
+          it->window = NULL;
+        }
+      } else if (Rows() - current_row == 0 ||
           (it->required_rows != -1 &&
            Rows() - current_row < it->required_rows)) {
         // Ran out of space, don't assign a subwindow for this, it can't render.
@@ -233,6 +246,18 @@ void CliControl::ReplaceChild(int index, CliControl* control) {
   Repaint();
 }
 
+void CliControl::UpdateChildHeights() {
+  for (list<ChildControl>::iterator it = children_.begin();
+      it != children_.end();
+      ++it) {
+    it->required_rows = it->control->PreferredHeight();
+  }
+
+  SetWindow(Window());
+
+  Repaint();
+}
+
 void CliControl::SetFocusedChild(CliControl* control) {
   if (control == focused_child_) {
     return;
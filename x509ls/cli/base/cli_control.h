@@ -66,8 +66,8 @@ class CliControl : public BaseObject {
 
   // Return the preferred height in rows.
   //
-  // Return -1 to request using the maximum space available. By default returns
-  // -1.
+  // Return -1 to request using the maximum space available, or 0 to be hidden.
+  // By default returns -1.
   virtual int PreferredHeight() const;
 
   // Repaint the control and any child controls.
@@ -109,6 +109,10 @@ class CliControl : public BaseObject {
   // Called when focus is lost. Hides the terminal cursor.
   void OnBlur();
 
+  // Called after each run loop iteration when the control has requested loop
+  // polling, see CliApplication::EnableLoopPoll().
+  virtual void OnLoopPoll();
+
   // Return the current child CliControl selected for focus, or otherwise NULL
   // to retain focus.
   //
@@ -149,6 +153,10 @@ class CliControl : public BaseObject {
   // ownership to either control.
   void ReplaceChild(int index, CliControl* control);
 
+  // Lay out the sub-controls again with their current PreferredHeight()s, e.g.
+  // after one is shown or hidden.
+  void UpdateChildHeights();
+
   // Set the currently focused child control to |control|. Set to NULL to take
   // focus.
   void SetFocusedChild(CliControl* control);
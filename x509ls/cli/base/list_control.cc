@@ -38,6 +38,15 @@ void ListControl::SetModel(const ListModel* model) {
   Emit(kEventSelectedItemChanged);
 }
 
+void ListControl::ReplaceModel(const ListModel* model) {
+  model_ = model;
+  if (model_ == NULL || selected_index_ >= model_->Size()) {
+    selected_index_ = 0;
+  }
+
+  Repaint();
+}
+
 bool ListControl::AdjustSelectedIndex(int adjustment) {
   if (!model_) {
     return false;
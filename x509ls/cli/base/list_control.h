@@ -45,6 +45,10 @@ class ListControl : public CliControl {
   // selected index is reset back to zero. Repaints to display the new model.
   void SetModel(const ListModel* model);
 
+  // Set the data source to |model|, which holds the same items as the current
+  // model. The selected index is kept. Repaints to display the new model.
+  void ReplaceModel(const ListModel* model);
+
   // The following methods return true iif the selected index changed. Reasons
   // for not changing include selecting a negative or identical index.
   //
@@ -155,7 +155,11 @@ bool TextControl::KeyPressEvent(int keypress) {
 }
 
 void TextControl::SetText(const string& text) {
-  text_ = text;
+  SetText(text.data(), text.size());
+}
+
+void TextControl::SetText(const char* text, size_t size) {
+  text_.assign(text, size);
   first_visible_line_index_ = 0;
   line_count_ = 0;
   line_to_byte_offset_.clear();
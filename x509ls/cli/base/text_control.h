@@ -54,6 +54,9 @@ class TextControl : public CliControl {
   // The scroll offset is reset to zero and the new text is painted.
   void SetText(const string& text);
 
+  // Set the displayed text to the |size| bytes at |text|, copied once.
+  void SetText(const char* text, size_t size);
+
  protected:
   virtual void PaintEvent();
   virtual bool KeyPressEvent(int keypress);
@@ -37,7 +37,7 @@ CertificateListControl::~CertificateListControl() {
 // virtual
 void CertificateListControl::PaintLine(unsigned int index, unsigned int row,
     bool selected) {
-  const Certificate& cert = (*model_)[index];
+  const unsigned int flags = model_->Flags(index);
 
   WINDOW* window = Window();
 
@@ -50,14 +50,14 @@ void CertificateListControl::PaintLine(unsigned int index, unsigned int row,
   wmove(window, row, 0);
 
   // Displays certificates in list or hierarchy format, based on |list_type_|.
-  // stpc   1 GlobalSign Root CA                                      2024-01-02
-  // stpc   1 + GlobalSign Root CA                                    2024-01-02
+  // stvcroq   1 GlobalSign Root CA                                   2024-01-02
+  // stvcroq   1 + GlobalSign Root CA                                 2024-01-02
 #ifdef X509LS_OLD_OPENSSL_NO_TRUST_STORE_LOOKUP
   // OpenSSL <v1 doesn't have the X509_STORE_get1_certs function needed for the
   // 't' (in trust store) flag. Omit showing it.
-  const int kFlagsSize = 3;
+  const int kFlagsSize = 6;
 #else
-  const int kFlagsSize = 4;
+  const int kFlagsSize = 7;
 #endif
 
   bool show_expiry = false;
@@ -84,9 +84,9 @@ void CertificateListControl::PaintLine(unsigned int index, unsigned int row,
     cols_for_common_name -= kExpiryColSize + 1;  // Expiry date & sp char.
   }
 
-  string common_name = cert.CommonNames();
+  string common_name = model_->CommonNames(index);
   if (common_name.empty()) {
-    common_name = cert.Subject();
+    common_name = model_->Name(index);
   }
 
   // Replace any unprintable (i.e. control) characters with '?'.
@@ -100,20 +100,29 @@ void CertificateListControl::PaintLine(unsigned int index, unsigned int row,
     common_name.append("...");
   }
 
-  PrintFlag(cert.IsSelfSigned(), 's',
+  PrintFlag(flags & CertificateList::kFlagSelfSigned, 's',
       selected ? Colours::kColourRedHighlighted : Colours::kColourRed);
 
 #ifndef X509LS_OLD_OPENSSL_NO_TRUST_STORE_LOOKUP
-  PrintFlag(cert.IsInTrustStore(), 't',
+  PrintFlag(flags & CertificateList::kFlagInTrustStore, 't',
       selected ? Colours::kColourYellowHighlighted : Colours::kColourYellow);
 #endif
 
-  PrintFlag(cert.IsInValidationPath(), 'v',
+  PrintFlag(flags & CertificateList::kFlagInValidationPath, 'v',
       selected ? Colours::kColourGreenHighlighted : Colours::kColourGreen);
 
-  PrintFlag(cert.IsInPeerChain(), 'c',
+  PrintFlag(flags & CertificateList::kFlagInPeerChain, 'c',
       selected ? Colours::kColourPurpleHighlighted : Colours::kColourPurple);
 
+  PrintFlag(flags & CertificateList::kFlagRevoked, 'r',
+      selected ? Colours::kColourRedHighlighted : Colours::kColourRed);
+
+  PrintFlag(flags & CertificateList::kFlagStapled, 'o',
+      selected ? Colours::kColourGreenHighlighted : Colours::kColourGreen);
+
+  PrintFlag(flags & CertificateList::kFlagResponderGood, 'q',
+      selected ? Colours::kColourGreenHighlighted : Colours::kColourGreen);
+
   wattrset(window, Colours::Get(
       selected ? Colours::kColourHighlighted : Colours::kColourDefault));
 
@@ -134,7 +143,7 @@ void CertificateListControl::PaintLine(unsigned int index, unsigned int row,
   if (show_expiry) {
     wmove(window, row, Cols() - kExpiryColSize);
     wattron(window, A_BOLD);
-    wprintw(window, "%s", cert.NotAfterDate().c_str());
+    wprintw(window, "%s", model_->NotAfterDate(index).c_str());
     wattroff(window, A_BOLD);
   }
 
@@ -155,6 +164,11 @@ void CertificateListControl::SetModel(const CertificateList* model) {
   ListControl::SetModel(model);
 }
 
+void CertificateListControl::ReplaceModel(const CertificateList* model) {
+  model_ = model;
+  ListControl::ReplaceModel(model);
+}
+
 const Certificate* CertificateListControl::CurrentCertificate() const {
   const int index = SelectedIndex();
   if (index == -1) {
@@ -61,6 +61,10 @@ class CertificateListControl : public ListControl {
   // See the constructor description for |model|'s lifetime requirements.
   void SetModel(const CertificateList* model);
 
+  // Display |model|, which holds the same certificates as the current list,
+  // keeping the selection.
+  void ReplaceModel(const CertificateList* model);
+
   // Returns the current certificate list.
   const CertificateList* Model() const;
 
@@ -6,10 +6,15 @@
 #include <ctype.h>
 #include <ncurses.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <algorithm>
 #include <sstream>
 
+#include "x509ls/base/arena.h"
+#include "x509ls/certificate/ocsp_cache.h"
+#include "x509ls/certificate/ocsp_staple.h"
+#include "x509ls/certificate/verified_chain.h"
 #include "x509ls/cli/base/cli_application.h"
 #include "x509ls/cli/base/colours.h"
 #include "x509ls/cli/base/command_line.h"
@@ -17,15 +22,19 @@
 #include "x509ls/cli/base/text_control.h"
 #include "x509ls/cli/certificate_list_control.h"
 #include "x509ls/cli/certificate_view_layout.h"
+#include "x509ls/cli/handshake_timeline_layout.h"
+#include "x509ls/cli/loop_health_panel.h"
 #include "x509ls/cli/menu_bar.h"
 #include "x509ls/cli/status_bar.h"
 #include "x509ls/net/chain_fetcher.h"
+#include "x509ls/net/fetch_metrics.h"
 #include "x509ls/net/ssl_client.h"
 
 namespace x509ls {
 // static
 const char* CertificateListLayout::kMenuText = ""
-  "q:quit g:goto-host r:reload t:toggle-display s:save";
+  "q:quit g:goto-host r:reload t:toggle-display p:next-path s:save "
+  "h:handshake l:loop-stats";
 
 // static
 const int CertificateListLayout::kListControlIndexValidationPath = 0;
@@ -38,16 +47,24 @@ CertificateListLayout::CertificateListLayout(CliApplication* application,
   :
     CliControl(application),
     trust_store_(trust_store),
+    chain_cache_(NULL),
+    address_map_(NULL),
+    metrics_(NULL),
+    ocsp_client_(NULL),
     menu_bar_(new MenuBar(this, kMenuText)),
     top_status_bar_(new StatusBar(this, "")),
     text_control_(new TextControl(this, "")),
+    loop_health_panel_(new LoopHealthPanel(this)),
     bottom_status_bar_(new StatusBar(this, "")),
     command_line_(new CommandLine(this)),
     displayed_list_control_index_(kListControlIndexValidationPath),
+    displayed_path_index_(0),
     lookup_type_(DnsLookup::kLookupTypeIPv4then6),
     tls_method_index_(0),
     tls_auth_type_index_(0),
-    current_fetcher_(NULL) {
+    early_abort_(false),
+    current_fetcher_(NULL),
+    fetch_in_flight_(false) {
   list_controls_[kListControlIndexValidationPath] =
         new CertificateListControl(
           this,
@@ -67,6 +84,7 @@ CertificateListLayout::CertificateListLayout(CliApplication* application,
   AddChild(list_controls_[kListControlIndexValidationPath]);
   AddChild(top_status_bar_);
   AddChild(text_control_);
+  AddChild(loop_health_panel_);
   AddChild(bottom_status_bar_);
   AddChild(command_line_);
 
@@ -82,6 +100,7 @@ CertificateListLayout::CertificateListLayout(CliApplication* application,
 CertificateListLayout::~CertificateListLayout() {
   if (current_fetcher_ != NULL) {
     current_fetcher_->Cancel();
+    RecordFetchFinished(ChainFetcher::kStateCancel);
   }
 }
 
@@ -105,6 +124,11 @@ bool CertificateListLayout::KeyPressEvent(int keypress) {
     tls_method_index_ = SslClient::NextTlsMethod(tls_method_index_);
     UpdateStatusBarOptionsText();
     break;
+  case 'e':
+    early_abort_ = !early_abort_;
+    UpdateStatusBarOptionsText();
+    handled = true;
+    break;
   case 's':
     ShowSaveCertificatesPrompt();
     break;
@@ -122,6 +146,18 @@ bool CertificateListLayout::KeyPressEvent(int keypress) {
   case 't':
     ToggleDisplayedListControl();
     break;
+  case 'p':
+    ShowNextPath();
+    handled = true;
+    break;
+  case 'h':
+    ShowHandshakeTimelineLayout();
+    handled = true;
+    break;
+  case 'l':
+    ToggleLoopHealthPanel();
+    handled = true;
+    break;
   case KEY_UP:
     list_controls_[displayed_list_control_index_]->SelectPrevious();
     handled = true;
@@ -174,6 +210,15 @@ void CertificateListLayout::OnEvent(const BaseObject* source, int event_code) {
 
     SetFocusedChild(NULL);
   } else if (source == current_fetcher_) {
+    UpdateStatusBarTimingText();
+
+    if (event_code == ChainFetcher::kStateResolveFail ||
+        event_code == ChainFetcher::kStateConnectSuccess ||
+        event_code == ChainFetcher::kStateRevalidated ||
+        event_code == ChainFetcher::kStateConnectFail) {
+      RecordFetchFinished(event_code);
+    }
+
     switch (event_code) {
     case ChainFetcher::kStateResolveFail:
       command_line_->DisplayMessage(current_fetcher_->ErrorMessage());
@@ -183,19 +228,23 @@ void CertificateListLayout::OnEvent(const BaseObject* source, int event_code) {
       break;
     case ChainFetcher::kStateConnectSuccess:
       DisplayConnectSuccessMessage();
-      list_controls_[kListControlIndexValidationPath]->SetModel(
-          current_fetcher_->Path());
-      list_controls_[kListControlIndexPeerChain]->SetModel(
-          current_fetcher_->Chain());
-
-      list_controls_[kListControlIndexValidationPath]->SelectLast();
-
-      // Emitted ListControl::kSelectedItemChanged event used to update
-      // certificate preview text.
+      ShowFetchedCertificates();
+      break;
+    case ChainFetcher::kStateCacheHit:
+      ShowFetchedCertificates();
+      break;
+    case ChainFetcher::kStateRevalidated:
+      // The chain is unchanged, but the live verification replaces the
+      // cached one for its stapled OCSP response.
+      DisplayRevalidatedMessage();
+      ReplaceFetchedCertificates();
       break;
     case ChainFetcher::kStateConnectFail:
       DisplayConnectFailedMessage();
       break;
+    case ChainFetcher::kStateCheckingRevocation:
+      DisplayCheckingRevocationMessage();
+      break;
     default:
       break;
     }
@@ -209,6 +258,7 @@ void CertificateListLayout::OnEvent(const BaseObject* source, int event_code) {
 void CertificateListLayout::GotoHost(const string& user_input_node) {
   if (current_fetcher_ != NULL) {
     current_fetcher_->Cancel();
+    RecordFetchFinished(ChainFetcher::kStateCancel);
     Unsubscribe(current_fetcher_);
 
     list_controls_[kListControlIndexValidationPath]->SetModel(NULL);
@@ -216,6 +266,7 @@ void CertificateListLayout::GotoHost(const string& user_input_node) {
     UpdateDisplayedCertificate();
 
     bottom_status_bar_->SetMainText("");
+    top_status_bar_->SetExtraText("");
 
     DeleteChild(current_fetcher_);
     current_fetcher_ = NULL;
@@ -234,34 +285,149 @@ void CertificateListLayout::GotoHost(const string& user_input_node) {
 
   current_fetcher_ = new ChainFetcher(this, trust_store_, node,
       port, lookup_type_, tls_method_index_, tls_auth_type_index_);
+  current_fetcher_->SetChainCache(chain_cache_);
+  current_fetcher_->SetAddressMap(address_map_);
+  current_fetcher_->SetEarlyAbort(early_abort_);
+  current_fetcher_->SetRecordHandshake(true);
+  current_fetcher_->SetFindPaths(true);
+  current_fetcher_->SetOCSPClient(ocsp_client_);
   Subscribe(current_fetcher_, ChainFetcher::kStateResolving);
   Subscribe(current_fetcher_, ChainFetcher::kStateResolveFail);
   Subscribe(current_fetcher_, ChainFetcher::kStateConnecting);
   Subscribe(current_fetcher_, ChainFetcher::kStateConnectSuccess);
   Subscribe(current_fetcher_, ChainFetcher::kStateConnectFail);
-  Subscribe(current_fetcher_, ChainFetcher::kStateResolving);
+  Subscribe(current_fetcher_, ChainFetcher::kStateCacheHit);
+  Subscribe(current_fetcher_, ChainFetcher::kStateRevalidated);
+  Subscribe(current_fetcher_, ChainFetcher::kStateCheckingRevocation);
   current_fetcher_->Start();
 
-  DisplayLoadingMessage();
+  fetch_in_flight_ = true;
+  if (metrics_) {
+    metrics_->FetchStarted();
+    if (chain_cache_) {
+      metrics_->ChainCacheLookup(current_fetcher_->WasCacheHit());
+    }
+  }
+
+  if (current_fetcher_->IsChainFromCache()) {
+    DisplayCacheHitMessage();
+  } else {
+    DisplayLoadingMessage();
+  }
+}
+
+void CertificateListLayout::SetChainCache(ChainCache* chain_cache) {
+  chain_cache_ = chain_cache;
+}
+
+void CertificateListLayout::SetAddressMap(const AddressMap* address_map) {
+  address_map_ = address_map;
+}
+
+void CertificateListLayout::SetMetrics(FetchMetrics* metrics) {
+  metrics_ = metrics;
+}
+
+void CertificateListLayout::SetOCSPCache(OCSPCache* ocsp_cache) {
+  if (ocsp_client_) {
+    DeleteChild(ocsp_client_);
+    ocsp_client_ = NULL;
+  }
+
+  if (ocsp_cache) {
+    ocsp_client_ = new OCSPClient(this, ocsp_cache, trust_store_);
+  }
+}
+
+void CertificateListLayout::RecordFetchFinished(int event_code) {
+  if (fetch_in_flight_ && metrics_) {
+    metrics_->FetchFinished(*current_fetcher_, event_code);
+  }
+  fetch_in_flight_ = false;
+}
+
+void CertificateListLayout::ShowFetchedCertificates() {
+  // Start with the path OpenSSL formed.
+  const VerifiedChain* verification = current_fetcher_->Verification();
+  displayed_path_index_ = verification ? verification->BuiltPathIndex() : 0;
+
+  list_controls_[kListControlIndexValidationPath]->SetModel(DisplayedPath());
+  list_controls_[kListControlIndexPeerChain]->SetModel(
+      current_fetcher_->Chain());
+
+  list_controls_[kListControlIndexValidationPath]->SelectLast();
+
+  // Emitted ListControl::kSelectedItemChanged event used to update
+  // certificate preview text.
+}
+
+void CertificateListLayout::ReplaceFetchedCertificates() {
+  if (displayed_path_index_ >= PathCount()) {
+    ShowFetchedCertificates();
+    return;
+  }
+
+  list_controls_[kListControlIndexValidationPath]->ReplaceModel(
+      DisplayedPath());
+  list_controls_[kListControlIndexPeerChain]->ReplaceModel(
+      current_fetcher_->Chain());
+
+  UpdateDisplayedCertificate();
 }
 
 void CertificateListLayout::DisplayLoadingMessage() {
+  if (current_fetcher_->IsChainFromCache()) {
+    DisplayCacheHitMessage();
+    return;
+  }
+
   std::stringstream message;
   message << "Loading " << LocationText();
 
   command_line_->DisplayMessage(message.str());
 }
 
+void CertificateListLayout::DisplayCacheHitMessage() {
+  std::stringstream message;
+  message << "Cached " << LocationText();
+  message << " (" << current_fetcher_->CachedChainAge() << "s old)";
+  message << ", revalidating";
+
+  command_line_->DisplayMessage(message.str());
+}
+
+void CertificateListLayout::DisplayCheckingRevocationMessage() {
+  std::stringstream message;
+  message << "Connected to " << LocationText() << ", checking revocation";
+
+  command_line_->DisplayMessage(message.str());
+}
+
+void CertificateListLayout::DisplayRevalidatedMessage() {
+  std::stringstream message;
+  message << "Connected to " << LocationText() << " ok, chain unchanged";
+
+  command_line_->DisplayMessage(message.str());
+}
+
 void CertificateListLayout::DisplayConnectSuccessMessage() {
   std::stringstream message;
   message << "Connected to " << LocationText() << " ok";
 
+  const string savings = current_fetcher_->EarlyAbortSavings();
+  if (!savings.empty()) {
+    message << " (early abort, " << savings << ")";
+  }
+
   command_line_->DisplayMessage(message.str());
 }
 
 void CertificateListLayout::DisplayConnectFailedMessage() {
   std::stringstream message;
   message << "Connection failed to " << LocationText();
+  if (current_fetcher_->IsChainFromCache()) {
+    message << ", showing cached chain";
+  }
 
   command_line_->DisplayMessage(message.str());
 }
@@ -292,11 +458,19 @@ void CertificateListLayout::UpdateStatusBarOptionsText() {
   options_text << " v:";
   options_text << DnsLookup::LookupTypeName(lookup_type_);
 
+  options_text << " e:";
+  options_text << (early_abort_ ? "abort-early" : "full");
+
   options_text << " ";
 
   bottom_status_bar_->SetExtraText(options_text.str());
 }
 
+void CertificateListLayout::UpdateStatusBarTimingText() {
+  const string timing = current_fetcher_->Timing().Summary();
+  top_status_bar_->SetExtraText(timing.empty() ? "" : timing + " ");
+}
+
 void CertificateListLayout::ShowGotoHostPrompt() {
   current_text_input_type_ = kTextInputTypeGo;
   command_line_->DisplayPrompt("Goto host: ");
@@ -314,16 +488,84 @@ void CertificateListLayout::ToggleDisplayedListControl() {
   UpdateDisplayedCertificate();
 }
 
+void CertificateListLayout::ShowNextPath() {
+  if (current_fetcher_ == NULL || PathCount() < 2) {
+    command_line_->DisplayMessage("No other validation paths found.");
+    return;
+  }
+
+  displayed_path_index_ = (displayed_path_index_ + 1) % PathCount();
+
+  list_controls_[kListControlIndexValidationPath]->SetModel(DisplayedPath());
+  list_controls_[kListControlIndexValidationPath]->SelectLast();
+
+  if (displayed_list_control_index_ != kListControlIndexValidationPath) {
+    ToggleDisplayedListControl();
+  } else {
+    UpdateDisplayedCertificate();
+  }
+}
+
+size_t CertificateListLayout::PathCount() const {
+  const VerifiedChain* verification = current_fetcher_->Verification();
+  if (verification == NULL) {
+    return 0;
+  }
+
+  const size_t found_count = verification->FoundPathCount();
+  if (verification->BuiltPathIndex() < found_count) {
+    return found_count;
+  }
+
+  return found_count + 1;
+}
+
+const CertificateList* CertificateListLayout::DisplayedPath() const {
+  const VerifiedChain* verification = current_fetcher_->Verification();
+  if (verification != NULL &&
+      displayed_path_index_ < verification->FoundPathCount()) {
+    return &(verification->FoundPath(displayed_path_index_));
+  }
+
+  return current_fetcher_->Path();
+}
+
+string CertificateListLayout::DisplayedPathStatus() const {
+  const VerifiedChain* verification = current_fetcher_->Verification();
+  if (verification != NULL &&
+      displayed_path_index_ < verification->FoundPathCount()) {
+    return verification->FoundPathStatus(displayed_path_index_);
+  }
+
+  return current_fetcher_->VerifyStatus();
+}
+
 void CertificateListLayout::UpdateDisplayedCertificate() {
   const Certificate* certificate =
     list_controls_[displayed_list_control_index_]->CurrentCertificate();
 
-  text_control_->SetText(certificate ? certificate->TextDescription() : "");
+  if (certificate) {
+    const ArenaString& text = certificate->TextDescriptionView();
+    text_control_->SetText(text.data, text.size);
+  } else {
+    text_control_->SetText("");
+  }
 
   if (current_fetcher_ != NULL) {
     switch (displayed_list_control_index_) {
     case kListControlIndexValidationPath:
-      top_status_bar_->SetMainText("Showing Validation Path");
+      if (PathCount() > 1) {
+        const VerifiedChain* verification = current_fetcher_->Verification();
+        std::stringstream text;
+        text << "Showing Validation Path " << displayed_path_index_ + 1;
+        text << " of " << PathCount();
+        if (displayed_path_index_ == verification->BuiltPathIndex()) {
+          text << " (OpenSSL's)";
+        }
+        top_status_bar_->SetMainText(text.str());
+      } else {
+        top_status_bar_->SetMainText("Showing Validation Path");
+      }
       break;
     case kListControlIndexPeerChain:
       top_status_bar_->SetMainText("Showing Server Chain");
@@ -335,7 +577,26 @@ void CertificateListLayout::UpdateDisplayedCertificate() {
 
   if (displayed_list_control_index_ == kListControlIndexValidationPath &&
      current_fetcher_ != NULL) {
-    bottom_status_bar_->SetMainText(current_fetcher_->VerifyStatus());
+    string status = DisplayedPathStatus();
+
+    const VerifiedChain* verification = current_fetcher_->Verification();
+    if (verification != NULL && verification->Staple().GetStatus() !=
+        OCSPStaple::kStatusNotChecked) {
+      status += "; OCSP staple: ";
+      status += verification->Staple().Description(time(NULL));
+    }
+
+    if (verification != NULL && verification->ResponderResult().status !=
+        OCSPResult::kStatusNotChecked) {
+      const OCSPResult& responder = verification->ResponderResult();
+      status += "; OCSP responder: ";
+      status += OCSPResult::StatusName(responder.status);
+      if (!responder.error_message.empty()) {
+        status += " (" + responder.error_message + ")";
+      }
+    }
+
+    bottom_status_bar_->SetMainText(status);
   } else {
     bottom_status_bar_->SetMainText("");
   }
@@ -353,6 +614,24 @@ void CertificateListLayout::ShowCertificateViewLayout() {
       new CertificateViewLayout(GetApplication(), *certificate));
 }
 
+void CertificateListLayout::ShowHandshakeTimelineLayout() {
+  const HandshakeRecorder* recorder =
+    current_fetcher_ ? current_fetcher_->Recorder() : NULL;
+
+  if (recorder == NULL || recorder->Messages().empty()) {
+    command_line_->DisplayMessage("No handshake recorded.");
+    return;
+  }
+
+  GetApplication()->Show(new HandshakeTimelineLayout(GetApplication(),
+        user_input_node_, recorder->Timeline()));
+}
+
+void CertificateListLayout::ToggleLoopHealthPanel() {
+  loop_health_panel_->Toggle();
+  UpdateChildHeights();
+}
+
 // static
 bool CertificateListLayout::ReadUserInputNode(const string& node_input,
     string* node, string* port) {
@@ -433,13 +712,13 @@ void CertificateListLayout::SaveCertificates(const string& filename) {
   }
 
   for (size_t i = 0; i < certificate_list->Size(); ++i) {
-    const string pem_certificate = (*certificate_list)[i].AsPEM();
+    const ArenaString& pem_certificate = (*certificate_list)[i].PEMView();
 
-    size_t bytes_written = fwrite(pem_certificate.c_str(),
+    size_t bytes_written = fwrite(pem_certificate.data,
         sizeof(char),  // NOLINT(runtime/sizeof)
-        pem_certificate.size(), file);
+        pem_certificate.size, file);
 
-    if (bytes_written != pem_certificate.size()) {
+    if (bytes_written != pem_certificate.size) {
       result_message = "Error writing file: ";
       result_message.append(strerror(errno));
       success = false;
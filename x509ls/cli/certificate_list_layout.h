@@ -13,11 +13,18 @@
 using std::string;
 
 namespace x509ls {
+class CertificateList;
 class CertificateListControl;
+class AddressMap;
+class ChainCache;
 class ChainFetcher;
 class CliApplication;
 class CommandLine;
+class FetchMetrics;
+class LoopHealthPanel;
 class MenuBar;
+class OCSPCache;
+class OCSPClient;
 class StatusBar;
 class TextControl;
 class TrustStore;
@@ -34,8 +41,33 @@ class CertificateListLayout : public CliControl {
 
   void GotoHost(const string& user_input_node);
 
+  // Use |chain_cache| for subsequent GotoHost() calls. May be NULL to disable
+  // caching. |chain_cache| must outlive the CertificateListLayout.
+  void SetChainCache(ChainCache* chain_cache);
+
+  // Connect to the hosts in |address_map| without DNS lookups, for
+  // subsequent GotoHost() calls. May be NULL. |address_map| must outlive the
+  // CertificateListLayout.
+  void SetAddressMap(const AddressMap* address_map);
+
+  // Record subsequent GotoHost() fetches in |metrics|. May be NULL.
+  // |metrics| must outlive the CertificateListLayout.
+  void SetMetrics(FetchMetrics* metrics);
+
+  // Query the OCSP responders of subsequent GotoHost() fetches, caching
+  // results in |ocsp_cache|, see ChainFetcher::SetOCSPClient(). May be NULL.
+  // |ocsp_cache| must outlive the CertificateListLayout.
+  void SetOCSPCache(OCSPCache* ocsp_cache);
+
   virtual void OnEvent(const BaseObject* source, int event_code);
 
+  // Split |node_input|, "host", "host:port" or "[IPv6 address]:port", into
+  // |node| and |port|. The port defaults to 443.
+  //
+  // Returns false if |node_input| can't be understood.
+  static bool ReadUserInputNode(const string& node_input,
+      string* node, string* port);
+
  protected:
   virtual bool KeyPressEvent(int keypress);
 
@@ -45,6 +77,18 @@ class CertificateListLayout : public CliControl {
   // The TrustStore to use for validating certificates.
   TrustStore* const trust_store_;
 
+  // Cache of previously fetched chains, or NULL.
+  ChainCache* chain_cache_;
+
+  // Known destination addresses, or NULL.
+  const AddressMap* address_map_;
+
+  // Fetch metrics, or NULL.
+  FetchMetrics* metrics_;
+
+  // OCSP client, or NULL.
+  OCSPClient* ocsp_client_;
+
   // The menu text ("q:Quit"...).
   static const char* kMenuText;
 
@@ -54,6 +98,7 @@ class CertificateListLayout : public CliControl {
   CertificateListControl* list_controls_[2];  // One displayed at a time.
   StatusBar* top_status_bar_;
   TextControl* text_control_;
+  LoopHealthPanel* loop_health_panel_;  // Hidden until toggled.
   StatusBar* bottom_status_bar_;
   CommandLine* command_line_;
 
@@ -64,6 +109,10 @@ class CertificateListLayout : public CliControl {
   // Index of the currently displayed |list_controls_|.
   int displayed_list_control_index_;
 
+  // Index of the validation path displayed, among the paths found to a trust
+  // anchor and, last if not among them, the path formed by OpenSSL.
+  size_t displayed_path_index_;
+
   // ---------------------------------------------------------------------------
   // Text input mode.
   enum TextInputType {
@@ -81,6 +130,7 @@ class CertificateListLayout : public CliControl {
   enum DnsLookup::LookupType lookup_type_;
   size_t tls_method_index_;
   size_t tls_auth_type_index_;
+  bool early_abort_;
   void UpdateStatusBarOptionsText();
 
   // ---------------------------------------------------------------------------
@@ -91,22 +141,56 @@ class CertificateListLayout : public CliControl {
   // Current network worker.
   ChainFetcher* current_fetcher_;
 
+  // True from starting |current_fetcher_| until its final event.
+  bool fetch_in_flight_;
+
+  // Record the end of |current_fetcher_| with |event_code| in |metrics_|, if
+  // it's still in flight.
+  void RecordFetchFinished(int event_code);
+
   // ---------------------------------------------------------------------------
   // UI methods.
   void DisplayLoadingMessage();
   void DisplayConnectSuccessMessage();
   void DisplayConnectFailedMessage();
+  void DisplayCacheHitMessage();
+  void DisplayRevalidatedMessage();
+  void DisplayCheckingRevocationMessage();
+
+  // Show the current fetcher's phase timings in the top status bar.
+  void UpdateStatusBarTimingText();
+
+  // Display the current fetcher's chain and path.
+  void ShowFetchedCertificates();
+
+  // Display the current fetcher's chain and path after revalidation: The
+  // certificates are unchanged, so the displayed path and selection are kept.
+  void ReplaceFetchedCertificates();
 
   string LocationText() const;
 
   void ToggleDisplayedListControl();
+
+  // Display the next validation path, see VerifiedChain::FindPaths().
+  void ShowNextPath();
+
+  // Return the number of validation paths to choose from, at least 1 once
+  // the current fetcher has a chain.
+  size_t PathCount() const;
+
+  // Return the validation path displayed, and its status.
+  const CertificateList* DisplayedPath() const;
+  string DisplayedPathStatus() const;
   void UpdateDisplayedCertificate();
   void ShowCertificateViewLayout();
 
-  void SaveCertificates(const string& filename);
+  // Show the current connection's handshake timeline.
+  void ShowHandshakeTimelineLayout();
 
-  static bool ReadUserInputNode(const string& node_input,
-      string* node, string* port);
+  // Show or hide |loop_health_panel_|.
+  void ToggleLoopHealthPanel();
+
+  void SaveCertificates(const string& filename);
 
   static bool DetermineNodeAndPort(const string& node_input,
       string* node, string* port);
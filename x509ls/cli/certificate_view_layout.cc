@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "x509ls/base/arena.h"
 #include "x509ls/cli/base/cli_application.h"
 #include "x509ls/cli/base/command_line.h"
 #include "x509ls/cli/base/text_control.h"
@@ -26,7 +27,7 @@ CertificateViewLayout::CertificateViewLayout(CliApplication* application,
     CliControl(application),
     certificate_(certificate),
     menu_bar_(new MenuBar(this, kMenuText)),
-    text_control_(new TextControl(this, certificate_.TextDescription())),
+    text_control_(new TextControl(this, "")),
     status_bar_(new StatusBar(this)),
     command_line_(new CommandLine(this)) {
   AddChild(menu_bar_);
@@ -34,6 +35,9 @@ CertificateViewLayout::CertificateViewLayout(CliApplication* application,
   AddChild(status_bar_);
   AddChild(command_line_);
   SetFocusedChild(text_control_);
+
+  const ArenaString& text = certificate_.TextDescriptionView();
+  text_control_->SetText(text.data, text.size);
 }
 
 // virtual
@@ -83,7 +87,7 @@ void CertificateViewLayout::OnEvent(const BaseObject* source, int event_code) {
 
 bool CertificateViewLayout::SaveCertificate(
     const string& filename, string* result_message) const {
-  const string pem_certificate = certificate_.AsPEM();
+  const ArenaString& pem_certificate = certificate_.PEMView();
 
   FILE* file = fopen(filename.c_str(), "w");
   if (!file) {
@@ -92,13 +96,13 @@ bool CertificateViewLayout::SaveCertificate(
     return false;
   }
 
-  size_t bytes_written = fwrite(pem_certificate.c_str(),
+  size_t bytes_written = fwrite(pem_certificate.data,
       sizeof(char),  // NOLINT(runtime/sizeof)
-      pem_certificate.size(), file);
+      pem_certificate.size, file);
 
   bool success = true;
 
-  if (bytes_written != pem_certificate.size()) {
+  if (bytes_written != pem_certificate.size) {
     *result_message = "Error writing file: ";
     result_message->append(strerror(errno));
     success = false;
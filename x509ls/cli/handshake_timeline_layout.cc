@@ -0,0 +1,50 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/cli/handshake_timeline_layout.h"
+
+#include "x509ls/cli/base/cli_application.h"
+#include "x509ls/cli/base/command_line.h"
+#include "x509ls/cli/base/text_control.h"
+#include "x509ls/cli/menu_bar.h"
+#include "x509ls/cli/status_bar.h"
+
+namespace x509ls {
+
+// static
+const char* HandshakeTimelineLayout::kMenuText =
+  "q:index";
+
+HandshakeTimelineLayout::HandshakeTimelineLayout(CliApplication* application,
+    const string& host, const string& timeline)
+  :
+    CliControl(application),
+    menu_bar_(new MenuBar(this, kMenuText)),
+    text_control_(new TextControl(this, timeline)),
+    status_bar_(new StatusBar(this, "Handshake with " + host)),
+    command_line_(new CommandLine(this)) {
+  AddChild(menu_bar_);
+  AddChild(text_control_);
+  AddChild(status_bar_);
+  AddChild(command_line_);
+  SetFocusedChild(text_control_);
+}
+
+// virtual
+HandshakeTimelineLayout::~HandshakeTimelineLayout() {
+}
+
+// virtual
+bool HandshakeTimelineLayout::KeyPressEvent(int keypress) {
+  bool handled = false;
+  switch (keypress) {
+  case 'i':
+  case 'q':
+    handled = true;
+    GetApplication()->Close(this);
+    break;
+  }
+
+  return handled;
+}
+}  // namespace x509ls
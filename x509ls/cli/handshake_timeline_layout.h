@@ -0,0 +1,52 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CLI_HANDSHAKE_TIMELINE_LAYOUT_H_
+#define X509LS_CLI_HANDSHAKE_TIMELINE_LAYOUT_H_
+
+#include <string>
+
+#include "x509ls/base/types.h"
+#include "x509ls/cli/base/cli_control.h"
+
+using std::string;
+
+namespace x509ls {
+class CliApplication;
+class CommandLine;
+class MenuBar;
+class StatusBar;
+class TextControl;
+
+// Screen layout for displaying the TLS handshake timeline of a connection, as
+// recorded by a HandshakeRecorder.
+//
+// The screen layout consists of a menu bar, the scrollable timeline text, a
+// status bar naming the host, and an empty command line row.
+//
+// There is one menu option:
+//  - index: Close layout, go back to previous layout, i.e. certificate list.
+class HandshakeTimelineLayout : public CliControl {
+ public:
+  // Construct a HandshakeTimelineLayout showing |timeline| (see
+  // HandshakeRecorder::Timeline()) for the connection to |host|.
+  HandshakeTimelineLayout(CliApplication* application, const string& host,
+      const string& timeline);
+  virtual ~HandshakeTimelineLayout();
+
+ protected:
+  virtual bool KeyPressEvent(int keypress);
+
+ private:
+  NO_COPY_AND_ASSIGN(HandshakeTimelineLayout)
+
+  MenuBar* menu_bar_;
+  TextControl* text_control_;
+  StatusBar* status_bar_;
+  CommandLine* command_line_;
+
+  static const char* kMenuText;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CLI_HANDSHAKE_TIMELINE_LAYOUT_H_
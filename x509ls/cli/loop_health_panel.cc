@@ -0,0 +1,117 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/cli/loop_health_panel.h"
+
+#include <ncurses.h>
+
+#include "x509ls/base/clock.h"
+#include "x509ls/cli/base/cli_application.h"
+#include "x509ls/cli/base/colours.h"
+
+namespace x509ls {
+namespace {
+const int kPanelRows = 3;
+const int64_t kSampleIntervalMicroseconds = 1000000;
+
+// Samples are taken when the run loop wakes for the loop poll, up to a little
+// early.
+const int64_t kSampleSlackMicroseconds = 20000;
+
+// Return |count| per second over |duration_us|.
+double PerSecond(uint64_t count, int64_t duration_us) {
+  return duration_us > 0 ? count * 1e6 / duration_us : 0;
+}
+
+// Return the average of |total_us| over |count|, in milliseconds.
+double AverageMilliseconds(int64_t total_us, uint64_t count) {
+  return count > 0 ? total_us / 1e3 / count : 0;
+}
+}  // namespace
+
+LoopHealthPanel::LoopHealthPanel(CliControl* parent)
+  :
+    CliControl(parent),
+    shown_(false),
+    sample_us_(0),
+    sample_end_us_(0) {
+}
+
+// virtual
+LoopHealthPanel::~LoopHealthPanel() {
+  if (shown_) {
+    GetApplication()->DisableLoopPoll(this);
+  }
+}
+
+void LoopHealthPanel::Toggle() {
+  shown_ = !shown_;
+
+  if (shown_) {
+    // Discard the statistics counted while hidden.
+    TakeSample();
+    statistics_ = LoopStatistics();
+    sample_us_ = 0;
+    GetApplication()->EnableLoopPoll(this);
+  } else {
+    GetApplication()->DisableLoopPoll(this);
+  }
+}
+
+// virtual
+int LoopHealthPanel::PreferredHeight() const {
+  return shown_ ? kPanelRows : 0;
+}
+
+// virtual
+void LoopHealthPanel::OnLoopPoll() {
+  if (Clock::NowMicroseconds() - sample_end_us_ >=
+      kSampleIntervalMicroseconds - kSampleSlackMicroseconds) {
+    TakeSample();
+    Repaint();
+  }
+}
+
+void LoopHealthPanel::TakeSample() {
+  const int64_t now_us = Clock::NowMicroseconds();
+
+  GetApplication()->TakeLoopStatistics(&statistics_);
+  sample_us_ = now_us - sample_end_us_;
+  sample_end_us_ = now_us;
+}
+
+// virtual
+void LoopHealthPanel::PaintEvent() {
+  WINDOW* window = Window();
+
+  wbkgd(window, Colours::Get(Colours::kColourInfoBar));
+  wattron(window, Colours::Get(Colours::kColourInfoBar));
+
+  if (!LoopStatistics::kEnabled) {
+    mvwprintw(window, 0, 0, "%s",
+        "Event loop statistics not built in (X509LS_LOOP_STATISTICS).");
+    wnoutrefresh(window);
+    return;
+  }
+
+  const LoopStatistics& s = statistics_;
+
+  mvwprintw(window, 0, 0,
+      "Event loop: %.1f iterations/s, %.1f paints/s",
+      PerSecond(s.iterations, sample_us_), PerSecond(s.paints, sample_us_));
+  mvwprintw(window, 1, 0,
+      "DeliverNetworkEvents avg %.2fms max %.2fms, "
+      "DeliverEvents avg %.2fms max %.2fms",
+      AverageMilliseconds(s.network_total_us, s.network_deliveries),
+      s.network_max_us / 1e3,
+      AverageMilliseconds(s.events_total_us, s.event_deliveries),
+      s.events_max_us / 1e3);
+  mvwprintw(window, 2, 0,
+      "Queued events: %u, watched FDs: %u, poll receivers: %u",
+      static_cast<unsigned int>(s.queued_events),
+      static_cast<unsigned int>(s.watched_fds),
+      static_cast<unsigned int>(s.poll_receivers));
+
+  wnoutrefresh(window);
+}
+}  // namespace x509ls
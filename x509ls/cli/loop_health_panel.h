@@ -0,0 +1,55 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_CLI_LOOP_HEALTH_PANEL_H_
+#define X509LS_CLI_LOOP_HEALTH_PANEL_H_
+
+#include <stdint.h>
+
+#include "x509ls/base/loop_statistics.h"
+#include "x509ls/base/types.h"
+#include "x509ls/cli/base/cli_control.h"
+
+namespace x509ls {
+// Event loop health panel, hidden by default.
+//
+// While shown, takes the application's LoopStatistics every second and
+// displays loop iterations and paints per second, the average and maximum
+// time spent delivering network and pub-sub events, and the queued event,
+// watched FD and poll receiver counts.
+//
+// Loop polled while shown (CliApplication::EnableLoopPoll()): The run loop
+// wakes every second to refresh it, without delaying key presses.
+class LoopHealthPanel : public CliControl {
+ public:
+  explicit LoopHealthPanel(CliControl* parent);
+  virtual ~LoopHealthPanel();
+
+  // Show the panel if hidden, else hide it. The parent should then lay out
+  // its children again, see CliControl::UpdateChildHeights().
+  void Toggle();
+
+  // Return the panel height when shown, else 0.
+  virtual int PreferredHeight() const;
+
+  virtual void OnLoopPoll();
+
+ protected:
+  virtual void PaintEvent();
+
+ private:
+  NO_COPY_AND_ASSIGN(LoopHealthPanel)
+
+  bool shown_;
+
+  // The last statistics taken, covering |sample_us_| microseconds until
+  // |sample_end_us_|.
+  LoopStatistics statistics_;
+  int64_t sample_us_;
+  int64_t sample_end_us_;
+
+  void TakeSample();
+};
+}  // namespace x509ls
+
+#endif  // X509LS_CLI_LOOP_HEALTH_PANEL_H_
@@ -0,0 +1,148 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/address_map.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "x509ls/net/dns_lookup.h"
+
+namespace x509ls {
+namespace {
+// Typical file bytes per entry, for sizing the table before loading a file.
+const size_t kEntryBytesEstimate = 32;
+}  // namespace
+
+AddressMap::AddressMap() {
+}
+
+bool AddressMap::Add(const string& entry, string* error_message) {
+  // host:port:address, where address may contain colons.
+  const size_t host_end = entry.find(':');
+  const size_t port_end = host_end == string::npos ? string::npos :
+    entry.find(':', host_end + 1);
+  if (port_end == string::npos || host_end == 0) {
+    *error_message = "Invalid address mapping " + entry +
+      ", expecting host:port:address.";
+    return false;
+  }
+
+  const uint16_t port =
+    DnsLookup::ServicePort(entry.substr(host_end + 1, port_end - host_end - 1));
+
+  string address_text = entry.substr(port_end + 1);
+  if (address_text.size() > 2 && address_text[0] == '[' &&
+      address_text[address_text.size() - 1] == ']') {
+    address_text = address_text.substr(1, address_text.size() - 2);
+  }
+
+  Address address;
+  memset(&address, 0, sizeof address);
+  if (inet_pton(AF_INET, address_text.c_str(), address.bytes) == 1) {
+    address.family = AF_INET;
+  } else if (inet_pton(AF_INET6, address_text.c_str(), address.bytes) == 1) {
+    address.family = AF_INET6;
+  } else {
+    address.family = AF_UNSPEC;
+  }
+
+  if (port == 0 || address.family == AF_UNSPEC) {
+    *error_message = "Invalid address mapping " + entry +
+      ", expecting host:port:address.";
+    return false;
+  }
+
+  addresses_[Key(entry.substr(0, host_end), port)] = address;
+
+  return true;
+}
+
+bool AddressMap::LoadFile(const string& filename, string* error_message) {
+  FILE* file = fopen(filename.c_str(), "r");
+  if (!file) {
+    *error_message = "Unable to open " + filename + ": ";
+    error_message->append(strerror(errno));
+    return false;
+  }
+
+  // Size the table once up front, rather than rehashing as it grows.
+  struct stat file_stat;
+  if (fstat(fileno(file), &file_stat) == 0) {
+    addresses_.rehash(addresses_.size() +
+        file_stat.st_size / kEntryBytesEstimate);
+  }
+
+  bool success = true;
+  char buffer[1024];
+  while (success && fgets(buffer, sizeof buffer, file)) {
+    string line(buffer);
+
+    const size_t end = line.find_last_not_of(" \t\r\n");
+    const size_t start = line.find_first_not_of(" \t");
+    if (end == string::npos || line[start] == '#') {
+      continue;
+    }
+
+    success = Add(line.substr(start, end - start + 1), error_message);
+  }
+
+  fclose(file);
+
+  return success;
+}
+
+bool AddressMap::Lookup(const string& node, const string& service,
+    sockaddr_storage* address, socklen_t* address_length) const {
+  if (addresses_.empty()) {
+    return false;
+  }
+
+  const uint16_t port = DnsLookup::ServicePort(service);
+  Map::const_iterator it = addresses_.find(Key(node, port));
+  if (port == 0 || it == addresses_.end()) {
+    return false;
+  }
+
+  memset(address, 0, sizeof *address);
+  if (it->second.family == AF_INET) {
+    sockaddr_in* ipv4 = reinterpret_cast<sockaddr_in*>(address);
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_port = htons(port);
+    memcpy(&ipv4->sin_addr, it->second.bytes, sizeof ipv4->sin_addr);
+    *address_length = sizeof *ipv4;
+  } else {
+    sockaddr_in6* ipv6 = reinterpret_cast<sockaddr_in6*>(address);
+    ipv6->sin6_family = AF_INET6;
+    ipv6->sin6_port = htons(port);
+    memcpy(&ipv6->sin6_addr, it->second.bytes, sizeof ipv6->sin6_addr);
+    *address_length = sizeof *ipv6;
+  }
+
+  return true;
+}
+
+size_t AddressMap::Size() const {
+  return addresses_.size();
+}
+
+// static
+string AddressMap::Key(const string& host, uint16_t port) {
+  string key;
+  key.reserve(host.size() + 6);
+  for (size_t i = 0; i < host.size(); ++i) {
+    key.push_back(tolower(host[i]));
+  }
+
+  char port_text[8];
+  snprintf(port_text, sizeof port_text, ":%u", port);
+  key.append(port_text);
+
+  return key;
+}
+}  // namespace x509ls
@@ -0,0 +1,68 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_ADDRESS_MAP_H_
+#define X509LS_NET_ADDRESS_MAP_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <tr1/unordered_map>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+// Known addresses of destinations, so their DNS lookups can be skipped.
+//
+// Maps a host and port to one IPv4 or IPv6 address, as curl's --resolve
+// option. Entries are "host:port:address", e.g. "example.org:443:192.0.2.1" or
+// "example.org:443:[2001:db8::1]". Hosts are matched case insensitively.
+//
+// Populate before use: Lookup() is then safe from several threads at once.
+class AddressMap {
+ public:
+  AddressMap();
+
+  // Add the mapping |entry|. A later entry for the same host and port
+  // replaces an earlier one.
+  //
+  // Returns false if |entry| can't be understood, setting |error_message|.
+  bool Add(const string& entry, string* error_message);
+
+  // Add the mappings in |filename|, one entry per line. Blank lines and lines
+  // starting with # are ignored.
+  //
+  // Returns false if the file can't be read or any entry can't be
+  // understood, setting |error_message|.
+  bool LoadFile(const string& filename, string* error_message);
+
+  // Look up the address of |node| on |service| (a port number, or a service
+  // name from services(5)). Returns true iif found, storing the address (with
+  // the port set) in |address| and |address_length|.
+  bool Lookup(const string& node, const string& service,
+      sockaddr_storage* address, socklen_t* address_length) const;
+
+  // Return the number of mappings.
+  size_t Size() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(AddressMap)
+
+  // Compact for large maps: No sockaddr_storage per entry.
+  struct Address {
+    int family;
+    unsigned char bytes[16];
+  };
+
+  // Keyed by "host:port", with |host| in lower case.
+  typedef std::tr1::unordered_map<string, Address> Map;
+  Map addresses_;
+
+  static string Key(const string& host, uint16_t port);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_ADDRESS_MAP_H_
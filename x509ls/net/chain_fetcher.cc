@@ -5,6 +5,18 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <openssl/x509.h>
+
+#include <sstream>
+
+#include "x509ls/base/clock.h"
+#include "x509ls/base/trace_recorder.h"
+#include "x509ls/certificate/chain_cache.h"
+#include "x509ls/certificate/verified_chain.h"
+#include "x509ls/net/address_map.h"
+#include "x509ls/net/connect_scheduler.h"
+
+using std::stringstream;
 
 namespace x509ls {
 ChainFetcher::ChainFetcher(BaseObject* parent, TrustStore* trust_store,
@@ -19,16 +31,39 @@ ChainFetcher::ChainFetcher(BaseObject* parent, TrustStore* trust_store,
   service_(service),
   tls_method_index_(tls_method_index),
   tls_auth_type_index_(tls_auth_type_index),
-  lookup_(new DnsLookup(this, node_, service_, lookup_type)),
+  early_abort_(false),
+  connect_scheduler_(NULL),
+  queue_delay_ms_(0),
+  bio_pair_(false),
+  record_handshake_(false),
+  find_paths_(false),
+  uring_backend_(NULL),
+  lookup_type_(lookup_type),
+  stub_resolver_(NULL),
+  address_map_(NULL),
+  lookup_(NULL),
+  mapped_address_length_(0),
   ssl_client_(NULL),
-  state_(kStateStart) {
-  Subscribe(lookup_, DnsLookup::kStateSuccess);
-  Subscribe(lookup_, DnsLookup::kStateFail);
+  resolve_start_us_(0),
+  resolve_end_us_(0),
+  ocsp_client_(NULL),
+  ocsp_verification_(NULL),
+  ocsp_final_state_(kStateConnectSuccess),
+  ocsp_start_us_(0),
+  ocsp_end_us_(0),
+  state_(kStateStart),
+  traced_(false),
+  chain_cache_(NULL),
+  cached_chain_(NULL),
+  cached_fetch_time_(0),
+  current_chain_(NULL) {
 }
 
 // virtual
 ChainFetcher::~ChainFetcher() {
   Cancel();
+
+  delete cached_chain_;
 }
 
 ChainFetcher::State ChainFetcher::GetState() const {
@@ -36,48 +71,132 @@ ChainFetcher::State ChainFetcher::GetState() const {
 }
 
 void ChainFetcher::Start() {
+  if (chain_cache_ != NULL && LoadFromCache()) {
+    current_chain_ = cached_chain_;
+    SetState(kStateCacheHit);
+  }
+
   SetState(kStateResolving);
+  resolve_start_us_ = Clock::NowMicroseconds();
+
+  if (address_map_ != NULL && address_map_->Lookup(node_, service_,
+        &mapped_address_, &mapped_address_length_)) {
+    resolve_end_us_ = resolve_start_us_;
+    StartConnectOrQueue();
+    return;
+  }
+
+  lookup_ = new DnsLookup(this, node_, service_, lookup_type_);
+  if (stub_resolver_) {
+    lookup_->SetStubResolver(stub_resolver_);
+  }
+  Subscribe(lookup_, DnsLookup::kStateSuccess);
+  Subscribe(lookup_, DnsLookup::kStateFail);
   lookup_->Start();
 }
 
+void ChainFetcher::SetChainCache(ChainCache* chain_cache) {
+  chain_cache_ = chain_cache;
+}
+
+void ChainFetcher::SetEarlyAbort(bool early_abort) {
+  early_abort_ = early_abort;
+}
+
+void ChainFetcher::SetConnectScheduler(ConnectScheduler* connect_scheduler) {
+  connect_scheduler_ = connect_scheduler;
+}
+
+void ChainFetcher::SetBioPair(bool bio_pair) {
+  bio_pair_ = bio_pair;
+}
+
+void ChainFetcher::SetRecordHandshake(bool record_handshake) {
+  record_handshake_ = record_handshake;
+}
+
+void ChainFetcher::SetFindPaths(bool find_paths) {
+  find_paths_ = find_paths;
+}
+
+void ChainFetcher::SetUringBackend(UringBackend* uring_backend) {
+  uring_backend_ = uring_backend;
+}
+
+void ChainFetcher::SetStubResolver(StubResolver* stub_resolver) {
+  stub_resolver_ = stub_resolver;
+}
+
+void ChainFetcher::SetAddressMap(const AddressMap* address_map) {
+  address_map_ = address_map;
+}
+
+void ChainFetcher::SetOCSPClient(OCSPClient* ocsp_client) {
+  ocsp_client_ = ocsp_client;
+}
+
+void ChainFetcher::StartConnect(int queue_delay_ms) {
+  assert(ssl_client_ == NULL);
+
+  queue_delay_ms_ = queue_delay_ms;
+  SetState(kStateConnecting);
+
+  ssl_client_ = new SslClient(this, trust_store_, Sockaddr(), SockaddrLen(),
+      tls_method_index_, tls_auth_type_index_);
+
+  ssl_client_->SetSNIHostname(node_);
+  ssl_client_->SetEarlyAbort(early_abort_);
+  ssl_client_->SetBioPair(bio_pair_);
+  ssl_client_->SetRecordHandshake(record_handshake_);
+  ssl_client_->SetUringBackend(uring_backend_);
+
+  Subscribe(ssl_client_, SslClient::kStateConnectFail);
+  Subscribe(ssl_client_, SslClient::kStateTlsFail);
+  Subscribe(ssl_client_, SslClient::kStateSuccess);
+
+  ssl_client_->Connect();
+}
+
+int ChainFetcher::QueueDelayMilliseconds() const {
+  return queue_delay_ms_;
+}
+
 void ChainFetcher::Cancel() {
   if (state_ == kStateCancel) {
     return;
   }
 
-  Unsubscribe(lookup_);
+  if (connect_scheduler_) {
+    connect_scheduler_->Remove(this);
+  }
+
+  if (lookup_) {
+    Unsubscribe(lookup_);
+    lookup_->Cancel();
+  }
   if (ssl_client_) {
     Unsubscribe(ssl_client_);
   }
 
-  lookup_->Cancel();
-
   if (ssl_client_) {
     ssl_client_->Cancel();
   }
 
+  if (state_ == kStateCheckingRevocation) {
+    ocsp_client_->Cancel(this);
+  }
+
   SetState(kStateCancel);
 }
 
 // virtual
 void ChainFetcher::OnEvent(const BaseObject* source, int event_code) {
   if (source == lookup_ && state_ == kStateResolving) {
+    resolve_end_us_ = Clock::NowMicroseconds();
     if (event_code == DnsLookup::kStateFail) {
       SetState(kStateResolveFail);
     } else if (event_code == DnsLookup::kStateSuccess) {
-      SetState(kStateConnecting);
-      assert(ssl_client_ == NULL);
-
-      ssl_client_ = new SslClient(this, trust_store_, lookup_->Sockaddr(),
-          lookup_->SockaddrLen(), tls_method_index_, tls_auth_type_index_);
-
-      ssl_client_->SetSNIHostname(node_);
-
-      Subscribe(ssl_client_, SslClient::kStateConnectFail);
-      Subscribe(ssl_client_, SslClient::kStateTlsFail);
-      Subscribe(ssl_client_, SslClient::kStateSuccess);
-
-      ssl_client_->Connect();
+      StartConnectOrQueue();
     }
   } else if (source == ssl_client_) {
     switch (event_code) {
@@ -86,7 +205,11 @@ void ChainFetcher::OnEvent(const BaseObject* source, int event_code) {
       SetState(kStateConnectFail);
       break;
     case SslClient::kStateSuccess:
-      SetState(kStateConnectSuccess);
+      // The cache only decides whether the chain changed: The live
+      // verification carries the handshake's stapled OCSP response.
+      current_chain_ = &(ssl_client_->Verification());
+      CheckRevocation(ssl_client_->MutableVerification(),
+          UpdateCache() ? kStateRevalidated : kStateConnectSuccess);
       break;
     default:
       break;
@@ -94,44 +217,271 @@ void ChainFetcher::OnEvent(const BaseObject* source, int event_code) {
   }
 }
 
+// virtual
+void ChainFetcher::OnOCSPResult(const OCSPResult& result) {
+  ocsp_end_us_ = Clock::NowMicroseconds();
+  ocsp_verification_->SetResponderResult(result);
+  SetState(ocsp_final_state_);
+}
+
+void ChainFetcher::CheckRevocation(VerifiedChain* verification,
+    State final_state) {
+  if (find_paths_) {
+    verification->FindPaths();
+  }
+
+  if (ocsp_client_ == NULL || verification->Staple().IsCurrent() ||
+      verification->Leaf() == NULL || verification->Issuer() == NULL) {
+    SetState(final_state);
+    return;
+  }
+
+  ocsp_start_us_ = Clock::NowMicroseconds();
+
+  OCSPResult result;
+  if (ocsp_client_->Query(this, verification->Leaf(), verification->Issuer(),
+        verification->PeerChain(), &result)) {
+    ocsp_end_us_ = ocsp_start_us_;
+    verification->SetResponderResult(result);
+    SetState(final_state);
+    return;
+  }
+
+  ocsp_verification_ = verification;
+  ocsp_final_state_ = final_state;
+  SetState(kStateCheckingRevocation);
+}
+
 void ChainFetcher::SetState(const State& state) {
   state_ = state;
+
+  if (!traced_ && TraceRecorder::IsEnabled()) {
+    TraceFetch(state);
+  }
+
   Emit(state_);
 }
 
+void ChainFetcher::TraceFetch(State state) {
+  switch (state) {
+  case kStateResolveFail:
+  case kStateConnectSuccess:
+  case kStateConnectFail:
+  case kStateCancel:
+  case kStateRevalidated:
+    break;
+  default:
+    return;
+  }
+
+  traced_ = true;
+  if (resolve_start_us_ == 0) {
+    // Never started.
+    return;
+  }
+
+  const FetchTiming timing = Timing();
+  const uint64_t id = TraceRecorder::NextId();
+  const string target = node_ + ":" + service_;
+
+  TraceRecorder::AddAsyncSpan("fetch", id, resolve_start_us_,
+      Clock::NowMicroseconds(), target);
+
+  const char* const kPhaseNames[] = {
+    "resolve", "connect", "handshake", "verify", "ocsp"
+  };
+  const int64_t phase_times_us[][2] = {
+    {timing.resolve_start_us, timing.resolve_end_us},
+    {timing.connect_start_us, timing.connect_end_us},
+    {timing.handshake_start_us, timing.handshake_end_us},
+    {timing.verify_start_us, timing.verify_end_us},
+    {timing.ocsp_start_us, timing.ocsp_end_us}
+  };
+
+  for (size_t i = 0; i < sizeof kPhaseNames / sizeof kPhaseNames[0]; ++i) {
+    if (FetchTiming::Duration(phase_times_us[i][0],
+          phase_times_us[i][1]) >= 0) {
+      TraceRecorder::AddAsyncSpan(kPhaseNames[i], id, phase_times_us[i][0],
+          phase_times_us[i][1], target);
+    }
+  }
+}
+
 string ChainFetcher::IPAddressAndPort() const {
+  if (lookup_ == NULL) {
+    return mapped_address_length_ > 0 ?
+      DnsLookup::AddressAndPort(Sockaddr(), SockaddrLen()) : "";
+  }
+
   return lookup_->IPAddressAndPort();
 }
 
+const sockaddr* ChainFetcher::Sockaddr() const {
+  if (lookup_ == NULL) {
+    return reinterpret_cast<const sockaddr*>(&mapped_address_);
+  }
+
+  return lookup_->Sockaddr();
+}
+
+socklen_t ChainFetcher::SockaddrLen() const {
+  if (lookup_ == NULL) {
+    return mapped_address_length_;
+  }
+
+  return lookup_->SockaddrLen();
+}
+
+void ChainFetcher::StartConnectOrQueue() {
+  if (connect_scheduler_) {
+    SetState(kStateQueued);
+    connect_scheduler_->Enqueue(this, Sockaddr());
+  } else {
+    StartConnect(0);
+  }
+}
+
 const CertificateList* ChainFetcher::Chain() const {
-  if (state_ != kStateConnectSuccess) {
+  if (current_chain_ == NULL) {
     return NULL;
   }
 
-  return &(ssl_client_->Chain());
+  return &(current_chain_->Chain());
 }
 
 const CertificateList* ChainFetcher::Path() const {
-  if (state_ != kStateConnectSuccess) {
+  if (current_chain_ == NULL) {
     return NULL;
   }
 
-  return &(ssl_client_->Path());
+  return &(current_chain_->Path());
 }
 
 string ChainFetcher::VerifyStatus() const {
-  if (state_ != kStateConnectSuccess) {
+  if (current_chain_ == NULL) {
+    return "";
+  }
+
+  return current_chain_->VerifyStatus();
+}
+
+const VerifiedChain* ChainFetcher::Verification() const {
+  return current_chain_;
+}
+
+bool ChainFetcher::IsChainFromCache() const {
+  return current_chain_ != NULL && current_chain_ == cached_chain_;
+}
+
+bool ChainFetcher::WasCacheHit() const {
+  return cached_chain_ != NULL;
+}
+
+int ChainFetcher::CachedChainAge() const {
+  return time(NULL) - cached_fetch_time_;
+}
+
+string ChainFetcher::CacheKey() const {
+  return ChainCache::Key(node_, service_, node_,
+      SslClient::TlsMethodName(tls_method_index_),
+      SslClient::TlsAuthTypeName(tls_auth_type_index_));
+}
+
+bool ChainFetcher::LoadFromCache() {
+  if (!chain_cache_->Lookup(CacheKey(), &cached_der_chain_,
+        &cached_fetch_time_)) {
+    return false;
+  }
+
+  STACK_OF(X509)* peer_chain = sk_X509_new_null();
+  for (vector<string>::const_iterator it = cached_der_chain_.begin();
+      it != cached_der_chain_.end();
+      ++it) {
+    const unsigned char* data =
+      reinterpret_cast<const unsigned char*>(it->data());
+    X509* x509 = d2i_X509(NULL, &data, it->size());
+    if (x509 == NULL) {
+      sk_X509_pop_free(peer_chain, X509_free);
+      cached_der_chain_.clear();
+      return false;
+    }
+
+    sk_X509_push(peer_chain, x509);
+  }
+
+  cached_chain_ = new VerifiedChain(trust_store_);
+  cached_chain_->PopulateChainAndPath(peer_chain);
+  if (find_paths_) {
+    cached_chain_->FindPaths();
+  }
+
+  sk_X509_pop_free(peer_chain, X509_free);
+
+  return true;
+}
+
+bool ChainFetcher::UpdateCache() {
+  if (chain_cache_ == NULL) {
+    return false;
+  }
+
+  const CertificateList& chain = ssl_client_->Chain();
+
+  vector<string> der_chain;
+  for (size_t i = 0; i < chain.Size(); ++i) {
+    der_chain.push_back(chain[i].AsDER());
+  }
+
+  chain_cache_->Store(CacheKey(), der_chain, time(NULL));
+
+  return cached_chain_ != NULL && der_chain == cached_der_chain_;
+}
+
+string ChainFetcher::EarlyAbortSavings() const {
+  if (ssl_client_ == NULL || !ssl_client_->WasAbortedEarly()) {
     return "";
   }
 
-  return ssl_client_->VerifyStatus();
+  stringstream savings;
+  savings << "~" << ssl_client_->SavedMilliseconds() << "ms, ";
+  savings << ssl_client_->SavedServerSignatures() << " server signature";
+  if (ssl_client_->SavedServerSignatures() != 1) {
+    savings << "s";
+  }
+  savings << " saved";
+
+  return savings.str();
+}
+
+FetchTiming ChainFetcher::Timing() const {
+  FetchTiming timing;
+  if (ssl_client_) {
+    timing = ssl_client_->Timing();
+  }
+  timing.resolve_start_us = resolve_start_us_;
+  timing.resolve_end_us = resolve_end_us_;
+  timing.ocsp_start_us = ocsp_start_us_;
+  timing.ocsp_end_us = ocsp_end_us_;
+
+  return timing;
 }
 
 string ChainFetcher::ErrorMessage() const {
-  if (state_ == kStateResolveFail) {
+  if (state_ == kStateResolveFail && lookup_) {
     return lookup_->ErrorMessage();
   }
   return "";
 }
-}  // namespace x509ls
 
+uint64_t ChainFetcher::BytesReceived() const {
+  return ssl_client_ ? ssl_client_->BytesReceived() : 0;
+}
+
+uint64_t ChainFetcher::BytesSent() const {
+  return ssl_client_ ? ssl_client_->BytesSent() : 0;
+}
+
+const HandshakeRecorder* ChainFetcher::Recorder() const {
+  return ssl_client_ ? ssl_client_->Recorder() : NULL;
+}
+}  // namespace x509ls
@@ -4,17 +4,29 @@
 #ifndef X509LS_NET_CHAIN_FETCHER_H_
 #define X509LS_NET_CHAIN_FETCHER_H_
 
+#include <stdint.h>
+#include <time.h>
+
 #include <string>
+#include <vector>
 
 #include "x509ls/base/base_object.h"
 #include "x509ls/base/types.h"
 #include "x509ls/net/dns_lookup.h"
+#include "x509ls/net/fetch_timing.h"
+#include "x509ls/net/ocsp_client.h"
 #include "x509ls/net/ssl_client.h"
 
 using std::string;
+using std::vector;
 
 namespace x509ls {
+class AddressMap;
+class ChainCache;
+class ConnectScheduler;
 class TrustStore;
+class UringBackend;
+class VerifiedChain;
 // Fetch X509 certificates over TLS asynchronously.
 //
 // First initiates an DNS lookup on |node|. |node| may be an IP address or
@@ -22,7 +34,19 @@ class TrustStore;
 // strings), then attempts a TLS connection on the specified |service|.
 // |service| may be a port number, or service string (e.g. https) as recognised
 // by the system. Emits a number of events to indicate progress.
-class ChainFetcher : public BaseObject {
+//
+// If a ChainCache is set and holds a fresh entry for the connection
+// parameters, the cached chain is made available immediately (kStateCacheHit)
+// and the network fetch continues in the background to revalidate it. The
+// cache entry is refreshed after every successful fetch.
+//
+// If a ConnectScheduler is set, the TLS connection waits in its queue after
+// the DNS lookup, until the scheduler's rate limits allow it (kStateQueued).
+//
+// If an OCSPClient is set, the end-entity certificate's OCSP responder is
+// queried after a successful connection, unless the server stapled a current
+// response (kStateCheckingRevocation).
+class ChainFetcher : public BaseObject, public OCSPClient::Listener {
  public:
   // Construct a ChainFetcher with |parent|, to fetch X509 certificates from
   // |node| on |service|. Use a DNS lookup of type |lookup_type| and
@@ -42,7 +66,11 @@ class ChainFetcher : public BaseObject {
     kStateConnecting,      // Emitted as an event.
     kStateConnectSuccess,  // Emitted as an event.
     kStateConnectFail,     // Emitted as an event.
-    kStateCancel           // Emitted as an event.
+    kStateCancel,          // Emitted as an event.
+    kStateCacheHit,        // Emitted as an event.
+    kStateRevalidated,     // Emitted as an event.
+    kStateQueued,          // Emitted as an event.
+    kStateCheckingRevocation  // Emitted as an event.
   };
   State GetState() const;
 
@@ -56,8 +84,82 @@ class ChainFetcher : public BaseObject {
   // - kStateConnecting: TLS connection started
   // - kStateConnectSuccess: TLS connection succeeded, certificates available
   // - kStateConnectFail: TLS connection failed
+  //
+  // With a ChainCache set, two further events may be emitted:
+  // - kStateCacheHit: Emitted first, a cached chain is available
+  // - kStateRevalidated: TLS connection succeeded, and the chain served matches
+  //   the cached chain. Emitted instead of kStateConnectSuccess. As with
+  //   kStateConnectSuccess, the live chain (and any stapled OCSP response)
+  //   replaces the cached chain.
+  //
+  // With a ConnectScheduler set, kStateQueued is emitted before
+  // kStateConnecting, while waiting for the scheduler.
+  //
+  // With an OCSPClient set, kStateCheckingRevocation may be emitted before
+  // kStateConnectSuccess or kStateRevalidated, while waiting for the OCSP
+  // responder.
   void Start();
 
+  // Use |chain_cache| to store fetched chains, and to make fresh cached chains
+  // available while fetching.
+  //
+  // Call before Start(). |chain_cache| may be NULL (the default) to disable
+  // caching, and must outlive the ChainFetcher.
+  void SetChainCache(ChainCache* chain_cache);
+
+  // Stop TLS handshakes as soon as the server's certificates arrive. See
+  // SslClient::SetEarlyAbort(). Call before Start().
+  void SetEarlyAbort(bool early_abort);
+
+  // Queue the TLS connection with |connect_scheduler| once the destination
+  // address is known.
+  //
+  // Call before Start(). |connect_scheduler| may be NULL (the default) to
+  // connect immediately, and must outlive the ChainFetcher.
+  void SetConnectScheduler(ConnectScheduler* connect_scheduler);
+
+  // Run the TLS connection over a BIO pair. See SslClient::SetBioPair().
+  // Call before Start().
+  void SetBioPair(bool bio_pair);
+
+  // Record the TLS connection's handshake messages. See
+  // SslClient::SetRecordHandshake(). Call before Start().
+  void SetRecordHandshake(bool record_handshake);
+
+  // Find every path from the chain to a trust anchor, not just the one
+  // OpenSSL forms. See VerifiedChain::FindPaths(). Call before Start().
+  void SetFindPaths(bool find_paths);
+
+  // Perform the TLS connection's socket I/O through |uring_backend|. See
+  // SslClient::SetUringBackend(). Call before Start().
+  void SetUringBackend(UringBackend* uring_backend);
+
+  // Resolve the node with |stub_resolver|. See DnsLookup::SetStubResolver().
+  // Call before Start().
+  void SetStubResolver(StubResolver* stub_resolver);
+
+  // Connect to the address of |node| and |service| in |address_map|, if any,
+  // without a DNS lookup. The node is still sent as the SNI hostname.
+  //
+  // Call before Start(). |address_map| may be NULL (the default), and must
+  // outlive the ChainFetcher.
+  void SetAddressMap(const AddressMap* address_map);
+
+  // Query the end-entity certificate's OCSP responder with |ocsp_client|,
+  // when no current response was stapled. See VerifiedChain::ResponderResult().
+  //
+  // Call before Start(). |ocsp_client| may be NULL (the default), and must
+  // outlive the ChainFetcher.
+  void SetOCSPClient(OCSPClient* ocsp_client);
+
+  // Start the TLS connection, after |queue_delay_ms| in the ConnectScheduler's
+  // queue. Called by the ConnectScheduler only.
+  void StartConnect(int queue_delay_ms);
+
+  // Return the number of milliseconds spent waiting in the ConnectScheduler's
+  // queue.
+  int QueueDelayMilliseconds() const;
+
   // Cancel any outstanding network requests (DNS/TLS).
   //
   // The state is updated to kStateCancel.
@@ -66,10 +168,17 @@ class ChainFetcher : public BaseObject {
   // Receives events from DnsLookup, SslClient objects.
   virtual void OnEvent(const BaseObject* source, int event_code);
 
+  // Receives the OCSP responder's result.
+  virtual void OnOCSPResult(const OCSPResult& result);
+
   // Methods valid in the kStateConnectSuccess state:
   // Return a string representation of the IP address and port.
   string IPAddressAndPort() const;
 
+  // The following methods return the most recently available chain: Either
+  // from the kStateConnectSuccess state, or from the cache after
+  // kStateCacheHit. They return NULL/"" if no chain is available.
+
   // Return the server's certificate chain.
   const CertificateList* Chain() const;
 
@@ -79,6 +188,37 @@ class ChainFetcher : public BaseObject {
   // Return the validation status string from OpenSSL.
   string VerifyStatus() const;
 
+  // Return the chain, path and validation status together.
+  const VerifiedChain* Verification() const;
+
+  // Return true iif the chain returned by Chain() came from the cache, i.e.
+  // the network fetch is still in progress or failed.
+  bool IsChainFromCache() const;
+
+  // Return true iif a fresh chain was found in the ChainCache by Start().
+  bool WasCacheHit() const;
+
+  // Return the number of seconds since the cached chain was fetched. Valid
+  // when IsChainFromCache().
+  int CachedChainAge() const;
+
+  // Return a short description of the time and server work saved by an
+  // early abort, or "" if the handshake was not aborted early.
+  string EarlyAbortSavings() const;
+
+  // Return the number of bytes received from / sent to the server by the
+  // TLS connection, 0 before it starts.
+  uint64_t BytesReceived() const;
+  uint64_t BytesSent() const;
+
+  // Return the TLS connection's recorded handshake messages, or NULL if
+  // recording is disabled or the connection hasn't started.
+  const HandshakeRecorder* Recorder() const;
+
+  // Return when each phase of the network fetch started and ended, so far.
+  // Loading a cached chain isn't timed.
+  FetchTiming Timing() const;
+
   // Methods valid in the kStateResolveFail state:
   // Return the DnsLookup's error message.
   string ErrorMessage() const;
@@ -92,12 +232,85 @@ class ChainFetcher : public BaseObject {
   const string service_;
   const size_t tls_method_index_;
   const size_t tls_auth_type_index_;
+  bool early_abort_;
 
+  ConnectScheduler* connect_scheduler_;
+  int queue_delay_ms_;
+
+  bool bio_pair_;
+  bool record_handshake_;
+  bool find_paths_;
+  UringBackend* uring_backend_;
+
+  const DnsLookup::LookupType lookup_type_;
+  StubResolver* stub_resolver_;
+  const AddressMap* address_map_;
+
+  // The DnsLookup, or NULL before Start() and when the address came from
+  // |address_map_|.
   DnsLookup* lookup_;
+  sockaddr_storage mapped_address_;
+  socklen_t mapped_address_length_;
+
   SslClient* ssl_client_;
 
+  int64_t resolve_start_us_;
+  int64_t resolve_end_us_;
+
+  // The destination address, once resolved.
+  const sockaddr* Sockaddr() const;
+  socklen_t SockaddrLen() const;
+
+  // Connect (or queue) once the destination address is known.
+  void StartConnectOrQueue();
+
+  // ---------------------------------------------------------------------------
+  // OCSP.
+  OCSPClient* ocsp_client_;
+
+  // The verification awaiting the OCSP result, and the state to report once
+  // it arrives.
+  VerifiedChain* ocsp_verification_;
+  State ocsp_final_state_;
+
+  int64_t ocsp_start_us_;
+  int64_t ocsp_end_us_;
+
+  // Finish a successful connection in |final_state|, after finding the paths
+  // of |verification| and querying its OCSP responder, if needed.
+  void CheckRevocation(VerifiedChain* verification, State final_state);
+
   enum State state_;
   void SetState(const State& state);
+
+  // True once the fetch has been written to the TraceRecorder.
+  bool traced_;
+
+  // Record the fetch and its phases in the TraceRecorder, on reaching the
+  // final |state|.
+  void TraceFetch(State state);
+
+  // ---------------------------------------------------------------------------
+  // Chain cache.
+  ChainCache* chain_cache_;
+
+  // The chain loaded from |chain_cache_|, or NULL.
+  VerifiedChain* cached_chain_;
+  vector<string> cached_der_chain_;
+  time_t cached_fetch_time_;
+
+  // The chain currently returned by Chain() etc., or NULL.
+  const VerifiedChain* current_chain_;
+
+  string CacheKey() const;
+
+  // Load a fresh |cached_chain_| for this connection. Returns true iif one
+  // was found.
+  bool LoadFromCache();
+
+  // Compare the fetched chain with any |cached_chain_|, then update the cache.
+  // Returns true iif the fetched chain matched the cached chain.
+  bool UpdateCache();
 };
 }  // namespace x509ls
 
@@ -0,0 +1,192 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/connect_scheduler.h"
+
+#include <sstream>
+
+#include "x509ls/base/clock.h"
+#include "x509ls/net/chain_fetcher.h"
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// Interval between forgetting idle rate limiter buckets.
+const int64_t kPurgeIntervalUs = 1000000;
+}  // namespace
+
+ConnectScheduler::Statistics::Statistics()
+  :
+    grant_count(0),
+    total_delay_us(0),
+    max_delay_us(0) {
+  for (size_t i = 0; i < sizeof wait_counts / sizeof wait_counts[0]; ++i) {
+    wait_counts[i] = 0;
+  }
+}
+
+void ConnectScheduler::Statistics::Merge(const Statistics& other) {
+  grant_count += other.grant_count;
+  total_delay_us += other.total_delay_us;
+  if (other.max_delay_us > max_delay_us) {
+    max_delay_us = other.max_delay_us;
+  }
+  for (size_t i = 0; i < sizeof wait_counts / sizeof wait_counts[0]; ++i) {
+    wait_counts[i] += other.wait_counts[i];
+  }
+}
+
+string ConnectScheduler::Statistics::Summary() const {
+  stringstream summary;
+  summary << grant_count << " connects, queued avg ";
+  summary << (grant_count > 0 ? total_delay_us / 1000 / grant_count : 0);
+  summary << "ms max " << max_delay_us / 1000 << "ms (waits:";
+
+  const RateLimiter::Limit limits[] = {
+    RateLimiter::kLimitAddress,
+    RateLimiter::kLimitSubnet,
+    RateLimiter::kLimitGlobal
+  };
+  for (size_t i = 0; i < sizeof limits / sizeof limits[0]; ++i) {
+    summary << " " << RateLimiter::LimitName(limits[i]);
+    summary << " " << wait_counts[limits[i]];
+  }
+  summary << ")";
+
+  return summary.str();
+}
+
+ConnectScheduler::ConnectScheduler(BaseObject* parent,
+    RateLimiter* rate_limiter)
+  :
+    BaseObject(parent),
+    rate_limiter_(rate_limiter),
+    last_purge_us_(Clock::NowMicroseconds()) {
+}
+
+// virtual
+ConnectScheduler::~ConnectScheduler() {
+}
+
+void ConnectScheduler::Enqueue(ChainFetcher* fetcher,
+    const sockaddr* address) {
+  string address_key;
+  string subnet_key;
+  RateLimiter::DestinationKeys(address, &address_key, &subnet_key);
+
+  Entry entry;
+  entry.fetcher = fetcher;
+  entry.enqueued_us = Clock::NowMicroseconds();
+  entry.waited = false;
+
+  Destination& destination = destinations_[address_key];
+  if (destination.entries.empty()) {
+    destination.subnet_key = subnet_key;
+    ready_destinations_.push_back(address_key);
+  }
+  destination.entries.push_back(entry);
+  queued_fetchers_[fetcher] = address_key;
+
+  EnablePoll();
+}
+
+void ConnectScheduler::Remove(ChainFetcher* fetcher) {
+  map<ChainFetcher*, string>::iterator queued = queued_fetchers_.find(fetcher);
+  if (queued == queued_fetchers_.end()) {
+    return;
+  }
+
+  const string address_key = queued->second;
+  queued_fetchers_.erase(queued);
+
+  Destination& destination = destinations_[address_key];
+  for (deque<Entry>::iterator it = destination.entries.begin();
+      it != destination.entries.end();
+      ++it) {
+    if (it->fetcher == fetcher) {
+      destination.entries.erase(it);
+      break;
+    }
+  }
+
+  if (destination.entries.empty()) {
+    destinations_.erase(address_key);
+    ready_destinations_.remove(address_key);
+  }
+}
+
+size_t ConnectScheduler::QueuedCount() const {
+  return queued_fetchers_.size();
+}
+
+const ConnectScheduler::Statistics& ConnectScheduler::GetStatistics() const {
+  return statistics_;
+}
+
+// virtual
+void ConnectScheduler::OnPoll() {
+  const int64_t now_us = Clock::NowMicroseconds();
+
+  // Serve one fetcher per destination per round, for as long as any
+  // destination makes progress.
+  bool progress = true;
+  while (progress && !ready_destinations_.empty()) {
+    progress = false;
+
+    for (size_t i = ready_destinations_.size(); i > 0; --i) {
+      const string address_key = ready_destinations_.front();
+      ready_destinations_.pop_front();
+
+      Destination& destination = destinations_[address_key];
+      Entry& entry = destination.entries.front();
+
+      RateLimiter::Limit limit;
+      if (rate_limiter_->TryAcquire(address_key, destination.subnet_key,
+            now_us, &limit)) {
+        const Entry granted = entry;
+        destination.entries.pop_front();
+        queued_fetchers_.erase(granted.fetcher);
+        Grant(granted, now_us);
+        progress = true;
+      } else if (!entry.waited) {
+        entry.waited = true;
+        ++statistics_.wait_counts[limit];
+      }
+
+      if (destination.entries.empty()) {
+        destinations_.erase(address_key);
+      } else {
+        ready_destinations_.push_back(address_key);
+      }
+
+      if (limit == RateLimiter::kLimitGlobal) {
+        // Nothing more can be granted until the global bucket refills.
+        progress = false;
+        break;
+      }
+    }
+  }
+
+  if (now_us - last_purge_us_ > kPurgeIntervalUs) {
+    rate_limiter_->Purge(now_us);
+    last_purge_us_ = now_us;
+  }
+
+  if (ready_destinations_.empty()) {
+    DisablePoll();
+  }
+}
+
+void ConnectScheduler::Grant(const Entry& entry, int64_t now_us) {
+  const int64_t delay_us = now_us - entry.enqueued_us;
+
+  ++statistics_.grant_count;
+  statistics_.total_delay_us += delay_us;
+  if (delay_us > statistics_.max_delay_us) {
+    statistics_.max_delay_us = delay_us;
+  }
+
+  entry.fetcher->StartConnect(static_cast<int>(delay_us / 1000));
+}
+}  // namespace x509ls
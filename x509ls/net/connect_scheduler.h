@@ -0,0 +1,115 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_CONNECT_SCHEDULER_H_
+#define X509LS_NET_CONNECT_SCHEDULER_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/types.h"
+#include "x509ls/net/rate_limiter.h"
+
+using std::deque;
+using std::list;
+using std::map;
+using std::string;
+
+namespace x509ls {
+class ChainFetcher;
+// Schedules the TLS connections of many ChainFetchers, within a RateLimiter's
+// limits. The RateLimiter may be shared with ConnectSchedulers on other
+// threads.
+//
+// A ChainFetcher with a ConnectScheduler set queues itself once its DNS lookup
+// completes, as only then is the destination address known. Queued fetchers
+// are granted their connections when tokens are available.
+//
+// Fetchers are queued per destination IP address, and destinations are served
+// round-robin: Many targets resolving to one address are spread out over time,
+// without delaying targets elsewhere. Connections are granted as soon as the
+// limits allow, so throughput is only limited by the configured rates.
+class ConnectScheduler : public BaseObject {
+ public:
+  // Construct, granting connections within the limits of |rate_limiter|,
+  // which must outlive the ConnectScheduler.
+  ConnectScheduler(BaseObject* parent, RateLimiter* rate_limiter);
+  virtual ~ConnectScheduler();
+
+  // Queueing statistics.
+  struct Statistics {
+    Statistics();
+
+    // Add the counts from |other|.
+    void Merge(const Statistics& other);
+
+    // Return a one line summary, e.g.:
+    //   "120 connects, queued avg 35ms max 410ms (waits: ip 80 subnet 12
+    //   global 0)"
+    string Summary() const;
+
+    uint64_t grant_count;
+    int64_t total_delay_us;
+    int64_t max_delay_us;
+
+    // Number of fetchers which had to wait, by the RateLimiter::Limit first
+    // reached.
+    uint64_t wait_counts[4];
+  };
+
+  // Queue |fetcher| for a connection to |address|. Eventually calls
+  // fetcher->StartConnect(), unless Remove() is called first.
+  void Enqueue(ChainFetcher* fetcher, const sockaddr* address);
+
+  // Remove |fetcher| if queued.
+  void Remove(ChainFetcher* fetcher);
+
+  // Return the number of fetchers queued.
+  size_t QueuedCount() const;
+
+  // Return the queueing statistics so far.
+  const Statistics& GetStatistics() const;
+
+  // Grants connections while the rate limits allow.
+  virtual void OnPoll();
+
+ private:
+  NO_COPY_AND_ASSIGN(ConnectScheduler)
+
+  struct Entry {
+    ChainFetcher* fetcher;
+    int64_t enqueued_us;
+    bool waited;
+  };
+
+  struct Destination {
+    string subnet_key;
+    deque<Entry> entries;
+  };
+
+  RateLimiter* const rate_limiter_;
+
+  // Queued fetchers, by destination address key.
+  map<string, Destination> destinations_;
+
+  // Destinations with queued fetchers, in round-robin order.
+  list<string> ready_destinations_;
+
+  // Destination address key of each queued fetcher.
+  map<ChainFetcher*, string> queued_fetchers_;
+
+  int64_t last_purge_us_;
+
+  Statistics statistics_;
+
+  void Grant(const Entry& entry, int64_t now_us);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_CONNECT_SCHEDULER_H_
@@ -0,0 +1,103 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/dns_cache.h"
+
+#include <sstream>
+
+#include "x509ls/base/clock.h"
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// Minimum number of entries before purging.
+const size_t kMinimumPurgeSize = 1024;
+
+const int64_t kMicrosecondsPerSecond = 1000 * 1000;
+}  // namespace
+
+DnsAnswer::DnsAnswer()
+  :
+    result(kResultError) {
+}
+
+DnsCache::DnsCache()
+  :
+    purge_size_(kMinimumPurgeSize) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+DnsCache::~DnsCache() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool DnsCache::Lookup(const string& name, uint16_t type,
+    DnsAnswer* answer) {
+  const string key = Key(name, type);
+  const int64_t now_us = Clock::NowMicroseconds();
+  bool found = false;
+
+  pthread_mutex_lock(&mutex_);
+  map<string, Entry>::iterator it = entries_.find(key);
+  if (it != entries_.end()) {
+    if (it->second.expiry_us > now_us) {
+      *answer = it->second.answer;
+      found = true;
+    } else {
+      entries_.erase(it);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  return found;
+}
+
+void DnsCache::Store(const string& name, uint16_t type,
+    const DnsAnswer& answer, uint32_t ttl) {
+  if (ttl == 0 || answer.result == DnsAnswer::kResultError) {
+    return;
+  }
+
+  const string key = Key(name, type);
+  const int64_t now_us = Clock::NowMicroseconds();
+
+  pthread_mutex_lock(&mutex_);
+  Entry& entry = entries_[key];
+  entry.answer = answer;
+  entry.expiry_us = now_us + ttl * kMicrosecondsPerSecond;
+
+  if (entries_.size() >= purge_size_) {
+    map<string, Entry>::iterator it = entries_.begin();
+    while (it != entries_.end()) {
+      if (it->second.expiry_us <= now_us) {
+        entries_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+
+    purge_size_ = entries_.size() * 2;
+    if (purge_size_ < kMinimumPurgeSize) {
+      purge_size_ = kMinimumPurgeSize;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+size_t DnsCache::Size() {
+  pthread_mutex_lock(&mutex_);
+  const size_t size = entries_.size();
+  pthread_mutex_unlock(&mutex_);
+
+  return size;
+}
+
+// static
+string DnsCache::Key(const string& name, uint16_t type) {
+  stringstream key;
+  key << type << "/" << name;
+
+  return key.str();
+}
+}  // namespace x509ls
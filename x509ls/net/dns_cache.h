@@ -0,0 +1,81 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_DNS_CACHE_H_
+#define X509LS_NET_DNS_CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// The answer to a DNS query for one name's A or AAAA records.
+struct DnsAnswer {
+  DnsAnswer();
+
+  enum Result {
+    kResultAddresses,  // |addresses| holds one or more addresses.
+    kResultNoAddress,  // The name doesn't exist, or has no such records.
+    kResultError       // No answer: Timeouts, server failures...
+  };
+  Result result;
+
+  // Addresses in network byte order: 4 bytes (A) or 16 bytes (AAAA) each.
+  vector<string> addresses;
+
+  // For kResultNoAddress and kResultError, a short description.
+  string error_message;
+};
+
+// Caches DnsAnswers until their DNS TTL expires.
+//
+// Both positive answers and negative answers (kResultNoAddress) are cached.
+// Errors are not.
+//
+// Thread safe: One DnsCache may be shared by the StubResolvers of several
+// threads.
+class DnsCache {
+ public:
+  DnsCache();
+  ~DnsCache();
+
+  // Look up the answer for |name| (in lower case) and record |type|. Returns
+  // true iif an unexpired answer was found and stored in |answer|.
+  bool Lookup(const string& name, uint16_t type, DnsAnswer* answer);
+
+  // Store |answer| for |name| and |type|, for |ttl| seconds.
+  void Store(const string& name, uint16_t type, const DnsAnswer& answer,
+      uint32_t ttl);
+
+  // Return the number of answers cached, including any expired but not yet
+  // purged.
+  size_t Size();
+
+ private:
+  NO_COPY_AND_ASSIGN(DnsCache)
+
+  struct Entry {
+    DnsAnswer answer;
+    int64_t expiry_us;
+  };
+
+  pthread_mutex_t mutex_;
+  map<string, Entry> entries_;
+
+  // Purge expired entries once the cache has doubled since the last purge.
+  size_t purge_size_;
+
+  static string Key(const string& name, uint16_t type);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_DNS_CACHE_H_
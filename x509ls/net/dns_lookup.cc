@@ -3,6 +3,7 @@
 
 #include "x509ls/net/dns_lookup.h"
 
+#include <arpa/inet.h>
 #include <assert.h>
 #include <ctype.h>
 #include <gnu/libc-version.h>
@@ -23,11 +24,20 @@ DnsLookup::DnsLookup(BaseObject* parent, const string& node,
     lookup_type_(lookup_type),
     request_count_(0),
     result_index_(-1),
+    stub_resolver_(NULL),
+    stub_type_count_(0),
+    stub_type_index_(0),
+    port_(0),
+    stub_address_length_(0),
     state_(kStateStart) {
 }
 
 // virtual
 DnsLookup::~DnsLookup() {
+  if (stub_resolver_) {
+    stub_resolver_->Cancel(this);
+  }
+
   bool can_free_node_and_service = true;
   for (int i = 0; i < request_count_; ++i) {
     int state = gai_cancel(&requests[i]);
@@ -44,12 +54,21 @@ DnsLookup::~DnsLookup() {
   }
 }
 
+void DnsLookup::SetStubResolver(StubResolver* stub_resolver) {
+  stub_resolver_ = stub_resolver;
+}
+
 void DnsLookup::Start() {
   assert(request_count_ == 0);
   assert(GetState() == kStateStart);
 
   SetState(kStateInProgress);
 
+  if (stub_resolver_) {
+    StartStub();
+    return;
+  }
+
   if (HasBuggyGlibc()) {
     SetState(kStateFail, true);
     error_message_ = "A bug your glibc version prevents async DNS lookups,"
@@ -144,6 +163,102 @@ void DnsLookup::OnPoll() {
   }
 }
 
+// virtual
+void DnsLookup::OnDnsAnswer(const DnsAnswer& answer) {
+  if (!HandleStubAnswer(answer)) {
+    ResolveNextStub();
+  }
+}
+
+void DnsLookup::StartStub() {
+  port_ = ServicePort(service_);
+  if (port_ == 0) {
+    error_message_ = "Name/service lookup failed.";
+    SetState(kStateFail, true);
+    return;
+  }
+
+  switch (lookup_type_) {
+  case kLookupTypeIPv4:
+    stub_types_[stub_type_count_++] = StubResolver::kTypeA;
+    break;
+  case kLookupTypeIPv6:
+    stub_types_[stub_type_count_++] = StubResolver::kTypeAAAA;
+    break;
+  case kLookupTypeIPv4then6:
+    stub_types_[stub_type_count_++] = StubResolver::kTypeA;
+    stub_types_[stub_type_count_++] = StubResolver::kTypeAAAA;
+    break;
+  case kLookupTypeIPv6then4:
+    stub_types_[stub_type_count_++] = StubResolver::kTypeAAAA;
+    stub_types_[stub_type_count_++] = StubResolver::kTypeA;
+    break;
+  default:
+    break;
+  }
+
+  // Address strings need no lookup.
+  unsigned char address[16];
+  for (int i = 0; i < stub_type_count_; ++i) {
+    const int family =
+      stub_types_[i] == StubResolver::kTypeA ? AF_INET : AF_INET6;
+    if (inet_pton(family, node_, address) == 1) {
+      SetStubAddress(family, address);
+      return;
+    }
+  }
+
+  ResolveNextStub();
+}
+
+void DnsLookup::ResolveNextStub() {
+  while (stub_type_index_ < stub_type_count_) {
+    DnsAnswer answer;
+    if (!stub_resolver_->Resolve(this, node_,
+          stub_types_[stub_type_index_], &answer)) {
+      // Wait for OnDnsAnswer().
+      return;
+    } else if (HandleStubAnswer(answer)) {
+      return;
+    }
+  }
+
+  SetState(kStateFail, true);
+}
+
+bool DnsLookup::HandleStubAnswer(const DnsAnswer& answer) {
+  if (answer.result != DnsAnswer::kResultAddresses) {
+    error_message_ = "Name lookup failed: " + answer.error_message;
+    ++stub_type_index_;
+    return false;
+  }
+
+  const bool is_ipv4 = stub_types_[stub_type_index_] == StubResolver::kTypeA;
+  SetStubAddress(is_ipv4 ? AF_INET : AF_INET6, answer.addresses[0].data());
+
+  return true;
+}
+
+void DnsLookup::SetStubAddress(int family, const void* address) {
+  memset(&stub_address_, 0, sizeof stub_address_);
+  if (family == AF_INET) {
+    sockaddr_in* ipv4 = reinterpret_cast<sockaddr_in*>(&stub_address_);
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_port = htons(port_);
+    memcpy(&ipv4->sin_addr, address, sizeof ipv4->sin_addr);
+    stub_address_length_ = sizeof *ipv4;
+  } else {
+    sockaddr_in6* ipv6 = reinterpret_cast<sockaddr_in6*>(&stub_address_);
+    ipv6->sin6_family = AF_INET6;
+    ipv6->sin6_port = htons(port_);
+    memcpy(&ipv6->sin6_addr, address, sizeof ipv6->sin6_addr);
+    stub_address_length_ = sizeof *ipv6;
+  }
+
+  result_index_ = 0;
+  SetState(kStateSuccess, true);
+}
+
 // static
 string DnsLookup::LookupTypeName(
     const DnsLookup::LookupType& lookup_type) {
@@ -179,13 +294,41 @@ DnsLookup::LookupType DnsLookup::NextLookupType(
   return static_cast<LookupType>(new_lookup_type);
 }
 
+// static
+uint16_t DnsLookup::ServicePort(const string& service) {
+  char* end;
+  const long port =  // NOLINT(runtime/int)
+    strtol(service.c_str(), &end, 10);
+  if (!service.empty() && *end == '\0') {
+    return port > 0 && port <= 65535 ? port : 0;
+  }
+
+  servent service_entry;
+  servent* result = NULL;
+  char buffer[1024];
+  if (getservbyname_r(service.c_str(), "tcp", &service_entry, buffer,
+        sizeof buffer, &result) == 0 && result != NULL) {
+    return ntohs(result->s_port);
+  }
+
+  return 0;
+}
+
 const sockaddr* DnsLookup::Sockaddr() const {
   assert(result_index_ != -1);
+  if (stub_resolver_) {
+    return reinterpret_cast<const sockaddr*>(&stub_address_);
+  }
+
   return requests[result_index_].ar_result->ai_addr;
 }
 
 socklen_t DnsLookup::SockaddrLen() const {
   assert(result_index_ != -1);
+  if (stub_resolver_) {
+    return stub_address_length_;
+  }
+
   return requests[result_index_].ar_result->ai_addrlen;
 }
 
@@ -194,13 +337,19 @@ string DnsLookup::IPAddressAndPort() const {
     return "";
   }
 
+  return AddressAndPort(Sockaddr(), SockaddrLen());
+}
+
+// static
+string DnsLookup::AddressAndPort(const sockaddr* address,
+    socklen_t address_length) {
   char host[NI_MAXHOST];
   char port[NI_MAXSERV];
-  getnameinfo(Sockaddr(), SockaddrLen(), host, sizeof(host),
+  getnameinfo(address, address_length, host, sizeof(host),
       port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
 
   stringstream result;
-  if (Sockaddr()->sa_family == AF_INET6) {
+  if (address->sa_family == AF_INET6) {
     result << "[";
     result << host;
     result << "]:";
@@ -215,6 +364,10 @@ string DnsLookup::IPAddressAndPort() const {
 }
 
 void DnsLookup::Cancel() {
+  if (stub_resolver_) {
+    stub_resolver_->Cancel(this);
+  }
+
   for (int i = 0; i < request_count_; ++i) {
     gai_cancel(&requests[i]);
   }
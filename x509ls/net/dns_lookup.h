@@ -15,6 +15,7 @@
 
 #include "x509ls/base/base_object.h"
 #include "x509ls/base/types.h"
+#include "x509ls/net/stub_resolver.h"
 
 using std::string;
 
@@ -38,7 +39,10 @@ namespace x509ls {
 // was buggy between about glibc versions 2.5-8. The glibc version is examined
 // upon calling Start() and an error occurs if any of these versions are being
 // used.
-class DnsLookup : public BaseObject {
+//
+// Alternatively, names can be resolved by a StubResolver, see
+// SetStubResolver().
+class DnsLookup : public BaseObject, public StubResolver::Listener {
  public:
   enum LookupType {
     kLookupTypeIPv4,
@@ -57,6 +61,13 @@ class DnsLookup : public BaseObject {
   // Leaks memory if HasOutstandingRequests() is true.
   virtual ~DnsLookup();
 
+  // Resolve the name with |stub_resolver| instead of getaddrinfo_a(). The
+  // lookup types are resolved in order, one at a time. |service| is resolved
+  // locally, from services(5).
+  //
+  // Call before Start(). |stub_resolver| must outlive the DnsLookup.
+  void SetStubResolver(StubResolver* stub_resolver);
+
   // Start asynchronous DNS lookup.
   //
   // Call once only.
@@ -103,6 +114,9 @@ class DnsLookup : public BaseObject {
   // - easier not to interact with ncurses' use of signals.
   virtual void OnPoll();
 
+  // Receives answers from the StubResolver.
+  virtual void OnDnsAnswer(const DnsAnswer& answer);
+
   // The following methods are only valid when kStateSuccess is Emit()ed:
 
   // Returns the sockaddr struct of the successful lookup. The returned sockaddr
@@ -129,6 +143,15 @@ class DnsLookup : public BaseObject {
   static LookupType NextLookupType(
       const LookupType& lookup_type);
 
+  // Returns the TCP port of |service|, a port number or a service name from
+  // services(5), or 0 if unknown.
+  static uint16_t ServicePort(const string& service);
+
+  // Returns a text representation of |address|'s IP address and port, e.g.
+  // "192.0.2.1:443" or "[2001:db8::1]:443".
+  static string AddressAndPort(const sockaddr* address,
+      socklen_t address_length);
+
   // In the kStateFail state returns a short string describing the error.
   string ErrorMessage() const;
 
@@ -145,6 +168,28 @@ class DnsLookup : public BaseObject {
   int request_count_;
   int result_index_;
 
+  // StubResolver lookups: The record types to try in order, and the result.
+  StubResolver* stub_resolver_;
+  uint16_t stub_types_[2];
+  int stub_type_count_;
+  int stub_type_index_;
+  uint16_t port_;
+  sockaddr_storage stub_address_;
+  socklen_t stub_address_length_;
+
+  void StartStub();
+
+  // Resolve the remaining record types until one is waiting for an answer,
+  // or the lookup finishes.
+  void ResolveNextStub();
+
+  // Succeed with the first address in |answer|, if any. Returns false if
+  // |answer| has no addresses, to try the next record type.
+  bool HandleStubAnswer(const DnsAnswer& answer);
+
+  // Set the result to |family|'s |address| (in network byte order) and
+  // |port_|.
+  void SetStubAddress(int family, const void* address);
 
   void SetState(State state, bool emit_event = false);
   State state_;
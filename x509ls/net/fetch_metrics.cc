@@ -0,0 +1,128 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/fetch_metrics.h"
+
+#include "x509ls/base/metrics.h"
+#include "x509ls/net/chain_fetcher.h"
+#include "x509ls/net/fetch_timing.h"
+
+namespace x509ls {
+namespace {
+const char kFailedName[] = "x509ls_fetches_failed_total";
+const char kFailedHelp[] = "Chain fetches failed, by reason.";
+const char kPhaseName[] = "x509ls_fetch_phase_seconds";
+const char kPhaseHelp[] = "Latency of each phase of successful chain fetches.";
+const char kChainCacheName[] = "x509ls_chain_cache_lookups_total";
+const char kChainCacheHelp[] = "Chain cache lookups, by result.";
+const char kDnsCacheName[] = "x509ls_dns_cache_lookups_total";
+const char kDnsCacheHelp[] = "Stub resolver DNS cache lookups, by result.";
+}  // namespace
+
+FetchMetrics::FetchMetrics(MetricsRegistry* registry)
+  :
+    started_(registry->AddCounter("x509ls_fetches_started_total", "",
+          "Chain fetches started.")),
+    succeeded_(registry->AddCounter("x509ls_fetches_succeeded_total", "",
+          "Chain fetches succeeded.")),
+    failed_resolve_(registry->AddCounter(kFailedName, "reason=\"resolve\"",
+          kFailedHelp)),
+    failed_connect_(registry->AddCounter(kFailedName, "reason=\"connect\"",
+          kFailedHelp)),
+    failed_cancelled_(registry->AddCounter(kFailedName,
+          "reason=\"cancelled\"", kFailedHelp)),
+    failed_target_(registry->AddCounter(kFailedName, "reason=\"target\"",
+          kFailedHelp)),
+    in_flight_(registry->AddGauge("x509ls_fetches_in_flight", "",
+          "Chain fetches in progress.")),
+    resolve_latency_(registry->AddHistogram(kPhaseName, "phase=\"resolve\"",
+          kPhaseHelp)),
+    connect_latency_(registry->AddHistogram(kPhaseName, "phase=\"connect\"",
+          kPhaseHelp)),
+    handshake_latency_(registry->AddHistogram(kPhaseName,
+          "phase=\"handshake\"", kPhaseHelp)),
+    verify_latency_(registry->AddHistogram(kPhaseName, "phase=\"verify\"",
+          kPhaseHelp)),
+    chain_cache_hits_(registry->AddCounter(kChainCacheName,
+          "result=\"hit\"", kChainCacheHelp)),
+    chain_cache_misses_(registry->AddCounter(kChainCacheName,
+          "result=\"miss\"", kChainCacheHelp)),
+    dns_cache_hits_(registry->AddCounter(kDnsCacheName, "result=\"hit\"",
+          kDnsCacheHelp)),
+    dns_cache_misses_(registry->AddCounter(kDnsCacheName, "result=\"miss\"",
+          kDnsCacheHelp)),
+    event_loop_busy_(registry->AddHistogram(
+          "x509ls_event_loop_busy_seconds", "",
+          "Time each event loop iteration spent delivering events.")) {
+}
+
+FetchMetrics::~FetchMetrics() {
+}
+
+void FetchMetrics::FetchStarted() {
+  started_->Increment();
+  in_flight_->Add(1);
+}
+
+void FetchMetrics::FetchFinished(const ChainFetcher& fetcher,
+    int event_code) {
+  in_flight_->Add(-1);
+
+  switch (event_code) {
+  case ChainFetcher::kStateConnectSuccess:
+  case ChainFetcher::kStateRevalidated: {
+    succeeded_->Increment();
+
+    const FetchTiming timing = fetcher.Timing();
+    resolve_latency_->Observe(FetchTiming::Duration(timing.resolve_start_us,
+          timing.resolve_end_us));
+    connect_latency_->Observe(FetchTiming::Duration(timing.connect_start_us,
+          timing.connect_end_us));
+    handshake_latency_->Observe(FetchTiming::Duration(
+          timing.handshake_start_us, timing.handshake_end_us));
+    verify_latency_->Observe(FetchTiming::Duration(timing.verify_start_us,
+          timing.verify_end_us));
+    break;
+  }
+  case ChainFetcher::kStateResolveFail:
+    failed_resolve_->Increment();
+    break;
+  case ChainFetcher::kStateCancel:
+    failed_cancelled_->Increment();
+    break;
+  case ChainFetcher::kStateConnectFail:
+  default:
+    failed_connect_->Increment();
+    break;
+  }
+}
+
+void FetchMetrics::FetchRejected() {
+  failed_target_->Increment();
+}
+
+void FetchMetrics::ChainCacheLookup(bool hit) {
+  if (hit) {
+    chain_cache_hits_->Increment();
+  } else {
+    chain_cache_misses_->Increment();
+  }
+}
+
+void FetchMetrics::PublishDnsStatistics(
+    const StubResolver::Statistics& statistics,
+    StubResolver::Statistics* published) {
+  const uint64_t hits =
+    statistics.cache_hit_count - published->cache_hit_count;
+  const uint64_t lookups = statistics.lookup_count - published->lookup_count;
+
+  dns_cache_hits_->Increment(hits);
+  dns_cache_misses_->Increment(lookups - hits);
+
+  *published = statistics;
+}
+
+Histogram* FetchMetrics::EventLoopHistogram() {
+  return event_loop_busy_;
+}
+}  // namespace x509ls
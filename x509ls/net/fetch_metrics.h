@@ -0,0 +1,77 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_FETCH_METRICS_H_
+#define X509LS_NET_FETCH_METRICS_H_
+
+#include "x509ls/base/types.h"
+#include "x509ls/net/stub_resolver.h"
+
+namespace x509ls {
+class ChainFetcher;
+class Counter;
+class Gauge;
+class Histogram;
+class MetricsRegistry;
+// The metrics of chain fetches, registered in a MetricsRegistry:
+// - Fetches started, succeeded, and failed by reason.
+// - Fetches in flight.
+// - Resolve, connect, handshake and verify latencies (see FetchTiming).
+// - Chain cache and DNS cache lookups, by hit or miss.
+// - Event loop busy time, see CliApplication::SetLoopHistogram().
+//
+// Every update is lock-free, so one FetchMetrics may be shared by all batch
+// worker threads.
+class FetchMetrics {
+ public:
+  // Register the metrics in |registry|, which must outlive the FetchMetrics.
+  explicit FetchMetrics(MetricsRegistry* registry);
+  ~FetchMetrics();
+
+  // Record a fetch started with ChainFetcher::Start().
+  void FetchStarted();
+
+  // Record the end of a started |fetcher| with its final |event_code|, e.g.
+  // ChainFetcher::kStateConnectSuccess.
+  void FetchFinished(const ChainFetcher& fetcher, int event_code);
+
+  // Record a target which couldn't be fetched at all, e.g. unparseable.
+  void FetchRejected();
+
+  // Record a chain cache lookup, a hit iif |hit|.
+  void ChainCacheLookup(bool hit);
+
+  // Record the StubResolver |statistics| counted since |published|, then set
+  // |published| to |statistics|.
+  void PublishDnsStatistics(const StubResolver::Statistics& statistics,
+      StubResolver::Statistics* published);
+
+  // Return the histogram for CliApplication::SetLoopHistogram().
+  Histogram* EventLoopHistogram();
+
+ private:
+  NO_COPY_AND_ASSIGN(FetchMetrics)
+
+  Counter* started_;
+  Counter* succeeded_;
+  Counter* failed_resolve_;
+  Counter* failed_connect_;
+  Counter* failed_cancelled_;
+  Counter* failed_target_;
+  Gauge* in_flight_;
+
+  Histogram* resolve_latency_;
+  Histogram* connect_latency_;
+  Histogram* handshake_latency_;
+  Histogram* verify_latency_;
+
+  Counter* chain_cache_hits_;
+  Counter* chain_cache_misses_;
+  Counter* dns_cache_hits_;
+  Counter* dns_cache_misses_;
+
+  Histogram* event_loop_busy_;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_FETCH_METRICS_H_
@@ -0,0 +1,58 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/fetch_timing.h"
+
+#include <stdio.h>
+
+namespace x509ls {
+namespace {
+// Append " |name|=<duration>ms" to |summary| if the phase completed.
+void AppendPhase(const char* name, int64_t start_us, int64_t end_us,
+    string* summary) {
+  const int64_t duration_us = FetchTiming::Duration(start_us, end_us);
+  if (duration_us < 0) {
+    return;
+  }
+
+  char phase[64];
+  snprintf(phase, sizeof phase, "%s%s=%.1fms", summary->empty() ? "" : " ",
+      name, duration_us / 1000.0);
+  summary->append(phase);
+}
+}  // namespace
+
+FetchTiming::FetchTiming()
+  :
+    resolve_start_us(0),
+    resolve_end_us(0),
+    connect_start_us(0),
+    connect_end_us(0),
+    handshake_start_us(0),
+    handshake_end_us(0),
+    verify_start_us(0),
+    verify_end_us(0),
+    ocsp_start_us(0),
+    ocsp_end_us(0) {
+}
+
+// static
+int64_t FetchTiming::Duration(int64_t start_us, int64_t end_us) {
+  if (start_us == 0 || end_us == 0) {
+    return -1;
+  }
+
+  return end_us - start_us;
+}
+
+string FetchTiming::Summary() const {
+  string summary;
+  AppendPhase("resolve", resolve_start_us, resolve_end_us, &summary);
+  AppendPhase("connect", connect_start_us, connect_end_us, &summary);
+  AppendPhase("handshake", handshake_start_us, handshake_end_us, &summary);
+  AppendPhase("verify", verify_start_us, verify_end_us, &summary);
+  AppendPhase("ocsp", ocsp_start_us, ocsp_end_us, &summary);
+
+  return summary;
+}
+}  // namespace x509ls
@@ -0,0 +1,51 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_FETCH_TIMING_H_
+#define X509LS_NET_FETCH_TIMING_H_
+
+#include <stdint.h>
+
+#include <string>
+
+using std::string;
+
+namespace x509ls {
+// When each phase of a chain fetch started and ended, as Clock microseconds.
+// A timestamp is 0 if the phase hasn't started or ended (e.g. after a
+// failure).
+//
+// The phases are consecutive, except that a ConnectScheduler's queue may
+// delay the connect after the resolve:
+// - resolve: DNS lookup (instant for AddressMap entries).
+// - connect: TCP connection.
+// - handshake: TLS handshake, until the server's chain is available.
+// - verify: Building and verifying the validation path.
+// - ocsp: Querying the end-entity certificate's OCSP responder, if enabled.
+struct FetchTiming {
+  FetchTiming();
+
+  int64_t resolve_start_us;
+  int64_t resolve_end_us;
+  int64_t connect_start_us;
+  int64_t connect_end_us;
+  int64_t handshake_start_us;
+  int64_t handshake_end_us;
+  int64_t verify_start_us;
+  int64_t verify_end_us;
+  int64_t ocsp_start_us;
+  int64_t ocsp_end_us;
+
+  // Return the microseconds from |start_us| to |end_us|, or -1 if the phase
+  // didn't complete.
+  static int64_t Duration(int64_t start_us, int64_t end_us);
+
+  // Return a one line summary of the completed phases, e.g.:
+  //   "resolve=12.1ms connect=0.4ms handshake=38.0ms verify=1.2ms
+  //   ocsp=20.5ms"
+  // Returns "" if no phase completed.
+  string Summary() const;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_FETCH_TIMING_H_
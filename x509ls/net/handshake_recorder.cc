@@ -0,0 +1,245 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/handshake_recorder.h"
+
+#include <stdio.h>
+
+#include "x509ls/base/clock.h"
+
+namespace x509ls {
+namespace {
+// Initial congestion window (RFC 6928) of ten full Ethernet segments.
+const uint64_t kInitialWindowBytes = 10 * 1460;
+
+// TLS record header length.
+const size_t kRecordHeaderLength = 5;
+
+struct HandshakeTypeName {
+  int type;
+  const char* name;
+};
+
+const HandshakeTypeName kHandshakeTypeNames[] = {
+  {0, "HelloRequest"},
+  {1, "ClientHello"},
+  {2, "ServerHello"},
+  {3, "HelloVerifyRequest"},
+  {4, "NewSessionTicket"},
+  {5, "EndOfEarlyData"},
+  {8, "EncryptedExtensions"},
+  {11, "Certificate"},
+  {12, "ServerKeyExchange"},
+  {13, "CertificateRequest"},
+  {14, "ServerHelloDone"},
+  {15, "CertificateVerify"},
+  {16, "ClientKeyExchange"},
+  {20, "Finished"},
+  {22, "CertificateStatus"},
+  {24, "KeyUpdate"},
+  {-1, NULL}
+};
+
+const int kCertificateType = 11;
+const int kServerHelloType = 2;
+}  // namespace
+
+HandshakeRecorder::HandshakeRecorder()
+  :
+    connect_start_us_(0),
+    connect_end_us_(0),
+    received_bytes_(0),
+    received_records_(0),
+    last_message_records_(0) {
+}
+
+HandshakeRecorder::~HandshakeRecorder() {
+}
+
+void HandshakeRecorder::Attach(SSL_CTX* ssl_ctx, int64_t connect_start_us) {
+  connect_start_us_ = connect_start_us;
+
+  SSL_CTX_set_msg_callback(ssl_ctx, MessageProcedure);
+  SSL_CTX_set_msg_callback_arg(ssl_ctx, this);
+}
+
+void HandshakeRecorder::SetConnectEnd(int64_t connect_end_us) {
+  connect_end_us_ = connect_end_us;
+}
+
+const vector<HandshakeRecorder::Message>& HandshakeRecorder::Messages()
+    const {
+  return messages_;
+}
+
+string HandshakeRecorder::Timeline() const {
+  string timeline = "Handshake timeline, from the start of the TCP connect:\n\n"
+    "       time  dir  message                      bytes   received\n";
+
+  char line[256];
+  if (connect_end_us_ != 0) {
+    snprintf(line, sizeof line, "%9.2fms  --   %-24s\n",
+        (connect_end_us_ - connect_start_us_) / 1000.0, "TCP connected");
+    timeline.append(line);
+  }
+
+  const Message* server_hello = NULL;
+  const Message* certificate = NULL;
+  size_t certificate_records = 0;
+  for (size_t i = 0; i < messages_.size(); ++i) {
+    const Message& message = messages_[i];
+
+    if (message.sent) {
+      snprintf(line, sizeof line, "%9.2fms  ->   %-24s %9lu\n",
+          message.time_us / 1000.0, MessageName(message).c_str(),
+          static_cast<unsigned long>(message.length));  // NOLINT(runtime/int)
+    } else {
+      snprintf(line, sizeof line, "%9.2fms  <-   %-24s %9lu %10lu\n",
+          message.time_us / 1000.0, MessageName(message).c_str(),
+          static_cast<unsigned long>(message.length),  // NOLINT(runtime/int)
+          static_cast<unsigned long>(  // NOLINT(runtime/int)
+            message.received_offset));
+    }
+    timeline.append(line);
+
+    if (message.sent || message.content_type != SSL3_RT_HANDSHAKE) {
+      continue;
+    } else if (message.handshake_type == kServerHelloType && !server_hello) {
+      server_hello = &message;
+    } else if (message.handshake_type == kCertificateType && !certificate) {
+      certificate = &message;
+      certificate_records = message.records;
+    }
+  }
+
+  timeline.append("\n");
+
+  const int64_t rtt_us = connect_end_us_ != 0 ?
+    connect_end_us_ - connect_start_us_ : 0;
+  if (rtt_us > 0) {
+    snprintf(line, sizeof line,
+        "Round trip (TCP connect): %.2fms\n", rtt_us / 1000.0);
+    timeline.append(line);
+  }
+
+  if (server_hello && rtt_us > 0) {
+    snprintf(line, sizeof line, "ServerHello: %.2fms after connecting\n",
+        (server_hello->time_us - rtt_us) / 1000.0);
+    timeline.append(line);
+  }
+
+  if (certificate) {
+    const int flights = SlowStartFlights(certificate->received_offset);
+    snprintf(line, sizeof line, "Certificate: %lu bytes in %lu record%s, "
+        "complete at received byte %lu: ~%d flight%s from a 10 segment "
+        "initial window\n",
+        static_cast<unsigned long>(certificate->length),  // NOLINT
+        static_cast<unsigned long>(certificate_records),  // NOLINT
+        certificate_records == 1 ? "" : "s",
+        static_cast<unsigned long>(certificate->received_offset),  // NOLINT
+        flights, flights == 1 ? "" : "s");
+    timeline.append(line);
+
+    if (server_hello && rtt_us > 0) {
+      snprintf(line, sizeof line,
+          "Certificate complete %.2fms (%.1f round trips) after "
+          "ServerHello\n",
+          (certificate->time_us - server_hello->time_us) / 1000.0,
+          static_cast<double>(certificate->time_us - server_hello->time_us) /
+          rtt_us);
+      timeline.append(line);
+    }
+  }
+
+  return timeline;
+}
+
+// static
+string HandshakeRecorder::MessageName(const Message& message) {
+  switch (message.content_type) {
+  case SSL3_RT_CHANGE_CIPHER_SPEC:
+    return "ChangeCipherSpec";
+  case SSL3_RT_ALERT:
+    return "Alert";
+  case SSL3_RT_HANDSHAKE:
+    for (const HandshakeTypeName* it = kHandshakeTypeNames; it->name; ++it) {
+      if (it->type == message.handshake_type) {
+        return it->name;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+
+  char name[32];
+  snprintf(name, sizeof name, "Unknown (%d/%d)", message.content_type,
+      message.handshake_type);
+
+  return name;
+}
+
+// static
+int HandshakeRecorder::SlowStartFlights(uint64_t bytes) {
+  int flights = 1;
+  uint64_t window = kInitialWindowBytes;
+  uint64_t sent = window;
+  while (sent < bytes) {
+    window *= 2;
+    sent += window;
+    ++flights;
+  }
+
+  return flights;
+}
+
+void HandshakeRecorder::OnMessage(bool sent, int content_type,
+    const unsigned char* data, size_t length) {
+#ifdef SSL3_RT_HEADER
+  if (content_type == SSL3_RT_HEADER) {
+    if (!sent && length >= kRecordHeaderLength) {
+      received_bytes_ += kRecordHeaderLength + ((data[3] << 8) | data[4]);
+      ++received_records_;
+    }
+    return;
+  }
+#endif
+
+  if (content_type != SSL3_RT_HANDSHAKE &&
+      content_type != SSL3_RT_CHANGE_CIPHER_SPEC &&
+      content_type != SSL3_RT_ALERT) {
+    return;
+  }
+
+#ifndef SSL3_RT_HEADER
+  // Without record headers, count message bytes only.
+  if (!sent) {
+    received_bytes_ += length;
+    ++received_records_;
+  }
+#endif
+
+  Message message;
+  message.time_us = Clock::NowMicroseconds() - connect_start_us_;
+  message.sent = sent;
+  message.content_type = content_type;
+  message.handshake_type = content_type == SSL3_RT_HANDSHAKE && length > 0 ?
+    data[0] : -1;
+  message.length = length;
+  message.received_offset = sent ? 0 : received_bytes_;
+  message.records = sent ? 0 : received_records_ - last_message_records_;
+
+  if (!sent) {
+    last_message_records_ = received_records_;
+  }
+
+  messages_.push_back(message);
+}
+
+// static
+void HandshakeRecorder::MessageProcedure(int write_p, int version,
+    int content_type, const void* buf, size_t len, SSL* ssl, void* arg) {
+  static_cast<HandshakeRecorder*>(arg)->OnMessage(write_p != 0, content_type,
+      static_cast<const unsigned char*>(buf), len);
+}
+}  // namespace x509ls
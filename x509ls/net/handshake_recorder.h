@@ -0,0 +1,96 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_HANDSHAKE_RECORDER_H_
+#define X509LS_NET_HANDSHAKE_RECORDER_H_
+
+#include <openssl/ssl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// Records the TLS messages of one handshake, through OpenSSL's message
+// callback: Each handshake message, ChangeCipherSpec and alert, with its size
+// and time relative to the start of the TCP connect.
+//
+// Record headers are counted too (OpenSSL v1.0.2 and later), giving the
+// offset in the received TLS stream at which each message completed. For the
+// server's Certificate message this shows whether the chain fits in the
+// server's initial congestion window, or needs further round trips.
+//
+// Times are when OpenSSL processed each message: The same as the arrival
+// time, except in BIO pair mode where a message may wait in the pair's buffer
+// until the previous ones are processed.
+class HandshakeRecorder {
+ public:
+  HandshakeRecorder();
+  ~HandshakeRecorder();
+
+  // A message sent or received.
+  struct Message {
+    int64_t time_us;          // Since connect start.
+    bool sent;
+    int content_type;         // e.g. SSL3_RT_HANDSHAKE.
+    int handshake_type;       // e.g. SSL3_MT_CERTIFICATE, or -1.
+    size_t length;            // Message length, including its header.
+
+    // Received TLS bytes (record headers included) up to the end of the
+    // record completing this message. 0 for sent messages.
+    uint64_t received_offset;
+
+    // Number of records received since the previous received message. 0 for
+    // sent messages.
+    size_t records;
+  };
+
+  // Record the messages of connections made with |ssl_ctx|, timed relative
+  // to |connect_start_us| (a Clock time). Call before the handshake starts.
+  void Attach(SSL_CTX* ssl_ctx, int64_t connect_start_us);
+
+  // Set the connect end time, as an estimate of the round trip time.
+  void SetConnectEnd(int64_t connect_end_us);
+
+  const vector<Message>& Messages() const;
+
+  // Return the timeline as multiple lines of text: One line per message, then
+  // a summary of the server's first flight and Certificate message.
+  string Timeline() const;
+
+  // Return a short name for |message|, e.g. "Certificate".
+  static string MessageName(const Message& message);
+
+  // Estimate the number of server flights (round trips) needed to send
+  // |bytes| in TCP slow start, from an initial window of ten segments.
+  static int SlowStartFlights(uint64_t bytes);
+
+ private:
+  NO_COPY_AND_ASSIGN(HandshakeRecorder)
+
+  int64_t connect_start_us_;
+  int64_t connect_end_us_;
+
+  vector<Message> messages_;
+
+  // Received record bytes and record count so far, and the count when the
+  // last message was received.
+  uint64_t received_bytes_;
+  size_t received_records_;
+  size_t last_message_records_;
+
+  void OnMessage(bool sent, int content_type, const unsigned char* data,
+      size_t length);
+
+  static void MessageProcedure(int write_p, int version, int content_type,
+      const void* buf, size_t len, SSL* ssl, void* arg);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_HANDSHAKE_RECORDER_H_
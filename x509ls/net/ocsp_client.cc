@@ -0,0 +1,701 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/ocsp_client.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509v3.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+#include "x509ls/base/clock.h"
+#include "x509ls/base/event_manager.h"
+#include "x509ls/certificate/ocsp_staple.h"
+#include "x509ls/certificate/trust_store.h"
+#include "x509ls/net/dns_lookup.h"
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// How long queries are gathered before a request is sent.
+const int64_t kGatherMicroseconds = 20 * 1000;
+
+// How long a request may take, from name lookup to complete response.
+const int64_t kTimeoutMicroseconds = 10 * 1000 * 1000;
+
+// Largest HTTP response accepted.
+const size_t kMaxResponseSize = 1024 * 1024;
+
+// Clock skew allowed between us and the OCSP responder.
+const long kMaxClockSkewSeconds = 5 * 60;  // NOLINT(runtime/int)
+
+// Return true iif |text| starts with |prefix|, ignoring case.
+bool StartsWithIgnoringCase(const string& text, const char* prefix) {
+  const size_t length = strlen(prefix);
+  return text.size() >= length &&
+    strncasecmp(text.data(), prefix, length) == 0;
+}
+}  // namespace
+
+OCSPClient::Statistics::Statistics()
+  :
+    lookup_count(0),
+    cache_hit_count(0),
+    coalesced_count(0),
+    request_count(0),
+    certificate_count(0),
+    error_count(0) {
+}
+
+void OCSPClient::Statistics::Merge(const Statistics& other) {
+  lookup_count += other.lookup_count;
+  cache_hit_count += other.cache_hit_count;
+  coalesced_count += other.coalesced_count;
+  request_count += other.request_count;
+  certificate_count += other.certificate_count;
+  error_count += other.error_count;
+}
+
+string OCSPClient::Statistics::Summary() const {
+  stringstream summary;
+  summary << "ocsp: " << lookup_count << " lookups, ";
+  summary << cache_hit_count << " cached, ";
+  summary << coalesced_count << " coalesced, ";
+  summary << request_count << " requests for ";
+  summary << certificate_count << " certificates, ";
+  summary << error_count << " errors";
+
+  return summary.str();
+}
+
+OCSPClient::OCSPClient(BaseObject* parent, OCSPCache* cache,
+    TrustStore* trust_store)
+  :
+    BaseObject(parent),
+    cache_(cache),
+    trust_store_(trust_store),
+    stub_resolver_(NULL),
+    polling_(false) {
+}
+
+// virtual
+OCSPClient::~OCSPClient() {
+  // Every request has a deadline.
+  while (!deadlines_.empty()) {
+    RemoveRequest(deadlines_.begin()->second);
+  }
+
+  for (map<string, PendingQuery*>::iterator it = queries_.begin();
+      it != queries_.end();
+      ++it) {
+    OCSP_CERTID_free(it->second->id);
+    delete it->second;
+  }
+}
+
+void OCSPClient::SetStubResolver(StubResolver* stub_resolver) {
+  stub_resolver_ = stub_resolver;
+}
+
+bool OCSPClient::Query(Listener* listener, X509* leaf, X509* issuer,
+    const vector<X509Handle>& untrusted, OCSPResult* result) {
+  ++statistics_.lookup_count;
+
+  const string url = ResponderUrl(leaf);
+  string host;
+  string port;
+  string path;
+  if (url.empty() || !ParseUrl(url, &host, &port, &path)) {
+    result->status = OCSPResult::kStatusNoResponder;
+    result->error_message = "no http responder";
+    return true;
+  }
+
+  OCSP_CERTID* id = OCSP_cert_to_id(NULL, leaf, issuer);
+  const int id_length = id ? i2d_OCSP_CERTID(id, NULL) : 0;
+  if (id_length <= 0) {
+    OCSP_CERTID_free(id);
+    ++statistics_.error_count;
+    result->status = OCSPResult::kStatusError;
+    result->error_message = "unable to form CertID";
+    return true;
+  }
+
+  string cert_id(id_length, '\0');
+  unsigned char* data = reinterpret_cast<unsigned char*>(&cert_id[0]);
+  i2d_OCSP_CERTID(id, &data);
+
+  if (cache_->Lookup(cert_id, result)) {
+    OCSP_CERTID_free(id);
+    ++statistics_.cache_hit_count;
+    return true;
+  }
+
+  map<string, PendingQuery*>::iterator it = queries_.find(cert_id);
+  if (it != queries_.end()) {
+    OCSP_CERTID_free(id);
+    ++statistics_.coalesced_count;
+    it->second->listeners.push_back(listener);
+    listener_queries_[listener] = it->second;
+    return false;
+  }
+
+  PendingQuery* query = new PendingQuery;
+  query->cert_id = cert_id;
+  query->id = id;
+  query->alone = false;
+  query->untrusted = untrusted;
+  query->listeners.push_back(listener);
+  query->request = NULL;
+
+  queries_[cert_id] = query;
+  listener_queries_[listener] = query;
+
+  Gather(query, url, issuer);
+
+  return false;
+}
+
+void OCSPClient::Cancel(Listener* listener) {
+  map<Listener*, PendingQuery*>::iterator it =
+    listener_queries_.find(listener);
+  if (it == listener_queries_.end()) {
+    return;
+  }
+
+  // The query itself carries on: Its result will still be cached.
+  vector<Listener*>& listeners = it->second->listeners;
+  listeners.erase(std::remove(listeners.begin(), listeners.end(), listener),
+      listeners.end());
+  listener_queries_.erase(it);
+}
+
+const OCSPClient::Statistics& OCSPClient::GetStatistics() const {
+  return statistics_;
+}
+
+// virtual
+void OCSPClient::OnEvent(const BaseObject* source, int event_code) {
+  map<DnsLookup*, Request*>::iterator it =
+    lookup_requests_.find(const_cast<DnsLookup*>(
+          static_cast<const DnsLookup*>(source)));
+  if (it == lookup_requests_.end()) {
+    return;
+  }
+  Request* request = it->second;
+
+  if (event_code == DnsLookup::kStateSuccess) {
+    Connect(request);
+  } else if (event_code == DnsLookup::kStateFail) {
+    FailRequest(request, "unable to resolve responder", false);
+  }
+}
+
+// virtual
+void OCSPClient::OnFDEvent(int fd, bool read_event,
+    bool write_event, bool error_event) {
+  map<int, Request*>::iterator it = fd_requests_.find(fd);
+  if (it == fd_requests_.end()) {
+    return;
+  }
+  Request* request = it->second;
+
+  if (write_event && !request->output.empty()) {
+    const ssize_t sent = send(fd, request->output.data(),
+        request->output.size(), MSG_NOSIGNAL);
+    if (sent == -1 && errno != EAGAIN && errno != EINTR) {
+      FailRequest(request, "connection failed", false);
+      return;
+    } else if (sent > 0) {
+      request->output.erase(0, sent);
+      if (request->output.empty()) {
+        WatchFD(fd, EventManager::kFDReadable);
+      }
+    }
+  }
+
+  if (read_event) {
+    Receive(request);
+  }
+}
+
+// virtual
+void OCSPClient::OnPoll() {
+  const int64_t now_us = Clock::NowMicroseconds();
+
+  while (!deadlines_.empty() && deadlines_.begin()->first <= now_us) {
+    Request* request = deadlines_.begin()->second;
+    deadlines_.erase(deadlines_.begin());
+    request->deadline = deadlines_.end();
+
+    if (!request->gathering_key.empty()) {
+      Send(request);
+    } else {
+      FailRequest(request, "timed out", false);
+    }
+  }
+
+  UpdatePolling();
+}
+
+void OCSPClient::Gather(PendingQuery* query, const string& url,
+    X509* issuer) {
+  // A response's signer is checked against one issuer, so requests are
+  // gathered per issuer as well as per responder.
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_length = 0;
+  X509_digest(issuer, EVP_sha1(), digest, &digest_length);
+
+  string key = url;
+  key.push_back('\n');
+  key.append(reinterpret_cast<const char*>(digest), digest_length);
+
+  map<string, Request*>::iterator it = gathering_.find(key);
+  Request* request;
+  if (it != gathering_.end() && !query->alone) {
+    request = it->second;
+  } else {
+    request = new Request;
+    request->url = url;
+    ParseUrl(url, &request->host, &request->port, &request->path);
+    request->issuer = X509Handle::Share(issuer);
+    request->deadline = deadlines_.end();
+    request->lookup = NULL;
+    request->fd = -1;
+
+    if (!query->alone) {
+      request->gathering_key = key;
+      gathering_[key] = request;
+    }
+    SetDeadline(request, Clock::NowMicroseconds() + kGatherMicroseconds);
+  }
+
+  request->queries.push_back(query);
+  query->request = request;
+
+  for (size_t i = 0; i < query->untrusted.size(); ++i) {
+    X509* x509 = query->untrusted[i].Get();
+    bool is_known = false;
+    for (size_t j = 0; j < request->untrusted.size() && !is_known; ++j) {
+      is_known = request->untrusted[j].Get() == x509;
+    }
+    if (!is_known) {
+      request->untrusted.push_back(query->untrusted[i]);
+    }
+  }
+
+  if (query->alone ||
+      request->queries.size() >= kMaxCertificatesPerRequest) {
+    Send(request);
+  }
+}
+
+void OCSPClient::Send(Request* request) {
+  if (!request->gathering_key.empty()) {
+    gathering_.erase(request->gathering_key);
+    request->gathering_key.clear();
+  }
+  SetDeadline(request, Clock::NowMicroseconds() + kTimeoutMicroseconds);
+
+  ++statistics_.request_count;
+  statistics_.certificate_count += request->queries.size();
+
+  OCSP_REQUEST* ocsp_request = OCSP_REQUEST_new();
+  for (size_t i = 0; i < request->queries.size(); ++i) {
+    OCSP_request_add0_id(ocsp_request,
+        OCSP_CERTID_dup(request->queries[i]->id));
+  }
+
+  const int der_length = i2d_OCSP_REQUEST(ocsp_request, NULL);
+  string der(der_length > 0 ? der_length : 0, '\0');
+  if (der_length > 0) {
+    unsigned char* data = reinterpret_cast<unsigned char*>(&der[0]);
+    i2d_OCSP_REQUEST(ocsp_request, &data);
+  }
+  OCSP_REQUEST_free(ocsp_request);
+
+  if (der.empty()) {
+    FailRequest(request, "unable to form request", false);
+    return;
+  }
+
+  stringstream output;
+  output << "POST " << request->path << " HTTP/1.0\r\n";
+  output << "Host: " << request->host;
+  if (request->port != "80") {
+    output << ":" << request->port;
+  }
+  output << "\r\n";
+  output << "Content-Type: application/ocsp-request\r\n";
+  output << "Content-Length: " << der.size() << "\r\n";
+  output << "\r\n";
+  output << der;
+  request->output = output.str();
+
+  // Strip the brackets from IPv6 literals.
+  string node = request->host;
+  if (node.size() > 2 && node[0] == '[') {
+    node = node.substr(1, node.size() - 2);
+  }
+
+  request->lookup = new DnsLookup(this, node, request->port,
+      DnsLookup::kLookupTypeIPv4then6);
+  if (stub_resolver_) {
+    request->lookup->SetStubResolver(stub_resolver_);
+  }
+  lookup_requests_[request->lookup] = request;
+  Subscribe(request->lookup, DnsLookup::kStateSuccess);
+  Subscribe(request->lookup, DnsLookup::kStateFail);
+  request->lookup->Start();
+}
+
+void OCSPClient::Connect(Request* request) {
+  const sockaddr* address = request->lookup->Sockaddr();
+
+  request->fd = socket(address->sa_family, SOCK_STREAM, 0);
+  if (request->fd == -1) {
+    FailRequest(request, "unable to create socket", false);
+    return;
+  }
+  fcntl(request->fd, F_SETFL, fcntl(request->fd, F_GETFL) | O_NONBLOCK);
+  fd_requests_[request->fd] = request;
+
+  if (connect(request->fd, address, request->lookup->SockaddrLen()) == -1 &&
+      errno != EINPROGRESS) {
+    FailRequest(request, "unable to connect", false);
+    return;
+  }
+
+  WatchFD(request->fd, EventManager::kFDReadable | EventManager::kFDWritable);
+}
+
+void OCSPClient::Receive(Request* request) {
+  bool closed = false;
+  char buffer[4096];
+  for (;;) {
+    const ssize_t received = recv(request->fd, buffer, sizeof buffer, 0);
+    if (received > 0) {
+      request->input.append(buffer, received);
+      if (request->input.size() > kMaxResponseSize) {
+        FailRequest(request, "response too large", false);
+        return;
+      }
+    } else if (received == 0) {
+      closed = true;
+      break;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      FailRequest(request, "connection failed", false);
+      return;
+    }
+  }
+
+  string body;
+  string error_message;
+  if (!ParseHttpResponse(request->input, closed, &body, &error_message)) {
+    return;
+  }
+
+  if (!error_message.empty()) {
+    // Some responders reject requests for several certificates outright.
+    FailRequest(request, error_message, true);
+    return;
+  }
+
+  ProcessResponse(request, body);
+}
+
+void OCSPClient::ProcessResponse(Request* request, const string& body) {
+  const unsigned char* data =
+    reinterpret_cast<const unsigned char*>(body.data());
+  OCSP_RESPONSE* response = d2i_OCSP_RESPONSE(NULL, &data, body.size());
+  OCSP_BASICRESP* basic = NULL;
+
+  string error_message;
+  bool retry_alone = false;
+  if (response == NULL) {
+    error_message = "malformed";
+  } else if (OCSP_response_status(response) !=
+      OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+    error_message = "responder error: ";
+    error_message.append(OCSP_response_status_str(
+          OCSP_response_status(response)));
+    retry_alone = true;
+  } else if ((basic = OCSP_response_get1_basic(response)) == NULL) {
+    error_message = "malformed";
+  } else {
+    // The signer may be the issuer, or a delegated responder chaining to the
+    // trust store through the issuer and its own issuers.
+    STACK_OF(X509)* untrusted = sk_X509_new_null();
+    sk_X509_push(untrusted, request->issuer.Get());
+    for (size_t i = 0; i < request->untrusted.size(); ++i) {
+      sk_X509_push(untrusted, request->untrusted[i].Get());
+    }
+    if (OCSP_basic_verify(basic, untrusted, trust_store_->Store(), 0) <= 0) {
+      error_message = "signature not trusted";
+    }
+    sk_X509_free(untrusted);
+  }
+
+  // OCSP_basic_verify() leaves errors queued on failure.
+  ERR_clear_error();
+  OCSP_RESPONSE_free(response);
+
+  if (!error_message.empty()) {
+    OCSP_BASICRESP_free(basic);
+    FailRequest(request, error_message, retry_alone);
+    return;
+  }
+
+  // Finishing queries notifies listeners, who may start new ones: Work from
+  // copies once |request| is gone.
+  const vector<PendingQuery*> queries = request->queries;
+  const string url = request->url;
+  X509Handle issuer = request->issuer;
+  RemoveRequest(request);
+
+  for (size_t i = 0; i < queries.size(); ++i) {
+    PendingQuery* query = queries[i];
+
+    int status;
+    int reason;
+    ASN1_GENERALIZEDTIME* revocation_time;
+    ASN1_GENERALIZEDTIME* this_update;
+    ASN1_GENERALIZEDTIME* next_update;
+    if (!OCSP_resp_find_status(basic, query->id, &status, &reason,
+          &revocation_time, &this_update, &next_update)) {
+      if (queries.size() > 1) {
+        query->alone = true;
+        Gather(query, url, issuer.Get());
+      } else {
+        OCSPResult result;
+        result.status = OCSPResult::kStatusError;
+        result.error_message = "not for this certificate";
+        Finish(query, result);
+      }
+      continue;
+    }
+
+    OCSPResult result;
+    if (!OCSP_check_validity(this_update, next_update, kMaxClockSkewSeconds,
+          -1)) {
+      result.status = OCSPResult::kStatusError;
+      result.error_message = "stale";
+      ERR_clear_error();
+    } else if (status == V_OCSP_CERTSTATUS_GOOD) {
+      result.status = OCSPResult::kStatusGood;
+    } else if (status == V_OCSP_CERTSTATUS_REVOKED) {
+      result.status = OCSPResult::kStatusRevoked;
+    } else {
+      result.status = OCSPResult::kStatusUnknown;
+    }
+    result.next_update = OCSPStaple::TimeFromASN1(next_update);
+
+    Finish(query, result);
+  }
+
+  OCSP_BASICRESP_free(basic);
+}
+
+void OCSPClient::FailRequest(Request* request, const string& error_message,
+    bool retry_alone) {
+  const vector<PendingQuery*> queries = request->queries;
+  const string url = request->url;
+  X509Handle issuer = request->issuer;
+  RemoveRequest(request);
+
+  for (size_t i = 0; i < queries.size(); ++i) {
+    if (retry_alone && queries.size() > 1) {
+      queries[i]->alone = true;
+      Gather(queries[i], url, issuer.Get());
+    } else {
+      OCSPResult result;
+      result.status = OCSPResult::kStatusError;
+      result.error_message = error_message;
+      Finish(queries[i], result);
+    }
+  }
+}
+
+void OCSPClient::Finish(PendingQuery* query, const OCSPResult& result) {
+  if (result.status == OCSPResult::kStatusError) {
+    ++statistics_.error_count;
+  }
+  cache_->Store(query->cert_id, result);
+
+  // Listeners may start new queries: Deliver once |query| is gone.
+  const vector<Listener*> listeners = query->listeners;
+  for (size_t i = 0; i < listeners.size(); ++i) {
+    listener_queries_.erase(listeners[i]);
+  }
+  queries_.erase(query->cert_id);
+  OCSP_CERTID_free(query->id);
+  delete query;
+
+  UpdatePolling();
+
+  for (size_t i = 0; i < listeners.size(); ++i) {
+    listeners[i]->OnOCSPResult(result);
+  }
+}
+
+void OCSPClient::RemoveRequest(Request* request) {
+  if (!request->gathering_key.empty()) {
+    gathering_.erase(request->gathering_key);
+  }
+  if (request->deadline != deadlines_.end()) {
+    deadlines_.erase(request->deadline);
+  }
+  if (request->lookup) {
+    lookup_requests_.erase(request->lookup);
+    Unsubscribe(request->lookup);
+    request->lookup->Cancel();
+    DeleteChild(request->lookup);
+  }
+  if (request->fd != -1) {
+    UnwatchFD(request->fd);
+    close(request->fd);
+    fd_requests_.erase(request->fd);
+  }
+
+  for (size_t i = 0; i < request->queries.size(); ++i) {
+    request->queries[i]->request = NULL;
+  }
+  delete request;
+
+  UpdatePolling();
+}
+
+void OCSPClient::SetDeadline(Request* request, int64_t deadline_us) {
+  if (request->deadline != deadlines_.end()) {
+    deadlines_.erase(request->deadline);
+  }
+  request->deadline = deadlines_.insert(std::make_pair(deadline_us, request));
+
+  UpdatePolling();
+}
+
+void OCSPClient::UpdatePolling() {
+  // Only poll while requests are outstanding, so an idle client doesn't keep
+  // the event loop running.
+  const bool polling = !deadlines_.empty();
+  if (polling == polling_) {
+    return;
+  }
+
+  if (polling) {
+    EnablePoll();
+  } else {
+    DisablePoll();
+  }
+
+  polling_ = polling;
+}
+
+// static
+bool OCSPClient::ParseUrl(const string& url, string* host, string* port,
+    string* path) {
+  const char kScheme[] = "http://";
+  if (!StartsWithIgnoringCase(url, kScheme)) {
+    return false;
+  }
+
+  const size_t host_start = sizeof kScheme - 1;
+  size_t path_start = url.find('/', host_start);
+  if (path_start == string::npos) {
+    path_start = url.size();
+  }
+  const string authority = url.substr(host_start, path_start - host_start);
+
+  // "[IPv6]:port", or "host:port".
+  const size_t bracket = authority.rfind(']');
+  size_t colon = authority.rfind(':');
+  if (colon != string::npos && bracket != string::npos && colon < bracket) {
+    colon = string::npos;
+  }
+
+  *host = authority.substr(0, colon);
+  *port = colon == string::npos ? "80" : authority.substr(colon + 1);
+  *path = path_start < url.size() ? url.substr(path_start) : "/";
+
+  return !host->empty() && !port->empty();
+}
+
+// static
+string OCSPClient::ResponderUrl(X509* x509) {
+  string url;
+
+  STACK_OF(OPENSSL_STRING)* urls = X509_get1_ocsp(x509);
+  for (int i = 0; i < sk_OPENSSL_STRING_num(urls); ++i) {
+    const string candidate = sk_OPENSSL_STRING_value(urls, i);
+    if (StartsWithIgnoringCase(candidate, "http://")) {
+      url = candidate;
+      break;
+    }
+  }
+  X509_email_free(urls);
+
+  return url;
+}
+
+// static
+bool OCSPClient::ParseHttpResponse(const string& input, bool closed,
+    string* body, string* error_message) {
+  const size_t header_end = input.find("\r\n\r\n");
+  if (header_end == string::npos) {
+    if (closed) {
+      *error_message = "malformed HTTP response";
+    }
+    return closed;
+  }
+
+  // "HTTP/1.x 200 OK".
+  if (!StartsWithIgnoringCase(input, "HTTP/1.") || input.size() < 12 ||
+      input.compare(8, 4, " 200") != 0) {
+    const size_t line_end = input.find("\r\n");
+    *error_message = "HTTP error: " +
+      input.substr(0, std::min(line_end, static_cast<size_t>(64)));
+    return true;
+  }
+
+  bool has_length = false;
+  size_t length = 0;
+  size_t line_start = input.find("\r\n") + 2;
+  while (line_start < header_end) {
+    const size_t line_end = input.find("\r\n", line_start);
+    const string line = input.substr(line_start, line_end - line_start);
+    if (StartsWithIgnoringCase(line, "Content-Length:")) {
+      has_length = true;
+      length = strtoul(line.c_str() + strlen("Content-Length:"), NULL, 10);
+    }
+    line_start = line_end + 2;
+  }
+
+  const size_t body_start = header_end + 4;
+  const size_t available = input.size() - body_start;
+  if (has_length && available >= length) {
+    *body = input.substr(body_start, length);
+    return true;
+  } else if (!closed) {
+    return false;
+  } else if (has_length) {
+    *error_message = "truncated HTTP response";
+    return true;
+  }
+
+  *body = input.substr(body_start);
+  return true;
+}
+}  // namespace x509ls
@@ -0,0 +1,233 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_OCSP_CLIENT_H_
+#define X509LS_NET_OCSP_CLIENT_H_
+
+#include <openssl/ocsp.h>
+#include <openssl/x509.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/openssl/shared_openssl.h"
+#include "x509ls/base/types.h"
+#include "x509ls/certificate/ocsp_cache.h"
+
+using std::map;
+using std::multimap;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+class DnsLookup;
+class StubResolver;
+class TrustStore;
+// An asynchronous OCSP client: Queries the revocation status of certificates
+// from the http OCSP responders named in their Authority Information Access
+// extension, over non-blocking sockets watched by the EventManager.
+//
+// Queries are held for a few milliseconds, and those for the same responder
+// and issuer are sent together in one request of up to
+// kMaxCertificatesPerRequest certificates. Certificates a responder leaves
+// out of a multi-certificate response, or all of them if it rejects the
+// request, are retried in requests of their own.
+//
+// Results are cached until the nextUpdate of their response in an OCSPCache,
+// which may be shared with other threads' clients. Identical queries in
+// flight at once are coalesced into one.
+//
+// Responses must be signed by the issuer, or by a responder it delegated to,
+// chaining to the trust store, and be current. Requests carry no nonce, so
+// responders may answer from their own caches.
+//
+// One client serves one event loop, and so one thread.
+class OCSPClient : public BaseObject {
+ public:
+  // Construct, caching results in |cache| and verifying responses against
+  // |trust_store|. Both must outlive the client.
+  OCSPClient(BaseObject* parent, OCSPCache* cache, TrustStore* trust_store);
+  virtual ~OCSPClient();
+
+  // Resolve responder names with |stub_resolver|, see
+  // DnsLookup::SetStubResolver(). Call before Query(). |stub_resolver| must
+  // outlive the client.
+  void SetStubResolver(StubResolver* stub_resolver);
+
+  // Receives results.
+  class Listener {
+   public:
+    virtual ~Listener() {}
+
+    // The query from Query() has been answered.
+    virtual void OnOCSPResult(const OCSPResult& result) = 0;
+  };
+
+  // Query the status of |leaf|, issued by |issuer|. |untrusted| holds further
+  // certificates, such as the peer chain, to chain the response's signer to
+  // the trust store with, as for a staple.
+  //
+  // Returns true if the result is already known (from the cache, or as
+  // |leaf| names no responder), and stores it in |result|. Otherwise
+  // listener->OnOCSPResult() is called later, unless Cancel() is called
+  // first. A |listener| may only have one query outstanding.
+  bool Query(Listener* listener, X509* leaf, X509* issuer,
+      const vector<X509Handle>& untrusted, OCSPResult* result);
+
+  // Stop delivering the result to |listener|.
+  void Cancel(Listener* listener);
+
+  // Query statistics.
+  struct Statistics {
+    Statistics();
+
+    // Add the counts from |other|.
+    void Merge(const Statistics& other);
+
+    // Return a one line summary, e.g.:
+    //   "ocsp: 120 lookups, 80 cached, 10 coalesced, 6 requests for 30
+    //   certificates, 1 errors"
+    string Summary() const;
+
+    uint64_t lookup_count;
+    uint64_t cache_hit_count;
+    uint64_t coalesced_count;
+    uint64_t request_count;
+    uint64_t certificate_count;
+    uint64_t error_count;
+  };
+  const Statistics& GetStatistics() const;
+
+  // Receives responder name lookup results.
+  virtual void OnEvent(const BaseObject* source, int event_code);
+
+  // Receives responder connection events.
+  virtual void OnFDEvent(int fd, bool read_event,
+      bool write_event, bool error_event);
+
+  // Sends gathered requests, and fails timed out ones.
+  virtual void OnPoll();
+
+  // Most certificates sent in one request.
+  static const size_t kMaxCertificatesPerRequest = 16;
+
+ private:
+  NO_COPY_AND_ASSIGN(OCSPClient)
+
+  struct Request;
+
+  struct PendingQuery {
+    // DER encoded CertID, the cache key.
+    string cert_id;
+    OCSP_CERTID* id;
+
+    // Send in a request of its own.
+    bool alone;
+
+    // Certificates to chain the response's signer with.
+    vector<X509Handle> untrusted;
+
+    vector<Listener*> listeners;
+
+    // The request carrying the query.
+    Request* request;
+  };
+
+  // One HTTP POST to a responder.
+  struct Request {
+    // "http://host:port/path", and its parts.
+    string url;
+    string host;
+    string port;
+    string path;
+
+    // Issuer of every query's certificate, to find a delegated responder.
+    X509Handle issuer;
+
+    // Every query's untrusted certificates, without duplicates.
+    vector<X509Handle> untrusted;
+
+    vector<PendingQuery*> queries;
+
+    // Key in |gathering_| while gathering queries, else "".
+    string gathering_key;
+
+    // When to send the request while gathering, else when it times out.
+    multimap<int64_t, Request*>::iterator deadline;
+
+    DnsLookup* lookup;
+    int fd;
+    string output;
+    string input;
+  };
+
+  OCSPCache* const cache_;
+  TrustStore* const trust_store_;
+  StubResolver* stub_resolver_;
+
+  // Queries in flight, by CertID.
+  map<string, PendingQuery*> queries_;
+  map<Listener*, PendingQuery*> listener_queries_;
+
+  // Requests gathering queries, by responder URL and issuer digest.
+  map<string, Request*> gathering_;
+
+  // Requests sent, by lookup and by fd.
+  map<DnsLookup*, Request*> lookup_requests_;
+  map<int, Request*> fd_requests_;
+
+  // Every request, by deadline.
+  multimap<int64_t, Request*> deadlines_;
+
+  Statistics statistics_;
+
+  bool polling_;
+
+  // Add |query| to a request gathering for |url| and |issuer|, starting one
+  // if needed.
+  void Gather(PendingQuery* query, const string& url, X509* issuer);
+
+  // Send |request|: Resolve its host, then connect.
+  void Send(Request* request);
+  void Connect(Request* request);
+  void Receive(Request* request);
+
+  // Process the complete HTTP response to |request|, finishing its queries.
+  void ProcessResponse(Request* request, const string& body);
+
+  // Fail every query of |request| with |error_message|, retrying each alone
+  // if |retry_alone| and the request carried several. Removes |request|.
+  void FailRequest(Request* request, const string& error_message,
+      bool retry_alone);
+
+  // Finish |query| with |result|, caching it, and notify the listeners.
+  void Finish(PendingQuery* query, const OCSPResult& result);
+
+  // Remove |request| from the indexes, close it, and free it. Its queries are
+  // left alone.
+  void RemoveRequest(Request* request);
+
+  void SetDeadline(Request* request, int64_t deadline_us);
+
+  void UpdatePolling();
+
+  // Split "http://host[:port][/path]" into its parts. Returns false if |url|
+  // isn't an http URL.
+  static bool ParseUrl(const string& url, string* host, string* port,
+      string* path);
+
+  // Return the first http responder URL of |x509|, or "".
+  static string ResponderUrl(X509* x509);
+
+  // Parse the HTTP response |input|. Returns true once it is complete (or
+  // the connection |closed|), storing the body in |body| and any error in
+  // |error_message|.
+  static bool ParseHttpResponse(const string& input, bool closed,
+      string* body, string* error_message);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_OCSP_CLIENT_H_
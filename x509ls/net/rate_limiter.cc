@@ -0,0 +1,162 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/rate_limiter.h"
+
+#include <netinet/in.h>
+
+#include <utility>
+
+using std::make_pair;
+
+namespace x509ls {
+namespace {
+// Burst size, as the number of seconds of tokens a bucket holds.
+const double kBurstSeconds = 0.02;
+}  // namespace
+
+TokenBucket::TokenBucket(double rate, double burst, int64_t now_us)
+  :
+    rate_(rate),
+    burst_(burst),
+    tokens_(burst),
+    updated_us_(now_us) {
+}
+
+bool TokenBucket::HasToken(int64_t now_us) {
+  if (rate_ <= 0) {
+    return true;
+  }
+
+  Refill(now_us);
+
+  return tokens_ >= 1;
+}
+
+void TokenBucket::TakeToken() {
+  if (rate_ > 0) {
+    tokens_ -= 1;
+  }
+}
+
+bool TokenBucket::IsFull(int64_t now_us) const {
+  return rate_ <= 0 ||
+    tokens_ + (now_us - updated_us_) * rate_ / 1000000 >= burst_;
+}
+
+void TokenBucket::Refill(int64_t now_us) {
+  tokens_ += (now_us - updated_us_) * rate_ / 1000000;
+  if (tokens_ > burst_) {
+    tokens_ = burst_;
+  }
+  updated_us_ = now_us;
+}
+
+RateLimiter::RateLimiter(double global_rate, double subnet_rate,
+    double address_rate)
+  :
+    subnet_rate_(subnet_rate),
+    address_rate_(address_rate),
+    global_bucket_(global_rate, Burst(global_rate), 0) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+RateLimiter::~RateLimiter() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+// static
+void RateLimiter::DestinationKeys(const sockaddr* address,
+    string* address_key, string* subnet_key) {
+  if (address->sa_family == AF_INET6) {
+    const sockaddr_in6* address6 =
+      reinterpret_cast<const sockaddr_in6*>(address);
+    const char* bytes = reinterpret_cast<const char*>(&address6->sin6_addr);
+    address_key->assign(bytes, 16);
+    subnet_key->assign(bytes, 6);
+  } else {
+    const sockaddr_in* address4 = reinterpret_cast<const sockaddr_in*>(address);
+    const char* bytes = reinterpret_cast<const char*>(&address4->sin_addr);
+    address_key->assign(bytes, 4);
+    subnet_key->assign(bytes, 3);
+  }
+}
+
+bool RateLimiter::TryAcquire(const string& address_key,
+    const string& subnet_key, int64_t now_us, Limit* limit) {
+  pthread_mutex_lock(&mutex_);
+
+  TokenBucket* address_bucket =
+    FindBucket(&address_buckets_, address_key, address_rate_, now_us);
+  TokenBucket* subnet_bucket =
+    FindBucket(&subnet_buckets_, subnet_key, subnet_rate_, now_us);
+
+  if (!address_bucket->HasToken(now_us)) {
+    *limit = kLimitAddress;
+  } else if (!subnet_bucket->HasToken(now_us)) {
+    *limit = kLimitSubnet;
+  } else if (!global_bucket_.HasToken(now_us)) {
+    *limit = kLimitGlobal;
+  } else {
+    global_bucket_.TakeToken();
+    subnet_bucket->TakeToken();
+    address_bucket->TakeToken();
+    *limit = kLimitNone;
+  }
+
+  pthread_mutex_unlock(&mutex_);
+
+  return *limit == kLimitNone;
+}
+
+void RateLimiter::Purge(int64_t now_us) {
+  pthread_mutex_lock(&mutex_);
+  PurgeBuckets(&subnet_buckets_, now_us);
+  PurgeBuckets(&address_buckets_, now_us);
+  pthread_mutex_unlock(&mutex_);
+}
+
+// static
+string RateLimiter::LimitName(Limit limit) {
+  switch (limit) {
+  case kLimitGlobal:
+    return "global";
+  case kLimitSubnet:
+    return "subnet";
+  case kLimitAddress:
+    return "ip";
+  case kLimitNone:
+  default:
+    return "none";
+  }
+}
+
+// static
+double RateLimiter::Burst(double rate) {
+  const double burst = rate * kBurstSeconds;
+  return burst < 1 ? 1 : burst;
+}
+
+// static
+TokenBucket* RateLimiter::FindBucket(BucketMap* buckets, const string& key,
+    double rate, int64_t now_us) {
+  BucketMap::iterator it = buckets->find(key);
+  if (it == buckets->end()) {
+    it = buckets->insert(
+        make_pair(key, TokenBucket(rate, Burst(rate), now_us))).first;
+  }
+
+  return &(it->second);
+}
+
+// static
+void RateLimiter::PurgeBuckets(BucketMap* buckets, int64_t now_us) {
+  for (BucketMap::iterator it = buckets->begin(); it != buckets->end();) {
+    if (it->second.IsFull(now_us)) {
+      buckets->erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+}  // namespace x509ls
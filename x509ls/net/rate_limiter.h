@@ -0,0 +1,112 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_RATE_LIMITER_H_
+#define X509LS_NET_RATE_LIMITER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::map;
+using std::string;
+
+namespace x509ls {
+// A token bucket: Allows |rate| events per second on average, with bursts of
+// at most |burst| events.
+class TokenBucket {
+ public:
+  // Construct a full bucket. A |rate| of 0 means unlimited.
+  TokenBucket(double rate, double burst, int64_t now_us);
+
+  // Return true iif a token is available at |now_us|.
+  bool HasToken(int64_t now_us);
+
+  // Take a token. Call only when HasToken() returned true.
+  void TakeToken();
+
+  // Return true iif the bucket would be full at |now_us|, i.e. it has been
+  // idle long enough to be forgotten.
+  bool IsFull(int64_t now_us) const;
+
+ private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  int64_t updated_us_;
+
+  void Refill(int64_t now_us);
+};
+
+// Connection rate limits: Global, per destination subnet and per destination
+// IP address.
+//
+// Subnets are /24 for IPv4 and /48 for IPv6, approximating the address blocks
+// a single hosting site or CDN location serves from.
+//
+// Thread safe: One RateLimiter may be shared by the ConnectSchedulers of
+// several threads, so the limits apply to all their connections together.
+class RateLimiter {
+ public:
+  // The limit which stopped TryAcquire().
+  enum Limit {
+    kLimitNone,
+    kLimitGlobal,
+    kLimitSubnet,
+    kLimitAddress
+  };
+
+  // Construct, allowing |global_rate|, |subnet_rate| and |address_rate|
+  // connections per second. A rate of 0 means unlimited.
+  //
+  // Each bucket allows a burst of 20ms worth of connections (at least one),
+  // so connections to each destination are spread out evenly.
+  RateLimiter(double global_rate, double subnet_rate, double address_rate);
+  ~RateLimiter();
+
+  // Return the address and subnet keys for the destination |address|.
+  static void DestinationKeys(const sockaddr* address, string* address_key,
+      string* subnet_key);
+
+  // Take a token for a connection to |address_key| in |subnet_key| at
+  // |now_us|, from all three buckets.
+  //
+  // Returns true iif all buckets had a token. Otherwise no tokens are taken,
+  // and |limit| is set to the most specific limit reached.
+  bool TryAcquire(const string& address_key, const string& subnet_key,
+      int64_t now_us, Limit* limit);
+
+  // Forget the buckets for destinations not connected to recently.
+  void Purge(int64_t now_us);
+
+  // Return a short name for |limit|, e.g. "ip".
+  static string LimitName(Limit limit);
+
+ private:
+  NO_COPY_AND_ASSIGN(RateLimiter)
+
+  typedef map<string, TokenBucket> BucketMap;
+
+  const double subnet_rate_;
+  const double address_rate_;
+
+  // Guards the buckets.
+  pthread_mutex_t mutex_;
+
+  TokenBucket global_bucket_;
+  BucketMap subnet_buckets_;
+  BucketMap address_buckets_;
+
+  static double Burst(double rate);
+  static TokenBucket* FindBucket(BucketMap* buckets, const string& key,
+      double rate, int64_t now_us);
+  static void PurgeBuckets(BucketMap* buckets, int64_t now_us);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_RATE_LIMITER_H_
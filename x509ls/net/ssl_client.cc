@@ -4,6 +4,7 @@
 #include "x509ls/net/ssl_client.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,15 +12,15 @@
 
 #include <openssl/x509.h>
 
-#include <list>
-#include <sstream>
-
+#include "x509ls/base/clock.h"
 #include "x509ls/base/event_manager.h"
 
-using std::list;
-using std::stringstream;
-
 namespace x509ls {
+namespace {
+// Size of each io_uring receive: One maximum size TLS record.
+const size_t kReceiveLength = 16 * 1024 + 5;
+}  // namespace
+
 // static
 const struct SslClient::TlsMethod
   SslClient::methods_[] = {
@@ -62,9 +63,17 @@ SslClient::SslClient(BaseObject* parent, TrustStore* trust_store,
     state_(kStateStart),
     ssl_ctx_(NULL),
     ssl_(NULL),
-    chain_(),
-    path_(),
-    verify_level_(0) {
+    verified_chain_(trust_store),
+    recorder_(NULL),
+    early_abort_(false),
+    chain_captured_(false),
+    saved_server_signatures_(0),
+    bio_pair_(false),
+    bio_driver_(NULL),
+    uring_backend_(NULL),
+    send_in_flight_(false),
+    receive_in_flight_(false),
+    flushing_(false) {
   saddr_ = static_cast<sockaddr*>(malloc(saddr_len));
   memcpy(saddr_, saddr, saddr_len_);
 }
@@ -82,14 +91,25 @@ SslClient::~SslClient() {
   if (ssl_ctx_) {
     SSL_CTX_free(ssl_ctx_);
   }
+
+  delete bio_driver_;
+  delete recorder_;
 }
 
 void SslClient::Connect() {
   assert(fd_ == -1);
 
   SetState(kStateConnecting);
+  timing_.connect_start_us = Clock::NowMicroseconds();
 
   fd_ = socket(saddr_->sa_family, SOCK_STREAM, 0);
+
+  if (uring_backend_) {
+    // The socket stays blocking: io_uring waits for readiness itself.
+    uring_backend_->Connect(this, fd_, saddr_, saddr_len_);
+    return;
+  }
+
   fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
 
   WatchFD(fd_, EventManager::kFDWritable);
@@ -99,6 +119,7 @@ void SslClient::Connect() {
     SetState(kStateConnectFail);
     UnwatchFD(fd_);
   } else if (result == 0) {
+    timing_.connect_end_us = Clock::NowMicroseconds();
     SetState(kStateConnected);
     if (!SetupOpenSSL()) {
       CloseConnectionWithState(kStateTlsFail);
@@ -125,6 +146,7 @@ void SslClient::OnFDEvent(int fd, bool read_event,
     if (success != 0 || result_len != 1 || result != 0) {
       CloseConnectionWithState(kStateConnectFail);
     } else {
+      timing_.connect_end_us = Clock::NowMicroseconds();
       SetState(kStateConnected);
       if (!SetupOpenSSL()) {
         CloseConnectionWithState(kStateTlsFail);
@@ -139,7 +161,61 @@ void SslClient::OnFDEvent(int fd, bool read_event,
   RunOpenSSL(read_event, write_event);
 }
 
+// virtual
+void SslClient::OnUringCompletion(int fd, Operation operation, int result,
+    const unsigned char* data) {
+  switch (operation) {
+  case kOperationConnect:
+    if (result < 0) {
+      CloseConnectionWithState(kStateConnectFail);
+      return;
+    }
+
+    timing_.connect_end_us = Clock::NowMicroseconds();
+    SetState(kStateConnected);
+    if (!SetupOpenSSL()) {
+      CloseConnectionWithState(kStateTlsFail);
+      return;
+    }
+    RunOpenSSL(false, true);
+    break;
+  case kOperationSend:
+    send_in_flight_ = false;
+    if (result < 0) {
+      CloseConnectionWithState(chain_captured_ || flushing_ ? kStateSuccess :
+          kStateTlsFail);
+      return;
+    }
+
+    bio_driver_->OutputSent(result);
+    if (flushing_) {
+      FinishHandshake();
+      return;
+    }
+
+    // OpenSSL may be waiting for room to write more.
+    RunOpenSSL(false, true);
+    break;
+  case kOperationReceive:
+    receive_in_flight_ = false;
+    if (flushing_) {
+      // The handshake is complete: Only the final send matters.
+      return;
+    }
+    if (result > 0) {
+      // Receives never exceed the pair's free space.
+      bio_driver_->Feed(data, result);
+    } else {
+      bio_driver_->SetEndOfInput();
+    }
+    RunOpenSSL(true, false);
+    break;
+  }
+}
+
 bool SslClient::SetupOpenSSL() {
+  timing_.handshake_start_us = Clock::NowMicroseconds();
+
   ssl_ctx_ = SSL_CTX_new(
       const_cast<SSL_METHOD*>(methods_[tls_method_index_].method));
   if (ssl_ctx_ == NULL) {
@@ -151,14 +227,32 @@ bool SslClient::SetupOpenSSL() {
 
   SSL_CTX_set_options(ssl_ctx_, SSL_OP_NO_COMPRESSION);
 
-  SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_NONE, VerifyProcedure);
+  if (early_abort_) {
+    // OpenSSL only acts on a failed verification with SSL_VERIFY_PEER.
+    SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_PEER, VerifyProcedure);
+    SSL_CTX_set_cert_verify_callback(ssl_ctx_, CaptureChainProcedure, this);
+  } else {
+    SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_NONE, VerifyProcedure);
+  }
+
+  if (recorder_) {
+    recorder_->Attach(ssl_ctx_, timing_.connect_start_us);
+    recorder_->SetConnectEnd(timing_.connect_end_us);
+  }
 
   ssl_ = SSL_new(ssl_ctx_);
   if (!ssl_) {
     goto err1;
   }
 
-  if (SSL_set_fd(ssl_, fd_) != 1) {
+  if (bio_pair_ || uring_backend_) {
+    bio_driver_ = new TlsBioDriver();
+    if (!bio_driver_->Attach(ssl_)) {
+      delete bio_driver_;
+      bio_driver_ = NULL;
+      goto err2;
+    }
+  } else if (SSL_set_fd(ssl_, fd_) != 1) {
     goto err2;
   }
 
@@ -168,6 +262,12 @@ bool SslClient::SetupOpenSSL() {
   }
 #endif
 
+#ifdef SSL_set_tlsext_status_type
+  // Ask the server to staple an OCSP response for its certificate, to check
+  // revocation without querying the responder.
+  SSL_set_tlsext_status_type(ssl_, TLSEXT_STATUSTYPE_ocsp);
+#endif
+
   return true;
 
  err2:
@@ -182,10 +282,14 @@ bool SslClient::SetupOpenSSL() {
 }
 
 void SslClient::RunOpenSSL(bool can_read, bool can_write) {
+  if (bio_driver_ && !uring_backend_ && can_read) {
+    ReceiveBuffered();
+  }
+
   int result = SSL_connect(ssl_);
   if (result == 1) {
-    PopulateChainAndPath();
-    CloseConnectionWithState(kStateSuccess);
+    VerifyChain(SSL_get_peer_cert_chain(ssl_));
+    FinishHandshake();
     return;
   }
 
@@ -196,7 +300,10 @@ void SslClient::RunOpenSSL(bool can_read, bool can_write) {
   } else if (result == -1) {
     int error = SSL_get_error(ssl_, result);
 
-    if (error == SSL_ERROR_WANT_READ) {
+    if (bio_driver_ && (error == SSL_ERROR_WANT_READ ||
+          error == SSL_ERROR_WANT_WRITE)) {
+      fatal_error = !TransferBuffered();
+    } else if (error == SSL_ERROR_WANT_READ) {
       WatchFD(fd_, EventManager::kFDReadable);
     } else if (error == SSL_ERROR_WANT_WRITE) {
       WatchFD(fd_, EventManager::kFDWritable);
@@ -206,8 +313,59 @@ void SslClient::RunOpenSSL(bool can_read, bool can_write) {
   }
 
   if (fatal_error) {
-    CloseConnectionWithState(kStateTlsFail);
+    CloseConnectionWithState(chain_captured_ ? kStateSuccess : kStateTlsFail);
+  }
+}
+
+void SslClient::FinishHandshake() {
+  if (bio_driver_ == NULL || !bio_driver_->HasOutput()) {
+    CloseConnectionWithState(kStateSuccess);
+    return;
   }
+
+  if (uring_backend_) {
+    // Close once the send completes: Closing cancels it.
+    flushing_ = true;
+    if (!send_in_flight_) {
+      const unsigned char* output;
+      const size_t output_length = bio_driver_->OutputBuffer(&output);
+      uring_backend_->Send(this, fd_, output, output_length);
+      send_in_flight_ = true;
+    }
+    return;
+  }
+
+  // The output is a single small flight, which an idle socket's send buffer
+  // takes without blocking.
+  SendBuffered();
+  CloseConnectionWithState(kStateSuccess);
+}
+
+void SslClient::VerifyChain(STACK_OF(X509)* peer_chain) {
+  timing_.handshake_end_us = Clock::NowMicroseconds();
+  timing_.verify_start_us = timing_.handshake_end_us;
+
+#ifdef SSL_set_tlsext_status_type
+  // The staple follows the Certificate message, except in TLSv1.3 where it
+  // is part of it: An early abort leaves it unchecked.
+  bool has_staple_arrived = !early_abort_;
+#ifdef TLS1_3_VERSION
+  if (SSL_version(ssl_) >= TLS1_3_VERSION) {
+    has_staple_arrived = true;
+  }
+#endif
+  if (has_staple_arrived) {
+    const unsigned char* staple;
+    const long staple_length =  // NOLINT(runtime/int)
+      SSL_get_tlsext_status_ocsp_resp(ssl_, &staple);
+    verified_chain_.SetStapledResponse(staple,
+        staple_length > 0 && staple != NULL ? staple_length : 0);
+  }
+#endif
+
+  verified_chain_.PopulateChainAndPath(peer_chain);
+
+  timing_.verify_end_us = Clock::NowMicroseconds();
 }
 
 // static
@@ -249,144 +407,235 @@ void SslClient::CloseConnectionWithState(State state) {
 }
 
 void SslClient::CloseConnection() {
-  assert(fd_ != -1);
-
-  UnwatchFD(fd_);
-  close(fd_);
-}
-
-// static
-int SslClient::VerifyProcedure(int ok, X509_STORE_CTX* ctx) {
-  return ok;
-}
-
-void SslClient::PopulateChainAndPath() {
-  STACK_OF(X509)* peer_chain = SSL_get_peer_cert_chain(ssl_);
-  if (peer_chain == NULL || sk_X509_num(peer_chain) < 1) {
+  if (fd_ == -1) {
     return;
   }
 
-  list<X509*> verification_path;
+  if (uring_backend_) {
+    uring_backend_->Close(this, fd_);
+  } else {
+    UnwatchFD(fd_);
+    close(fd_);
+  }
+  fd_ = -1;
+}
 
-  // Reverify the peer chain to gain access to the verification chain.
-  X509* cert = sk_X509_value(peer_chain, 0);
+bool SslClient::TransferBuffered() {
+  if (uring_backend_) {
+    // One send at a time, to keep the output in order.
+    const unsigned char* output;
+    const size_t output_length = bio_driver_->OutputBuffer(&output);
+    if (!send_in_flight_ && output_length > 0) {
+      uring_backend_->Send(this, fd_, output, output_length);
+      send_in_flight_ = true;
+    }
 
-  X509_STORE_CTX ctx;
-  X509_STORE_CTX_init(&ctx, trust_store_->Store(), cert, peer_chain);
+    const size_t space = bio_driver_->InputSpace();
+    if (!receive_in_flight_ && space > 0) {
+      uring_backend_->Receive(this, fd_,
+          space < kReceiveLength ? space : kReceiveLength);
+      receive_in_flight_ = true;
+    }
 
-  int result = X509_verify_cert(&ctx);
-  if (result >= 0) {
-    for (int i = sk_X509_num(ctx.chain) - 1; i >= 0; --i) {
-      X509* x509 = sk_X509_value(ctx.chain, i);
-      verification_path.push_back(x509);
+    return true;
+  }
 
-      path_.Add(*x509,
-          IsX509InTrustStore(x509),
-          IsX509InPeerChain(x509),
-          true);
-    }
+  if (!SendBuffered()) {
+    return false;
   }
 
-  // Populate peer chain.
-  for (int i = 0; i < sk_X509_num(peer_chain); ++i) {
-    X509* x509 = sk_X509_value(peer_chain, i);
+  WatchFD(fd_, bio_driver_->HasOutput() ?
+      EventManager::kFDReadable | EventManager::kFDWritable :
+      EventManager::kFDReadable);
+
+  return true;
+}
 
-    bool in_verification_path = false;
-    for (list<X509*>::const_iterator it = verification_path.begin();
-        it != verification_path.end();
-        ++it) {
-      if (X509_cmp(x509, *it) == 0) {
-        in_verification_path = true;
+void SslClient::ReceiveBuffered() {
+  unsigned char* buffer;
+  size_t space;
+  while ((space = bio_driver_->InputBuffer(&buffer)) > 0) {
+    const ssize_t received = recv(fd_, buffer, space, 0);
+    if (received > 0) {
+      bio_driver_->InputWritten(received);
+      // A short read means the socket is drained: Save a system call.
+      if (static_cast<size_t>(received) < space) {
         break;
       }
+    } else if (received == -1 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    } else {
+      // Closed or failed: OpenSSL reports the error.
+      bio_driver_->SetEndOfInput();
+      break;
     }
+  }
+}
 
-    chain_.Add(*x509,
-        IsX509InTrustStore(x509),
-        true,
-        in_verification_path);
+bool SslClient::SendBuffered() {
+  const unsigned char* output;
+  size_t length;
+  while ((length = bio_driver_->OutputBuffer(&output)) > 0) {
+    const ssize_t sent = send(fd_, output, length, MSG_NOSIGNAL);
+    if (sent == -1) {
+      return errno == EAGAIN || errno == EINTR;
+    }
+    bio_driver_->OutputSent(sent);
   }
 
-  verify_level_ = path_.Size() - X509_STORE_CTX_get_error_depth(&ctx);
+  return true;
+}
 
-  const int verify_error = X509_STORE_CTX_get_error(&ctx);
+// static
+int SslClient::VerifyProcedure(int ok, X509_STORE_CTX* ctx) {
+  return ok;
+}
 
-  stringstream verify_status;
-  if (verify_error != X509_V_OK) {
-    verify_status << "Certificate ";
-    verify_status << verify_level_;
-    verify_status << ": ";
-  }
+// static
+int SslClient::CaptureChainProcedure(X509_STORE_CTX* ctx, void* arg) {
+  SslClient* ssl_client = static_cast<SslClient*>(arg);
 
-  verify_status << X509_verify_cert_error_string(
-      X509_STORE_CTX_get_error(&ctx));
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  STACK_OF(X509)* peer_chain = X509_STORE_CTX_get0_untrusted(ctx);
+#else
+  STACK_OF(X509)* peer_chain = ctx->untrusted;
+#endif
 
-  verify_status_ = verify_status.str();
+  ssl_client->VerifyChain(peer_chain);
+  ssl_client->chain_captured_ = true;
+
+  // The server has already signed its key exchange parameters if it sends a
+  // ServerKeyExchange (ephemeral (EC)DH), or a CertificateVerify (TLSv1.3).
+  // Otherwise its private key is only used after our ClientKeyExchange.
+  // The negotiated cipher only becomes current after the handshake: Use the
+  // pending cipher, or before OpenSSL v1.1.1 the session's, which is set from
+  // the ServerHello. If it is unknown, assume nothing was saved.
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  const SSL_CIPHER* cipher = SSL_get_pending_cipher(ssl_client->ssl_);
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+  const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl_client->ssl_);
+#else
+  const SSL_CIPHER* cipher = ssl_client->ssl_->s3->tmp.new_cipher;
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  const int kx_nid = cipher ? SSL_CIPHER_get_kx_nid(cipher) : NID_undef;
+  bool server_has_signed = kx_nid == NID_undef || kx_nid == NID_kx_ecdhe ||
+    kx_nid == NID_kx_dhe || kx_nid == NID_kx_any;
+#else
+  const char* cipher_name = cipher ? SSL_CIPHER_get_name(cipher) : NULL;
+  bool server_has_signed = cipher_name == NULL ||
+    strstr(cipher_name, "DHE-") != NULL ||
+    strstr(cipher_name, "EDH-") != NULL;
+#endif
+#ifdef TLS1_3_VERSION
+  if (SSL_version(ssl_client->ssl_) >= TLS1_3_VERSION) {
+    server_has_signed = true;
+  }
+#endif
+  ssl_client->saved_server_signatures_ = server_has_signed ? 0 : 1;
 
-  X509_STORE_CTX_cleanup(&ctx);
+  // Fail verification, aborting the handshake.
+  return 0;
 }
 
 const CertificateList& SslClient::Chain() const {
-  return chain_;
+  return verified_chain_.Chain();
 }
 
 const CertificateList& SslClient::Path() const {
-  return path_;
+  return verified_chain_.Path();
 }
 
-#ifdef X509LS_OLD_OPENSSL_NO_TRUST_STORE_LOOKUP
-bool SslClient::IsX509InTrustStore(const X509* x509) const {
-  return false;
+const VerifiedChain& SslClient::Verification() const {
+  return verified_chain_;
+}
+
+VerifiedChain* SslClient::MutableVerification() {
+  return &verified_chain_;
+}
+
+void SslClient::SetSNIHostname(const string& hostname) {
+  sni_name_ = hostname;
 }
-#else
-bool SslClient::IsX509InTrustStore(const X509* x509) const {
-  X509_STORE_CTX ctx;
-  X509_STORE_CTX_init(&ctx, trust_store_->Store(), NULL, NULL);
 
-  STACK_OF(X509)* candidates = X509_STORE_get1_certs(&ctx,
-      X509_get_subject_name(const_cast<X509*>(x509)));
+string SslClient::VerifyStatus() const {
+  return verified_chain_.VerifyStatus();
+}
 
-  bool is_in_trust_store = false;
+int SslClient::VerifyLevel() const {
+  return verified_chain_.VerifyLevel();
+}
 
-  if (candidates != NULL) {
-    for (int i = 0; i < sk_X509_num(candidates); ++i) {
-      if (X509_cmp(x509, sk_X509_value(candidates, i)) == 0) {
-        is_in_trust_store = true;
-        break;
-      }
-    }
-  }
+void SslClient::SetEarlyAbort(bool early_abort) {
+  early_abort_ = early_abort;
+}
 
-  X509_STORE_CTX_cleanup(&ctx);
+void SslClient::SetBioPair(bool bio_pair) {
+  bio_pair_ = bio_pair;
+}
 
-  return is_in_trust_store;
+void SslClient::SetUringBackend(UringBackend* uring_backend) {
+  uring_backend_ = uring_backend;
 }
-#endif
 
-bool SslClient::IsX509InPeerChain(const X509* x509) const {
-  STACK_OF(X509)* peer_chain = SSL_get_peer_cert_chain(ssl_);
+void SslClient::SetRecordHandshake(bool record_handshake) {
+  if (record_handshake && recorder_ == NULL) {
+    recorder_ = new HandshakeRecorder();
+  } else if (!record_handshake) {
+    delete recorder_;
+    recorder_ = NULL;
+  }
+}
 
-  if (peer_chain != NULL) {
-    for (int i = 0; i < sk_X509_num(peer_chain); ++i) {
-      if (X509_cmp(x509, sk_X509_value(peer_chain, i)) == 0) {
-        return true;
-      }
-    }
+const HandshakeRecorder* SslClient::Recorder() const {
+  return recorder_;
+}
+
+uint64_t SslClient::BytesReceived() const {
+  if (bio_driver_) {
+    return bio_driver_->BytesReceived();
+  } else if (ssl_) {
+    return BIO_number_read(SSL_get_rbio(ssl_));
   }
 
-  return false;
+  return 0;
 }
 
-void SslClient::SetSNIHostname(const string& hostname) {
-  sni_name_ = hostname;
+uint64_t SslClient::BytesSent() const {
+  if (bio_driver_) {
+    return bio_driver_->BytesSent();
+  } else if (ssl_) {
+    return BIO_number_written(SSL_get_wbio(ssl_));
+  }
+
+  return 0;
 }
 
-string SslClient::VerifyStatus() const {
-  return verify_status_;
+const FetchTiming& SslClient::Timing() const {
+  return timing_;
 }
 
-int SslClient::VerifyLevel() const {
-  return verify_level_;
+bool SslClient::WasAbortedEarly() const {
+  return chain_captured_;
+}
+
+int SslClient::SavedMilliseconds() const {
+  if (!chain_captured_) {
+    return 0;
+  }
+
+#ifdef TLS1_3_VERSION
+  if (SSL_version(ssl_) >= TLS1_3_VERSION) {
+    return 0;
+  }
+#endif
+
+  return Clock::ElapsedMilliseconds(timing_.connect_start_us,
+      timing_.connect_end_us);
+}
+
+int SslClient::SavedServerSignatures() const {
+  return chain_captured_ ? saved_server_signatures_ : 0;
 }
 }  // namespace x509ls
 
@@ -6,6 +6,7 @@
 
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -17,6 +18,11 @@
 #include "x509ls/base/types.h"
 #include "x509ls/certificate/certificate_list.h"
 #include "x509ls/certificate/trust_store.h"
+#include "x509ls/certificate/verified_chain.h"
+#include "x509ls/net/fetch_timing.h"
+#include "x509ls/net/handshake_recorder.h"
+#include "x509ls/net/tls_bio_driver.h"
+#include "x509ls/net/uring_backend.h"
 
 using std::string;
 
@@ -26,10 +32,18 @@ namespace x509ls {
 //
 //
 // - SetSNIHostname() allows SNI to be used.
+// - A stapled OCSP response is requested (status_request), and validated with
+// the chain, see VerifiedChain::Staple(). Not in early abort mode before
+// TLSv1.3, where the staple would arrive after the abort.
+// - SetEarlyAbort() stops the handshake as soon as the server's Certificate
+// message has been received, see below.
+// - SetBioPair() runs OpenSSL over a BIO pair, with SslClient performing the
+// socket I/O itself, see below.
+// - SetUringBackend() performs the socket I/O through an io_uring, see below.
 // - Compression (i.e. DEFLATE) is disabled: Not specifically because of the
 // security risk in doing so (the CRIME attack...), rather that connections to
 // google.com, EC-only currently do not succeed with compression enabled.
-class SslClient : public BaseObject {
+class SslClient : public BaseObject, public UringBackend::Client {
  public:
   // Construct an SslClient with |parent|, to connect to |saddr| (with length
   // |saddr_len| using TLS method |tls_method_index| and auth type (RSA/EC...)
@@ -49,6 +63,71 @@ class SslClient : public BaseObject {
   // is required.
   void SetSNIHostname(const string& hostname);
 
+  // Enable or disable early abort mode.
+  //
+  // Call before Start().
+  //
+  // Only the server's certificates are needed, so in early abort mode the
+  // handshake is torn down as soon as the Certificate message arrives: The
+  // chain is captured by the certificate verification callback, which then
+  // fails the handshake. This saves the final handshake round trip, and for
+  // non-ephemeral key exchanges the server's private key operation. The
+  // connection still ends in kStateSuccess.
+  void SetEarlyAbort(bool early_abort);
+
+  // In the kStateSuccess state, after an early abort:
+  // Return true iif the handshake was aborted early.
+  bool WasAbortedEarly() const;
+
+  // Return the estimated number of milliseconds saved, i.e. one round trip as
+  // measured by the TCP connection setup time. 0 for TLSv1.3, where the
+  // server's Certificate arrives in its last flight, so no round trip is
+  // saved.
+  int SavedMilliseconds() const;
+
+  // Return the number of server private key operations (signatures or RSA
+  // decryptions) saved. 0 for ephemeral key exchanges, where the server signs
+  // its key exchange parameters before sending the Certificate message.
+  int SavedServerSignatures() const;
+
+  // Enable or disable running OpenSSL over a BIO pair (a TlsBioDriver).
+  //
+  // Call before Start().
+  //
+  // By default OpenSSL reads and writes the socket itself, with a read
+  // system call for each record header and body. Over a BIO pair, all data
+  // available is read into the pair's buffer at once, OpenSSL's output is
+  // sent once per handshake step, and the socket is only watched for
+  // writability while output is pending.
+  void SetBioPair(bool bio_pair);
+
+  // Perform the connect and socket I/O through |uring_backend|, which must
+  // outlive the SslClient. Implies SetBioPair(true).
+  //
+  // Call before Start().
+  //
+  // OpenSSL's output is sent, and a receive queued, through the backend once
+  // per handshake step, instead of watching the socket for readiness.
+  void SetUringBackend(UringBackend* uring_backend);
+
+  // Enable or disable recording the handshake's TLS messages, see
+  // HandshakeRecorder.
+  //
+  // Call before Start().
+  void SetRecordHandshake(bool record_handshake);
+
+  // Return the recorded handshake messages so far, or NULL if recording is
+  // disabled.
+  const HandshakeRecorder* Recorder() const;
+
+  // Return the number of bytes received from / sent to the server so far.
+  uint64_t BytesReceived() const;
+  uint64_t BytesSent() const;
+
+  // Return when the connect, handshake and verify phases started and ended.
+  // The resolve phase is left unset.
+  const FetchTiming& Timing() const;
+
   // Start the network connection.
   //
   // Call only once.
@@ -78,6 +157,10 @@ class SslClient : public BaseObject {
   virtual void OnFDEvent(int fd, bool read_event,
       bool write_event, bool error_event);
 
+  // Receives io_uring completions.
+  virtual void OnUringCompletion(int fd, Operation operation, int result,
+      const unsigned char* data);
+
   struct TlsMethod {
     const SSL_METHOD* method;
     const string name;
@@ -106,6 +189,12 @@ class SslClient : public BaseObject {
   // applies.
   int VerifyLevel() const;
 
+  // Return the chain, path and validation status together.
+  const VerifiedChain& Verification() const;
+
+  // Return Verification(), to apply an OCSP responder result to.
+  VerifiedChain* MutableVerification();
+
  private:
   NO_COPY_AND_ASSIGN(SslClient)
 
@@ -137,15 +226,50 @@ class SslClient : public BaseObject {
 
   static int VerifyProcedure(int ok, X509_STORE_CTX* ctx);
 
-  CertificateList chain_;
-  CertificateList path_;
-  string verify_status_;
-  int verify_level_;
+  VerifiedChain verified_chain_;
+
+  FetchTiming timing_;
+
+  // The handshake recorder, or NULL if recording is disabled.
+  HandshakeRecorder* recorder_;
+
+  // End the handshake phase, and verify |peer_chain| into
+  // |verified_chain_|, timing both.
+  void VerifyChain(STACK_OF(X509)* peer_chain);
+
+  // Early abort mode.
+  bool early_abort_;
+  bool chain_captured_;
+  int saved_server_signatures_;
+
+  // Certificate verification callback used in early abort mode. Populates
+  // the chain, then returns 0 to abort the handshake.
+  static int CaptureChainProcedure(X509_STORE_CTX* ctx, void* arg);
+
+  // BIO pair mode.
+  bool bio_pair_;
+  TlsBioDriver* bio_driver_;
+
+  // Move data between the BIO pair and the transport, returning false on a
+  // transport error.
+  bool TransferBuffered();
+
+  // Read the socket until it or the BIO pair runs dry.
+  void ReceiveBuffered();
+
+  // Send pending output until done or the socket would block.
+  bool SendBuffered();
 
-  void PopulateChainAndPath();
+  // The handshake succeeded: Send what OpenSSL left in the BIO pair (e.g.
+  // the TLSv1.3 client Finished), then close with kStateSuccess.
+  void FinishHandshake();
 
-  bool IsX509InTrustStore(const X509* x509) const;
-  bool IsX509InPeerChain(const X509* x509) const;
+  // io_uring mode.
+  UringBackend* uring_backend_;
+  bool send_in_flight_;
+  bool receive_in_flight_;
+  // Sending the last of the output before closing.
+  bool flushing_;
 
   string sni_name_;
 };
@@ -0,0 +1,1076 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/stub_resolver.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+#include "x509ls/base/clock.h"
+#include "x509ls/base/event_manager.h"
+
+using std::min;
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// resolv.conf(5) defaults.
+const int kDefaultTimeoutSeconds = 5;
+const int kDefaultAttempts = 2;
+const uint16_t kDnsPort = 53;
+
+// Message constants.
+const size_t kHeaderLength = 12;
+const uint16_t kFlagResponse = 0x8000;
+const uint16_t kFlagTruncated = 0x0200;
+const uint16_t kFlagRecursionDesired = 0x0100;
+const uint16_t kRcodeNoError = 0;
+const uint16_t kRcodeNameError = 3;
+const uint16_t kClassIN = 1;
+const uint16_t kTypeCNAME = 5;
+const uint16_t kTypeSOA = 6;
+const uint16_t kTypeOPT = 41;
+
+// EDNS0 UDP payload size: Avoids IP fragmentation on any path.
+const uint16_t kUdpPayloadSize = 1232;
+const size_t kMaxMessageLength = 65535;
+
+const int kMaxCnameDepth = 8;
+
+// UDP sockets are bound to random ports from kMinUdpPort up, trying
+// kMaxBindAttempts before leaving the choice to the kernel.
+const int kMinUdpPort = 1024;
+const int kMaxBindAttempts = 8;
+
+// TTL limits, in seconds.
+const uint32_t kMaxTtl = 24 * 60 * 60;
+const uint32_t kDefaultNegativeTtl = 60;
+const uint32_t kMaxNegativeTtl = 5 * 60;
+
+const int64_t kMicrosecondsPerSecond = 1000 * 1000;
+
+uint16_t ReadUint16(const unsigned char* data) {
+  return (data[0] << 8) | data[1];
+}
+
+uint32_t ReadUint32(const unsigned char* data) {
+  return (static_cast<uint32_t>(data[0]) << 24) |
+    (static_cast<uint32_t>(data[1]) << 16) |
+    (static_cast<uint32_t>(data[2]) << 8) |
+    data[3];
+}
+
+void AppendUint16(string* data, uint16_t value) {
+  data->push_back(static_cast<char>(value >> 8));
+  data->push_back(static_cast<char>(value & 0xff));
+}
+
+// Read the (possibly compressed) name at |*offset| in |message| into |name|,
+// in lower case. Advances |*offset| past the name. Returns false if the name
+// is malformed.
+bool ReadName(const unsigned char* message, size_t length, size_t* offset,
+    string* name) {
+  // Bound the compression pointers followed, so loops terminate.
+  const int kMaxPointers = 64;
+
+  name->clear();
+  size_t position = *offset;
+  int pointer_count = 0;
+  bool followed_pointer = false;
+
+  for (;;) {
+    if (position >= length) {
+      return false;
+    }
+
+    const unsigned char label_length = message[position];
+    if ((label_length & 0xc0) == 0xc0) {
+      if (position + 1 >= length || ++pointer_count > kMaxPointers) {
+        return false;
+      }
+      if (!followed_pointer) {
+        *offset = position + 2;
+        followed_pointer = true;
+      }
+      position = ((label_length & 0x3f) << 8) | message[position + 1];
+      continue;
+    } else if ((label_length & 0xc0) != 0) {
+      return false;
+    }
+
+    ++position;
+    if (label_length == 0) {
+      break;
+    } else if (position + label_length > length) {
+      return false;
+    }
+
+    if (!name->empty()) {
+      name->push_back('.');
+    }
+    for (size_t i = 0; i < label_length; ++i) {
+      name->push_back(tolower(message[position + i]));
+    }
+    position += label_length;
+
+    if (name->size() > 255) {
+      return false;
+    }
+  }
+
+  if (!followed_pointer) {
+    *offset = position;
+  }
+
+  return true;
+}
+
+// A resource record's fixed fields.
+struct Record {
+  string owner;
+  uint16_t type;
+  uint16_t record_class;
+  uint32_t ttl;
+  size_t data_offset;
+  size_t data_length;
+};
+
+// Read the record at |*offset|, advancing |*offset| past it.
+bool ReadRecord(const unsigned char* message, size_t length, size_t* offset,
+    Record* record) {
+  if (!ReadName(message, length, offset, &record->owner) ||
+      *offset + 10 > length) {
+    return false;
+  }
+
+  const unsigned char* fields = message + *offset;
+  record->type = ReadUint16(fields);
+  record->record_class = ReadUint16(fields + 2);
+  record->ttl = ReadUint32(fields + 4) & 0x7fffffff;
+  record->data_length = ReadUint16(fields + 8);
+  record->data_offset = *offset + 10;
+
+  if (record->data_offset + record->data_length > length) {
+    return false;
+  }
+
+  *offset = record->data_offset + record->data_length;
+
+  return true;
+}
+
+// Store |name| in lower case, without any trailing dot, in |normalized|.
+// Returns false if |name| isn't a valid DNS name.
+bool NormalizeName(const string& name, string* normalized) {
+  normalized->clear();
+  size_t label_length = 0;
+
+  for (size_t i = 0; i < name.size(); ++i) {
+    const char c = name[i];
+    if (c == '.') {
+      if (label_length == 0) {
+        // Only a final, trailing dot may follow an empty label.
+        return i == name.size() - 1 && i > 0;
+      }
+      label_length = 0;
+    } else if (++label_length > 63) {
+      return false;
+    }
+
+    if (c != '.' || i != name.size() - 1) {
+      normalized->push_back(tolower(c));
+    }
+  }
+
+  return !normalized->empty() && normalized->size() <= 253;
+}
+
+// Parse "address", "address:port" or "[address]:port" into |address|.
+bool ParseNameserver(const string& text, sockaddr_storage* address,
+    socklen_t* address_length) {
+  string host = text;
+  uint16_t port = kDnsPort;
+
+  const size_t colon = text.rfind(':');
+  if (!text.empty() && text[0] == '[') {
+    const size_t bracket = text.find(']');
+    if (bracket == string::npos) {
+      return false;
+    }
+    host = text.substr(1, bracket - 1);
+    if (bracket + 1 < text.size()) {
+      if (text[bracket + 1] != ':') {
+        return false;
+      }
+      port = atoi(text.c_str() + bracket + 2);
+    }
+  } else if (colon != string::npos && text.find(':') == colon) {
+    // One colon: IPv4 address and port. More: A bare IPv6 address.
+    host = text.substr(0, colon);
+    port = atoi(text.c_str() + colon + 1);
+  }
+
+  // Drop any IPv6 zone index.
+  const size_t percent = host.find('%');
+  if (percent != string::npos) {
+    host.erase(percent);
+  }
+
+  if (port == 0) {
+    return false;
+  }
+
+  memset(address, 0, sizeof *address);
+  sockaddr_in* ipv4 = reinterpret_cast<sockaddr_in*>(address);
+  sockaddr_in6* ipv6 = reinterpret_cast<sockaddr_in6*>(address);
+  if (inet_pton(AF_INET, host.c_str(), &ipv4->sin_addr) == 1) {
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_port = htons(port);
+    *address_length = sizeof *ipv4;
+  } else if (inet_pton(AF_INET6, host.c_str(), &ipv6->sin6_addr) == 1) {
+    ipv6->sin6_family = AF_INET6;
+    ipv6->sin6_port = htons(port);
+    *address_length = sizeof *ipv6;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+}  // namespace
+
+// static
+const uint16_t StubResolver::kTypeA;
+// static
+const uint16_t StubResolver::kTypeAAAA;
+
+StubResolver::Statistics::Statistics()
+  :
+    lookup_count(0),
+    cache_hit_count(0),
+    coalesced_count(0),
+    query_count(0),
+    tcp_count(0),
+    timeout_count(0) {
+}
+
+void StubResolver::Statistics::Merge(const Statistics& other) {
+  lookup_count += other.lookup_count;
+  cache_hit_count += other.cache_hit_count;
+  coalesced_count += other.coalesced_count;
+  query_count += other.query_count;
+  tcp_count += other.tcp_count;
+  timeout_count += other.timeout_count;
+}
+
+string StubResolver::Statistics::Summary() const {
+  stringstream summary;
+  summary << "dns: " << lookup_count << " lookups, ";
+  summary << cache_hit_count << " cached, ";
+  summary << coalesced_count << " coalesced, ";
+  summary << query_count << " queries (" << tcp_count << " over TCP, ";
+  summary << timeout_count << " timeouts)";
+
+  return summary.str();
+}
+
+StubResolver::StubResolver(BaseObject* parent, DnsCache* cache)
+  :
+    BaseObject(parent),
+    cache_(cache),
+    timeout_seconds_(kDefaultTimeoutSeconds),
+    attempts_(kDefaultAttempts),
+    random_state_(0),
+    polling_(false) {
+  // Unpredictable query IDs and ports make forged answers harder.
+  FILE* urandom = fopen("/dev/urandom", "rb");
+  if (urandom) {
+    if (fread(&random_state_, sizeof random_state_, 1, urandom) != 1) {
+      random_state_ = 0;
+    }
+    fclose(urandom);
+  }
+  random_state_ ^= static_cast<uint64_t>(time(NULL)) ^
+    reinterpret_cast<uintptr_t>(this) ^ Clock::NowMicroseconds();
+  if (random_state_ == 0) {
+    random_state_ = 1;
+  }
+}
+
+// virtual
+StubResolver::~StubResolver() {
+  for (map<string, Query*>::iterator it = queries_.begin();
+      it != queries_.end();
+      ++it) {
+    CloseTcp(it->second);
+    delete it->second;
+  }
+
+  for (map<int, UdpSocket>::const_iterator it = udp_sockets_.begin();
+      it != udp_sockets_.end();
+      ++it) {
+    UnwatchFD(it->first);
+    close(it->first);
+  }
+}
+
+bool StubResolver::Configure(const string& resolv_conf,
+    string* error_message) {
+  nameservers_.clear();
+
+  FILE* file = fopen(resolv_conf.c_str(), "r");
+  if (!file) {
+    *error_message = "Unable to open " + resolv_conf + ": ";
+    error_message->append(strerror(errno));
+  }
+
+  char line[1024];
+  while (file && fgets(line, sizeof line, file)) {
+    stringstream words(line);
+    string keyword;
+    words >> keyword;
+
+    if (keyword == "nameserver") {
+      string address;
+      words >> address;
+      Nameserver nameserver;
+      if (ParseNameserver(address, &nameserver.address,
+            &nameserver.address_length)) {
+        nameservers_.push_back(nameserver);
+      }
+    } else if (keyword == "options") {
+      string option;
+      while (words >> option) {
+        if (option.compare(0, 8, "timeout:") == 0) {
+          timeout_seconds_ = std::max(1, atoi(option.c_str() + 8));
+        } else if (option.compare(0, 9, "attempts:") == 0) {
+          attempts_ = std::max(1, atoi(option.c_str() + 9));
+        }
+      }
+    }
+  }
+
+  if (nameservers_.empty()) {
+    Nameserver nameserver;
+    ParseNameserver("127.0.0.1", &nameserver.address,
+        &nameserver.address_length);
+    nameservers_.push_back(nameserver);
+  }
+
+  if (!file) {
+    return false;
+  }
+  fclose(file);
+
+  return true;
+}
+
+bool StubResolver::SetNameservers(const vector<string>& nameservers,
+    string* error_message) {
+  nameservers_.clear();
+  for (size_t i = 0; i < nameservers.size(); ++i) {
+    Nameserver nameserver;
+    if (!ParseNameserver(nameservers[i], &nameserver.address,
+          &nameserver.address_length)) {
+      *error_message = "Invalid nameserver " + nameservers[i] + ".";
+      return false;
+    }
+    nameservers_.push_back(nameserver);
+  }
+
+  return true;
+}
+
+// static
+bool StubResolver::IsValidNameserver(const string& nameserver) {
+  sockaddr_storage address;
+  socklen_t address_length;
+
+  return ParseNameserver(nameserver, &address, &address_length);
+}
+
+bool StubResolver::Resolve(Listener* listener, const string& name,
+    uint16_t type, DnsAnswer* answer) {
+  ++statistics_.lookup_count;
+
+  string normalized;
+  if (!NormalizeName(name, &normalized)) {
+    answer->result = DnsAnswer::kResultNoAddress;
+    answer->error_message = "Invalid name.";
+    return true;
+  } else if (nameservers_.empty()) {
+    answer->result = DnsAnswer::kResultError;
+    answer->error_message = "No nameservers configured.";
+    return true;
+  }
+
+  if (cache_->Lookup(normalized, type, answer)) {
+    ++statistics_.cache_hit_count;
+    return true;
+  }
+
+  Query* query;
+  map<string, Query*>::iterator it =
+    queries_.find(QueryKey(normalized, type));
+  if (it != queries_.end()) {
+    query = it->second;
+    ++statistics_.coalesced_count;
+  } else {
+    query = StartQuery(normalized, type);
+  }
+
+  query->listeners.push_back(listener);
+  listener_queries_[listener] = query;
+
+  return false;
+}
+
+void StubResolver::Cancel(Listener* listener) {
+  map<Listener*, Query*>::iterator it = listener_queries_.find(listener);
+  if (it == listener_queries_.end()) {
+    return;
+  }
+
+  // The query itself carries on: Its answer will still be cached.
+  vector<Listener*>& listeners = it->second->listeners;
+  listeners.erase(std::remove(listeners.begin(), listeners.end(), listener),
+      listeners.end());
+  listener_queries_.erase(it);
+}
+
+const StubResolver::Statistics& StubResolver::GetStatistics() const {
+  return statistics_;
+}
+
+// virtual
+void StubResolver::OnFDEvent(int fd, bool read_event,
+    bool write_event, bool error_event) {
+  if (udp_sockets_.find(fd) != udp_sockets_.end()) {
+    ReceiveUdp(fd);
+    return;
+  }
+
+  map<int, Query*>::iterator it = tcp_queries_.find(fd);
+  if (it == tcp_queries_.end()) {
+    return;
+  }
+  Query* query = it->second;
+
+  if (write_event && !query->tcp_output.empty()) {
+    const ssize_t sent = send(fd, query->tcp_output.data(),
+        query->tcp_output.size(), MSG_NOSIGNAL);
+    if (sent == -1 && errno != EAGAIN && errno != EINTR) {
+      Retry(query, "DNS TCP connection failed.");
+      return;
+    } else if (sent > 0) {
+      query->tcp_output.erase(0, sent);
+      if (query->tcp_output.empty()) {
+        WatchFD(fd, EventManager::kFDReadable);
+      }
+    }
+  }
+
+  if (read_event) {
+    ReceiveTcp(query);
+  }
+}
+
+// virtual
+void StubResolver::OnPoll() {
+  const int64_t now_us = Clock::NowMicroseconds();
+
+  while (!deadlines_.empty() && deadlines_.begin()->first <= now_us) {
+    Query* query = deadlines_.begin()->second;
+    deadlines_.erase(deadlines_.begin());
+    query->deadline = deadlines_.end();
+
+    ++statistics_.timeout_count;
+    Retry(query, "DNS query timed out.");
+  }
+
+  UpdatePolling();
+}
+
+// static
+string StubResolver::QueryKey(const string& name, uint16_t type) {
+  stringstream key;
+  key << type << "/" << name;
+
+  return key.str();
+}
+
+StubResolver::Query* StubResolver::StartQuery(const string& name,
+    uint16_t type) {
+  Query* query = new Query;
+  query->name = name;
+  query->type = type;
+  query->id = NewQueryId();
+  query->nameserver_index = 0;
+  query->send_count = 0;
+  query->udp_fd = -1;
+  query->tcp_fd = -1;
+  query->cname_depth = 0;
+  query->deadline = deadlines_.end();
+
+  // Header: One question, and an EDNS0 OPT record.
+  string& message = query->message;
+  AppendUint16(&message, query->id);
+  AppendUint16(&message, kFlagRecursionDesired);
+  AppendUint16(&message, 1);
+  AppendUint16(&message, 0);
+  AppendUint16(&message, 0);
+  AppendUint16(&message, 1);
+
+  // Question.
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t end = name.find('.', start);
+    if (end == string::npos) {
+      end = name.size();
+    }
+    message.push_back(static_cast<char>(end - start));
+    message.append(name, start, end - start);
+    start = end + 1;
+  }
+  message.push_back('\0');
+  AppendUint16(&message, type);
+  AppendUint16(&message, kClassIN);
+
+  // OPT record: Root name, type, UDP payload size, no flags or options.
+  message.push_back('\0');
+  AppendUint16(&message, kTypeOPT);
+  AppendUint16(&message, kUdpPayloadSize);
+  AppendUint16(&message, 0);
+  AppendUint16(&message, 0);
+  AppendUint16(&message, 0);
+
+  queries_[QueryKey(name, type)] = query;
+  query_ids_[query->id] = query;
+
+  Send(query);
+
+  return query;
+}
+
+void StubResolver::Send(Query* query) {
+  const Nameserver& nameserver = nameservers_[query->nameserver_index];
+
+  ++query->send_count;
+  ++statistics_.query_count;
+
+  // Only answers to the latest send are accepted, on its socket.
+  ReleaseUdpSocket(query);
+  const int fd = ChooseUdpSocket(nameserver.address.ss_family);
+  if (fd != -1) {
+    UdpSocket& udp_socket = udp_sockets_[fd];
+    ++udp_socket.send_count;
+    ++udp_socket.query_count;
+    query->udp_fd = fd;
+
+    // Failures are retried like timeouts.
+    sendto(fd, query->message.data(), query->message.size(), 0,
+        reinterpret_cast<const sockaddr*>(&nameserver.address),
+        nameserver.address_length);
+  }
+
+  SetDeadline(query);
+}
+
+void StubResolver::SendTcp(Query* query) {
+  const Nameserver& nameserver = nameservers_[query->nameserver_index];
+
+  ++statistics_.tcp_count;
+  CloseTcp(query);
+  ReleaseUdpSocket(query);
+
+  const int fd = socket(nameserver.address.ss_family, SOCK_STREAM, 0);
+  if (fd == -1) {
+    Retry(query, "DNS TCP connection failed.");
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&nameserver.address),
+        nameserver.address_length) == -1 && errno != EINPROGRESS) {
+    close(fd);
+    Retry(query, "DNS TCP connection failed.");
+    return;
+  }
+
+  query->tcp_fd = fd;
+  query->tcp_output.clear();
+  AppendUint16(&query->tcp_output, query->message.size());
+  query->tcp_output.append(query->message);
+  query->tcp_input.clear();
+  tcp_queries_[fd] = query;
+
+  WatchFD(fd, EventManager::kFDReadable | EventManager::kFDWritable);
+  SetDeadline(query);
+}
+
+void StubResolver::CloseTcp(Query* query) {
+  if (query->tcp_fd == -1) {
+    return;
+  }
+
+  UnwatchFD(query->tcp_fd);
+  close(query->tcp_fd);
+  tcp_queries_.erase(query->tcp_fd);
+  query->tcp_fd = -1;
+}
+
+void StubResolver::Retry(Query* query, const string& error_message) {
+  CloseTcp(query);
+
+  // Each attempt tries every nameserver once.
+  const int max_send_count = attempts_ * nameservers_.size();
+  if (query->send_count >= max_send_count) {
+    DnsAnswer answer;
+    answer.result = DnsAnswer::kResultError;
+    answer.error_message = error_message;
+    Finish(query, answer, 0);
+    return;
+  }
+
+  query->nameserver_index =
+    (query->nameserver_index + 1) % nameservers_.size();
+  Send(query);
+}
+
+void StubResolver::ReceiveUdp(int fd) {
+  unsigned char message[kMaxMessageLength];
+
+  // Read every answer waiting.
+  for (;;) {
+    sockaddr_storage source;
+    socklen_t source_length = sizeof source;
+    const ssize_t length = recvfrom(fd, message, sizeof message, 0,
+        reinterpret_cast<sockaddr*>(&source), &source_length);
+    if (length == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    if (static_cast<size_t>(length) < kHeaderLength ||
+        !IsNameserver(reinterpret_cast<sockaddr*>(&source), source_length)) {
+      continue;
+    }
+
+    // Answers must arrive on the socket the query was last sent from.
+    map<uint16_t, Query*>::iterator it =
+      query_ids_.find(ReadUint16(message));
+    if (it == query_ids_.end() || it->second->udp_fd != fd) {
+      continue;
+    }
+
+    // Answers to other questions are ignored: Could be forged.
+    ProcessAnswer(it->second, message, length, false);
+
+    // The answer may have been the last awaited on a replaced socket.
+    if (udp_sockets_.find(fd) == udp_sockets_.end()) {
+      break;
+    }
+  }
+}
+
+void StubResolver::ReceiveTcp(Query* query) {
+  // Servers may close the connection straight after answering.
+  bool closed = false;
+  char buffer[4096];
+  for (;;) {
+    const ssize_t length = recv(query->tcp_fd, buffer, sizeof buffer, 0);
+    if (length > 0) {
+      query->tcp_input.append(buffer, length);
+    } else if (length == -1 && errno == EINTR) {
+      continue;
+    } else {
+      closed = length == 0 || errno != EAGAIN;
+      break;
+    }
+  }
+
+  const string& input = query->tcp_input;
+  const unsigned char* data =
+    reinterpret_cast<const unsigned char*>(input.data());
+  if (input.size() < 2 || input.size() < 2u + ReadUint16(data)) {
+    if (closed) {
+      Retry(query, "DNS TCP connection closed.");
+    }
+    return;
+  }
+
+  if (!ProcessAnswer(query, data + 2, ReadUint16(data), true)) {
+    Retry(query, "Invalid DNS answer.");
+  }
+}
+
+bool StubResolver::ProcessAnswer(Query* query, const unsigned char* message,
+    size_t length, bool over_tcp) {
+  if (length < kHeaderLength) {
+    return false;
+  }
+
+  const uint16_t flags = ReadUint16(message + 2);
+  const uint16_t question_count = ReadUint16(message + 4);
+  const uint16_t answer_count = ReadUint16(message + 6);
+  const uint16_t authority_count = ReadUint16(message + 8);
+  if ((flags & kFlagResponse) == 0 || question_count != 1 ||
+      ReadUint16(message) != query->id) {
+    return false;
+  }
+
+  // The question must match ours.
+  size_t offset = kHeaderLength;
+  string question_name;
+  if (!ReadName(message, length, &offset, &question_name) ||
+      offset + 4 > length || question_name != query->name ||
+      ReadUint16(message + offset) != query->type ||
+      ReadUint16(message + offset + 2) != kClassIN) {
+    return false;
+  }
+  offset += 4;
+
+  if ((flags & kFlagTruncated) != 0 && !over_tcp) {
+    SendTcp(query);
+    return true;
+  }
+
+  const uint16_t rcode = flags & 0x0f;
+  if (rcode != kRcodeNoError && rcode != kRcodeNameError) {
+    Retry(query, "DNS server failure.");
+    return true;
+  }
+
+  // Collect the addresses of the name, following any CNAMEs. A CNAME back to
+  // a name already visited, in this answer or by the queries chased here, is
+  // a loop.
+  const size_t address_length = query->type == kTypeA ? 4 : 16;
+  vector<string> names(1, query->name);
+  DnsAnswer answer;
+  uint32_t ttl = kMaxTtl;
+  string cname_target;
+  bool is_cname_loop = false;
+
+  Record record;
+  for (int i = 0; i < answer_count; ++i) {
+    if (!ReadRecord(message, length, &offset, &record)) {
+      Retry(query, "Malformed DNS answer.");
+      return true;
+    }
+
+    if (record.record_class != kClassIN ||
+        std::find(names.begin(), names.end(), record.owner) == names.end()) {
+      continue;
+    }
+
+    if (record.type == query->type && record.data_length == address_length) {
+      answer.addresses.push_back(string(
+            reinterpret_cast<const char*>(message + record.data_offset),
+            record.data_length));
+      ttl = min(ttl, record.ttl);
+    } else if (record.type == kTypeCNAME) {
+      size_t target_offset = record.data_offset;
+      string target;
+      if (!ReadName(message, length, &target_offset, &target)) {
+        continue;
+      }
+      if (std::find(names.begin(), names.end(), target) != names.end() ||
+          std::find(query->aliases.begin(), query->aliases.end(), target) !=
+          query->aliases.end()) {
+        is_cname_loop = true;
+        continue;
+      }
+      cname_target = target;
+      names.push_back(cname_target);
+      ttl = min(ttl, record.ttl);
+    }
+  }
+
+  if (!answer.addresses.empty()) {
+    answer.result = DnsAnswer::kResultAddresses;
+    Finish(query, answer, ttl);
+    return true;
+  }
+
+  if (is_cname_loop) {
+    answer.result = DnsAnswer::kResultError;
+    answer.error_message = "CNAME loop.";
+    Finish(query, answer, 0);
+    return true;
+  }
+
+  // A CNAME without its target's addresses: Query the target, passing the
+  // listeners on.
+  if (rcode == kRcodeNoError && !cname_target.empty() &&
+      query->cname_depth < kMaxCnameDepth) {
+    map<string, Query*>::iterator it =
+      queries_.find(QueryKey(cname_target, query->type));
+    Query* target = it != queries_.end() ? it->second :
+      StartQuery(cname_target, query->type);
+
+    target->cname_depth = std::max(target->cname_depth,
+        query->cname_depth + 1);
+    target->aliases.push_back(query->name);
+    target->aliases.insert(target->aliases.end(), query->aliases.begin(),
+        query->aliases.end());
+    for (size_t i = 0; i < query->listeners.size(); ++i) {
+      target->listeners.push_back(query->listeners[i]);
+      listener_queries_[query->listeners[i]] = target;
+    }
+
+    Remove(query);
+    return true;
+  }
+
+  // No addresses: Negative answers are cached for the SOA's minimum TTL.
+  uint32_t negative_ttl = kDefaultNegativeTtl;
+  for (int i = 0; i < authority_count; ++i) {
+    if (!ReadRecord(message, length, &offset, &record)) {
+      break;
+    }
+    if (record.type == kTypeSOA && record.data_length >= 20) {
+      negative_ttl = min(record.ttl, ReadUint32(message +
+            record.data_offset + record.data_length - 4));
+      break;
+    }
+  }
+
+  answer.result = DnsAnswer::kResultNoAddress;
+  answer.error_message = rcode == kRcodeNameError ? "Name not found." :
+    "No address records.";
+  Finish(query, answer, min(negative_ttl, kMaxNegativeTtl));
+
+  return true;
+}
+
+void StubResolver::Finish(Query* query, const DnsAnswer& answer,
+    uint32_t ttl) {
+  cache_->Store(query->name, query->type, answer, ttl);
+  for (size_t i = 0; i < query->aliases.size(); ++i) {
+    cache_->Store(query->aliases[i], query->type, answer, ttl);
+  }
+
+  // Listeners may start new queries: Deliver once |query| is gone.
+  const vector<Listener*> listeners = query->listeners;
+  for (size_t i = 0; i < listeners.size(); ++i) {
+    listener_queries_.erase(listeners[i]);
+  }
+  Remove(query);
+
+  for (size_t i = 0; i < listeners.size(); ++i) {
+    listeners[i]->OnDnsAnswer(answer);
+  }
+}
+
+void StubResolver::Remove(Query* query) {
+  queries_.erase(QueryKey(query->name, query->type));
+  query_ids_.erase(query->id);
+  if (query->deadline != deadlines_.end()) {
+    deadlines_.erase(query->deadline);
+  }
+  CloseTcp(query);
+  ReleaseUdpSocket(query);
+  delete query;
+
+  UpdatePolling();
+}
+
+void StubResolver::SetDeadline(Query* query) {
+  if (query->deadline != deadlines_.end()) {
+    deadlines_.erase(query->deadline);
+  }
+
+  const int64_t deadline_us = Clock::NowMicroseconds() +
+    timeout_seconds_ * kMicrosecondsPerSecond;
+  query->deadline = deadlines_.insert(std::make_pair(deadline_us, query));
+
+  UpdatePolling();
+}
+
+void StubResolver::UpdatePolling() {
+  // Only watch the UDP sockets and poll while queries are in flight, so an
+  // idle resolver doesn't keep the event loop running.
+  const bool polling = !queries_.empty();
+  if (polling == polling_) {
+    return;
+  }
+
+  for (map<int, UdpSocket>::const_iterator it = udp_sockets_.begin();
+      it != udp_sockets_.end();
+      ++it) {
+    if (polling) {
+      WatchFD(it->first, EventManager::kFDReadable);
+    } else {
+      UnwatchFD(it->first);
+    }
+  }
+
+  if (polling) {
+    EnablePoll();
+  } else {
+    DisablePoll();
+  }
+
+  polling_ = polling;
+}
+
+int StubResolver::ChooseUdpSocket(int family) {
+  vector<int> fds;
+  for (map<int, UdpSocket>::const_iterator it = udp_sockets_.begin();
+      it != udp_sockets_.end();
+      ++it) {
+    if (it->second.family == family &&
+        it->second.send_count < kMaxUdpSocketSends) {
+      fds.push_back(it->first);
+    }
+  }
+
+  if (fds.size() < kUdpSocketsPerFamily) {
+    const int fd = OpenUdpSocket(family);
+    if (fd != -1) {
+      return fd;
+    }
+  }
+
+  if (fds.empty()) {
+    return -1;
+  }
+  return fds[Random() % fds.size()];
+}
+
+int StubResolver::OpenUdpSocket(int family) {
+  const int fd = socket(family, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  // Not every kernel randomizes ephemeral ports: Choose one here, unless
+  // every attempt is in use.
+  bool bound = false;
+  for (int attempt = 0; !bound && attempt <= kMaxBindAttempts; ++attempt) {
+    const uint16_t port = attempt == kMaxBindAttempts ? 0 :
+      kMinUdpPort + Random() % (65536 - kMinUdpPort);
+
+    sockaddr_storage address;
+    memset(&address, 0, sizeof address);
+    socklen_t address_length;
+    if (family == AF_INET6) {
+      sockaddr_in6* address6 = reinterpret_cast<sockaddr_in6*>(&address);
+      address6->sin6_family = AF_INET6;
+      address6->sin6_addr = in6addr_any;
+      address6->sin6_port = htons(port);
+      address_length = sizeof *address6;
+    } else {
+      sockaddr_in* address4 = reinterpret_cast<sockaddr_in*>(&address);
+      address4->sin_family = AF_INET;
+      address4->sin_addr.s_addr = htonl(INADDR_ANY);
+      address4->sin_port = htons(port);
+      address_length = sizeof *address4;
+    }
+
+    bound = bind(fd, reinterpret_cast<const sockaddr*>(&address),
+        address_length) == 0;
+  }
+
+  if (!bound) {
+    close(fd);
+    return -1;
+  }
+
+  UdpSocket udp_socket;
+  udp_socket.family = family;
+  udp_socket.send_count = 0;
+  udp_socket.query_count = 0;
+  udp_sockets_[fd] = udp_socket;
+
+  if (polling_) {
+    WatchFD(fd, EventManager::kFDReadable);
+  }
+
+  return fd;
+}
+
+void StubResolver::ReleaseUdpSocket(Query* query) {
+  if (query->udp_fd == -1) {
+    return;
+  }
+
+  map<int, UdpSocket>::iterator it = udp_sockets_.find(query->udp_fd);
+  query->udp_fd = -1;
+  if (it == udp_sockets_.end()) {
+    return;
+  }
+
+  UdpSocket& udp_socket = it->second;
+  --udp_socket.query_count;
+  if (udp_socket.query_count == 0 &&
+      udp_socket.send_count >= kMaxUdpSocketSends) {
+    UnwatchFD(it->first);
+    close(it->first);
+    udp_sockets_.erase(it);
+  }
+}
+
+uint16_t StubResolver::NewQueryId() {
+  uint16_t id;
+  do {
+    id = Random() & 0xffff;
+  } while (query_ids_.find(id) != query_ids_.end());
+
+  return id;
+}
+
+uint64_t StubResolver::Random() {
+  // xorshift64*.
+  random_state_ ^= random_state_ >> 12;
+  random_state_ ^= random_state_ << 25;
+  random_state_ ^= random_state_ >> 27;
+
+  return random_state_ * 2685821657736338717ULL;
+}
+
+bool StubResolver::IsNameserver(const sockaddr* address,
+    socklen_t length) const {
+  for (size_t i = 0; i < nameservers_.size(); ++i) {
+    const sockaddr* nameserver =
+      reinterpret_cast<const sockaddr*>(&nameservers_[i].address);
+    if (nameserver->sa_family != address->sa_family) {
+      continue;
+    }
+
+    if (address->sa_family == AF_INET) {
+      const sockaddr_in* a = reinterpret_cast<const sockaddr_in*>(address);
+      const sockaddr_in* b = reinterpret_cast<const sockaddr_in*>(nameserver);
+      if (a->sin_port == b->sin_port &&
+          a->sin_addr.s_addr == b->sin_addr.s_addr) {
+        return true;
+      }
+    } else if (address->sa_family == AF_INET6) {
+      const sockaddr_in6* a = reinterpret_cast<const sockaddr_in6*>(address);
+      const sockaddr_in6* b =
+        reinterpret_cast<const sockaddr_in6*>(nameserver);
+      if (a->sin6_port == b->sin6_port &&
+          memcmp(&a->sin6_addr, &b->sin6_addr, sizeof a->sin6_addr) == 0) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+}  // namespace x509ls
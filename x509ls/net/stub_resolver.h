@@ -0,0 +1,252 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_STUB_RESOLVER_H_
+#define X509LS_NET_STUB_RESOLVER_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/types.h"
+#include "x509ls/net/dns_cache.h"
+
+using std::map;
+using std::multimap;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// A non-blocking DNS stub resolver: Sends A/AAAA queries to the configured
+// recursive nameservers itself, rather than through the system resolver.
+//
+// Unlike getaddrinfo_a(), which runs a thread per outstanding lookup, all
+// queries are pipelined over a small pool of UDP sockets per address family,
+// watched by the EventManager. Each socket is bound to a random port, and is
+// replaced after kMaxUdpSocketSends queries: Forging an answer means guessing
+// the port as well as the 16 bit query ID. Truncated answers are retried over
+// TCP. Timed out or
+// failed queries are retried on the next nameserver, following resolv.conf's
+// "timeout" and "attempts" options.
+//
+// Answers are cached by TTL in a DnsCache, which may be shared with other
+// threads' resolvers. Identical queries in flight at once are coalesced into
+// one.
+//
+// Names are always queried as given: resolv.conf "search" and "ndots" are
+// ignored, as are /etc/hosts and nsswitch.conf.
+//
+// One resolver serves one event loop, and so one thread.
+class StubResolver : public BaseObject {
+ public:
+  // Record types.
+  static const uint16_t kTypeA = 1;
+  static const uint16_t kTypeAAAA = 28;
+
+  // Construct, caching answers in |cache|, which must outlive the resolver.
+  StubResolver(BaseObject* parent, DnsCache* cache);
+  virtual ~StubResolver();
+
+  // Receives answers.
+  class Listener {
+   public:
+    virtual ~Listener() {}
+
+    // The query from Resolve() has been answered.
+    virtual void OnDnsAnswer(const DnsAnswer& answer) = 0;
+  };
+
+  // Use the nameservers and options from |resolv_conf|, e.g.
+  // "/etc/resolv.conf". Without the file or any "nameserver" lines, uses
+  // 127.0.0.1, as glibc does.
+  //
+  // Returns false if the file can't be read, setting |error_message|.
+  bool Configure(const string& resolv_conf, string* error_message);
+
+  // Use |nameservers| instead: "address" or "address:port", e.g.
+  // "127.0.0.1:5353" or "[::1]:53".
+  //
+  // Returns false if any address is invalid, setting |error_message|.
+  bool SetNameservers(const vector<string>& nameservers,
+      string* error_message);
+
+  // Returns true iif |nameserver| is valid for SetNameservers().
+  static bool IsValidNameserver(const string& nameserver);
+
+  // Resolve the records of |type| for |name|.
+  //
+  // Returns true if the answer is already known (from the cache, or as
+  // |name| is invalid), and stores it in |answer|. Otherwise
+  // listener->OnDnsAnswer() is called later, unless Cancel() is called
+  // first. A |listener| may only have one query outstanding.
+  bool Resolve(Listener* listener, const string& name, uint16_t type,
+      DnsAnswer* answer);
+
+  // Stop delivering the answer to |listener|.
+  void Cancel(Listener* listener);
+
+  // Query statistics.
+  struct Statistics {
+    Statistics();
+
+    // Add the counts from |other|.
+    void Merge(const Statistics& other);
+
+    // Return a one line summary, e.g.:
+    //   "dns: 120 lookups, 80 cached, 10 coalesced, 30 queries (2 over TCP,
+    //   1 timeouts)"
+    string Summary() const;
+
+    uint64_t lookup_count;
+    uint64_t cache_hit_count;
+    uint64_t coalesced_count;
+    uint64_t query_count;
+    uint64_t tcp_count;
+    uint64_t timeout_count;
+  };
+  const Statistics& GetStatistics() const;
+
+  // Receives UDP answers, and TCP connection events.
+  virtual void OnFDEvent(int fd, bool read_event,
+      bool write_event, bool error_event);
+
+  // Retries timed out queries.
+  virtual void OnPoll();
+
+  // UDP sockets used for new queries, per address family.
+  static const size_t kUdpSocketsPerFamily = 8;
+
+  // Queries sent from a UDP socket before it is replaced.
+  static const int kMaxUdpSocketSends = 64;
+
+ private:
+  NO_COPY_AND_ASSIGN(StubResolver)
+
+  struct Nameserver {
+    sockaddr_storage address;
+    socklen_t address_length;
+  };
+
+  struct Query {
+    // Lower case, without a trailing dot.
+    string name;
+    uint16_t type;
+    uint16_t id;
+
+    // The query message.
+    string message;
+
+    // Nameserver in use, and the number sent so far.
+    size_t nameserver_index;
+    int send_count;
+
+    // The UDP socket last sent from, the only one answers are accepted on,
+    // or -1.
+    int udp_fd;
+
+    // TCP retry: The connection, the length-prefixed query and answer.
+    int tcp_fd;
+    string tcp_output;
+    string tcp_input;
+
+    // Other names (CNAME aliases) to cache the answer under.
+    vector<string> aliases;
+    int cname_depth;
+
+    vector<Listener*> listeners;
+
+    multimap<int64_t, Query*>::iterator deadline;
+  };
+
+  DnsCache* const cache_;
+
+  vector<Nameserver> nameservers_;
+  int timeout_seconds_;
+  int attempts_;
+
+  struct UdpSocket {
+    int family;
+
+    // Queries sent from the socket, and those whose answers are awaited on
+    // it. Sockets are closed once they've sent kMaxUdpSocketSends and no
+    // answers are awaited.
+    int send_count;
+    int query_count;
+  };
+
+  // UDP sockets, by fd, opened as needed.
+  map<int, UdpSocket> udp_sockets_;
+
+  // Queries in flight, by "type/name", by ID, and by TCP fd.
+  map<string, Query*> queries_;
+  map<uint16_t, Query*> query_ids_;
+  map<int, Query*> tcp_queries_;
+  map<Listener*, Query*> listener_queries_;
+
+  // Deadlines of queries in flight.
+  multimap<int64_t, Query*> deadlines_;
+
+  uint64_t random_state_;
+
+  Statistics statistics_;
+
+  bool polling_;
+
+  static string QueryKey(const string& name, uint16_t type);
+
+  // Start a query for |name| and |type|, with no listeners.
+  Query* StartQuery(const string& name, uint16_t type);
+
+  // Send |query| (again) over UDP to its current nameserver.
+  void Send(Query* query);
+
+  // Send |query| over TCP to its current nameserver, after a truncated UDP
+  // answer.
+  void SendTcp(Query* query);
+  void CloseTcp(Query* query);
+
+  // Move |query| to the next nameserver, or fail it once all the attempts
+  // are used.
+  void Retry(Query* query, const string& error_message);
+
+  void ReceiveUdp(int fd);
+  void ReceiveTcp(Query* query);
+
+  // Process the answer |message| to |query|. Returns false if it isn't an
+  // answer to |query|.
+  bool ProcessAnswer(Query* query, const unsigned char* message,
+      size_t length, bool over_tcp);
+
+  // Finish |query| with |answer|, caching it for |ttl| seconds, and notify
+  // the listeners.
+  void Finish(Query* query, const DnsAnswer& answer, uint32_t ttl);
+
+  // Remove |query| from the indexes and free it.
+  void Remove(Query* query);
+
+  void SetDeadline(Query* query);
+  void UpdatePolling();
+
+  // Return a UDP socket for a query to a nameserver of |family|, chosen at
+  // random from the pool, or -1 on error.
+  int ChooseUdpSocket(int family);
+
+  // Open a UDP socket of |family|, bound to a random port. Returns -1 on
+  // error.
+  int OpenUdpSocket(int family);
+
+  // Stop awaiting |query|'s answer on its UDP socket, closing the socket if
+  // it has been replaced and no other answers are awaited on it.
+  void ReleaseUdpSocket(Query* query);
+  uint16_t NewQueryId();
+  uint64_t Random();
+
+  bool IsNameserver(const sockaddr* address, socklen_t length) const;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_STUB_RESOLVER_H_
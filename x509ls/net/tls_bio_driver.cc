@@ -0,0 +1,110 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/tls_bio_driver.h"
+
+#include <string.h>
+
+namespace x509ls {
+namespace {
+// Pair buffer sizes. Input holds at least one maximum size record, so OpenSSL
+// can always make progress. The client's handshake messages are small.
+const size_t kInputBufferSize = SSL3_RT_MAX_PACKET_SIZE;
+const size_t kOutputBufferSize = 8 * 1024;
+}  // namespace
+
+TlsBioDriver::TlsBioDriver()
+  :
+    network_bio_(NULL),
+    bytes_received_(0),
+    bytes_sent_(0) {
+}
+
+TlsBioDriver::~TlsBioDriver() {
+  if (network_bio_) {
+    BIO_free(network_bio_);
+  }
+}
+
+bool TlsBioDriver::Attach(SSL* ssl) {
+  // Each half's size is that of the buffer it writes into.
+  BIO* ssl_bio;
+  if (BIO_new_bio_pair(&ssl_bio, kOutputBufferSize,
+        &network_bio_, kInputBufferSize) != 1) {
+    network_bio_ = NULL;
+    return false;
+  }
+
+  SSL_set_bio(ssl, ssl_bio, ssl_bio);
+
+  return true;
+}
+
+size_t TlsBioDriver::InputBuffer(unsigned char** buffer) {
+  char* space;
+  const int length = BIO_nwrite0(network_bio_, &space);
+  if (length <= 0) {
+    return 0;
+  }
+
+  *buffer = reinterpret_cast<unsigned char*>(space);
+  return length;
+}
+
+void TlsBioDriver::InputWritten(size_t length) {
+  char* space;
+  BIO_nwrite(network_bio_, &space, length);
+  bytes_received_ += length;
+}
+
+size_t TlsBioDriver::Feed(const unsigned char* data, size_t length) {
+  size_t fed = 0;
+  unsigned char* buffer;
+  size_t space;
+  while (fed < length && (space = InputBuffer(&buffer)) > 0) {
+    const size_t chunk = length - fed < space ? length - fed : space;
+    memcpy(buffer, data + fed, chunk);
+    InputWritten(chunk);
+    fed += chunk;
+  }
+
+  return fed;
+}
+
+size_t TlsBioDriver::InputSpace() const {
+  return BIO_ctrl_get_write_guarantee(network_bio_);
+}
+
+void TlsBioDriver::SetEndOfInput() {
+  BIO_shutdown_wr(network_bio_);
+}
+
+size_t TlsBioDriver::OutputBuffer(const unsigned char** buffer) {
+  char* pending;
+  const int length = BIO_nread0(network_bio_, &pending);
+  if (length <= 0) {
+    return 0;
+  }
+
+  *buffer = reinterpret_cast<const unsigned char*>(pending);
+  return length;
+}
+
+void TlsBioDriver::OutputSent(size_t length) {
+  char* pending;
+  BIO_nread(network_bio_, &pending, length);
+  bytes_sent_ += length;
+}
+
+bool TlsBioDriver::HasOutput() const {
+  return BIO_ctrl_pending(network_bio_) > 0;
+}
+
+uint64_t TlsBioDriver::BytesReceived() const {
+  return bytes_received_;
+}
+
+uint64_t TlsBioDriver::BytesSent() const {
+  return bytes_sent_;
+}
+}  // namespace x509ls
@@ -0,0 +1,91 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_TLS_BIO_DRIVER_H_
+#define X509LS_NET_TLS_BIO_DRIVER_H_
+
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "x509ls/base/types.h"
+
+namespace x509ls {
+// Connects an OpenSSL SSL object to its transport through a BIO pair, rather
+// than a socket.
+//
+// OpenSSL reads and writes its half of the pair; the owner moves bytes
+// between the other half and the transport, and decides when to do so:
+// OpenSSL never touches the socket, so the owner may batch reads, sends only
+// when output is pending, and can count every byte.
+//
+// The pair's buffers are allocated once per connection and reused for every
+// record. Received bytes can be written straight into them (InputBuffer() and
+// InputWritten()), and output sent straight out of them (OutputBuffer() and
+// OutputSent()), without intermediate copies. Feed() copies instead, for
+// bytes already held elsewhere.
+//
+// Nothing here is specific to sockets: The same driver can replay a captured
+// handshake, or run against a test fixture.
+//
+// Usage:
+//   TlsBioDriver driver;
+//   if (!driver.Attach(ssl)) { ... }
+//   while (SSL_connect(ssl) == -1 && <want read/write>) {
+//     <send OutputBuffer(), then OutputSent()>
+//     <receive into InputBuffer(), then InputWritten()>
+//   }
+class TlsBioDriver {
+ public:
+  TlsBioDriver();
+  ~TlsBioDriver();
+
+  // Attach |ssl| to a new BIO pair. |ssl| takes ownership of its half.
+  //
+  // Returns false if the pair couldn't be created.
+  bool Attach(SSL* ssl);
+
+  // Return the contiguous space available for received bytes, setting
+  // |buffer| to its start. 0 if the pair is full: Let OpenSSL read first.
+  size_t InputBuffer(unsigned char** buffer);
+
+  // Commit |length| bytes written to the InputBuffer().
+  void InputWritten(size_t length);
+
+  // Copy up to |length| bytes of |data| in. Returns the number of bytes
+  // accepted, less than |length| if the pair fills up.
+  size_t Feed(const unsigned char* data, size_t length);
+
+  // Return the total space available for received bytes.
+  size_t InputSpace() const;
+
+  // Signal the end of the input: The peer closed the connection.
+  void SetEndOfInput();
+
+  // Return the contiguous output pending, setting |buffer| to its start.
+  // 0 if no output is pending.
+  size_t OutputBuffer(const unsigned char** buffer);
+
+  // Consume |length| bytes of the OutputBuffer(), once sent.
+  void OutputSent(size_t length);
+
+  // Return true iif output is pending.
+  bool HasOutput() const;
+
+  // Return the number of bytes received and sent so far.
+  uint64_t BytesReceived() const;
+  uint64_t BytesSent() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(TlsBioDriver)
+
+  // The transport's half of the pair.
+  BIO* network_bio_;
+
+  uint64_t bytes_received_;
+  uint64_t bytes_sent_;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_TLS_BIO_DRIVER_H_
@@ -0,0 +1,570 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/net/uring_backend.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef X509LS_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <sstream>
+#include <utility>
+
+#include "x509ls/base/event_manager.h"
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// Submission ring size. Operations beyond this wait in the backend's queue.
+const unsigned kSubmissionEntries = 1024;
+
+// Completion ring size: Room for a send, a receive and a cancellation for
+// several thousand connections.
+const unsigned kCompletionEntries = 16384;
+
+#ifdef X509LS_HAVE_IO_URING
+// Set up a ring with |entries| submission entries, filling in |params|.
+// Returns the ring fd, or -1 (setting |error_message|).
+int SetupRing(unsigned entries, io_uring_params* params,
+    string* error_message) {
+  memset(params, 0, sizeof *params);
+  params->flags = IORING_SETUP_CQSIZE;
+  params->cq_entries = kCompletionEntries;
+
+  const int ring_fd = syscall(__NR_io_uring_setup, entries, params);
+  if (ring_fd == -1) {
+    *error_message = "io_uring unavailable: ";
+    error_message->append(strerror(errno));
+    error_message->append(".");
+    return -1;
+  }
+
+  // Without fast poll, socket operations block kernel worker threads.
+  if ((params->features & IORING_FEAT_FAST_POLL) == 0) {
+    *error_message = "io_uring unavailable: Linux 5.7 or later required.";
+    close(ring_fd);
+    return -1;
+  }
+
+  return ring_fd;
+}
+#endif
+}  // namespace
+
+UringBackend::Statistics::Statistics()
+  :
+    operation_count(0),
+    submit_count(0) {
+}
+
+void UringBackend::Statistics::Merge(const Statistics& other) {
+  operation_count += other.operation_count;
+  submit_count += other.submit_count;
+}
+
+string UringBackend::Statistics::Summary() const {
+  stringstream summary;
+  summary << "io_uring: " << operation_count << " operations in ";
+  summary << submit_count << " submissions";
+
+  return summary.str();
+}
+
+UringBackend::UringBackend(BaseObject* parent)
+  :
+    BaseObject(parent),
+    ring_fd_(-1),
+    event_fd_(-1),
+    sq_ring_(NULL),
+    sq_ring_size_(0),
+    cq_ring_(NULL),
+    cq_ring_size_(0),
+    sqes_(NULL),
+    sqes_size_(0),
+    sq_head_(NULL),
+    sq_tail_(NULL),
+    sq_mask_(0),
+    sq_entries_(0),
+    sq_array_(NULL),
+    cq_head_(NULL),
+    cq_tail_(NULL),
+    cq_mask_(0),
+    cqes_(NULL),
+    pending_count_(0),
+    watching_(false),
+    polling_(false) {
+}
+
+// virtual
+UringBackend::~UringBackend() {
+  if (ring_fd_ != -1) {
+    // Cancel everything still outstanding, and wait for the kernel to let go
+    // of the buffers. Shutting the sockets down completes any operation
+    // which can't be cancelled.
+    for (multimap<int, Request*>::iterator it = requests_.begin();
+        it != requests_.end();
+        ++it) {
+      Request* request = it->second;
+      request->client = NULL;
+      closing_fds_.insert(request->fd);
+      if (request->submitted && !request->cancel_queued) {
+        shutdown(request->fd, SHUT_RDWR);
+        QueueCancel(request);
+      }
+    }
+
+    while (!requests_.empty()) {
+      // Requests never submitted are dropped by the first Submit().
+      if (!Submit(false) || requests_.empty() || !Submit(true)) {
+        break;
+      }
+      Reap();
+    }
+  }
+
+  for (set<int>::iterator it = closing_fds_.begin();
+      it != closing_fds_.end();
+      ++it) {
+    close(*it);
+  }
+
+  // Requests left only if the ring failed: Leak their buffers rather than
+  // risk the kernel writing into freed memory.
+  for (deque<Request*>::iterator it = queued_.begin();
+      it != queued_.end();
+      ++it) {
+    if ((*it)->cancel_target != NULL) {
+      delete *it;
+    }
+  }
+
+  Release();
+}
+
+bool UringBackend::Init(string* error_message) {
+#ifdef X509LS_HAVE_IO_URING
+  io_uring_params params;
+  ring_fd_ = SetupRing(kSubmissionEntries, &params, error_message);
+  if (ring_fd_ == -1) {
+    return false;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes +
+    params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    // Both rings share one mapping.
+    if (cq_ring_size_ > sq_ring_size_) {
+      sq_ring_size_ = cq_ring_size_;
+    }
+    cq_ring_size_ = 0;
+  }
+
+  sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = NULL;
+    goto err;
+  }
+
+  if (cq_ring_size_ == 0) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = NULL;
+      goto err;
+    }
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    sqes_ = NULL;
+    goto err;
+  }
+
+  {
+    char* sq_ring = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.tail);
+    sq_mask_ =
+      *reinterpret_cast<unsigned*>(sq_ring + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_array_ = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.array);
+
+    char* cq_ring = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.tail);
+    cq_mask_ =
+      *reinterpret_cast<unsigned*>(cq_ring + params.cq_off.ring_mask);
+    cqes_ = cq_ring + params.cq_off.cqes;
+  }
+
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ == -1 ||
+      syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_EVENTFD,
+        &event_fd_, 1) != 0) {
+    goto err;
+  }
+
+  return true;
+
+ err:
+  *error_message = "io_uring setup failed: ";
+  error_message->append(strerror(errno));
+  Release();
+
+  return false;
+#else
+  *error_message = "io_uring unavailable: Not supported by this build.";
+  return false;
+#endif
+}
+
+// static
+bool UringBackend::IsAvailable(string* error_message) {
+#ifdef X509LS_HAVE_IO_URING
+  io_uring_params params;
+  const int ring_fd = SetupRing(1, &params, error_message);
+  if (ring_fd == -1) {
+    return false;
+  }
+
+  close(ring_fd);
+  return true;
+#else
+  *error_message = "io_uring unavailable: Not supported by this build.";
+  return false;
+#endif
+}
+
+void UringBackend::Connect(Client* client, int fd, const sockaddr* address,
+    socklen_t address_length) {
+  Request* request = Queue(client, fd, Client::kOperationConnect, 0);
+  memcpy(&request->address, address, address_length);
+  request->length = address_length;
+}
+
+void UringBackend::Send(Client* client, int fd, const void* data,
+    size_t length) {
+  Request* request = Queue(client, fd, Client::kOperationSend, length);
+  memcpy(request->buffer, data, length);
+}
+
+void UringBackend::Receive(Client* client, int fd, size_t length) {
+  Queue(client, fd, Client::kOperationReceive, length);
+}
+
+void UringBackend::Close(Client* client, int fd) {
+  bool outstanding = false;
+
+  typedef multimap<int, Request*>::iterator Iterator;
+  std::pair<Iterator, Iterator> range = requests_.equal_range(fd);
+  for (Iterator it = range.first; it != range.second; ++it) {
+    Request* request = it->second;
+    if (request->client != client) {
+      continue;
+    }
+
+    request->client = NULL;
+    if (request->submitted && !request->cancel_queued) {
+      QueueCancel(request);
+    }
+    outstanding = true;
+  }
+
+  if (outstanding) {
+    closing_fds_.insert(fd);
+  } else {
+    close(fd);
+  }
+
+  UpdateWatches();
+}
+
+const UringBackend::Statistics& UringBackend::GetStatistics() const {
+  return statistics_;
+}
+
+// virtual
+void UringBackend::OnFDEvent(int fd, bool read_event,
+    bool write_event, bool error_event) {
+  uint64_t count;
+  while (read(event_fd_, &count, sizeof count) == -1 && errno == EINTR) {
+  }
+
+  Reap();
+
+  // Submit the follow-up operations together.
+  Submit(false);
+  UpdateWatches();
+}
+
+// virtual
+void UringBackend::OnPoll() {
+  Submit(false);
+  UpdateWatches();
+}
+
+UringBackend::Request* UringBackend::Queue(Client* client, int fd,
+    Client::Operation operation, size_t buffer_length) {
+  Request* request = new Request;
+  request->client = client;
+  request->fd = fd;
+  request->operation = operation;
+  request->buffer = buffer_length > 0 ?
+    static_cast<unsigned char*>(malloc(buffer_length)) : NULL;
+  request->length = buffer_length;
+  request->submitted = false;
+  request->cancel_queued = false;
+  request->cancel_target = NULL;
+
+  requests_.insert(std::make_pair(fd, request));
+  queued_.push_back(request);
+  ++statistics_.operation_count;
+
+  UpdateWatches();
+
+  return request;
+}
+
+void UringBackend::QueueCancel(Request* request) {
+  Request* cancel = new Request;
+  memset(cancel, 0, sizeof *cancel);
+  cancel->fd = -1;
+  cancel->cancel_target = request;
+
+  request->cancel_queued = true;
+  queued_.push_back(cancel);
+}
+
+bool UringBackend::Submit(bool wait) {
+#ifdef X509LS_HAVE_IO_URING
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(sqes_);
+
+  // Move queued requests into the submission ring, while there's room.
+  unsigned tail = *sq_tail_;
+  const unsigned head = *static_cast<volatile unsigned*>(sq_head_);
+  while (!queued_.empty() && tail - head < sq_entries_) {
+    Request* request = queued_.front();
+    queued_.pop_front();
+
+    if (request->cancel_target == NULL && request->client == NULL) {
+      // Closed before being submitted.
+      Complete(request, -ECANCELED);
+      continue;
+    }
+
+    const unsigned index = tail & sq_mask_;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+
+    if (request->cancel_target != NULL) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = reinterpret_cast<uintptr_t>(request->cancel_target);
+      request->cancel_target->cancel_queued = false;
+      delete request;
+    } else {
+      sqe->fd = request->fd;
+      sqe->user_data = reinterpret_cast<uintptr_t>(request);
+      request->submitted = true;
+
+      switch (request->operation) {
+      case Client::kOperationConnect:
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->addr = reinterpret_cast<uintptr_t>(&request->address);
+        sqe->off = request->length;
+        break;
+      case Client::kOperationSend:
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = reinterpret_cast<uintptr_t>(request->buffer);
+        sqe->len = request->length;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+      case Client::kOperationReceive:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = reinterpret_cast<uintptr_t>(request->buffer);
+        sqe->len = request->length;
+        break;
+      }
+    }
+
+    sq_array_[index] = index;
+    ++tail;
+    ++pending_count_;
+  }
+
+  // Publish the entries before the kernel reads the tail.
+  __sync_synchronize();
+  *sq_tail_ = tail;
+
+  if (pending_count_ == 0 && !wait) {
+    return true;
+  }
+
+  int result;
+  do {
+    result = syscall(__NR_io_uring_enter, ring_fd_, pending_count_,
+        wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (result == -1 && errno == EINTR);
+
+  if (result == -1) {
+    // Typically EBUSY/EAGAIN, with the completion ring full: The entries are
+    // submitted on a later call, once completions have been reaped.
+    return false;
+  }
+
+  pending_count_ -= result;
+  ++statistics_.submit_count;
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+void UringBackend::Reap() {
+#ifdef X509LS_HAVE_IO_URING
+  io_uring_cqe* cqes = static_cast<io_uring_cqe*>(cqes_);
+
+  unsigned head = *cq_head_;
+  for (;;) {
+    const unsigned tail = *static_cast<volatile unsigned*>(cq_tail_);
+    // Read the entries only after the tail.
+    __sync_synchronize();
+    if (head == tail) {
+      break;
+    }
+
+    const io_uring_cqe* cqe = &cqes[head & cq_mask_];
+    Request* request = reinterpret_cast<Request*>(cqe->user_data);
+    const int result = cqe->res;
+
+    // Release the entry before delivering it: The client may queue more.
+    ++head;
+    __sync_synchronize();
+    *cq_head_ = head;
+
+    // Cancellations have no request.
+    if (request != NULL) {
+      Complete(request, result);
+    }
+  }
+#endif
+}
+
+void UringBackend::Complete(Request* request, int result) {
+  const int fd = request->fd;
+
+  typedef multimap<int, Request*>::iterator Iterator;
+  std::pair<Iterator, Iterator> range = requests_.equal_range(fd);
+  for (Iterator it = range.first; it != range.second; ++it) {
+    if (it->second == request) {
+      requests_.erase(it);
+      break;
+    }
+  }
+
+  // A cancellation still queued would match whichever request is allocated
+  // at this address next.
+  if (request->cancel_queued) {
+    for (deque<Request*>::iterator it = queued_.begin();
+        it != queued_.end();
+        ++it) {
+      if ((*it)->cancel_target == request) {
+        delete *it;
+        queued_.erase(it);
+        break;
+      }
+    }
+  }
+
+  if (request->client != NULL) {
+    request->client->OnUringCompletion(fd, request->operation, result,
+        request->buffer);
+  }
+
+  free(request->buffer);
+  delete request;
+
+  if (closing_fds_.count(fd) > 0 && requests_.count(fd) == 0) {
+    close(fd);
+    closing_fds_.erase(fd);
+  }
+}
+
+void UringBackend::UpdateWatches() {
+  const bool watch = !requests_.empty();
+  if (watch != watching_) {
+    if (watch) {
+      WatchFD(event_fd_, EventManager::kFDReadable);
+    } else {
+      UnwatchFD(event_fd_);
+    }
+    watching_ = watch;
+  }
+
+  const bool poll = !queued_.empty() || pending_count_ > 0;
+  if (poll != polling_) {
+    if (poll) {
+      EnablePoll();
+    } else {
+      DisablePoll();
+    }
+    polling_ = poll;
+  }
+}
+
+void UringBackend::Release() {
+#ifdef X509LS_HAVE_IO_URING
+  if (watching_) {
+    UnwatchFD(event_fd_);
+    watching_ = false;
+  }
+
+  if (polling_) {
+    DisablePoll();
+    polling_ = false;
+  }
+
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = NULL;
+  }
+
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  cq_ring_ = NULL;
+
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = NULL;
+  }
+
+  if (event_fd_ != -1) {
+    close(event_fd_);
+    event_fd_ = -1;
+  }
+
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+    ring_fd_ = -1;
+  }
+#endif
+}
+}  // namespace x509ls
@@ -0,0 +1,192 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_NET_URING_BACKEND_H_
+#define X509LS_NET_URING_BACKEND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+#include "x509ls/base/base_object.h"
+#include "x509ls/base/types.h"
+
+using std::deque;
+using std::multimap;
+using std::set;
+using std::string;
+
+namespace x509ls {
+// Performs socket connects, sends and receives through a Linux io_uring.
+//
+// Operations are queued on the submission ring and submitted together, once
+// per event loop iteration (and after each batch of completions), so many
+// connections share each kernel crossing. Completions are signalled on an
+// eventfd watched by the EventManager, and delivered to each operation's
+// Client.
+//
+// The backend owns the buffers of operations in flight: A Client may go away
+// at any time by calling Close(), and any of its outstanding operations are
+// cancelled rather than completing into freed memory.
+//
+// Requires Linux 5.7 or later (IORING_FEAT_FAST_POLL, so socket operations
+// wait on readiness in the kernel rather than on a worker thread). Init()
+// fails on older kernels, or where io_uring is disabled, and callers should
+// fall back to readiness-based I/O.
+//
+// One backend serves one event loop, and so one thread.
+class UringBackend : public BaseObject {
+ public:
+  explicit UringBackend(BaseObject* parent);
+
+  // Waits for any operations still in flight to be cancelled.
+  virtual ~UringBackend();
+
+  // Receives completed operations.
+  class Client {
+   public:
+    virtual ~Client() {}
+
+    enum Operation {
+      kOperationConnect,
+      kOperationSend,
+      kOperationReceive
+    };
+
+    // |operation| on |fd| completed with |result|: As returned by the
+    // equivalent system call, but with errors as negative errno values.
+    // For kOperationReceive, |data| holds the |result| bytes received, and is
+    // only valid during the call.
+    virtual void OnUringCompletion(int fd, Operation operation, int result,
+        const unsigned char* data) = 0;
+  };
+
+  // Set up the rings. Returns false (setting |error_message|) if io_uring is
+  // unavailable.
+  bool Init(string* error_message);
+
+  // Return true iif io_uring is usable here. Sets |error_message| if not.
+  static bool IsAvailable(string* error_message);
+
+  // Queue a connect of the (blocking) socket |fd| to |address|.
+  void Connect(Client* client, int fd, const sockaddr* address,
+      socklen_t address_length);
+
+  // Queue a send of |length| bytes of |data|, which are copied.
+  void Send(Client* client, int fd, const void* data, size_t length);
+
+  // Queue a receive of up to |length| bytes.
+  void Receive(Client* client, int fd, size_t length);
+
+  // Stop delivering completions to |client| for |fd|, and close |fd| once
+  // its outstanding operations are cancelled.
+  void Close(Client* client, int fd);
+
+  // Kernel crossing statistics.
+  struct Statistics {
+    Statistics();
+
+    // Add the counts from |other|.
+    void Merge(const Statistics& other);
+
+    // Return a one line summary, e.g.:
+    //   "io_uring: 3000 operations in 410 submissions"
+    string Summary() const;
+
+    uint64_t operation_count;
+    uint64_t submit_count;
+  };
+  const Statistics& GetStatistics() const;
+
+  // Receives eventfd events: Delivers completions.
+  virtual void OnFDEvent(int fd, bool read_event,
+      bool write_event, bool error_event);
+
+  // Submits the operations queued since the last poll.
+  virtual void OnPoll();
+
+ private:
+  NO_COPY_AND_ASSIGN(UringBackend)
+
+  struct Request {
+    Client* client;
+    int fd;
+    Client::Operation operation;
+    sockaddr_storage address;
+    unsigned char* buffer;
+    size_t length;
+    bool submitted;
+    bool cancel_queued;
+
+    // Set for cancellations, which have no client.
+    Request* cancel_target;
+  };
+
+  int ring_fd_;
+  int event_fd_;
+
+  // Ring mappings.
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  void* sqes_;
+  size_t sqes_size_;
+
+  // Pointers into the ring mappings.
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  void* cqes_;
+
+  // Requests not yet in the submission ring, and entries in the ring not yet
+  // submitted.
+  deque<Request*> queued_;
+  unsigned pending_count_;
+
+  // Outstanding requests by fd, and fds to close once they have none.
+  multimap<int, Request*> requests_;
+  set<int> closing_fds_;
+
+  bool watching_;
+  bool polling_;
+
+  Statistics statistics_;
+
+  // Return a request for |client|, queued as a new submission entry.
+  Request* Queue(Client* client, int fd, Client::Operation operation,
+      size_t buffer_length);
+
+  // Queue a cancellation of |request|.
+  void QueueCancel(Request* request);
+
+  // Move queued requests into the submission ring and submit them. If |wait|,
+  // also wait for at least one completion. Returns false if the kernel
+  // refused the submission.
+  bool Submit(bool wait);
+
+  // Deliver all available completions.
+  void Reap();
+
+  // Deliver the |result| of |request| to its client, then free it.
+  void Complete(Request* request, int result);
+
+  // Update the EventManager: Watch the eventfd while requests are
+  // outstanding, and poll while entries are queued.
+  void UpdateWatches();
+
+  void Release();
+};
+}  // namespace x509ls
+
+#endif  // X509LS_NET_URING_BACKEND_H_
@@ -0,0 +1,250 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/pcap/packet_decoder.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <sstream>
+
+using std::stringstream;
+
+namespace x509ls {
+namespace {
+// Link-layer header types, see pcap-linktype(7).
+const uint32_t kLinkTypeNull = 0;
+const uint32_t kLinkTypeEthernet = 1;
+const uint32_t kLinkTypeRaw = 101;
+const uint32_t kLinkTypeLoop = 108;
+const uint32_t kLinkTypeLinuxSll = 113;
+const uint32_t kLinkTypeIPv4 = 228;
+const uint32_t kLinkTypeIPv6 = 229;
+const uint32_t kLinkTypeLinuxSll2 = 276;
+
+// Ethertypes.
+const uint16_t kEtherTypeIPv4 = 0x0800;
+const uint16_t kEtherTypeIPv6 = 0x86dd;
+const uint16_t kEtherTypeVlan = 0x8100;
+const uint16_t kEtherTypeQinQ = 0x88a8;
+
+// IP protocol numbers.
+const uint8_t kProtocolHopByHop = 0;
+const uint8_t kProtocolTcp = 6;
+const uint8_t kProtocolRouting = 43;
+const uint8_t kProtocolFragment = 44;
+const uint8_t kProtocolDestinationOptions = 60;
+
+uint16_t ReadUint16(const unsigned char* data) {
+  return (data[0] << 8) | data[1];
+}
+
+uint32_t ReadUint32(const unsigned char* data) {
+  return (static_cast<uint32_t>(data[0]) << 24) |
+    (static_cast<uint32_t>(data[1]) << 16) |
+    (static_cast<uint32_t>(data[2]) << 8) |
+    data[3];
+}
+
+string AddressText(int family, const unsigned char* address, uint16_t port) {
+  char address_text[INET6_ADDRSTRLEN];
+  inet_ntop(family, address, address_text, sizeof address_text);
+
+  stringstream text;
+  if (family == AF_INET6) {
+    text << "[" << address_text << "]:" << port;
+  } else {
+    text << address_text << ":" << port;
+  }
+
+  return text.str();
+}
+}  // namespace
+
+string TcpSegment::SourceText() const {
+  return AddressText(family, source_address, source_port);
+}
+
+string TcpSegment::DestinationText() const {
+  return AddressText(family, destination_address, destination_port);
+}
+
+// static
+bool PacketDecoder::DecodeTcp(uint32_t link_type, const unsigned char* data,
+    size_t length, TcpSegment* segment) {
+  uint16_t ether_type = 0;
+  size_t offset = 0;
+
+  switch (link_type) {
+  case kLinkTypeEthernet:
+    if (length < 14) {
+      return false;
+    }
+    ether_type = ReadUint16(data + 12);
+    offset = 14;
+    while ((ether_type == kEtherTypeVlan || ether_type == kEtherTypeQinQ) &&
+        length >= offset + 4) {
+      ether_type = ReadUint16(data + offset + 2);
+      offset += 4;
+    }
+    break;
+  case kLinkTypeLinuxSll:
+    if (length < 16) {
+      return false;
+    }
+    ether_type = ReadUint16(data + 14);
+    offset = 16;
+    break;
+  case kLinkTypeLinuxSll2:
+    if (length < 20) {
+      return false;
+    }
+    ether_type = ReadUint16(data);
+    offset = 20;
+    break;
+  case kLinkTypeNull:
+  case kLinkTypeLoop: {
+    // Address family in 4 bytes, of either byte order. IPv6 family values
+    // vary between BSDs.
+    if (length < 4) {
+      return false;
+    }
+    uint32_t family = ReadUint32(data);
+    if (family > 0xffff) {
+      family = __builtin_bswap32(family);
+    }
+    ether_type = family == 2 ? kEtherTypeIPv4 :
+      (family == 24 || family == 28 || family == 30) ? kEtherTypeIPv6 : 0;
+    offset = 4;
+    break;
+  }
+  case kLinkTypeRaw:
+    if (length < 1) {
+      return false;
+    }
+    ether_type = (data[0] >> 4) == 6 ? kEtherTypeIPv6 : kEtherTypeIPv4;
+    break;
+  case kLinkTypeIPv4:
+    ether_type = kEtherTypeIPv4;
+    break;
+  case kLinkTypeIPv6:
+    ether_type = kEtherTypeIPv6;
+    break;
+  default:
+    return false;
+  }
+
+  if (offset > length) {
+    return false;
+  }
+
+  if (ether_type == kEtherTypeIPv4) {
+    return DecodeIPv4(data + offset, length - offset, segment);
+  } else if (ether_type == kEtherTypeIPv6) {
+    return DecodeIPv6(data + offset, length - offset, segment);
+  }
+
+  return false;
+}
+
+// static
+bool PacketDecoder::DecodeIPv4(const unsigned char* data, size_t length,
+    TcpSegment* segment) {
+  if (length < 20 || (data[0] >> 4) != 4) {
+    return false;
+  }
+
+  const size_t header_length = (data[0] & 0x0f) * 4;
+  const size_t total_length = ReadUint16(data + 2);
+  const uint16_t fragment = ReadUint16(data + 6);
+
+  // Ignore fragments: More fragments flag, or a non-zero offset.
+  if ((fragment & 0x3fff) != 0 || data[9] != kProtocolTcp ||
+      header_length < 20 || header_length > total_length) {
+    return false;
+  }
+
+  segment->family = AF_INET;
+  memset(segment->source_address, 0, sizeof segment->source_address);
+  memset(segment->destination_address, 0,
+      sizeof segment->destination_address);
+  memcpy(segment->source_address, data + 12, 4);
+  memcpy(segment->destination_address, data + 16, 4);
+
+  // Ethernet frames may be padded: Trust the IP total length, but never
+  // beyond the captured length.
+  const size_t ip_length = total_length < length ? total_length : length;
+  if (header_length > ip_length) {
+    return false;
+  }
+
+  return DecodeTcpHeader(data + header_length, ip_length - header_length,
+      segment);
+}
+
+// static
+bool PacketDecoder::DecodeIPv6(const unsigned char* data, size_t length,
+    TcpSegment* segment) {
+  if (length < 40 || (data[0] >> 4) != 6) {
+    return false;
+  }
+
+  const size_t payload_length = ReadUint16(data + 4);
+  uint8_t next_header = data[6];
+
+  segment->family = AF_INET6;
+  memcpy(segment->source_address, data + 8, 16);
+  memcpy(segment->destination_address, data + 24, 16);
+
+  size_t end = 40 + payload_length;
+  if (end > length) {
+    end = length;
+  }
+
+  size_t offset = 40;
+  while (next_header != kProtocolTcp) {
+    if (next_header == kProtocolFragment) {
+      return false;
+    } else if (next_header != kProtocolHopByHop &&
+        next_header != kProtocolRouting &&
+        next_header != kProtocolDestinationOptions) {
+      return false;
+    } else if (offset + 8 > end) {
+      return false;
+    }
+
+    next_header = data[offset];
+    offset += (data[offset + 1] + 1) * 8;
+  }
+
+  if (offset > end) {
+    return false;
+  }
+
+  return DecodeTcpHeader(data + offset, end - offset, segment);
+}
+
+// static
+bool PacketDecoder::DecodeTcpHeader(const unsigned char* data, size_t length,
+    TcpSegment* segment) {
+  if (length < 20) {
+    return false;
+  }
+
+  const size_t header_length = (data[12] >> 4) * 4;
+  if (header_length < 20 || header_length > length) {
+    return false;
+  }
+
+  segment->source_port = ReadUint16(data);
+  segment->destination_port = ReadUint16(data + 2);
+  segment->sequence_number = ReadUint32(data + 4);
+  segment->flags = data[13];
+  segment->payload = data + header_length;
+  segment->payload_length = length - header_length;
+
+  return true;
+}
+}  // namespace x509ls
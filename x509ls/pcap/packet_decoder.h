@@ -0,0 +1,71 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_PCAP_PACKET_DECODER_H_
+#define X509LS_PCAP_PACKET_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+// A TCP segment decoded from a captured packet.
+//
+// Addresses are stored as 16 bytes: IPv4 addresses occupy the first 4 bytes,
+// with the remainder zeroed. |payload| points into the captured packet.
+struct TcpSegment {
+  int family;  // AF_INET or AF_INET6.
+  unsigned char source_address[16];
+  unsigned char destination_address[16];
+  uint16_t source_port;
+  uint16_t destination_port;
+  uint32_t sequence_number;
+  uint8_t flags;
+  const unsigned char* payload;
+  size_t payload_length;
+
+  // TCP flags.
+  static const uint8_t kFlagFin = 0x01;
+  static const uint8_t kFlagSyn = 0x02;
+  static const uint8_t kFlagRst = 0x04;
+
+  // Return the source/destination address and port as text, e.g.
+  // "192.0.2.1:443" or "[2001:db8::1]:443".
+  string SourceText() const;
+  string DestinationText() const;
+};
+
+// Decodes captured packets down to TCP segments.
+//
+// Supports the link types most captures use: Ethernet (with 802.1Q VLAN
+// tags), Linux cooked capture v1/v2, BSD loopback and raw IP. Handles IPv4 and
+// IPv6 (skipping common extension headers). IP fragments are ignored: TLS
+// handshakes are not normally fragmented at the IP layer.
+class PacketDecoder {
+ public:
+  // Decode |length| bytes of |data|, captured with link type |link_type|.
+  //
+  // Returns true iif the packet is a TCP segment, which is then stored in
+  // |segment|. The payload is truncated to the captured length.
+  static bool DecodeTcp(uint32_t link_type, const unsigned char* data,
+      size_t length, TcpSegment* segment);
+
+ private:
+  NO_COPY_AND_ASSIGN(PacketDecoder)
+  PacketDecoder();
+
+  static bool DecodeIPv4(const unsigned char* data, size_t length,
+      TcpSegment* segment);
+  static bool DecodeIPv6(const unsigned char* data, size_t length,
+      TcpSegment* segment);
+  static bool DecodeTcpHeader(const unsigned char* data, size_t length,
+      TcpSegment* segment);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_PCAP_PACKET_DECODER_H_
@@ -0,0 +1,127 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/pcap/pcap_ingester.h"
+
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#include <sstream>
+
+#include "x509ls/batch/result_writer.h"
+#include "x509ls/certificate/trust_store.h"
+#include "x509ls/certificate/verified_chain.h"
+#include "x509ls/pcap/packet_decoder.h"
+#include "x509ls/pcap/pcap_reader.h"
+
+using std::stringstream;
+
+namespace x509ls {
+PcapIngester::PcapIngester(TrustStore* trust_store, ResultWriter* writer)
+  :
+    trust_store_(trust_store),
+    writer_(writer),
+    packet_count_(0),
+    segment_count_(0),
+    byte_count_(0),
+    chain_count_(0),
+    duplicate_count_(0) {
+}
+
+// virtual
+PcapIngester::~PcapIngester() {
+}
+
+bool PcapIngester::Ingest(const string& filename, string* error_message) {
+  PcapReader reader;
+  if (!reader.Open(filename, error_message)) {
+    return false;
+  }
+
+  TlsChainExtractor extractor(this);
+  const uint32_t link_type = reader.LinkType();
+
+  PcapReader::Packet packet;
+  TcpSegment segment;
+  while (reader.Next(&packet)) {
+    ++packet_count_;
+    if (PacketDecoder::DecodeTcp(link_type, packet.data,
+          packet.captured_length, &segment)) {
+      ++segment_count_;
+      extractor.AddSegment(segment);
+    }
+  }
+
+  byte_count_ = reader.BytesRead();
+
+  *error_message = reader.ErrorMessage();
+  if (!error_message->empty()) {
+    *error_message = filename + ": " + *error_message;
+    return false;
+  }
+
+  return true;
+}
+
+string PcapIngester::Summary() const {
+  stringstream summary;
+  summary << packet_count_ << " packets (" << byte_count_ << " bytes), ";
+  summary << segment_count_ << " TCP segments, ";
+  summary << chain_count_ << " certificate chains (";
+  summary << duplicate_count_ << " duplicates); ";
+  summary << trust_store_->Signatures()->GetStatistics().Summary();
+
+  return summary.str();
+}
+
+// virtual
+void PcapIngester::OnChain(const string& server_address,
+    const string& sni_name, const vector<string>& der_chain) {
+  ++chain_count_;
+
+  if (!seen_chains_.insert(
+        ChainDigest(server_address, sni_name, der_chain)).second) {
+    ++duplicate_count_;
+    return;
+  }
+
+  const string& target = sni_name.empty() ? server_address : sni_name;
+
+  STACK_OF(X509)* peer_chain = sk_X509_new_null();
+  for (size_t i = 0; i < der_chain.size(); ++i) {
+    const unsigned char* der =
+      reinterpret_cast<const unsigned char*>(der_chain[i].data());
+    X509* x509 = d2i_X509(NULL, &der, der_chain[i].size());
+    if (!x509) {
+      sk_X509_pop_free(peer_chain, X509_free);
+      writer_->WriteFailure(target, server_address,
+          "Unparsable certificate in captured chain");
+      return;
+    }
+    sk_X509_push(peer_chain, x509);
+  }
+
+  VerifiedChain verified_chain(trust_store_);
+  verified_chain.PopulateChainAndPath(peer_chain);
+  sk_X509_pop_free(peer_chain, X509_free);
+
+  writer_->WriteSuccess(target, server_address, verified_chain, "source=pcap");
+}
+
+// static
+string PcapIngester::ChainDigest(const string& server_address,
+    const string& sni_name, const vector<string>& der_chain) {
+  SHA_CTX sha;
+  SHA1_Init(&sha);
+  SHA1_Update(&sha, server_address.c_str(), server_address.size() + 1);
+  SHA1_Update(&sha, sni_name.c_str(), sni_name.size() + 1);
+  for (size_t i = 0; i < der_chain.size(); ++i) {
+    SHA1_Update(&sha, der_chain[i].data(), der_chain[i].size());
+  }
+
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1_Final(digest, &sha);
+
+  return string(reinterpret_cast<const char*>(digest), sizeof digest);
+}
+}  // namespace x509ls
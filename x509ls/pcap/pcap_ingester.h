@@ -0,0 +1,71 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_PCAP_PCAP_INGESTER_H_
+#define X509LS_PCAP_PCAP_INGESTER_H_
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+#include "x509ls/pcap/tls_chain_extractor.h"
+
+using std::set;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+class ResultWriter;
+class TrustStore;
+// Reads a packet capture file, and verifies every distinct server certificate
+// chain found in it.
+//
+// Chains are verified exactly as live fetches are (see VerifiedChain), and
+// written to a ResultWriter. The target is the SNI name from the ClientHello
+// where one was captured, otherwise the server address.
+//
+// A chain seen repeatedly from the same server and SNI name is only verified
+// and written once.
+class PcapIngester : public TlsChainExtractor::Listener {
+ public:
+  // Construct, verifying against |trust_store| and writing to |writer|.
+  PcapIngester(TrustStore* trust_store, ResultWriter* writer);
+  virtual ~PcapIngester();
+
+  // Read all of |filename| ("-" for standard input).
+  //
+  // Returns true iif the whole file was read. On error, |error_message| is
+  // set; results already written are kept.
+  bool Ingest(const string& filename, string* error_message);
+
+  // Return a one line summary of the packets and chains processed, and of
+  // the signature checks.
+  string Summary() const;
+
+  virtual void OnChain(const string& server_address, const string& sni_name,
+      const vector<string>& der_chain);
+
+ private:
+  NO_COPY_AND_ASSIGN(PcapIngester)
+
+  TrustStore* const trust_store_;
+  ResultWriter* const writer_;
+
+  // SHA1 digests of the (server, SNI name, chain) already written.
+  set<string> seen_chains_;
+
+  uint64_t packet_count_;
+  uint64_t segment_count_;
+  uint64_t byte_count_;
+  uint64_t chain_count_;
+  uint64_t duplicate_count_;
+
+  static string ChainDigest(const string& server_address,
+      const string& sni_name, const vector<string>& der_chain);
+};
+}  // namespace x509ls
+
+#endif  // X509LS_PCAP_PCAP_INGESTER_H_
@@ -0,0 +1,209 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/pcap/pcap_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace x509ls {
+namespace {
+// Size of the global file header and of each packet record header.
+const size_t kFileHeaderSize = 24;
+const size_t kRecordHeaderSize = 16;
+
+// Magic numbers, as read in host byte order.
+const uint32_t kMagicMicroseconds = 0xa1b2c3d4;
+const uint32_t kMagicNanoseconds = 0xa1b23c4d;
+const uint32_t kMagicMicrosecondsSwapped = 0xd4c3b2a1;
+const uint32_t kMagicNanosecondsSwapped = 0x4d3cb2a1;
+
+// Block size for reads from the capture file.
+const size_t kBlockSize = 4 * 1024 * 1024;
+
+// Largest packet record accepted. Larger records indicate a corrupt file.
+const uint32_t kMaxRecordLength = 16 * 1024 * 1024;
+}  // namespace
+
+PcapReader::PcapReader()
+  :
+    fd_(-1),
+    swapped_(false),
+    nanosecond_timestamps_(false),
+    link_type_(0),
+    buffer_(NULL),
+    buffer_size_(0),
+    buffer_start_(0),
+    buffer_end_(0),
+    end_of_file_(false),
+    bytes_read_(0) {
+}
+
+PcapReader::~PcapReader() {
+  if (fd_ > STDIN_FILENO) {
+    close(fd_);
+  }
+
+  free(buffer_);
+}
+
+bool PcapReader::Open(const string& filename, string* error_message) {
+  *error_message = "";
+
+  if (filename == "-") {
+    fd_ = STDIN_FILENO;
+  } else {
+    fd_ = open(filename.c_str(), O_RDONLY);
+  }
+
+  if (fd_ == -1) {
+    *error_message = "Unable to open " + filename + ": ";
+    error_message->append(strerror(errno));
+    return false;
+  }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  buffer_size_ = kBlockSize;
+  buffer_ = static_cast<unsigned char*>(malloc(buffer_size_));
+
+  if (!Fill(kFileHeaderSize)) {
+    *error_message = filename + " is too short to be a pcap file.";
+    return false;
+  }
+
+  const unsigned char* header = buffer_ + buffer_start_;
+  uint32_t magic;
+  memcpy(&magic, header, sizeof magic);
+
+  switch (magic) {
+  case kMagicMicroseconds:
+    break;
+  case kMagicNanoseconds:
+    nanosecond_timestamps_ = true;
+    break;
+  case kMagicMicrosecondsSwapped:
+    swapped_ = true;
+    break;
+  case kMagicNanosecondsSwapped:
+    swapped_ = true;
+    nanosecond_timestamps_ = true;
+    break;
+  default:
+    *error_message = filename +
+      " is not a pcap file (pcapng is not supported).";
+    return false;
+  }
+
+  link_type_ = ReadUint32(header + 20) & 0xffff;
+
+  buffer_start_ += kFileHeaderSize;
+  bytes_read_ += kFileHeaderSize;
+
+  return true;
+}
+
+bool PcapReader::Next(Packet* packet) {
+  if (!Fill(kRecordHeaderSize)) {
+    if (buffer_end_ != buffer_start_ && error_message_.empty()) {
+      error_message_ = "Truncated packet record header.";
+    }
+    return false;
+  }
+
+  const unsigned char* header = buffer_ + buffer_start_;
+  const uint32_t captured_length = ReadUint32(header + 8);
+
+  if (captured_length > kMaxRecordLength) {
+    error_message_ = "Corrupt packet record (invalid length).";
+    return false;
+  }
+
+  if (!Fill(kRecordHeaderSize + captured_length)) {
+    if (error_message_.empty()) {
+      error_message_ = "Truncated packet record.";
+    }
+    return false;
+  }
+
+  // Fill() may have moved the buffered data.
+  header = buffer_ + buffer_start_;
+
+  packet->timestamp_seconds = ReadUint32(header);
+  packet->timestamp_microseconds = ReadUint32(header + 4);
+  if (nanosecond_timestamps_) {
+    packet->timestamp_microseconds /= 1000;
+  }
+  packet->captured_length = captured_length;
+  packet->original_length = ReadUint32(header + 12);
+  packet->data = header + kRecordHeaderSize;
+
+  buffer_start_ += kRecordHeaderSize + captured_length;
+  bytes_read_ += kRecordHeaderSize + captured_length;
+
+  return true;
+}
+
+uint32_t PcapReader::LinkType() const {
+  return link_type_;
+}
+
+uint64_t PcapReader::BytesRead() const {
+  return bytes_read_;
+}
+
+string PcapReader::ErrorMessage() const {
+  return error_message_;
+}
+
+bool PcapReader::Fill(size_t length) {
+  while (buffer_end_ - buffer_start_ < length) {
+    if (end_of_file_) {
+      return false;
+    }
+
+    // Move the unconsumed tail to the front to make room for a new block.
+    if (buffer_start_ > 0) {
+      memmove(buffer_, buffer_ + buffer_start_, buffer_end_ - buffer_start_);
+      buffer_end_ -= buffer_start_;
+      buffer_start_ = 0;
+    }
+
+    if (length > buffer_size_) {
+      buffer_size_ = length;
+      buffer_ = static_cast<unsigned char*>(realloc(buffer_, buffer_size_));
+    }
+
+    ssize_t bytes;
+    do {
+      bytes = read(fd_, buffer_ + buffer_end_, buffer_size_ - buffer_end_);
+    } while (bytes == -1 && errno == EINTR);
+    if (bytes < 0) {
+      error_message_ = "Read error: ";
+      error_message_.append(strerror(errno));
+      end_of_file_ = true;
+      return false;
+    } else if (bytes == 0) {
+      end_of_file_ = true;
+    }
+
+    buffer_end_ += bytes;
+  }
+
+  return true;
+}
+
+uint32_t PcapReader::ReadUint32(const unsigned char* data) const {
+  uint32_t value;
+  memcpy(&value, data, sizeof value);
+
+  return swapped_ ? __builtin_bswap32(value) : value;
+}
+}  // namespace x509ls
@@ -0,0 +1,93 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_PCAP_PCAP_READER_H_
+#define X509LS_PCAP_PCAP_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "x509ls/base/types.h"
+
+using std::string;
+
+namespace x509ls {
+// Streaming reader for pcap(5) packet capture files.
+//
+// Reads the classic libpcap file format, in either byte order, with
+// microsecond or nanosecond timestamps. pcapng files are not supported.
+//
+// Designed for multi-gigabyte captures: The file is read sequentially in
+// large blocks, and packets are returned as pointers into the block buffer
+// rather than being copied. Memory use is constant regardless of file size.
+//
+// Usage:
+//   PcapReader reader;
+//   if (!reader.Open(filename, &error_message)) { ... }
+//   PcapReader::Packet packet;
+//   while (reader.Next(&packet)) { ... }
+class PcapReader {
+ public:
+  PcapReader();
+  ~PcapReader();
+
+  // A captured packet. |data| is only valid until the next call to Next().
+  struct Packet {
+    const unsigned char* data;
+    uint32_t captured_length;
+    uint32_t original_length;
+    uint32_t timestamp_seconds;
+    uint32_t timestamp_microseconds;
+  };
+
+  // Open |filename| and read the file header. Use "-" for standard input.
+  //
+  // Returns true iif the file is a readable pcap file. On error,
+  // |error_message| is set to a short string describing the problem.
+  bool Open(const string& filename, string* error_message);
+
+  // Read the next |packet|. Returns false at the end of the file, or if the
+  // file is truncated or corrupt (see ErrorMessage()).
+  bool Next(Packet* packet);
+
+  // Return the link-layer header type (e.g. 1 for Ethernet), as listed in
+  // pcap-linktype(7).
+  uint32_t LinkType() const;
+
+  // Return the number of bytes consumed so far.
+  uint64_t BytesRead() const;
+
+  // Return a description of why Next() stopped early, or "" at the end of a
+  // well formed file.
+  string ErrorMessage() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(PcapReader)
+
+  int fd_;
+
+  bool swapped_;
+  bool nanosecond_timestamps_;
+  uint32_t link_type_;
+
+  // Block buffer: Bytes [|buffer_start_|, |buffer_end_|) are unconsumed.
+  unsigned char* buffer_;
+  size_t buffer_size_;
+  size_t buffer_start_;
+  size_t buffer_end_;
+  bool end_of_file_;
+
+  uint64_t bytes_read_;
+  string error_message_;
+
+  // Ensure at least |length| unconsumed bytes are buffered. Returns false if
+  // the end of the file is reached first.
+  bool Fill(size_t length);
+
+  uint32_t ReadUint32(const unsigned char* data) const;
+};
+}  // namespace x509ls
+
+#endif  // X509LS_PCAP_PCAP_READER_H_
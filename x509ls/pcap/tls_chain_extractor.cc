@@ -0,0 +1,441 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#include "x509ls/pcap/tls_chain_extractor.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace x509ls {
+namespace {
+// TLS record content types.
+const unsigned char kContentChangeCipherSpec = 20;
+const unsigned char kContentAlert = 21;
+const unsigned char kContentHandshake = 22;
+const unsigned char kContentApplicationData = 23;
+const unsigned char kContentHeartbeat = 24;
+
+// TLS handshake message types.
+const unsigned char kHandshakeClientHello = 1;
+const unsigned char kHandshakeServerHello = 2;
+const unsigned char kHandshakeCertificate = 11;
+
+// TLS extension types.
+const uint16_t kExtensionServerName = 0;
+
+// Size of a TLS record header, and the largest valid record payload
+// (2^14 plus the maximum compression/encryption expansion).
+const size_t kRecordHeaderSize = 5;
+const size_t kMaxRecordLength = 18432;
+
+// Size of a TLS handshake message header, and the largest handshake message
+// reassembled.
+const size_t kHandshakeHeaderSize = 4;
+const size_t kMaxHandshakeLength = 256 * 1024;
+
+// Maximum out-of-order bytes buffered per stream.
+const size_t kMaxOutOfOrderBytes = 256 * 1024;
+
+// Maximum number of streams tracked at once.
+const size_t kMaxStreams = 65536;
+
+uint16_t ReadUint16(const unsigned char* data) {
+  return (data[0] << 8) | data[1];
+}
+
+uint32_t ReadUint24(const unsigned char* data) {
+  return (data[0] << 16) | (data[1] << 8) | data[2];
+}
+}  // namespace
+
+TlsChainExtractor::Stream::Stream()
+  :
+    next_sequence(0),
+    finished(false),
+    out_of_order_bytes(0),
+    last_used(0) {
+}
+
+bool TlsChainExtractor::StreamKey::operator<(const StreamKey& other) const {
+  return memcmp(bytes, other.bytes, sizeof bytes) < 0;
+}
+
+TlsChainExtractor::TlsChainExtractor(Listener* listener)
+  :
+    listener_(listener),
+    segment_count_(0) {
+}
+
+TlsChainExtractor::~TlsChainExtractor() {
+  for (StreamMap::iterator i = streams_.begin(); i != streams_.end(); ++i) {
+    delete i->second;
+  }
+}
+
+void TlsChainExtractor::AddSegment(const TcpSegment& segment) {
+  ++segment_count_;
+
+  const StreamKey key = MakeKey(segment, false);
+  StreamMap::iterator i = streams_.find(key);
+
+  if (segment.flags & (TcpSegment::kFlagFin | TcpSegment::kFlagRst)) {
+    if (i != streams_.end()) {
+      delete i->second;
+      streams_.erase(i);
+    }
+    return;
+  }
+
+  if (segment.payload_length == 0) {
+    return;
+  }
+
+  Stream* stream;
+  if (i == streams_.end()) {
+    // Only track streams which start with a TLS handshake record.
+    if (!IsHandshakeRecordStart(segment.payload, segment.payload_length)) {
+      return;
+    }
+
+    if (streams_.size() >= kMaxStreams) {
+      Evict();
+    }
+
+    stream = new Stream();
+    stream->next_sequence = segment.sequence_number;
+    streams_[key] = stream;
+  } else {
+    stream = i->second;
+  }
+
+  stream->last_used = segment_count_;
+  if (stream->finished) {
+    return;
+  }
+
+  const unsigned char* data = segment.payload;
+  size_t length = segment.payload_length;
+
+  // Signed distance from the next expected byte, allowing for wraparound.
+  const int32_t offset =
+    static_cast<int32_t>(segment.sequence_number - stream->next_sequence);
+
+  if (offset < 0) {
+    // Retransmission: Skip the bytes already seen.
+    const size_t overlap = static_cast<size_t>(-static_cast<int64_t>(offset));
+    if (overlap >= length) {
+      return;
+    }
+    data += overlap;
+    length -= overlap;
+  } else if (offset > 0) {
+    // Arrived early: Hold until the gap is filled.
+    if (stream->out_of_order_bytes + length > kMaxOutOfOrderBytes) {
+      Finish(stream);
+      return;
+    }
+
+    string& held = stream->out_of_order[segment.sequence_number];
+    if (held.size() < length) {
+      stream->out_of_order_bytes += length - held.size();
+      held.assign(reinterpret_cast<const char*>(data), length);
+    }
+    return;
+  }
+
+  Append(segment, stream, data, length);
+
+  // Release any held segments the new data made contiguous.
+  while (!stream->finished && !stream->out_of_order.empty()) {
+    map<uint32_t, string>::iterator next = stream->out_of_order.begin();
+    const int32_t held_offset =
+      static_cast<int32_t>(next->first - stream->next_sequence);
+    if (held_offset > 0) {
+      break;
+    }
+
+    const string held = next->second;
+    stream->out_of_order_bytes -= held.size();
+    stream->out_of_order.erase(next);
+
+    const size_t overlap = static_cast<size_t>(-held_offset);
+    if (overlap < held.size()) {
+      Append(segment, stream,
+          reinterpret_cast<const unsigned char*>(held.data()) + overlap,
+          held.size() - overlap);
+    }
+  }
+}
+
+size_t TlsChainExtractor::StreamCount() const {
+  return streams_.size();
+}
+
+// static
+TlsChainExtractor::StreamKey TlsChainExtractor::MakeKey(
+    const TcpSegment& segment, bool reverse) {
+  const unsigned char* source =
+    reverse ? segment.destination_address : segment.source_address;
+  const unsigned char* destination =
+    reverse ? segment.source_address : segment.destination_address;
+  const uint16_t source_port =
+    reverse ? segment.destination_port : segment.source_port;
+  const uint16_t destination_port =
+    reverse ? segment.source_port : segment.destination_port;
+
+  StreamKey key;
+  unsigned char* p = key.bytes;
+  *p++ = static_cast<unsigned char>(segment.family);
+  memcpy(p, source, 16);
+  p += 16;
+  memcpy(p, destination, 16);
+  p += 16;
+  *p++ = source_port >> 8;
+  *p++ = source_port & 0xff;
+  *p++ = destination_port >> 8;
+  *p++ = destination_port & 0xff;
+
+  return key;
+}
+
+// static
+bool TlsChainExtractor::IsHandshakeRecordStart(const unsigned char* data,
+    size_t length) {
+  // Handshake content type, SSL 3.0/TLS 1.x record version, and a first
+  // handshake message of ClientHello or ServerHello.
+  return length >= kRecordHeaderSize + 1 &&
+    data[0] == kContentHandshake &&
+    data[1] == 3 && data[2] <= 3 &&
+    ReadUint16(data + 3) <= kMaxRecordLength &&
+    (data[5] == kHandshakeClientHello || data[5] == kHandshakeServerHello);
+}
+
+void TlsChainExtractor::Append(const TcpSegment& segment, Stream* stream,
+    const unsigned char* data, size_t length) {
+  stream->next_sequence += length;
+  stream->records.append(reinterpret_cast<const char*>(data), length);
+
+  ParseRecords(segment, stream);
+}
+
+void TlsChainExtractor::ParseRecords(const TcpSegment& segment,
+    Stream* stream) {
+  size_t offset = 0;
+
+  while (!stream->finished &&
+      stream->records.size() - offset >= kRecordHeaderSize) {
+    const unsigned char* record =
+      reinterpret_cast<const unsigned char*>(stream->records.data()) + offset;
+    const unsigned char content_type = record[0];
+    const size_t record_length = ReadUint16(record + 3);
+
+    if (content_type < kContentChangeCipherSpec ||
+        content_type > kContentHeartbeat || record[1] != 3 ||
+        record_length > kMaxRecordLength) {
+      // Not TLS, or lost synchronisation.
+      Finish(stream);
+      return;
+    }
+
+    if (stream->records.size() - offset < kRecordHeaderSize + record_length) {
+      break;
+    }
+
+    if (content_type == kContentChangeCipherSpec ||
+        content_type == kContentApplicationData ||
+        content_type == kContentAlert) {
+      // Everything from here on is encrypted, or the handshake failed.
+      Finish(stream);
+      return;
+    }
+
+    if (content_type == kContentHandshake) {
+      stream->handshake.append(
+          reinterpret_cast<const char*>(record + kRecordHeaderSize),
+          record_length);
+      ParseHandshake(segment, stream);
+    }
+
+    offset += kRecordHeaderSize + record_length;
+  }
+
+  if (!stream->finished) {
+    stream->records.erase(0, offset);
+  }
+}
+
+void TlsChainExtractor::ParseHandshake(const TcpSegment& segment,
+    Stream* stream) {
+  size_t offset = 0;
+
+  while (!stream->finished &&
+      stream->handshake.size() - offset >= kHandshakeHeaderSize) {
+    const unsigned char* message =
+      reinterpret_cast<const unsigned char*>(stream->handshake.data()) +
+      offset;
+    const unsigned char message_type = message[0];
+    const size_t message_length = ReadUint24(message + 1);
+
+    if (message_length > kMaxHandshakeLength) {
+      Finish(stream);
+      return;
+    }
+
+    if (stream->handshake.size() - offset <
+        kHandshakeHeaderSize + message_length) {
+      break;
+    }
+
+    const unsigned char* body = message + kHandshakeHeaderSize;
+    if (message_type == kHandshakeClientHello) {
+      // Nothing else is needed from the client.
+      ParseClientHello(body, message_length, stream);
+      Finish(stream);
+      return;
+    } else if (message_type == kHandshakeCertificate) {
+      ParseCertificate(segment, body, message_length);
+      Finish(stream);
+      return;
+    }
+
+    offset += kHandshakeHeaderSize + message_length;
+  }
+
+  stream->handshake.erase(0, offset);
+}
+
+void TlsChainExtractor::ParseClientHello(const unsigned char* data,
+    size_t length, Stream* stream) {
+  // Version and random.
+  size_t offset = 2 + 32;
+
+  // Session ID, cipher suites, compression methods.
+  if (offset + 1 > length) {
+    return;
+  }
+  offset += 1 + data[offset];
+  if (offset + 2 > length) {
+    return;
+  }
+  offset += 2 + ReadUint16(data + offset);
+  if (offset + 1 > length) {
+    return;
+  }
+  offset += 1 + data[offset];
+
+  // Extensions.
+  if (offset + 2 > length) {
+    return;
+  }
+  size_t extensions_end = offset + 2 + ReadUint16(data + offset);
+  offset += 2;
+  if (extensions_end > length) {
+    extensions_end = length;
+  }
+
+  while (offset + 4 <= extensions_end) {
+    const uint16_t extension_type = ReadUint16(data + offset);
+    const size_t extension_length = ReadUint16(data + offset + 2);
+    offset += 4;
+    if (offset + extension_length > extensions_end) {
+      return;
+    }
+
+    if (extension_type == kExtensionServerName) {
+      // ServerNameList: Take the first host_name entry.
+      size_t name_offset = offset + 2;
+      const size_t names_end = offset + extension_length;
+      while (name_offset + 3 <= names_end) {
+        const unsigned char name_type = data[name_offset];
+        const size_t name_length = ReadUint16(data + name_offset + 1);
+        name_offset += 3;
+        if (name_offset + name_length > names_end) {
+          return;
+        }
+        if (name_type == 0) {
+          stream->sni_name.assign(
+              reinterpret_cast<const char*>(data + name_offset), name_length);
+          return;
+        }
+        name_offset += name_length;
+      }
+      return;
+    }
+
+    offset += extension_length;
+  }
+}
+
+void TlsChainExtractor::ParseCertificate(const TcpSegment& segment,
+    const unsigned char* data, size_t length) {
+  if (length < 3) {
+    return;
+  }
+
+  size_t list_end = 3 + ReadUint24(data);
+  if (list_end > length) {
+    return;
+  }
+
+  vector<string> der_chain;
+  size_t offset = 3;
+  while (offset + 3 <= list_end) {
+    const size_t certificate_length = ReadUint24(data + offset);
+    offset += 3;
+    if (offset + certificate_length > list_end) {
+      return;
+    }
+    der_chain.push_back(string(reinterpret_cast<const char*>(data + offset),
+          certificate_length));
+    offset += certificate_length;
+  }
+
+  if (der_chain.empty()) {
+    return;
+  }
+
+  // The SNI name, if any, was sent by the client on the reverse stream.
+  string sni_name;
+  StreamMap::const_iterator client = streams_.find(MakeKey(segment, true));
+  if (client != streams_.end()) {
+    sni_name = client->second->sni_name;
+  }
+
+  listener_->OnChain(segment.SourceText(), sni_name, der_chain);
+}
+
+// static
+void TlsChainExtractor::Finish(Stream* stream) {
+  stream->finished = true;
+
+  // Free the buffers, not just clear them.
+  string().swap(stream->records);
+  string().swap(stream->handshake);
+  stream->out_of_order.clear();
+  stream->out_of_order_bytes = 0;
+}
+
+void TlsChainExtractor::Evict() {
+  vector<uint64_t> last_used;
+  last_used.reserve(streams_.size());
+  for (StreamMap::const_iterator i = streams_.begin(); i != streams_.end();
+      ++i) {
+    last_used.push_back(i->second->last_used);
+  }
+
+  vector<uint64_t>::iterator median = last_used.begin() + last_used.size() / 2;
+  std::nth_element(last_used.begin(), median, last_used.end());
+  const uint64_t cutoff = *median;
+
+  StreamMap::iterator i = streams_.begin();
+  while (i != streams_.end()) {
+    if (i->second->last_used <= cutoff) {
+      delete i->second;
+      streams_.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+}
+}  // namespace x509ls
@@ -0,0 +1,125 @@
+// X509LS
+// Copyright 2013 Tom Harwood
+
+#ifndef X509LS_PCAP_TLS_CHAIN_EXTRACTOR_H_
+#define X509LS_PCAP_TLS_CHAIN_EXTRACTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "x509ls/base/types.h"
+#include "x509ls/pcap/packet_decoder.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace x509ls {
+// Extracts server certificate chains from captured TLS handshakes.
+//
+// Each direction of each TCP connection is reassembled just far enough to
+// parse the plaintext TLS handshake: The ClientHello (for the SNI name) and
+// the server's Certificate message. Reassembly of a stream stops as soon as
+// these are found, or when the stream turns out not to be TLS.
+//
+// Only TLS 1.0-1.2 handshakes can be extracted: TLS 1.3 encrypts the
+// Certificate message.
+//
+// Memory use is bounded: Streams are only tracked once they start with a TLS
+// handshake record, buffered data per stream is capped, and the least recently
+// used streams are dropped once too many are tracked.
+class TlsChainExtractor {
+ public:
+  // Receives each extracted chain.
+  class Listener {
+   public:
+    virtual ~Listener() {}
+
+    // |server_address| is the server's "address:port". |sni_name| is the
+    // server name from the matching ClientHello, or "" if unknown.
+    // |der_chain| holds the DER encoded certificates, in the order sent by the
+    // server (end-entity certificate first).
+    virtual void OnChain(const string& server_address, const string& sni_name,
+        const vector<string>& der_chain) = 0;
+  };
+
+  // Construct, reporting chains to |listener|.
+  explicit TlsChainExtractor(Listener* listener);
+  ~TlsChainExtractor();
+
+  // Process the next captured TCP |segment|. Segments must be supplied in
+  // capture order.
+  void AddSegment(const TcpSegment& segment);
+
+  // Return the number of streams currently tracked.
+  size_t StreamCount() const;
+
+ private:
+  NO_COPY_AND_ASSIGN(TlsChainExtractor)
+
+  // Identifies one direction of a TCP connection.
+  struct StreamKey {
+    unsigned char bytes[1 + 16 + 16 + 2 + 2];
+
+    bool operator<(const StreamKey& other) const;
+  };
+
+  struct Stream {
+    Stream();
+
+    // Sequence number of the next byte expected.
+    uint32_t next_sequence;
+
+    // Set once nothing more is needed from this stream. The entry is kept
+    // (with its buffers freed) so later segments are ignored cheaply.
+    bool finished;
+
+    // Server name from a ClientHello sent on this stream.
+    string sni_name;
+
+    // Reassembled bytes not yet parsed as complete TLS records.
+    string records;
+
+    // Handshake record payloads not yet parsed as complete messages.
+    string handshake;
+
+    // Segments received ahead of |next_sequence|, keyed by sequence number.
+    map<uint32_t, string> out_of_order;
+    size_t out_of_order_bytes;
+
+    // Value of |segment_count_| when the stream was last used.
+    uint64_t last_used;
+  };
+
+  typedef map<StreamKey, Stream*> StreamMap;
+
+  Listener* const listener_;
+  StreamMap streams_;
+  uint64_t segment_count_;
+
+  static StreamKey MakeKey(const TcpSegment& segment, bool reverse);
+  static bool IsHandshakeRecordStart(const unsigned char* data, size_t length);
+
+  // Append in-order |data| to |stream|, then parse any complete records.
+  void Append(const TcpSegment& segment, Stream* stream,
+      const unsigned char* data, size_t length);
+
+  void ParseRecords(const TcpSegment& segment, Stream* stream);
+  void ParseHandshake(const TcpSegment& segment, Stream* stream);
+  void ParseClientHello(const unsigned char* data, size_t length,
+      Stream* stream);
+  void ParseCertificate(const TcpSegment& segment, const unsigned char* data,
+      size_t length);
+
+  static void Finish(Stream* stream);
+
+  // Drop the least recently used half of the streams.
+  void Evict();
+};
+}  // namespace x509ls
+
+#endif  // X509LS_PCAP_TLS_CHAIN_EXTRACTOR_H_
@@ -5,32 +5,99 @@
 
 #include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <string>
 
+#include "x509ls/base/metrics.h"
+#include "x509ls/base/metrics_exporter.h"
+#include "x509ls/base/trace_recorder.h"
+#include "x509ls/batch/batch_runner.h"
+#include "x509ls/batch/result_writer.h"
 #include "x509ls/cli/certificate_list_layout.h"
+#include "x509ls/net/fetch_metrics.h"
+#include "x509ls/net/stub_resolver.h"
+#include "x509ls/net/uring_backend.h"
+#include "x509ls/pcap/pcap_ingester.h"
 
 using std::string;
 
 namespace x509ls {
+namespace {
+// Default batch mode connection rate limits, per second. Unlimited globally,
+// but gentle on any one destination.
+const double kDefaultSubnetRate = 20;
+const double kDefaultAddressRate = 5;
+
+// Default interval between rewrites of the metrics file.
+const int kDefaultMetricsIntervalSeconds = 10;
+}  // namespace
+
 X509LS::X509LS()
   :
-    CliApplication() {
+    CliApplication(),
+    chain_cache_(NULL),
+    ocsp_(false),
+    batch_concurrency_(0),
+    batch_threads_(1),
+    batch_bio_pair_(false),
+    batch_io_uring_(false),
+    batch_stub_resolver_(false),
+    global_rate_(0),
+    subnet_rate_(kDefaultSubnetRate),
+    address_rate_(kDefaultAddressRate),
+    metrics_interval_seconds_(kDefaultMetricsIntervalSeconds),
+    metrics_registry_(NULL),
+    fetch_metrics_(NULL),
+    metrics_exporter_(NULL) {
 }
 
 // virtual
 X509LS::~X509LS() {
+  delete chain_cache_;
+  delete metrics_exporter_;
+  delete fetch_metrics_;
+  delete metrics_registry_;
+
+  // If Init() failed after starting the trace.
+  string unused;
+  TraceRecorder::Stop(&unused);
 }
 
 bool X509LS::Init(int argc, char** argv) {
   static const struct option options[] = {
     {"capath", required_argument, NULL, 'p'},
     {"cafile", required_argument, NULL, 'f'},
+    {"crl-dir", required_argument, NULL, 'k'},
+    {"ocsp", no_argument, NULL, 'q'},
+    {"cache-dir", required_argument, NULL, 'c'},
+    {"cache-ttl", required_argument, NULL, 'l'},
+    {"pcap", required_argument, NULL, 'r'},
+    {"batch", required_argument, NULL, 'b'},
+    {"concurrency", required_argument, NULL, 'n'},
+    {"threads", required_argument, NULL, 't'},
+    {"bio-pair", no_argument, NULL, 'o'},
+    {"io-uring", no_argument, NULL, 'u'},
+    {"stub-resolver", no_argument, NULL, 'd'},
+    {"nameserver", required_argument, NULL, 'a'},
+    {"resolve", required_argument, NULL, 'e'},
+    {"resolve-file", required_argument, NULL, 'm'},
+    {"rate", required_argument, NULL, 'g'},
+    {"rate-per-subnet", required_argument, NULL, 's'},
+    {"rate-per-ip", required_argument, NULL, 'i'},
+    {"metrics", required_argument, NULL, 'x'},
+    {"metrics-interval", required_argument, NULL, 'y'},
+    {"trace", required_argument, NULL, 'z'},
     {0, 0, 0, 0}
   };
 
+  // Default chain cache entry lifetime, in seconds.
+  const int kDefaultCacheTTL = 3600;
+
   bool success = true;
   bool custom_trust_store = false;
+  string cache_directory;
+  int cache_ttl = kDefaultCacheTTL;
   int getopt_flag;
   string error_message;
   do {
@@ -52,6 +119,105 @@ bool X509LS::Init(int argc, char** argv) {
       }
       custom_trust_store = true;
       break;
+    case 'k':
+      if (!trust_store_.AddCRLDir(optarg, &error_message)) {
+        success = false;
+        fprintf(stderr, "%s\n", error_message.c_str());
+      }
+      break;
+    case 'q':
+      ocsp_ = true;
+      break;
+    case 'c':
+      cache_directory = optarg;
+      break;
+    case 'l':
+      cache_ttl = atoi(optarg);
+      if (cache_ttl <= 0) {
+        fprintf(stderr, "Invalid --cache-ttl, expecting seconds > 0.\n");
+        success = false;
+      }
+      break;
+    case 'r':
+      pcap_filename_ = optarg;
+      SetHeadless(true);
+      break;
+    case 'b':
+      batch_filename_ = optarg;
+      SetHeadless(true);
+      break;
+    case 'n':
+      if (atoi(optarg) <= 0) {
+        fprintf(stderr, "Invalid --concurrency, expecting a number > 0.\n");
+        success = false;
+      }
+      batch_concurrency_ = atoi(optarg);
+      break;
+    case 't':
+      if (atoi(optarg) <= 0) {
+        fprintf(stderr, "Invalid --threads, expecting a number > 0.\n");
+        success = false;
+      }
+      batch_threads_ = atoi(optarg);
+      break;
+    case 'o':
+      batch_bio_pair_ = true;
+      break;
+    case 'u':
+      batch_io_uring_ = true;
+      break;
+    case 'd':
+      batch_stub_resolver_ = true;
+      break;
+    case 'a':
+      if (!StubResolver::IsValidNameserver(optarg)) {
+        fprintf(stderr, "Invalid --nameserver, expecting address[:port].\n");
+        success = false;
+      }
+      batch_nameservers_.push_back(optarg);
+      batch_stub_resolver_ = true;
+      break;
+    case 'e':
+      if (!address_map_.Add(optarg, &error_message)) {
+        fprintf(stderr, "%s\n", error_message.c_str());
+        success = false;
+      }
+      break;
+    case 'm':
+      if (!address_map_.LoadFile(optarg, &error_message)) {
+        fprintf(stderr, "%s\n", error_message.c_str());
+        success = false;
+      }
+      break;
+    case 'g':
+      if (!ReadRate(optarg, &global_rate_)) {
+        success = false;
+      }
+      break;
+    case 's':
+      if (!ReadRate(optarg, &subnet_rate_)) {
+        success = false;
+      }
+      break;
+    case 'i':
+      if (!ReadRate(optarg, &address_rate_)) {
+        success = false;
+      }
+      break;
+    case 'x':
+      metrics_filename_ = optarg;
+      break;
+    case 'y':
+      metrics_interval_seconds_ = atoi(optarg);
+      if (metrics_interval_seconds_ <= 0) {
+        fprintf(stderr,
+            "Invalid --metrics-interval, expecting seconds > 0.\n");
+        success = false;
+      }
+      break;
+    case 'z':
+      trace_filename_ = optarg;
+      break;
     case -1:
       // No more options to parse.
       break;
@@ -65,7 +231,39 @@ bool X509LS::Init(int argc, char** argv) {
     trust_store_.AddSystemCAPath();
   }
 
-  if (optind == argc - 1) {
+  if (!cache_directory.empty()) {
+    chain_cache_ = new ChainCache(cache_directory, cache_ttl);
+    if (!chain_cache_->Init(&error_message)) {
+      fprintf(stderr, "%s\n", error_message.c_str());
+      success = false;
+    }
+  }
+
+  if (success && !metrics_filename_.empty() && !InitMetrics()) {
+    success = false;
+  }
+
+  if (success && !trace_filename_.empty() &&
+      !TraceRecorder::Start(trace_filename_, &error_message)) {
+    fprintf(stderr, "%s\n", error_message.c_str());
+    success = false;
+  }
+
+  if (batch_io_uring_ && !UringBackend::IsAvailable(&error_message)) {
+    fprintf(stderr, "%s Continuing without --io-uring.\n",
+        error_message.c_str());
+    batch_io_uring_ = false;
+  }
+
+  if (!pcap_filename_.empty() && !batch_filename_.empty()) {
+    fprintf(stderr, "Use only one of --pcap and --batch.\n");
+    success = false;
+  } else if ((!pcap_filename_.empty() || !batch_filename_.empty()) &&
+      optind < argc) {
+    fprintf(stderr,
+        "Unexpected arguments, --pcap/--batch take no host:port.\n");
+    success = false;
+  } else if (optind == argc - 1) {
     host_port_ = argv[optind];
   } else if (optind < argc - 1) {
     fprintf(stderr,
@@ -78,12 +276,110 @@ bool X509LS::Init(int argc, char** argv) {
 
 // virtual
 void X509LS::RunEvent() {
+  if (!pcap_filename_.empty()) {
+    Exit(RunPcap());
+    return;
+  } else if (!batch_filename_.empty()) {
+    Exit(RunBatch());
+    return;
+  }
+
   CertificateListLayout* app = new CertificateListLayout(this, &trust_store_);
+  app->SetChainCache(chain_cache_);
+  app->SetAddressMap(&address_map_);
+  app->SetMetrics(fetch_metrics_);
+  app->SetOCSPCache(ocsp_ ? &ocsp_cache_ : NULL);
+  if (metrics_exporter_) {
+    metrics_exporter_->StartPolling();
+  }
   Show(app);  // Ownership of app transfered here.
 
   if (!host_port_.empty()) {
     app->GotoHost(host_port_);
   }
 }
+
+// virtual
+void X509LS::ExitEvent() {
+  string error_message;
+  if (metrics_exporter_ != NULL &&
+      !metrics_exporter_->Write(&error_message) && IsHeadless()) {
+    fprintf(stderr, "%s\n", error_message.c_str());
+  }
+
+  // Batch worker threads have exited by now.
+  if (!TraceRecorder::Stop(&error_message) && IsHeadless()) {
+    fprintf(stderr, "%s\n", error_message.c_str());
+  }
+}
+
+bool X509LS::InitMetrics() {
+  metrics_registry_ = new MetricsRegistry();
+  fetch_metrics_ = new FetchMetrics(metrics_registry_);
+  metrics_exporter_ = new MetricsExporter(this, metrics_registry_,
+      metrics_filename_, metrics_interval_seconds_ * 1000);
+  SetLoopHistogram(fetch_metrics_->EventLoopHistogram());
+
+  string error_message;
+  if (!metrics_exporter_->Write(&error_message)) {
+    fprintf(stderr, "%s\n", error_message.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool X509LS::RunPcap() {
+  ResultWriter writer(stdout);
+  PcapIngester ingester(&trust_store_, &writer);
+
+  string error_message;
+  const bool success = ingester.Ingest(pcap_filename_, &error_message);
+  if (!success) {
+    fprintf(stderr, "%s\n", error_message.c_str());
+  }
+
+  fprintf(stderr, "%s\n", ingester.Summary().c_str());
+
+  return success;
+}
+
+bool X509LS::RunBatch() {
+  BatchRunner runner(&trust_store_, chain_cache_, stdout);
+  runner.SetThreadCount(batch_threads_);
+  if (batch_concurrency_ > 0) {
+    runner.SetConcurrency(batch_concurrency_);
+  }
+  runner.SetRateLimits(global_rate_, subnet_rate_, address_rate_);
+  runner.SetAddressMap(&address_map_);
+  runner.SetBioPair(batch_bio_pair_);
+  runner.SetIoUring(batch_io_uring_);
+  runner.SetStubResolver(batch_stub_resolver_, batch_nameservers_);
+  runner.SetOCSP(ocsp_);
+  runner.SetMetrics(fetch_metrics_, metrics_exporter_);
+
+  string error_message;
+  if (!runner.Run(batch_filename_, &error_message)) {
+    fprintf(stderr, "%s\n", error_message.c_str());
+    return false;
+  }
+
+  fprintf(stderr, "%s\n", runner.Summary().c_str());
+
+  return true;
+}
+
+// static
+bool X509LS::ReadRate(const char* text, double* rate) {
+  char* end;
+  *rate = strtod(text, &end);
+  if (*end != '\0' || *rate < 0) {
+    fprintf(stderr, "Invalid rate %s, expecting connections/second >= 0.\n",
+        text);
+    return false;
+  }
+
+  return true;
+}
 }  // namespace x509ls
 
@@ -5,20 +5,37 @@
 #define X509LS_X509LS_H_
 
 #include <string>
+#include <vector>
 
 #include "x509ls/base/openssl/openssl_environment.h"
 #include "x509ls/base/types.h"
+#include "x509ls/certificate/chain_cache.h"
+#include "x509ls/certificate/ocsp_cache.h"
 #include "x509ls/certificate/trust_store.h"
 #include "x509ls/cli/base/cli_application.h"
+#include "x509ls/net/address_map.h"
 
 using std::string;
+using std::vector;
 
 namespace x509ls {
+class FetchMetrics;
+class MetricsExporter;
+class MetricsRegistry;
+
 // Main x509ls application.
 //
 // Processes command line options. sets up the TrustStore, then starts the
 // X509LS ncurses interfaces.
 //
+// With --pcap or --batch, runs headless instead: The certificate chains in a
+// packet capture file, or of a list of targets, are verified and written to
+// stdout.
+//
+// With --metrics, fetch metrics are written to a Prometheus text file while
+// running, and once more on exit. With --trace, event loop and fetch spans
+// are written to a Chrome trace event file (see TraceRecorder).
+//
 // The usage from main() is:
 //  X509LS x509ls;
 //  if (!x509ls.Init(argc, argv)) {
@@ -40,12 +57,67 @@ class X509LS : public CliApplication {
  protected:
   virtual void RunEvent();
 
+  // Writes the final metrics file and finishes the trace file, if any.
+  virtual void ExitEvent();
+
  private:
   NO_COPY_AND_ASSIGN(X509LS)
 
   ScopedOpenSSLEnvironment openssl_;
   TrustStore trust_store_;
   string host_port_;
+
+  // Optional cache of fetched chains, NULL if disabled.
+  ChainCache* chain_cache_;
+
+  // Known destination addresses (--resolve, --resolve-file), bypassing DNS.
+  AddressMap address_map_;
+
+  // Query OCSP responders (--ocsp), caching results in |ocsp_cache_|.
+  bool ocsp_;
+  OCSPCache ocsp_cache_;
+
+  // Packet capture file to read chains from (--pcap), "" for interactive use.
+  string pcap_filename_;
+
+  // Verify the chains in |pcap_filename_|, writing results to stdout.
+  bool RunPcap();
+
+  // File of targets to fetch (--batch), "" for interactive use.
+  string batch_filename_;
+  size_t batch_concurrency_;
+  size_t batch_threads_;
+  bool batch_bio_pair_;
+  bool batch_io_uring_;
+  bool batch_stub_resolver_;
+  vector<string> batch_nameservers_;
+  double global_rate_;
+  double subnet_rate_;
+  double address_rate_;
+
+  // Metrics file (--metrics), "" if disabled, and its rewrite interval
+  // (--metrics-interval).
+  string metrics_filename_;
+  int metrics_interval_seconds_;
+
+  // The metrics, or NULL if disabled.
+  MetricsRegistry* metrics_registry_;
+  FetchMetrics* fetch_metrics_;
+  MetricsExporter* metrics_exporter_;
+
+  // Set up the metrics and write the first file. Returns false (and prints an
+  // error) if the file can't be written.
+  bool InitMetrics();
+
+  // Chrome trace event file (--trace), "" if disabled.
+  string trace_filename_;
+
+  // Fetch the targets in |batch_filename_|, writing results to stdout.
+  bool RunBatch();
+
+  // Read a connections per second |rate| from |text|. Returns false (and
+  // prints an error) if |text| isn't a rate >= 0.
+  static bool ReadRate(const char* text, double* rate);
 };
 }  // namespace x509ls
 